@@ -41,6 +41,7 @@ set(MODULES
   ice
   jack
   l16
+  mcu
   menu
   mixausrc
   mixminus
@@ -62,6 +63,7 @@ set(MODULES
   sdl
   selfview
   serreg
+  sfu
   snapshot
   sndfile
   sndio
@@ -205,6 +205,25 @@ enum vidmode {
 	VIDMODE_ON,         /**< Video enabled                 */
 };
 
+/** Call setup milestones, in the order they usually happen */
+enum call_setup_step {
+	CALL_SETUP_START = 0,    /**< Call allocated / INVITE received  */
+	CALL_SETUP_GATHERED,     /**< Media-NAT candidates gathered     */
+	CALL_SETUP_INVITE,       /**< INVITE sent                       */
+	CALL_SETUP_TRYING,       /**< First response to INVITE          */
+	CALL_SETUP_PROGRESS,     /**< 18x sent or received              */
+	CALL_SETUP_PRACK,        /**< PRACK received or answered        */
+	CALL_SETUP_SDP,          /**< SDP offer/answer completed        */
+	CALL_SETUP_ANSWERED,     /**< 2xx sent or received              */
+	CALL_SETUP_ESTABLISHED,  /**< SIP session established           */
+	CALL_SETUP_MEDIA,        /**< Media streams started             */
+	CALL_SETUP_MNATCONN,     /**< Media-NAT connectivity established */
+	CALL_SETUP_SECURE,       /**< Media encryption established      */
+	CALL_SETUP_RTP,          /**< First RTP packet received         */
+
+	CALL_SETUP_MAX
+};
+
 struct call;
 
 typedef void (call_event_h)(struct call *call, enum call_event ev,
@@ -245,6 +264,9 @@ uint16_t      call_scode(const struct call *call);
 enum call_state call_state(const struct call *call);
 uint32_t      call_duration(const struct call *call);
 uint32_t      call_setup_duration(const struct call *call);
+int64_t       call_setup_time(const struct call *call,
+			      enum call_setup_step step);
+const char   *call_setup_name(enum call_setup_step step);
 const char   *call_id(const struct call *call);
 const char   *call_peeruri(const struct call *call);
 const char   *call_peername(const struct call *call);
@@ -394,6 +416,7 @@ struct config_audio {
 	bool adaptive;          /**< Enable adaptive audio buffer   */
 	double silence;         /**< Silence volume in [dB]         */
 	uint32_t telev_pt;      /**< Payload type for tel.-event    */
+	double playout_loss;    /**< Target late-loss rate in [%]   */
 };
 
 /** Video */
@@ -409,6 +432,7 @@ struct config_video {
 	double fps;             /**< Video framerate                */
 	bool fullscreen;        /**< Enable fullscreen display      */
 	int enc_fmt;            /**< Encoder pixelfmt (enum vidfmt) */
+	unsigned simulcast;     /**< Number of simulcast layers     */
 };
 
 /** Audio/Video Transport */
@@ -430,6 +454,9 @@ struct config_avt {
 	uint32_t rtp_timeout;   /**< RTP Timeout in seconds (0=off) */
 	bool bundle;            /**< Media Multiplexing (BUNDLE)    */
 	enum rtp_receive_mode rxmode;   /**< RTP RX processing mode */
+	uint32_t rtp_batch;     /**< Datagrams per RTP syscall (0=off) */
+	uint32_t rtp_port_pool; /**< Number of pre-bound RTP sockets  */
+	uint32_t rtp_port_quarantine; /**< Port quarantine [s]      */
 };
 
 /** Network Configuration */
@@ -535,6 +562,29 @@ struct mediadev *mediadev_get_default(const struct list *dev_list);
 int mediadev_print(struct re_printf *pf, const struct list *dev_list);
 
 
+/*
+ * Media clock
+ */
+
+/** Media clock flags */
+enum mclock_flags {
+	MCLOCK_DEDICATED = (1<<0),  /**< Run on a dedicated thread */
+};
+
+struct mclock;
+
+/**
+ * Media clock handler, called every packet-time from a clock thread
+ *
+ * @param ts   Nominal timestamp of this packet in [us]
+ * @param arg  Handler argument
+ */
+typedef void (mclock_h)(uint64_t ts, void *arg);
+
+int mclock_start(struct mclock **mcp, uint32_t ptime, int flags,
+		 mclock_h *h, void *arg);
+
+
 /*
  * Message
  */
@@ -711,6 +761,7 @@ void log_enable_info(bool enable);
 void log_enable_stdout(bool enable);
 void log_enable_timestamps(bool enable);
 void log_enable_color(bool enable);
+int  log_enable_async(bool enable);
 void vlog(enum log_level level, const char *fmt, va_list ap);
 void loglv(enum log_level level, const char *fmt, ...);
 void debug(const char *fmt, ...);
@@ -822,6 +873,21 @@ int  play_init(struct player **playerp);
 void play_set_path(struct player *player, const char *path);
 
 
+/*
+ * WAV file mapping - shared streaming access to WAV files
+ */
+
+struct wavmap;
+
+int      wavmap_open(struct wavmap **wmp, const char *path);
+size_t   wavmap_read(const struct wavmap *wm, size_t pos,
+		     int16_t *sampv, size_t sampc);
+size_t   wavmap_sampc(const struct wavmap *wm);
+uint32_t wavmap_srate(const struct wavmap *wm);
+uint8_t  wavmap_channels(const struct wavmap *wm);
+uint64_t wavmap_duration(const struct wavmap *wm);
+
+
 /*
  * User Agent
  */
@@ -1028,6 +1094,7 @@ enum {
 struct cmd_arg {
 	char key;         /**< Which key was pressed  */
 	char *prm;        /**< Optional parameter     */
+	const struct odict *od; /**< Optional structured parameters */
 	void *data;       /**< Application data       */
 };
 
@@ -1052,6 +1119,9 @@ int  cmd_process(struct commands *commands, struct cmd_ctx **ctxp, char key,
 		 struct re_printf *pf, void *data);
 int  cmd_process_long(struct commands *commands, const char *str, size_t len,
 		      struct re_printf *pf_resp, void *data);
+int  cmd_process_args(struct commands *commands, const struct cmd *cmd,
+		      const char *prm, const struct odict *od,
+		      struct re_printf *pf_resp, void *data);
 int cmd_print(struct re_printf *pf, const struct commands *commands);
 const struct cmd *cmd_find_long(const struct commands *commands,
 				const char *name);
@@ -1440,6 +1510,7 @@ struct stream *video_strm(const struct video *v);
 const struct vidcodec *video_codec(const struct video *vid, bool tx);
 void video_sdp_attr_decode(struct video *v);
 void video_req_keyframe(struct video *vid);
+int  video_simulcast_pause(struct video *v, const char *rid, bool pause);
 
 double video_calc_seconds(uint64_t rtp_ts);
 double video_timestamp_to_seconds(uint64_t timestamp);
@@ -1447,6 +1518,45 @@ uint64_t video_calc_rtp_timestamp_fix(uint64_t timestamp);
 uint64_t video_calc_timebase_timestamp(uint64_t rtp_ts);
 
 
+/*
+ * Selective Forwarding Unit (SFU) for video
+ */
+
+struct sfu;
+
+int  sfu_alloc(struct sfu **sfup);
+int  sfu_add(struct sfu *sfu, struct call *call);
+void sfu_remove(struct sfu *sfu, const struct call *call);
+int  sfu_select(struct sfu *sfu, const struct call *viewer,
+		const struct call *source);
+int  sfu_debug(struct re_printf *pf, const struct sfu *sfu);
+
+
+/*
+ * Audio broadcast group
+ */
+
+struct bcast;
+
+int  bcast_alloc(struct bcast **bcp);
+int  bcast_add(struct bcast *bc, struct call *call);
+void bcast_remove(struct bcast *bc, const struct call *call);
+unsigned bcast_encoders(const struct bcast *bc);
+int  bcast_debug(struct re_printf *pf, const struct bcast *bc);
+
+
+/*
+ * Per-thread memory pools
+ */
+
+void *mempool_alloc(size_t size);
+struct mbuf *mempool_mbuf(size_t size);
+struct mbuf *mempool_mbuf_dup(const struct mbuf *mbs);
+int  mempool_vidframe(struct vidframe **vfp, enum vidfmt fmt,
+		      const struct vidsz *sz);
+int  mempool_debug(struct re_printf *pf, void *unused);
+
+
 /*
  * Generic stream
  */
@@ -1503,6 +1613,9 @@ const char *stream_cname(const struct stream *strm);
 const char *stream_peer(const struct stream *strm);
 int  stream_bundle_init(struct stream *strm, bool offerer);
 int  stream_debug(struct re_printf *pf, const struct stream *s);
+int  stream_relay_start(struct stream *a, struct stream *b);
+void stream_relay_stop(struct stream *s);
+bool stream_is_relayed(const struct stream *s);
 void stream_enable_rtp_timeout(struct stream *strm, uint32_t timeout_ms);
 
 
@@ -1528,6 +1641,7 @@ struct jbuf_stat {
 
 int  jbuf_alloc(struct jbuf **jbp, uint32_t min, uint32_t max);
 int  jbuf_set_type(struct jbuf *jb, enum jbuf_type jbtype);
+int  jbuf_set_wish(struct jbuf *jb, uint32_t wish);
 int  jbuf_put(struct jbuf *jb, const struct rtp_header *hdr, void *mem);
 int  jbuf_get(struct jbuf *jb, struct rtp_header *hdr, void **mem);
 int  jbuf_drain(struct jbuf *jb, struct rtp_header *hdr, void **mem);
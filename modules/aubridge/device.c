@@ -3,7 +3,6 @@
  *
  * Copyright (C) 2010 Alfred E. Heggestad
  */
-#include <re_atomic.h>
 #include <re.h>
 #include <rem.h>
 #include <baresip.h>
@@ -19,8 +18,9 @@ struct device {
 	const struct ausrc_st *ausrc;
 	const struct auplay_st *auplay;
 	char name[64];
-	thrd_t thread;
-	RE_ATOMIC bool run;
+	struct mclock *mc;
+	void *sampv;
+	size_t sampc;
 };
 
 
@@ -50,69 +50,51 @@ static struct device *find_device(const char *device)
 }
 
 
-static int device_thread(void *arg)
+static void device_tick(uint64_t ts, void *arg)
 {
-	uint64_t now, ts = tmr_jiffies();
 	struct device *dev = arg;
-	int16_t *sampv;
-	size_t sampc;
-	size_t sampsz;
-
-	info("aubridge: thread start: %u Hz, %u channels, format=%s\n",
-	     dev->auplay->prm.srate, dev->auplay->prm.ch,
-	     aufmt_name(dev->auplay->prm.fmt));
-
-	sampc = dev->auplay->prm.srate * dev->auplay->prm.ch * PTIME/1000;
-
-	sampsz = aufmt_sample_size(dev->auplay->prm.fmt);
-
-	sampv  = mem_alloc(sampsz * sampc, NULL);
-	if (!sampv)
-		goto out;
-
-	while (re_atomic_rlx(&dev->run)) {
-
-		(void)sys_msleep(4);
-
-		if (!re_atomic_rlx(&dev->run))
-			break;
 
-		now = tmr_jiffies();
+	if (dev->auplay->wh) {
+		struct auframe af;
 
-		if (ts > now)
-			continue;
+		auframe_init(&af, dev->auplay->prm.fmt, dev->sampv,
+			     dev->sampc, dev->auplay->prm.srate,
+			     dev->auplay->prm.ch);
 
-		if (dev->auplay->wh) {
-			struct auframe af;
+		af.timestamp = ts;
 
-			auframe_init(&af, dev->auplay->prm.fmt, sampv,
-				     sampc, dev->auplay->prm.srate,
-				     dev->auplay->prm.ch);
+		dev->auplay->wh(&af, dev->auplay->arg);
+	}
 
-			af.timestamp = ts * 1000;
+	if (dev->ausrc->rh) {
+		struct auframe af;
 
-			dev->auplay->wh(&af, dev->auplay->arg);
-		}
+		auframe_init(&af, dev->ausrc->prm.fmt, dev->sampv,
+			     dev->sampc, dev->ausrc->prm.srate,
+			     dev->ausrc->prm.ch);
 
-		if (dev->ausrc->rh) {
-			struct auframe af;
+		af.timestamp = ts;
 
-			auframe_init(&af, dev->ausrc->prm.fmt, sampv,
-			             sampc, dev->ausrc->prm.srate,
-			             dev->ausrc->prm.ch);
+		dev->ausrc->rh(&af, dev->ausrc->arg);
+	}
+}
 
-			af.timestamp = ts * 1000;
 
-			dev->ausrc->rh(&af, dev->ausrc->arg);
-		}
+static int device_start(struct device *dev)
+{
+	info("aubridge: start: %u Hz, %u channels, format=%s\n",
+	     dev->auplay->prm.srate, dev->auplay->prm.ch,
+	     aufmt_name(dev->auplay->prm.fmt));
 
-		ts += PTIME;
-	}
+	dev->sampc = dev->auplay->prm.srate * dev->auplay->prm.ch * PTIME/1000;
 
- out:
-	mem_deref(sampv);
+	mem_deref(dev->sampv);
+	dev->sampv = mem_alloc(aufmt_sample_size(dev->auplay->prm.fmt) *
+			       dev->sampc, NULL);
+	if (!dev->sampv)
+		return ENOMEM;
 
-	return 0;
+	return mclock_start(&dev->mc, PTIME, 0, device_tick, dev);
 }
 
 
@@ -152,7 +134,7 @@ int aubridge_device_connect(struct device **devp, const char *device,
 		dev->ausrc = ausrc;
 
 	/* wait until we have both SRC+PLAY */
-	if (dev->ausrc && dev->auplay && !re_atomic_rlx(&dev->run)) {
+	if (dev->ausrc && dev->auplay && !dev->mc) {
 		if (dev->auplay->prm.srate != dev->ausrc->prm.srate ||
 		    dev->auplay->prm.ch != dev->ausrc->prm.ch ||
 		    dev->auplay->prm.fmt != dev->ausrc->prm.fmt) {
@@ -162,12 +144,7 @@ int aubridge_device_connect(struct device **devp, const char *device,
 			return EINVAL;
 		}
 
-		re_atomic_rlx_set(&dev->run, true);
-		err = thread_create_name(&dev->thread, "aubridge",
-					 device_thread, dev);
-		if (err) {
-			re_atomic_rlx_set(&dev->run, false);
-		}
+		err = device_start(dev);
 	}
 
 	return err;
@@ -179,10 +156,9 @@ void aubridge_device_stop(struct device *dev)
 	if (!dev)
 		return;
 
-	if (re_atomic_rlx(&dev->run)) {
-		re_atomic_rlx_set(&dev->run, false);
-		thrd_join(dev->thread, NULL);
-	}
+	/* waits for a running callback */
+	dev->mc = mem_deref(dev->mc);
+	dev->sampv = mem_deref(dev->sampv);
 
 	dev->auplay = NULL;
 	dev->ausrc = NULL;
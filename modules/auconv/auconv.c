@@ -14,7 +14,7 @@ struct auconv_enc {
 
 	enum aufmt target_fmt;
 	void *buf;
-	size_t sampc;
+	size_t sampc;             /* buffer size in samples */
 };
 
 
@@ -23,7 +23,7 @@ struct auconv_dec {
 
 	enum aufmt target_fmt;
 	void *buf;
-	size_t sampc;
+	size_t sampc;             /* buffer size in samples */
 };
 
 
@@ -129,7 +129,7 @@ static int encode_frame(struct aufilt_enc_st *st, struct auframe *af)
 
 	if (af->fmt != ac->target_fmt) {
 
-		if (!ac->buf || af->sampc != ac->sampc) {
+		if (!ac->buf || af->sampc > ac->sampc) {
 
 			size_t sz = aufmt_sample_size(ac->target_fmt);
 
@@ -158,7 +158,7 @@ static int decode_frame(struct aufilt_dec_st *st, struct auframe *af)
 
 	if (af->fmt != ac->target_fmt) {
 
-		if (!ac->buf || af->sampc != ac->sampc) {
+		if (!ac->buf || af->sampc > ac->sampc) {
 
 			size_t sz = aufmt_sample_size(ac->target_fmt);
 
@@ -17,7 +17,7 @@ struct auplay_st {
 	struct aufile *auf;
 	struct auplay_prm prm;
 
-	thrd_t thread;
+	struct mclock *mc;
 	RE_ATOMIC bool run;
 	void *sampv;
 	size_t sampc;
@@ -30,50 +30,34 @@ struct auplay_st {
 static void destructor(void *arg)
 {
 	struct auplay_st *st = arg;
-	/* Wait for termination of other thread */
-	if (re_atomic_rlx(&st->run)) {
-		debug("aufile: stopping playback thread\n");
-		re_atomic_rlx_set(&st->run, false);
-		thrd_join(st->thread, NULL);
-	}
+	/* waits for a running callback */
+	re_atomic_rlx_set(&st->run, false);
+	mem_deref(st->mc);
 
 	mem_deref(st->auf);
 	mem_deref(st->sampv);
 }
 
 
-static int write_thread(void *arg)
+static void write_tick(uint64_t ts, void *arg)
 {
 	struct auplay_st *st = arg;
-	uint64_t t;
-	int dt;
+	struct auframe af;
 	int err;
-	uint32_t ptime = st->prm.ptime;
-
-	t = tmr_jiffies();
-	while (re_atomic_rlx(&st->run)) {
-		struct auframe af;
-
-		auframe_init(&af, st->prm.fmt, st->sampv, st->sampc,
-			     st->prm.srate, st->prm.ch);
 
-		af.timestamp = t * 1000;
+	if (!re_atomic_rlx(&st->run))
+		return;
 
-		st->wh(&af, st->arg);
+	auframe_init(&af, st->prm.fmt, st->sampv, st->sampc,
+		     st->prm.srate, st->prm.ch);
 
-		err = aufile_write(st->auf, st->sampv, st->num_bytes);
-		if (err)
-			break;
+	af.timestamp = ts;
 
-		t += ptime;
-		dt = (int)(t - tmr_jiffies());
-		if (dt <= 2)
-			continue;
+	st->wh(&af, st->arg);
 
-		sys_msleep(dt);
-	}
-
-	return 0;
+	err = aufile_write(st->auf, st->sampv, st->num_bytes);
+	if (err)
+		re_atomic_rlx_set(&st->run, false);
 }
 
 
@@ -121,7 +105,7 @@ int aufile_play_alloc(struct auplay_st **stp, const struct auplay *ap,
 
 	info("aufile: writing speaker audio to %s\n", file);
 	re_atomic_rlx_set(&st->run, true);
-	err = thread_create_name(&st->thread, "aufile_play", write_thread, st);
+	err = mclock_start(&st->mc, st->prm.ptime, 0, write_tick, st);
 	if (err) {
 		re_atomic_rlx_set(&st->run, false);
 		goto out;
@@ -5,6 +5,7 @@
  */
 #define _DEFAULT_SOURCE 1
 #define _BSD_SOURCE 1
+#include <string.h>
 #include <re_atomic.h>
 #include <re.h>
 #include <rem.h>
@@ -27,15 +28,14 @@
 
 struct ausrc_st {
 	struct tmr tmr;
-	struct aufile *aufile;
-	struct aubuf *aubuf;
-	enum aufmt fmt;                 /**< Wav file sample format          */
+	struct wavmap *wav;             /**< Shared mapping of the WAV file  */
+	size_t pos;                     /**< Read position in samples        */
 	struct ausrc_prm prm;           /**< Audio src parameter             */
 	uint32_t ptime;
 	size_t sampc;
 	RE_ATOMIC bool run;
-	bool started;
-	thrd_t thread;
+	struct mclock *mc;
+	int16_t *sampv;
 	ausrc_read_h *rh;
 	ausrc_error_h *errh;
 	void *arg;
@@ -46,54 +46,42 @@ static void destructor(void *arg)
 {
 	struct ausrc_st *st = arg;
 
-	if (st->started) {
-		re_atomic_rlx_set(&st->run, false);
-		thrd_join(st->thread, NULL);
-	}
+	re_atomic_rlx_set(&st->run, false);
+
+	/* waits for a running callback */
+	mem_deref(st->mc);
 
 	tmr_cancel(&st->tmr);
+	mem_deref(st->sampv);
 
-	mem_deref(st->aufile);
-	mem_deref(st->aubuf);
+	mem_deref(st->wav);
 }
 
 
-static int src_thread(void *arg)
+static void src_tick(uint64_t ts, void *arg)
 {
-	uint64_t now, ts = tmr_jiffies();
 	struct ausrc_st *st = arg;
-	int16_t *sampv;
-	uint32_t ms = 4;
-
-	sampv = mem_alloc(st->sampc * sizeof(int16_t), NULL);
-	if (!sampv)
-		return ENOMEM;
-
-	while (re_atomic_rlx(&st->run)) {
-		struct auframe af;
-
-		sys_msleep(ms);
-		now = tmr_jiffies();
-		if (ts > now)
-			continue;
-
-		auframe_init(&af, AUFMT_S16LE, sampv, st->sampc,
-		             st->prm.srate, st->prm.ch);
+	struct auframe af;
+	size_t n;
 
-		aubuf_read_auframe(st->aubuf, &af);
+	if (!re_atomic_rlx(&st->run))
+		return;
 
-		st->rh(&af, st->arg);
+	/* convert one packet-time window from the mapping */
+	n = wavmap_read(st->wav, st->pos, st->sampv, st->sampc);
+	if (n < st->sampc)
+		memset(&st->sampv[n], 0, (st->sampc - n) * sizeof(int16_t));
 
-		ts += st->ptime;
+	st->pos += n;
 
-		if (aubuf_cur_size(st->aubuf) == 0)
-			break;
-	}
+	auframe_init(&af, AUFMT_S16LE, st->sampv, st->sampc,
+		     st->prm.srate, st->prm.ch);
+	af.timestamp = ts;
 
-	mem_deref(sampv);
-	re_atomic_rlx_set(&st->run, false);
+	st->rh(&af, st->arg);
 
-	return 0;
+	if (st->pos >= wavmap_sampc(st->wav))
+		re_atomic_rlx_set(&st->run, false);
 }
 
 
@@ -115,86 +103,11 @@ static void timeout(void *arg)
 }
 
 
-static int read_file(struct ausrc_st *st)
-{
-	struct mbuf *mb = NULL;
-	int err;
-	size_t n;
-	struct mbuf *mb2 = NULL;
-	struct auframe af;
-
-	auframe_init(&af, AUFMT_S16LE, NULL, 0, st->prm.srate, st->prm.ch);
-
-	for (;;) {
-		uint16_t *sampv;
-		uint8_t *p;
-		size_t i;
-
-		mem_deref(mb);
-		mb = mbuf_alloc(4096);
-		if (!mb)
-			return ENOMEM;
-
-		mb->end = mb->size;
-
-		err = aufile_read(st->aufile, mb->buf, &mb->end);
-		if (err)
-			break;
-
-		if (mb->end == 0) {
-			info("aufile: read end of file\n");
-			break;
-		}
-
-		/* convert from Little-Endian to Native-Endian */
-		n = mb->end;
-		sampv = (void *)mb->buf;
-		p     = (void *)mb->buf;
-
-		switch (st->fmt) {
-		case AUFMT_S16LE:
-			/* convert from Little-Endian to Native-Endian */
-			for (i = 0; i < n/2; i++)
-				sampv[i] = sys_ltohs(sampv[i]);
-
-			aubuf_append_auframe(st->aubuf, mb, &af);
-			break;
-		case AUFMT_PCMA:
-		case AUFMT_PCMU:
-			mb2 = mbuf_alloc(2 * n);
-			for (i = 0; i < n; i++) {
-				err |= mbuf_write_u16(mb2,
-					   st->fmt == AUFMT_PCMA ?
-					   (uint16_t) g711_alaw2pcm(p[i]) :
-					   (uint16_t) g711_ulaw2pcm(p[i]) );
-			}
-
-			mbuf_set_pos(mb2, 0);
-			aubuf_append_auframe(st->aubuf, mb2, &af);
-			mem_deref(mb2);
-			break;
-
-		default:
-			err = ENOSYS;
-			break;
-		}
-
-		if (err)
-			break;
-	}
-
-	info("aufile: loaded %zu bytes\n", aubuf_cur_size(st->aubuf));
-	mem_deref(mb);
-	return err;
-}
-
-
 int aufile_src_alloc(struct ausrc_st **stp, const struct ausrc *as,
 		     struct ausrc_prm *prm, const char *dev,
 		     ausrc_read_h *rh, ausrc_error_h *errh, void *arg)
 {
 	struct ausrc_st *st;
-	struct aufile_prm fprm;
 	int err;
 
 	if (!stp || !as || !prm  || !prm->ptime)
@@ -206,7 +119,7 @@ int aufile_src_alloc(struct ausrc_st **stp, const struct ausrc *as,
 		return ENOTSUP;
 	}
 
-	info("aufile: loading input file '%s'\n", dev);
+	info("aufile: opening input file '%s'\n", dev);
 
 	st = mem_zalloc(sizeof(*st), destructor);
 	if (!st)
@@ -217,19 +130,19 @@ int aufile_src_alloc(struct ausrc_st **stp, const struct ausrc *as,
 	st->arg   = arg;
 	st->ptime = prm->ptime;
 
-	err = aufile_open(&st->aufile, &fprm, dev, AUFILE_READ);
+	err = wavmap_open(&st->wav, dev);
 	if (err) {
 		warning("aufile: failed to open file '%s' (%m)\n", dev, err);
 		goto out;
 	}
 
-	info("aufile: %s: %u Hz, %d channels, %s\n",
-	     dev, fprm.srate, fprm.channels, aufmt_name(fprm.fmt));
+	info("aufile: %s: %u Hz, %u channels\n",
+	     dev, wavmap_srate(st->wav), wavmap_channels(st->wav));
 
 	/* return wav format to caller */
-	prm->srate = fprm.srate;
-	prm->ch    = fprm.channels;
-	prm->duration = aufile_get_length(st->aufile, &fprm);
+	prm->srate = wavmap_srate(st->wav);
+	prm->ch    = wavmap_channels(st->wav);
+	prm->duration = wavmap_duration(st->wav);
 
 	if (!rh) {
 		mem_deref(st);
@@ -238,27 +151,21 @@ int aufile_src_alloc(struct ausrc_st **stp, const struct ausrc *as,
 
 	st->prm   = *prm;
 
-	st->fmt    = fprm.fmt;
 	st->sampc  = prm->srate * prm->ch * st->ptime / 1000;
 
 	info("aufile: audio ptime=%u sampc=%zu\n", st->ptime, st->sampc);
 
-	/* 1 - inf seconds of audio */
-	err = aubuf_alloc(&st->aubuf, 0, 0);
-	if (err)
-		goto out;
-
-	err = read_file(st);
-	if (err)
+	st->sampv = mem_alloc(st->sampc * sizeof(int16_t), NULL);
+	if (!st->sampv) {
+		err = ENOMEM;
 		goto out;
+	}
 
 	tmr_start(&st->tmr, st->ptime, timeout, st);
 
 	re_atomic_rlx_set(&st->run, true);
-	st->started = true;
-	err = thread_create_name(&st->thread, "aufile_src", src_thread, st);
+	err = mclock_start(&st->mc, st->ptime, 0, src_tick, st);
 	if (err) {
-		st->started = false;
 		re_atomic_rlx_set(&st->run, false);
 		goto out;
 	}
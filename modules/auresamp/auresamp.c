@@ -25,6 +25,14 @@
  * | |<--| auplay |<--| aubuf |<--|   e.g.   |<--| decode |<-- RTP
  * |/    |        |   |       |   | auresamp |   |        |
  *       '--------'   '-------'   '----------'   '--------'
+ *
+ *  Frames with more than two channels are resampled one channel at a time.
+ *  The frame is split into planes of s16le samples, converting the sample
+ *  format in the same pass, and interleaved again after resampling.
+ *
+ *  The channel count can only be converted between mono and stereo. Other
+ *  conversions, e.g. 4 to 2 channels, are rejected with ENOTSUP and a
+ *  warning.
  */
 
 struct auresamp_st {
@@ -34,9 +42,13 @@ struct auresamp_st {
 	} u;                     /* inheritance                              */
 
 	int16_t *sampv;          /* s16le audio data buffer                  */
+	size_t sampsz;           /* size of sampv buffer                     */
 	int16_t *rsampv;         /* resampled data                           */
 	size_t rsampsz;          /* size of rsampv buffer                    */
 	struct auresamp resamp;  /* resampler                                */
+	struct auresamp *chv;    /* resampler per channel, for planar data   */
+	uint8_t chc;             /* number of planar resamplers              */
+	bool chwarn;             /* channel conversion warning printed       */
 	struct aufilt_prm oprm;  /* filter output parameters                 */
 	const char *dbg;         /* debugging "encoder"/"decoder"            */
 };
@@ -46,6 +58,7 @@ static void common_destructor(void *arg)
 {
 	struct auresamp_st *st = arg;
 
+	mem_deref(st->chv);
 	mem_deref(st->rsampv);
 	mem_deref(st->sampv);
 }
@@ -69,24 +82,35 @@ static void dec_destructor(void *arg)
 }
 
 
+static int sampv_check_size(struct auresamp_st *st, size_t psize)
+{
+	if (st->sampsz >= psize)
+		return 0;
+
+	st->sampsz = 0;
+	st->sampv  = mem_deref(st->sampv);
+	st->sampv  = mem_zalloc(psize, NULL);
+	if (!st->sampv)
+		return ENOMEM;
+
+	st->sampsz = psize;
+	return 0;
+}
+
+
 static int sampv_alloc(struct auresamp_st *st, struct auframe *af)
 {
 	size_t psize_out;
 	size_t psize;
 
 	/* s16le used internally */
-	psize = af->sampc * af->ch * 2;
+	psize = af->sampc * 2;
 
-	/* output format == input format */
-	psize_out = aufmt_sample_size(af->fmt) * af->sampc *
+	/* converted to the output format */
+	psize_out = aufmt_sample_size(st->oprm.fmt) * af->sampc *
 			st->oprm.srate * st->oprm.ch / (af->srate * af->ch);
 
-	st->sampv = mem_zalloc(max(psize, psize_out), NULL);
-
-	if (!st->sampv)
-		return ENOMEM;
-
-	return 0;
+	return sampv_check_size(st, max(psize, psize_out));
 }
 
 
@@ -130,6 +154,161 @@ static int resamp_setup(struct auresamp_st *st, struct auframe *af)
 }
 
 
+static inline int16_t float_to_s16(float v)
+{
+	v *= 32768.0f;
+
+	if (v >= 32767.0f)
+		return 32767;
+	else if (v <= -32768.0f)
+		return -32768;
+	else
+		return (int16_t)v;
+}
+
+
+static void deinterleave(int16_t *dst, size_t stride,
+			 const struct auframe *af)
+{
+	const size_t ch = af->ch;
+	const size_t n  = af->sampc / ch;
+
+	if (af->fmt == AUFMT_FLOAT) {
+		const float *src = af->sampv;
+
+		for (size_t i = 0; i < n; i++) {
+			for (size_t c = 0; c < ch; c++)
+				dst[c * stride + i] = float_to_s16(*src++);
+		}
+	}
+	else {
+		const int16_t *src = af->sampv;
+
+		for (size_t i = 0; i < n; i++) {
+			for (size_t c = 0; c < ch; c++)
+				dst[c * stride + i] = *src++;
+		}
+	}
+}
+
+
+static void interleave(void *dst, enum aufmt fmt, const int16_t *src,
+		       size_t stride, size_t n, size_t ch)
+{
+	if (fmt == AUFMT_FLOAT) {
+		float *d = dst;
+
+		for (size_t i = 0; i < n; i++) {
+			for (size_t c = 0; c < ch; c++)
+				*d++ = src[c * stride + i] / 32768.0f;
+		}
+	}
+	else {
+		int16_t *d = dst;
+
+		for (size_t i = 0; i < n; i++) {
+			for (size_t c = 0; c < ch; c++)
+				*d++ = src[c * stride + i];
+		}
+	}
+}
+
+
+static int planar_setup(struct auresamp_st *st, const struct auframe *af)
+{
+	int err;
+
+	if (st->chc == af->ch && st->chv[0].irate == af->srate)
+		return 0;
+
+	st->chc = 0;
+	st->chv = mem_deref(st->chv);
+	st->chv = mem_reallocarray(NULL, af->ch, sizeof(*st->chv), NULL);
+	if (!st->chv)
+		return ENOMEM;
+
+	for (uint8_t c = 0; c < af->ch; c++) {
+
+		auresamp_init(&st->chv[c]);
+
+		err = auresamp_setup(&st->chv[c], af->srate, 1,
+				     st->oprm.srate, 1);
+		if (err) {
+			warning("resample: auresamp_setup error (%m)\n",
+				err);
+			st->chv = mem_deref(st->chv);
+			return err;
+		}
+	}
+
+	st->chc = af->ch;
+
+	return 0;
+}
+
+
+static int planar_resample(struct auresamp_st *st, struct auframe *af)
+{
+	const size_t ch = af->ch;
+	const size_t n  = af->sampc / ch;
+	size_t stride, osz, outc = 0;
+	int err;
+
+	if ((af->fmt != AUFMT_S16LE && af->fmt != AUFMT_FLOAT) ||
+	    (st->oprm.fmt != AUFMT_S16LE && st->oprm.fmt != AUFMT_FLOAT)) {
+		warning("resample: %zu channels not supported for %s/%s\n",
+			ch, aufmt_name(af->fmt), aufmt_name(st->oprm.fmt));
+		return ENOTSUP;
+	}
+
+	err = planar_setup(st, af);
+	if (err)
+		return err;
+
+	/* auresamp minimum output size is the input size */
+	stride = max(n, n * st->oprm.srate / af->srate);
+	osz    = aufmt_sample_size(st->oprm.fmt);
+
+	/* planes of the input, then the interleaved output */
+	err = sampv_check_size(st, ch * max(n * 2, stride * osz));
+	if (err)
+		return err;
+
+	if (st->rsampsz < ch * stride * 2) {
+		st->rsampsz = 0;
+		st->rsampv = mem_deref(st->rsampv);
+		st->rsampv = mem_zalloc(ch * stride * 2, NULL);
+		if (!st->rsampv)
+			return ENOMEM;
+
+		st->rsampsz = ch * stride * 2;
+	}
+
+	deinterleave(st->sampv, n, af);
+
+	for (size_t c = 0; c < ch; c++) {
+
+		outc = stride;
+
+		err = auresamp(&st->chv[c], st->rsampv + c * stride, &outc,
+			       st->sampv + c * n, n);
+		if (err) {
+			warning("resample: auresamp error (%m)\n", err);
+			return err;
+		}
+	}
+
+	interleave(st->sampv, st->oprm.fmt, st->rsampv, stride, outc, ch);
+
+	af->sampv = st->sampv;
+	af->sampc = outc * ch;
+	af->fmt   = st->oprm.fmt;
+	af->srate = st->oprm.srate;
+
+	return 0;
+}
+
+
 static int common_update(struct auresamp_st **stp, struct aufilt_prm *oprm,
 			 mem_destroy_h *dh)
 {
@@ -172,19 +351,35 @@ static int common_resample(struct auresamp_st *st, struct auframe *af)
 
 	if (st->oprm.srate == af->srate && st->oprm.ch == af->ch) {
 		st->rsampsz = 0;
+		st->sampsz  = 0;
+		st->chc     = 0;
 		st->rsampv = mem_deref(st->rsampv);
 		st->sampv  = mem_deref(st->sampv);
+		st->chv    = mem_deref(st->chv);
 		return 0;
 	}
 
-	sampv  = af->sampv;
-	if (af->fmt != AUFMT_S16LE) {
-		if (!st->sampv)
-			err = sampv_alloc(st, af);
+	if (af->ch > 2 && af->ch == st->oprm.ch)
+		return planar_resample(st, af);
+
+	/* libre's resampler converts between mono and stereo only */
+	if (af->ch > 2 || st->oprm.ch > 2) {
+		if (!st->chwarn) {
+			warning("auresamp: %u to %u channels not supported\n",
+				af->ch, st->oprm.ch);
+			st->chwarn = true;
+		}
+		return ENOTSUP;
+	}
 
+	sampv  = af->sampv;
+	if (af->fmt != AUFMT_S16LE || st->oprm.fmt != AUFMT_S16LE) {
+		err = sampv_alloc(st, af);
 		if (err)
 			return err;
+	}
 
+	if (af->fmt != AUFMT_S16LE) {
 		auconv_to_s16(st->sampv, af->fmt, af->sampv, af->sampc);
 		sampv = st->sampv;
 	}
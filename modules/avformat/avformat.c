@@ -50,6 +50,9 @@ static char pass_through[256] = "";
 static char rtsp_transport[256] = "";
 
 
+enum {READ_PTIME = 4};  /* read interval [ms] */
+
+
 static struct list sharedl;
 
 
@@ -57,11 +60,11 @@ static void shared_destructor(void *arg)
 {
 	struct shared *st = arg;
 
-	if (re_atomic_rlx(&st->run)) {
-		debug("avformat: stopping read thread\n");
-		re_atomic_rlx_set(&st->run, false);
-		thrd_join(st->thread, NULL);
-	}
+	/* waits for a running read */
+	re_atomic_rlx_set(&st->run, false);
+	mem_deref(st->mc);
+
+	av_packet_free(&st->pkt);
 
 	if (st->au.ctx) {
 		avcodec_free_context(&st->au.ctx);
@@ -80,104 +83,93 @@ static void shared_destructor(void *arg)
 }
 
 
-static int read_thread(void *data)
+static void read_tick(uint64_t ts, void *arg)
 {
-	struct shared *st = data;
-	uint64_t now, offset = tmr_jiffies();
-	double auts = 0, vidts = 0;
-	AVPacket *pkt;
-
-	pkt = av_packet_alloc();
-	if (!pkt)
-		return ENOMEM;
+	struct shared *st = arg;
+	AVPacket *pkt = st->pkt;
+	uint64_t now = ts / 1000;
 
-	while (re_atomic_rlx(&st->run)) {
+	if (!re_atomic_rlx(&st->run))
+		return;
 
+	for (;;) {
+		double xts;
 		int ret;
 
-		sys_msleep(4);
-
-		now = tmr_jiffies();
+		if (!re_atomic_rlx(&st->run))
+			break;
 
-		for (;;) {
-			double xts;
+		if (st->au.idx >=0 && st->vid.idx >=0)
+			xts = min(st->auts, st->vidts);
+		else if (st->au.idx >=0)
+			xts = st->auts;
+		else if (st->vid.idx >=0)
+			xts = st->vidts;
+		else
+			break;
 
-			if (!re_atomic_rlx(&st->run))
+		if (!(st->is_realtime))
+			if (now < (st->offset + xts))
 				break;
 
-			if (st->au.idx >=0 && st->vid.idx >=0)
-				xts = min(auts, vidts);
-			else if (st->au.idx >=0)
-				xts = auts;
-			else if (st->vid.idx >=0)
-				xts = vidts;
-			else
-				break;
+		ret = av_read_frame(st->ic, pkt);
+		if (ret == (int)AVERROR_EOF) {
 
-			if (!(st->is_realtime))
-				if (now < (offset + xts))
-					break;
+			debug("avformat: rewind stream\n");
 
-			ret = av_read_frame(st->ic, pkt);
-			if (ret == (int)AVERROR_EOF) {
+			sys_msleep(1000);
 
-				debug("avformat: rewind stream\n");
+			ret = av_seek_frame(st->ic, -1, 0,
+					    AVSEEK_FLAG_BACKWARD);
+			if (ret < 0) {
+				info("avformat: seek error (%d)\n", ret);
+				goto stop;
+			}
 
-				sys_msleep(1000);
+			st->offset = tmr_jiffies();
+			st->auts = st->vidts = 0;
+			break;
+		}
+		else if (ret < 0) {
+			debug("avformat: read error (%d)\n", ret);
+			goto stop;
+		}
 
-				ret = av_seek_frame(st->ic, -1, 0,
-						    AVSEEK_FLAG_BACKWARD);
-				if (ret < 0) {
-					info("avformat: seek error (%d)\n",
-					     ret);
-					goto out;
-				}
+		if (pkt->stream_index == st->au.idx) {
 
-				offset = tmr_jiffies();
-				auts = vidts = 0;
-				break;
-			}
-			else if (ret < 0) {
-				debug("avformat: read error (%d)\n", ret);
-				goto out;
+			if (pkt->pts == AV_NOPTS_VALUE) {
+				warning("no audio pts\n");
 			}
 
-			if (pkt->stream_index == st->au.idx) {
-
-				if (pkt->pts == AV_NOPTS_VALUE) {
-					warning("no audio pts\n");
-				}
+			st->auts = 1000 * pkt->pts *
+				av_q2d(st->au.time_base);
 
-				auts = 1000 * pkt->pts *
-					av_q2d(st->au.time_base);
+			avformat_audio_decode(st, pkt);
+		}
+		else if (pkt->stream_index == st->vid.idx) {
 
-				avformat_audio_decode(st, pkt);
+			if (pkt->pts == AV_NOPTS_VALUE) {
+				warning("no video pts\n");
 			}
-			else if (pkt->stream_index == st->vid.idx) {
-
-				if (pkt->pts == AV_NOPTS_VALUE) {
-					warning("no video pts\n");
-				}
 
-				vidts = 1000 * pkt->pts *
-					av_q2d(st->vid.time_base);
+			st->vidts = 1000 * pkt->pts *
+				av_q2d(st->vid.time_base);
 
-				if (st->is_pass_through) {
-					avformat_video_copy(st, pkt);
-				}
-				else {
-					avformat_video_decode(st, pkt);
-				}
+			if (st->is_pass_through) {
+				avformat_video_copy(st, pkt);
+			}
+			else {
+				avformat_video_decode(st, pkt);
 			}
-
-			av_packet_unref(pkt);
 		}
+
+		av_packet_unref(pkt);
 	}
 
- out:
-	av_packet_free(&pkt);
+	return;
 
-	return 0;
+ stop:
+	re_atomic_rlx_set(&st->run, false);
 }
 
 
@@ -423,8 +415,18 @@ int avformat_shared_alloc(struct shared **shp, const char *dev,
 		}
 	}
 
+	st->pkt = av_packet_alloc();
+	if (!st->pkt) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	st->offset = tmr_jiffies();
+
+	/* av_read_frame() may block, use a dedicated clock thread */
 	re_atomic_rlx_set(&st->run, true);
-	err = thread_create_name(&st->thread, "avformat", read_thread, st);
+	err = mclock_start(&st->mc, READ_PTIME, MCLOCK_DEDICATED,
+			   read_tick, st);
 	if (err) {
 		re_atomic_rlx_set(&st->run, false);
 		goto out;
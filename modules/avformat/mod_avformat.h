@@ -11,7 +11,10 @@ struct shared {
 	struct vidsrc_st *vidsrc_st;  /* pointer */
 	mtx_t lock;
 	AVFormatContext *ic;
-	thrd_t thread;
+	AVPacket *pkt;
+	struct mclock *mc;
+	uint64_t offset;
+	double auts, vidts;
 	char *dev;
 	bool is_realtime;
 	RE_ATOMIC bool run;
@@ -18,10 +18,17 @@
  * It receives commands to be executed, sends back command responses and
  * notifies about events.
  *
+ * Several clients may be connected at the same time. Requests may be
+ * pipelined on a connection, they are executed one by one in the order
+ * received and the responses are sent in the same order. Events may be
+ * sent between responses.
+ *
  * Command message parameters:
  *
  * - command : Command to be executed.
- * - params  : Command parameters.
+ * - params  : Command parameters. A JSON object or array is passed
+ *             to the command as JSON text and as structured
+ *             arguments.
  * - token   : Optional. Included in the response if present.
  *
  * Command message example:
@@ -54,6 +61,31 @@
  \endverbatim
  *
  *
+ * Batch command, "params" is an array of command messages. The response
+ * "data" is an array of responses, "ok" is true if all succeeded:
+ *
+ \verbatim
+ {
+  "command" : "batch",
+  "params"  : [{"command" : "reginfo"}, {"command" : "listcalls"}],
+  "token"   : "batch1"
+ }
+ \endverbatim
+ *
+ *
+ * Event subscriptions are per client. A new client receives all events,
+ * "subscribe" and "unsubscribe" take a comma separated list of event
+ * classes (register, mwi, application, call, VU_REPORT, other, message
+ * or all):
+ *
+ \verbatim
+ {
+  "command" : "subscribe",
+  "params"  : "call,register"
+ }
+ \endverbatim
+ *
+ *
  * Event message parameters:
  *
  * - event     : true. Identifies the message type.
@@ -83,16 +115,60 @@
  *
  \verbatim
   ctrl_tcp_listen     0.0.0.0:4444         # IP-address and port to listen on
+  ctrl_tcp_maxclients 16                   # Max. number of clients
  \endverbatim
  */
 
 
-enum {CTRL_PORT = 4444};
+enum {
+	CTRL_PORT    = 4444,
+	MAX_CLIENTS  = 16,
+	BUF_SIZE     = 2048,
+};
+
+
+enum {
+	CLASS_REGISTER    = 1 << 0,
+	CLASS_MWI         = 1 << 1,
+	CLASS_APPLICATION = 1 << 2,
+	CLASS_CALL        = 1 << 3,
+	CLASS_VU_REPORT   = 1 << 4,
+	CLASS_OTHER       = 1 << 5,
+	CLASS_MESSAGE     = 1 << 6,
+	CLASS_ALL         = (1 << 7) - 1,
+};
+
+
+static const struct {
+	const char *name;
+	uint32_t bit;
+} classv[] = {
+	{"register",    CLASS_REGISTER},
+	{"mwi",         CLASS_MWI},
+	{"application", CLASS_APPLICATION},
+	{"call",        CLASS_CALL},
+	{"VU_REPORT",   CLASS_VU_REPORT},
+	{"other",       CLASS_OTHER},
+	{"message",     CLASS_MESSAGE},
+	{"all",         CLASS_ALL},
+};
+
 
 struct ctrl_st {
 	struct tcp_sock *ts;
+	struct list clientl;     /**< Connected clients (ctrl_client) */
+	uint32_t maxclients;
+	struct mbuf *mb;         /**< Event buffer, shared by clients */
+};
+
+struct ctrl_client {
+	struct le le;
+	struct ctrl_st *st;
 	struct tcp_conn *tc;
 	struct netstring *ns;
+	struct mbuf *out;        /**< Command output, reused          */
+	struct mbuf *mb;         /**< Response buffer, reused         */
+	uint32_t classes;        /**< Subscribed event classes        */
 };
 
 static struct ctrl_st *ctrl = NULL;  /* allow only one instance */
@@ -105,73 +181,293 @@ static int print_handler(const char *p, size_t size, void *arg)
 }
 
 
-static int encode_response(int cmd_error, struct mbuf *resp, const char *token)
+static uint32_t class_bit(const struct pl *name)
 {
-	struct re_printf pf = {print_handler, resp};
-	struct odict *od = NULL;
-	char *buf = NULL;
-	char m[256];
+	for (size_t i=0; i<RE_ARRAY_SIZE(classv); i++) {
+
+		if (0 == pl_strcmp(name, classv[i].name))
+			return classv[i].bit;
+	}
+
+	return 0;
+}
+
+
+static int classes_decode(uint32_t *maskp, const char *prm)
+{
+	struct pl pl, name;
+	uint32_t mask = 0;
+
+	if (!str_isset(prm)) {
+		*maskp = CLASS_ALL;
+		return 0;
+	}
+
+	pl_set_str(&pl, prm);
+
+	while (!re_regex(pl.p, pl.l, "[ ,]*[^ ,]+", NULL, &name)) {
+
+		uint32_t bit = class_bit(&name);
+		if (!bit)
+			return ENOENT;
+
+		mask |= bit;
+		pl_advance(&pl, name.p + name.l - pl.p);
+	}
+
+	*maskp = mask;
+
+	return 0;
+}
+
+
+static int classes_print(struct re_printf *pf, uint32_t mask)
+{
+	const char *sep = "";
+	int err = 0;
+
+	for (size_t i=0; i<RE_ARRAY_SIZE(classv); i++) {
+
+		if (classv[i].bit == CLASS_ALL || !(mask & classv[i].bit))
+			continue;
+
+		err |= re_hprintf(pf, "%s%s", sep, classv[i].name);
+		sep = " ";
+	}
+
+	return err;
+}
+
+
+static int subscribe(struct ctrl_client *cli, const char *prm, bool add,
+		     struct re_printf *pf)
+{
+	uint32_t mask;
 	int err;
 
-	/* Empty response. */
-	if (resp->pos == NETSTRING_HEADER_SIZE)
-	{
-		buf = mem_alloc(1, NULL);
-		buf[0] = '\0';
+	err = classes_decode(&mask, prm);
+	if (err) {
+		re_hprintf(pf, "unknown event class (%s)", prm);
+		return err;
 	}
+
+	if (add)
+		cli->classes |= mask;
 	else
-	{
-		resp->pos = NETSTRING_HEADER_SIZE;
-		err = mbuf_strdup(resp, &buf,
-			resp->end - NETSTRING_HEADER_SIZE);
-		if (err)
-			return err;
+		cli->classes &= ~mask;
+
+	return classes_print(pf, cli->classes);
+}
+
+
+/* Run a command handler directly, no re-parsing of a command line */
+static int command_exec(struct ctrl_client *cli, const char *cmd,
+			const char *prm, const struct odict *od,
+			struct re_printf *pf)
+{
+	const struct cmd *c;
+
+	if (0 == str_casecmp(cmd, "subscribe"))
+		return subscribe(cli, prm, true, pf);
+	if (0 == str_casecmp(cmd, "unsubscribe"))
+		return subscribe(cli, prm, false, pf);
+
+	c = cmd_find_long(baresip_commands(), cmd);
+	if (!c) {
+		re_hprintf(pf, "command not found (%s)\n", cmd);
+		return ENOTSUP;
 	}
 
-	err = odict_alloc(&od, 8);
+	return cmd_process_args(baresip_commands(), c, prm, od, pf, NULL);
+}
+
+
+static int params_decode(char **bufp, const char **prmp,
+			 const struct odict **odp, const struct odict *od)
+{
+	const struct odict_entry *e = odict_lookup(od, "params");
+
+	*prmp = NULL;
+	*odp  = NULL;
+
+	if (!e)
+		return 0;
+
+	switch (odict_entry_type(e)) {
+
+	case ODICT_STRING:
+		*prmp = odict_entry_str(e);
+		return 0;
+
+	case ODICT_INT:
+		return re_sdprintf(bufp, "%lld", odict_entry_int(e));
+
+	case ODICT_BOOL:
+		return re_sdprintf(bufp, "%s",
+				   odict_entry_boolean(e) ? "true" : "false");
+
+	case ODICT_OBJECT:
+	case ODICT_ARRAY:
+		*odp = odict_entry_object(e);
+		return re_sdprintf(bufp, "%H", json_encode_odict, *odp);
+
+	default:
+		return 0;
+	}
+}
+
+
+/* Execute one command message and add the response entries to resp */
+static int command_run(struct ctrl_client *cli, struct odict *resp,
+		       const struct odict *od, bool *okp)
+{
+	struct re_printf pf = {print_handler, cli->out};
+	const char *cmd, *prm, *tok;
+	const struct odict *params;
+	char *buf = NULL;
+	char m[256];
+	int cmd_err;
+	int err;
+
+	cmd = odict_string(od, "command");
+	tok = odict_string(od, "token");
+
+	mbuf_rewind(cli->out);
+
+	err = params_decode(&buf, &prm, &params, od);
 	if (err)
 		return err;
 
-	err |= odict_entry_add(od, "response", ODICT_BOOL, true);
-	err |= odict_entry_add(od, "ok", ODICT_BOOL, (bool)!cmd_error);
+	if (buf)
+		prm = buf;
+
+	if (cmd) {
+		debug("ctrl_tcp: handle_command:  cmd='%s', params:'%s',"
+		      " token='%s'\n", cmd, prm, tok);
+
+		cmd_err = command_exec(cli, cmd, prm, params, &pf);
+		if (cmd_err) {
+			warning("ctrl_tcp: error processing command (%m)\n",
+				cmd_err);
+		}
+	}
+	else {
+		warning("ctrl_tcp: missing json entries\n");
+		cmd_err = EINVAL;
+	}
+
+	err  = mbuf_write_u8(cli->out, 0);
+	err |= odict_entry_add(resp, "response", ODICT_BOOL, true);
+	err |= odict_entry_add(resp, "ok", ODICT_BOOL, (bool)!cmd_err);
 
-	if (cmd_error && str_len(buf) == 0)
-		err |= odict_entry_add(od, "data", ODICT_STRING,
-			str_error(cmd_error, m, sizeof(m)));
+	if (cmd_err && cli->out->end <= 1)
+		err |= odict_entry_add(resp, "data", ODICT_STRING,
+				       str_error(cmd_err, m, sizeof(m)));
 	else
-		err |= odict_entry_add(od, "data", ODICT_STRING, buf);
+		err |= odict_entry_add(resp, "data", ODICT_STRING,
+				       (const char *)cli->out->buf);
+
+	if (tok)
+		err |= odict_entry_add(resp, "token", ODICT_STRING, tok);
+
+	if (okp)
+		*okp = !cmd_err;
+
+	mem_deref(buf);
+
+	return err;
+}
 
-	if (token)
-		err |= odict_entry_add(od, "token", ODICT_STRING, token);
+
+static int batch_run(struct ctrl_client *cli, struct odict *resp,
+		     const struct odict *od)
+{
+	const struct odict_entry *e;
+	struct odict *arr = NULL;
+	const char *tok;
+	bool ok = true;
+	unsigned idx = 0;
+	struct le *le;
+	int err;
+
+	e = odict_get_type(od, ODICT_ARRAY, "params");
+	if (!e)
+		return EPROTO;
+
+	err = odict_alloc(&arr, 32);
+	if (err)
+		return err;
+
+	LIST_FOREACH(&odict_entry_array(e)->lst, le) {
+
+		const struct odict_entry *ce = le->data;
+		struct odict *item = NULL;
+		bool item_ok = false;
+		char key[16];
+
+		if (odict_entry_type(ce) != ODICT_OBJECT)
+			continue;
+
+		err = odict_alloc(&item, 8);
+		if (err)
+			break;
+
+		err = command_run(cli, item, odict_entry_object(ce),
+				  &item_ok);
+
+		re_snprintf(key, sizeof(key), "%u", idx++);
+		err |= odict_entry_add(arr, key, ODICT_OBJECT, item);
+		mem_deref(item);
+		if (err)
+			break;
+
+		ok &= item_ok;
+	}
 
 	if (err)
 		goto out;
 
-	mbuf_reset(resp);
-	mbuf_init(resp);
-	resp->pos = NETSTRING_HEADER_SIZE;
+	tok = odict_string(od, "token");
+
+	err  = odict_entry_add(resp, "response", ODICT_BOOL, true);
+	err |= odict_entry_add(resp, "ok", ODICT_BOOL, ok);
+	err |= odict_entry_add(resp, "data", ODICT_ARRAY, arr);
+	if (tok)
+		err |= odict_entry_add(resp, "token", ODICT_STRING, tok);
+
+ out:
+	mem_deref(arr);
+
+	return err;
+}
+
+
+static int client_send(struct ctrl_client *cli, const struct odict *od)
+{
+	struct re_printf pf = {print_handler, cli->mb};
+	int err;
+
+	mbuf_rewind(cli->mb);
+	cli->mb->pos = NETSTRING_HEADER_SIZE;
 
 	err = json_encode_odict(&pf, od);
-	if (err)
+	if (err) {
 		warning("ctrl_tcp: failed to encode response JSON (%m)\n",
 			err);
+		return err;
+	}
 
- out:
-	mem_deref(buf);
-	mem_deref(od);
+	cli->mb->pos = NETSTRING_HEADER_SIZE;
 
-	return err;
+	return tcp_send(cli->tc, cli->mb);
 }
 
 
 static bool command_handler(struct mbuf *mb, void *arg)
 {
-	struct ctrl_st *st = arg;
-	struct mbuf *resp = mbuf_alloc(2048);
-	struct re_printf pf = {print_handler, resp};
-	struct odict *od = NULL;
-	const char *cmd, *prm, *tok;
-	char buf[1024];
+	struct ctrl_client *cli = arg;
+	struct odict *od = NULL, *resp = NULL;
+	const char *cmd;
 	int err;
 
 	err = json_decode_odict(&od, 32, (const char*)mb->buf, mb->end, 16);
@@ -180,38 +476,22 @@ static bool command_handler(struct mbuf *mb, void *arg)
 		goto out;
 	}
 
-	cmd = odict_string(od, "command");
-	prm = odict_string(od, "params");
-	tok = odict_string(od, "token");
-	if (!cmd) {
-		warning("ctrl_tcp: missing json entries\n");
+	err = odict_alloc(&resp, 8);
+	if (err)
 		goto out;
-	}
 
-	debug("ctrl_tcp: handle_command:  cmd='%s', params:'%s', token='%s'\n",
-	      cmd, prm, tok);
-
-	re_snprintf(buf, sizeof(buf), "%s%s%s", cmd, prm ? " " : "", prm);
-
-	resp->pos = NETSTRING_HEADER_SIZE;
-
-	/* Relay message to long commands */
-	err = cmd_process_long(baresip_commands(),
-			       buf,
-			       str_len(buf),
-			       &pf, NULL);
-	if (err) {
-		warning("ctrl_tcp: error processing command (%m)\n", err);
-	}
+	cmd = odict_string(od, "command");
+	if (cmd && 0 == str_casecmp(cmd, "batch"))
+		err = batch_run(cli, resp, od);
+	else
+		err = command_run(cli, resp, od, NULL);
 
-	err = encode_response(err, resp, tok ? tok : NULL);
 	if (err) {
 		warning("ctrl_tcp: failed to encode response (%m)\n", err);
 		goto out;
 	}
 
-	resp->pos = NETSTRING_HEADER_SIZE;
-	err = tcp_send(st->tc, resp);
+	err = client_send(cli, resp);
 	if (err) {
 		warning("ctrl_tcp: failed to send the response (%m)\n", err);
 	}
@@ -224,28 +504,116 @@ static bool command_handler(struct mbuf *mb, void *arg)
 }
 
 
+static void client_destructor(void *arg)
+{
+	struct ctrl_client *cli = arg;
+
+	list_unlink(&cli->le);
+	mem_deref(cli->ns);
+	mem_deref(cli->tc);
+	mem_deref(cli->out);
+	mem_deref(cli->mb);
+}
+
+
 static void tcp_close_handler(int err, void *arg)
 {
-	struct ctrl_st *st = arg;
+	struct ctrl_client *cli = arg;
 
-	(void)err;
+	debug("ctrl_tcp: client closed (%m)\n", err);
 
-	st->tc = mem_deref(st->tc);
+	mem_deref(cli);
 }
 
 
 static void tcp_conn_handler(const struct sa *peer, void *arg)
 {
 	struct ctrl_st *st = arg;
+	struct ctrl_client *cli;
+	int err;
 
-	(void)peer;
+	if (list_count(&st->clientl) >= st->maxclients) {
+		warning("ctrl_tcp: max %u clients, rejecting %J\n",
+			st->maxclients, peer);
+		tcp_reject(st->ts);
+		return;
+	}
 
-	/* only one connection allowed */
-	st->tc = mem_deref(st->tc);
-	st->ns = mem_deref(st->ns);
+	cli = mem_zalloc(sizeof(*cli), client_destructor);
+	if (!cli) {
+		tcp_reject(st->ts);
+		return;
+	}
 
-	(void)tcp_accept(&st->tc, st->ts, NULL, NULL, tcp_close_handler, st);
-	(void)netstring_insert(&st->ns, st->tc, 0, command_handler, st);
+	cli->st      = st;
+	cli->classes = CLASS_ALL;
+	cli->out     = mbuf_alloc(BUF_SIZE);
+	cli->mb      = mbuf_alloc(BUF_SIZE);
+	if (!cli->out || !cli->mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = tcp_accept(&cli->tc, st->ts, NULL, NULL, tcp_close_handler,
+			 cli);
+	if (err)
+		goto out;
+
+	err = netstring_insert(&cli->ns, cli->tc, 0, command_handler, cli);
+	if (err)
+		goto out;
+
+	list_append(&st->clientl, &cli->le, cli);
+
+	debug("ctrl_tcp: client connected from %J\n", peer);
+
+ out:
+	if (err) {
+		warning("ctrl_tcp: could not accept %J (%m)\n", peer, err);
+		if (!cli->tc)
+			tcp_reject(st->ts);
+		mem_deref(cli);
+	}
+}
+
+
+/* Send an encoded event to all clients subscribed to its class */
+static void broadcast(struct ctrl_st *st, const struct odict *od,
+		      uint32_t bit)
+{
+	struct re_printf pf = {print_handler, st->mb};
+	struct le *le;
+	size_t end;
+	int err;
+
+	mbuf_rewind(st->mb);
+	st->mb->pos = NETSTRING_HEADER_SIZE;
+
+	err = json_encode_odict(&pf, od);
+	if (err) {
+		warning("ctrl_tcp: failed to encode event JSON (%m)\n", err);
+		return;
+	}
+
+	end = st->mb->end;
+
+	le = st->clientl.head;
+	while (le) {
+		struct ctrl_client *cli = le->data;
+		le = le->next;
+
+		if (!(cli->classes & bit))
+			continue;
+
+		/* the netstring framing is written in place */
+		st->mb->pos = NETSTRING_HEADER_SIZE;
+		st->mb->end = end;
+
+		err = tcp_send(cli->tc, st->mb);
+		if (err) {
+			warning("ctrl_tcp: failed to send event (%m)\n", err);
+		}
+	}
 }
 
 
@@ -256,12 +624,12 @@ static void ua_event_handler(struct ua *ua, enum ua_event ev,
 			     struct call *call, const char *prm, void *arg)
 {
 	struct ctrl_st *st = arg;
-	struct mbuf *buf = mbuf_alloc(1024);
-	struct re_printf pf = {print_handler, buf};
 	struct odict *od = NULL;
+	struct pl cls;
 	int err;
 
-	buf->pos = NETSTRING_HEADER_SIZE;
+	if (list_isempty(&st->clientl))
+		return;
 
 	err = odict_alloc(&od, 8);
 	if (err)
@@ -274,22 +642,11 @@ static void ua_event_handler(struct ua *ua, enum ua_event ev,
 		goto out;
 	}
 
-	err = json_encode_odict(&pf, od);
-	if (err) {
-		warning("ctrl_tcp: failed to encode event JSON (%m)\n", err);
-		goto out;
-	}
+	pl_set_str(&cls, odict_string(od, "class"));
 
-	if (st->tc) {
-		buf->pos = NETSTRING_HEADER_SIZE;
-		err = tcp_send(st->tc, buf);
-		if (err) {
-			warning("ctrl_tcp: failed to send event (%m)\n", err);
-		}
-	}
+	broadcast(st, od, class_bit(&cls) ? class_bit(&cls) : CLASS_OTHER);
 
  out:
-	mem_deref(buf);
 	mem_deref(od);
 }
 
@@ -299,12 +656,11 @@ static void message_handler(struct ua *ua, const struct pl *peer,
 			    struct mbuf *body, void *arg)
 {
 	struct ctrl_st *st = arg;
-	struct mbuf *buf = mbuf_alloc(1024);
-	struct re_printf pf = {print_handler, buf};
 	struct odict *od = NULL;
 	int err;
 
-	buf->pos = NETSTRING_HEADER_SIZE;
+	if (list_isempty(&st->clientl))
+		return;
 
 	err = odict_alloc(&od, 8);
 	if (err)
@@ -317,24 +673,9 @@ static void message_handler(struct ua *ua, const struct pl *peer,
 		goto out;
 	}
 
-	err = json_encode_odict(&pf, od);
-	if (err) {
-		warning("ctrl_tcp: failed to encode event JSON (%m)\n", err);
-		goto out;
-	}
-
-	buf->pos = NETSTRING_HEADER_SIZE;
-	if (!st->tc)
-		goto out;
-
-	err = tcp_send(st->tc, buf);
-	if (err) {
-		warning("ctrl_tcp: failed to send the SIP message (%m)\n",
-			err);
-	}
+	broadcast(st, od, CLASS_MESSAGE);
 
 out:
-	mem_deref(buf);
 	mem_deref(od);
 }
 
@@ -343,9 +684,9 @@ static void ctrl_destructor(void *arg)
 {
 	struct ctrl_st *st = arg;
 
-	mem_deref(st->tc);
+	list_flush(&st->clientl);
 	mem_deref(st->ts);
-	mem_deref(st->ns);
+	mem_deref(st->mb);
 }
 
 
@@ -361,6 +702,16 @@ static int ctrl_alloc(struct ctrl_st **stp, const struct sa *laddr)
 	if (!st)
 		return ENOMEM;
 
+	st->maxclients = MAX_CLIENTS;
+	(void)conf_get_u32(conf_cur(), "ctrl_tcp_maxclients",
+			   &st->maxclients);
+
+	st->mb = mbuf_alloc(BUF_SIZE);
+	if (!st->mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
 	err = tcp_listen(&st->ts, laddr, tcp_conn_handler, st);
 	if (err) {
 		warning("ctrl_tcp: failed to listen on TCP %J (%m)\n",
@@ -4,6 +4,13 @@
  * Copyright (C) 2010 Alfred E. Heggestad
  */
 
+#include <stdio.h>
+#include <time.h>
+#include <sys/stat.h>
+#ifdef USE_OPENSSL
+#include <openssl/ssl.h>
+#include <openssl/pem.h>
+#endif
 #include <re.h>
 #include <baresip.h>
 #include "dtls_srtp.h"
@@ -28,3 +35,426 @@ int dtls_print_sha256_fingerprint(struct re_printf *pf, const struct tls *tls)
 
 	return err;
 }
+
+
+/* RFC 5764 section 5.1.2 -- DTLS records have 19 < B < 64 */
+static bool is_dtls_record(const struct mbuf *mb)
+{
+	uint8_t b;
+
+	if (mbuf_get_left(mb) < 13)
+		return false;
+
+	b = mbuf_buf(mb)[0];
+
+	return 19 < b && b < 64;
+}
+
+
+static bool stats_send_handler(int *err, struct sa *dst, struct mbuf *mb,
+			       void *arg)
+{
+	struct comp *comp = arg;
+	(void)err;
+	(void)dst;
+
+	if (comp->hs.ts_estab || !is_dtls_record(mb))
+		return false;
+
+	comp->hs.bytes_tx += mbuf_get_left(mb);
+	comp->hs.last_tx   = true;
+
+	return false;
+}
+
+
+static bool stats_recv_handler(struct sa *src, struct mbuf *mb, void *arg)
+{
+	struct comp *comp = arg;
+	(void)src;
+
+	if (comp->hs.ts_estab || !is_dtls_record(mb))
+		return false;
+
+	if (!comp->hs.ts_start)
+		comp->hs.ts_start = tmr_jiffies();
+
+	/* a reply to our last flight completes one round trip */
+	if (comp->hs.last_tx)
+		++comp->hs.flights;
+
+	comp->hs.bytes_rx += mbuf_get_left(mb);
+	comp->hs.last_tx   = false;
+
+	return false;
+}
+
+
+/**
+ * Count DTLS handshake traffic on the component socket
+ *
+ * @param comp Media component
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dtls_stats_install(struct comp *comp)
+{
+	if (!comp)
+		return EINVAL;
+
+	if (comp->uh_stats)
+		return 0;
+
+	return udp_register_helper(&comp->uh_stats, comp->app_sock,
+				   LAYER_STATS,
+				   stats_send_handler, stats_recv_handler,
+				   comp);
+}
+
+
+#ifdef USE_OPENSSL
+enum {
+	SESS_MAX = 64,
+};
+
+/** A client session, keyed by the address of the DTLS server */
+struct sess_ent {
+	struct le le;
+	struct sa peer;
+	SSL_SESSION *sess;
+};
+
+static struct list sessl;               /**< Client sessions, oldest first */
+static const struct sa *offer_peer;     /**< Peer of dtls_connect()       */
+static int peer_idx = -1;               /**< SSL ex_data index            */
+
+
+static void sess_ent_destructor(void *arg)
+{
+	struct sess_ent *ent = arg;
+
+	list_unlink(&ent->le);
+	SSL_SESSION_free(ent->sess);
+}
+
+
+static struct sess_ent *sess_lookup(const struct sa *peer)
+{
+	struct le *le;
+
+	for (le = sessl.head; le; le = le->next) {
+
+		struct sess_ent *ent = le->data;
+
+		if (sa_cmp(&ent->peer, peer, SA_ALL))
+			return ent;
+	}
+
+	return NULL;
+}
+
+
+static void peer_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad,
+		      int idx, long argl, void *argp)
+{
+	(void)parent;
+	(void)ad;
+	(void)idx;
+	(void)argl;
+	(void)argp;
+
+	mem_deref(ptr);
+}
+
+
+/*
+ * dtls_connect() starts the handshake before it returns, so the session
+ * to offer is attached when the client state machine starts.
+ */
+static void info_handler(const SSL *ssl, int where, int ret)
+{
+	struct sess_ent *ent;
+	struct sa *peer;
+	(void)ret;
+
+	if (!(where & SSL_CB_HANDSHAKE_START) || SSL_is_server(ssl))
+		return;
+
+	if (!offer_peer || SSL_get_ex_data(ssl, peer_idx))
+		return;
+
+	peer = mem_alloc(sizeof(*peer), NULL);
+	if (!peer)
+		return;
+
+	sa_cpy(peer, offer_peer);
+
+	if (!SSL_set_ex_data((SSL *)ssl, peer_idx, peer)) {
+		mem_deref(peer);
+		return;
+	}
+
+	ent = sess_lookup(peer);
+	if (!ent)
+		return;
+
+	if (!SSL_SESSION_is_resumable(ent->sess) ||
+	    (uint64_t)time(NULL) >= (uint64_t)SSL_SESSION_get_time(ent->sess)
+	    + (uint64_t)SSL_SESSION_get_timeout(ent->sess)) {
+		mem_deref(ent);
+		return;
+	}
+
+	if (1 != SSL_set_session((SSL *)ssl, ent->sess))
+		mem_deref(ent);
+}
+
+
+static int new_session_handler(SSL *ssl, SSL_SESSION *sess)
+{
+	const struct sa *peer;
+	struct sess_ent *ent;
+
+	if (SSL_is_server(ssl))
+		return 0;
+
+	peer = SSL_get_ex_data(ssl, peer_idx);
+	if (!peer)
+		return 0;
+
+	mem_deref(sess_lookup(peer));
+
+	if (list_count(&sessl) >= SESS_MAX)
+		mem_deref(list_ledata(sessl.head));
+
+	ent = mem_zalloc(sizeof(*ent), sess_ent_destructor);
+	if (!ent)
+		return 0;
+
+	ent->peer = *peer;
+	ent->sess = sess;
+	list_append(&sessl, &ent->le, ent);
+
+	/* the reference is kept */
+	return 1;
+}
+#endif
+
+
+/**
+ * Enable DTLS session resumption in both roles
+ *
+ * As DTLS server, session IDs and tickets are issued by the shared DTLS
+ * context. As DTLS client, the session of a server is kept per address
+ * and offered by the next dtls_connect() to it. Either way a repeat peer
+ * can abbreviate the handshake on the next call.
+ *
+ * @param tls     DTLS context
+ * @param timeout Session lifetime in [seconds]
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dtls_session_cache_enable(struct tls *tls, uint32_t timeout)
+{
+#ifdef USE_OPENSSL
+	static const unsigned char sid_ctx[] = "baresip-dtls-srtp";
+	SSL_CTX *ctx;
+
+	if (!tls)
+		return EINVAL;
+
+	ctx = tls_openssl_context(tls);
+	if (!ctx)
+		return EINVAL;
+
+	if (1 != SSL_CTX_set_session_id_context(ctx, sid_ctx,
+						sizeof(sid_ctx) - 1))
+		return ENOMEM;
+
+	if (peer_idx < 0) {
+		peer_idx = SSL_get_ex_new_index(0, NULL, NULL, NULL,
+						peer_free);
+		if (peer_idx < 0)
+			return ENOMEM;
+	}
+
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_BOTH);
+	SSL_CTX_set_timeout(ctx, timeout);
+	SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+
+	SSL_CTX_sess_set_new_cb(ctx, new_session_handler);
+	SSL_CTX_set_info_callback(ctx, info_handler);
+
+	return 0;
+#else
+	(void)tls;
+	(void)timeout;
+
+	return ENOSYS;
+#endif
+}
+
+
+/**
+ * Set the peer for which a cached session is offered
+ *
+ * Must wrap dtls_connect(), which sends the ClientHello.
+ *
+ * @param peer Address of the DTLS server, NULL to clear
+ */
+void dtls_session_offer(const struct sa *peer)
+{
+#ifdef USE_OPENSSL
+	offer_peer = peer;
+#else
+	(void)peer;
+#endif
+}
+
+
+/**
+ * Drop all cached client sessions
+ */
+void dtls_session_cache_flush(void)
+{
+#ifdef USE_OPENSSL
+	list_flush(&sessl);
+#endif
+}
+
+
+/**
+ * Save the certificate and private key of a DTLS context as PEM
+ *
+ * The file is created with owner-only permissions.
+ *
+ * @param tls  DTLS context
+ * @param file Filename
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dtls_cert_save(const struct tls *tls, const char *file)
+{
+#ifdef USE_OPENSSL
+	SSL_CTX *ctx;
+	X509 *cert;
+	EVP_PKEY *key;
+	FILE *f = NULL;
+	int err;
+
+	if (!tls || !file)
+		return EINVAL;
+
+	ctx  = tls_openssl_context(tls);
+	cert = ctx ? SSL_CTX_get0_certificate(ctx) : NULL;
+	key  = ctx ? SSL_CTX_get0_privatekey(ctx) : NULL;
+	if (!cert || !key)
+		return ENOENT;
+
+	err = fs_fopen(&f, file, "w");
+	if (err)
+		return err;
+
+	if (1 != PEM_write_X509(f, cert) ||
+	    1 != PEM_write_PrivateKey(f, key, NULL, NULL, 0, NULL, NULL))
+		err = EIO;
+
+	(void)fclose(f);
+
+	return err;
+#else
+	(void)tls;
+	(void)file;
+
+	return ENOSYS;
+#endif
+}
+
+
+/**
+ * Load a certificate and private key saved by dtls_cert_save()
+ *
+ * @param tls     DTLS context
+ * @param file    Filename
+ * @param max_age Maximum certificate age in [days], 0 for no limit
+ *
+ * @return 0 if success, ETIMEDOUT if the certificate is too old,
+ *         otherwise errorcode
+ *
+ * @note The age is taken from the modification time of the file, which
+ *       is written when the certificate is generated. The notBefore time
+ *       of a self-signed certificate is backdated.
+ */
+int dtls_cert_load(struct tls *tls, const char *file, uint32_t max_age)
+{
+#ifdef USE_OPENSSL
+	struct mbuf *mb;
+	FILE *f = NULL;
+	X509 *cert;
+	int err;
+
+	if (!tls || !file)
+		return EINVAL;
+
+	mb = mbuf_alloc(2048);
+	if (!mb)
+		return ENOMEM;
+
+	err = fs_fopen(&f, file, "r");
+	if (err)
+		goto out;
+
+	while (!feof(f)) {
+		size_t n;
+
+		err = mbuf_resize(mb, mb->end + 1024);
+		if (err)
+			goto out;
+
+		n = fread(mb->buf + mb->end, 1, mb->size - mb->end, f);
+		if (ferror(f)) {
+			err = EIO;
+			goto out;
+		}
+
+		mb->end += n;
+	}
+
+	err = tls_set_certificate(tls, (char *)mb->buf, mb->end);
+	if (err)
+		goto out;
+
+	cert = SSL_CTX_get0_certificate(tls_openssl_context(tls));
+	if (!cert) {
+		err = ENOENT;
+		goto out;
+	}
+
+	if (max_age) {
+		struct stat st;
+		time_t age;
+
+		if (fstat(fileno(f), &st)) {
+			err = errno;
+			goto out;
+		}
+
+		age = time(NULL) - st.st_mtime;
+		if (age < 0 || (uint64_t)age >= (uint64_t)max_age * 86400)
+			err = ETIMEDOUT;
+	}
+
+ out:
+	if (f)
+		(void)fclose(f);
+	mem_deref(mb);
+
+	return err;
+#else
+	(void)tls;
+	(void)file;
+	(void)max_age;
+
+	return ENOSYS;
+#endif
+}
@@ -42,10 +42,25 @@
  *                [socket]
  \endverbatim
  *
+ * With "dtls_srtp_resumption <seconds>", sessions are cached on both
+ * sides. As DTLS server we issue session IDs and tickets, as DTLS client
+ * we offer the last session of a peer address on the next handshake.
+ *
  */
 
+/** Handshake cost summed up per call or globally */
+struct hs_stats {
+	uint32_t handshakes;
+	uint32_t resumed;
+	uint32_t flights;
+	uint64_t time_sum;           /**< Handshake time [ms]             */
+	uint64_t time_max;
+	uint64_t bytes;
+};
+
 struct menc_sess {
 	struct sdp_session *sdp;
+	struct hs_stats stats;
 	bool offerer;
 	menc_event_h *eventh;
 	menc_error_h *errorh;
@@ -55,7 +70,7 @@ struct menc_sess {
 /* media */
 struct dtls_srtp {
 	struct comp compv[2];
-	const struct menc_sess *sess;
+	struct menc_sess *sess;
 	struct sdp_media *sdpm;
 	const struct stream *strm;   /**< pointer to parent */
 	bool started;
@@ -71,6 +86,13 @@ enum setup {
 };
 
 static struct tls *tls;
+static struct hs_stats stats;
+static char ec[64] = "prime256v1";
+static char certfile[FS_PATH_MAX];  /**< Certificate cache, if enabled */
+static mtx_t *keygen_mtx;
+static cnd_t keygen_cnd;            /**< Signalled when keygen is done */
+static bool keygen_busy;            /**< Certificate generation running */
+static int keygen_err;
 static const char* srtp_profiles =
 	"SRTP_AES128_CM_SHA1_80:"
 	"SRTP_AES128_CM_SHA1_32:"
@@ -78,6 +100,116 @@ static const char* srtp_profiles =
 	"SRTP_AEAD_AES_256_GCM";
 
 
+/*
+ * The certificate is generated on an async worker, in parallel with the
+ * loading of other modules. The first session waits for it to complete.
+ */
+static int keygen_work(void *arg)
+{
+	uint64_t t0 = tmr_jiffies_usec();
+	int err;
+	(void)arg;
+
+	err = tls_set_selfsigned_ec(tls, "dtls@baresip", ec);
+	if (err)
+		goto out;
+
+	info("dtls_srtp: ec-certificate generated in %llu us\n",
+	     tmr_jiffies_usec() - t0);
+
+	if (certfile[0]) {
+		int e = dtls_cert_save(tls, certfile);
+		if (e)
+			warning("dtls_srtp: could not save certificate"
+				" to %s (%m)\n", certfile, e);
+	}
+
+ out:
+	mtx_lock(keygen_mtx);
+	keygen_err = err;
+	keygen_busy = false;
+	cnd_broadcast(&keygen_cnd);
+	mtx_unlock(keygen_mtx);
+
+	return err;
+}
+
+
+static void keygen_done(int err, void *arg)
+{
+	(void)arg;
+
+	if (err) {
+		warning("dtls_srtp: failed to self-sign "
+			"ec-certificate (%m)\n", err);
+		return;
+	}
+
+	debug("dtls_srtp: ec-certificate ready\n");
+}
+
+
+/*
+ * Reuse the certificate from the last run, so that the fingerprint stays
+ * the same across restarts. It is replaced when older than max_age days.
+ */
+static bool cert_cache_load(uint32_t max_age)
+{
+	char path[FS_PATH_MAX];
+	int err;
+
+	err = conf_path_get(path, sizeof(path));
+	if (err)
+		return false;
+
+	if (re_snprintf(certfile, sizeof(certfile), "%s/dtls_srtp.pem",
+			path) < 0)
+		return false;
+
+	err = dtls_cert_load(tls, certfile, max_age);
+	switch (err) {
+
+	case 0:
+		info("dtls_srtp: using certificate from %s\n", certfile);
+		return true;
+
+	case ENOENT:
+		break;
+
+	case ETIMEDOUT:
+		info("dtls_srtp: certificate older than %u days,"
+		     " rotating\n", max_age);
+		break;
+
+	default:
+		warning("dtls_srtp: could not load certificate from %s"
+			" (%m)\n", certfile, err);
+		break;
+	}
+
+	return false;
+}
+
+
+static int keygen_wait(void)
+{
+	int err;
+
+	if (!keygen_mtx)
+		return 0;
+
+	mtx_lock(keygen_mtx);
+
+	while (keygen_busy)
+		cnd_wait(&keygen_cnd, keygen_mtx);
+
+	err = keygen_err;
+	mtx_unlock(keygen_mtx);
+
+	return err;
+}
+
+
 static enum setup setup_decode(const char *setup)
 {
 	if (0 == str_casecmp(setup, "active")) return SETUP_ACTIVE;
@@ -88,10 +220,43 @@ static enum setup setup_decode(const char *setup)
 }
 
 
+static int hs_stats_print(struct re_printf *pf, const struct hs_stats *hs)
+{
+	uint32_t n = hs->handshakes;
+
+	return re_hprintf(pf, "%u handshakes (%u resumed),"
+			  " time avg %llu ms max %llu ms,"
+			  " avg %llu bytes, avg %u round trips",
+			  n, hs->resumed,
+			  n ? hs->time_sum / n : 0, hs->time_max,
+			  n ? hs->bytes / n : 0,
+			  n ? hs->flights / n : 0);
+}
+
+
+static void hs_stats_add(struct hs_stats *hs, const struct dtls_hs *h)
+{
+	uint64_t t = h->ts_estab - h->ts_start;
+
+	++hs->handshakes;
+	if (h->resumed)
+		++hs->resumed;
+
+	hs->flights  += h->flights;
+	hs->time_sum += t;
+	hs->time_max  = max(hs->time_max, t);
+	hs->bytes    += h->bytes_tx + h->bytes_rx;
+}
+
+
 static void sess_destructor(void *arg)
 {
 	struct menc_sess *sess = arg;
 
+	if (sess->stats.handshakes)
+		info("dtls_srtp: call summary: %H\n",
+		     hs_stats_print, &sess->stats);
+
 	mem_deref(sess->sdp);
 }
 
@@ -105,6 +270,7 @@ static void destructor(void *arg)
 		struct comp *c = &st->compv[i];
 
 		mem_deref(c->uh_srtp);
+		mem_deref(c->uh_stats);
 		mem_deref(c->tls_conn);
 		mem_deref(c->dtls_sock);
 		mem_deref(c->app_sock);  /* must be freed last */
@@ -172,6 +338,10 @@ static int session_alloc(struct menc_sess **sessp,
 	if (!sessp || !sdp)
 		return EINVAL;
 
+	err = keygen_wait();
+	if (err)
+		return err;
+
 	sess = mem_zalloc(sizeof(*sess), sess_destructor);
 	if (!sess)
 		return ENOMEM;
@@ -217,23 +387,74 @@ static size_t get_master_keylen(enum srtp_suite suite)
 }
 
 
+static int comp_set_keys(struct comp *comp, enum srtp_suite suite,
+			 const uint8_t *cli_key, const uint8_t *srv_key)
+{
+	const struct dtls_srtp *ds = comp->ds;
+	size_t keylen = get_master_keylen(suite);
+	char buf[32] = "";
+	int err = 0;
+
+	err |= srtp_stream_add(&comp->tx, suite,
+			       ds->active ? cli_key : srv_key, keylen, true);
+	err |= srtp_stream_add(&comp->rx, suite,
+			       ds->active ? srv_key : cli_key, keylen, false);
+	if (err)
+		return err;
+
+	err = srtp_install(comp);
+	if (err) {
+		warning("dtls_srtp: srtp_install: %m\n", err);
+	}
+
+	if (ds->sess->eventh) {
+		if (re_snprintf(buf, sizeof(buf), "%s,%s",
+				sdp_media_name(ds->sdpm),
+				comp->is_rtp ? "RTP" : "RTCP"))
+			ds->sess->eventh(MENC_EVENT_SECURE, buf,
+					 (struct stream *)ds->strm,
+					 ds->sess->arg);
+		else
+			warning("dtls_srtp: failed to print secure"
+				" event arguments\n");
+	}
+
+	return err;
+}
+
+
 static void dtls_estab_handler(void *arg)
 {
 	struct comp *comp = arg;
-	const struct dtls_srtp *ds = comp->ds;
+	struct dtls_srtp *ds = comp->ds;
+	struct menc_sess *sess = ds->sess;
 	enum srtp_suite suite;
 	uint8_t cli_key[32+12], srv_key[32+12];
-	char buf[32] = "";
-	size_t keylen;
 	int err;
 
 	debug("dtls_srtp: established: cipher=%s\n",
 	      tls_cipher_name(comp->tls_conn));
 
-	if (!verify_fingerprint(ds->sess->sdp, ds->sdpm, comp->tls_conn)) {
+	comp->hs.ts_estab = tmr_jiffies();
+	if (!comp->hs.ts_start)
+		comp->hs.ts_start = comp->hs.ts_estab;
+
+	comp->hs.resumed = tls_session_reused(comp->tls_conn);
+
+	hs_stats_add(&sess->stats, &comp->hs);
+	hs_stats_add(&stats, &comp->hs);
+
+	info("dtls_srtp: %s,%s handshake %llu ms, %u round trips,"
+	     " %zu/%zu bytes tx/rx%s\n",
+	     sdp_media_name(ds->sdpm), comp->is_rtp ? "RTP" : "RTCP",
+	     comp->hs.ts_estab - comp->hs.ts_start, comp->hs.flights,
+	     comp->hs.bytes_tx, comp->hs.bytes_rx,
+	     comp->hs.resumed ? " (resumed)" : "");
+
+	if (!verify_fingerprint(sess->sdp, ds->sdpm, comp->tls_conn)) {
 		warning("dtls_srtp: could not verify remote fingerprint\n");
-		if (ds->sess->errorh)
-			ds->sess->errorh(EPIPE, ds->sess->arg);
+		if (sess->errorh)
+			sess->errorh(EPIPE, sess->arg);
 		return;
 	}
 
@@ -251,31 +472,7 @@ static void dtls_estab_handler(void *arg)
 	     sdp_media_name(ds->sdpm),
 	     comp->is_rtp ? "RTP" : "RTCP", srtp_suite_name(suite));
 
-	keylen = get_master_keylen(suite);
-
-	err |= srtp_stream_add(&comp->tx, suite,
-			       ds->active ? cli_key : srv_key, keylen, true);
-	err |= srtp_stream_add(&comp->rx, suite,
-			       ds->active ? srv_key : cli_key, keylen, false);
-	if (err)
-		return;
-
-	err |= srtp_install(comp);
-	if (err) {
-		warning("dtls_srtp: srtp_install: %m\n", err);
-	}
-
-	if (ds->sess->eventh) {
-		if (re_snprintf(buf, sizeof(buf), "%s,%s",
-				sdp_media_name(ds->sdpm),
-				comp->is_rtp ? "RTP" : "RTCP"))
-			ds->sess->eventh(MENC_EVENT_SECURE, buf,
-					 (struct stream *)ds->strm,
-					 ds->sess->arg);
-		else
-			warning("dtls_srtp: failed to print secure"
-				" event arguments\n");
-	}
+	(void)comp_set_keys(comp, suite, cli_key, srv_key);
 }
 
 
@@ -319,6 +516,9 @@ static void dtls_conn_handler(const struct sa *peer, void *arg)
 		return;
 	}
 
+	if (!comp->hs.ts_start)
+		comp->hs.ts_start = tmr_jiffies();
+
 	err = dtls_accept(&comp->tls_conn, tls, comp->dtls_sock,
 			  dtls_estab_handler, NULL, dtls_close_handler, comp);
 	if (err) {
@@ -338,6 +538,10 @@ static int component_start(struct comp *comp, const struct sa *raddr)
 	if (!comp->app_sock || comp->negotiated || comp->dtls_sock)
 		return 0;
 
+	err = dtls_stats_install(comp);
+	if (err)
+		return err;
+
 	err = dtls_listen(&comp->dtls_sock, NULL,
 			  comp->app_sock, 2, LAYER_DTLS,
 			  dtls_conn_handler, comp);
@@ -358,10 +562,15 @@ static int component_start(struct comp *comp, const struct sa *raddr)
 			     comp->is_rtp ? "RTP" : "RTCP",
 			     raddr);
 
+			comp->hs.ts_start = tmr_jiffies();
+
+			/* the ClientHello is sent from dtls_connect() */
+			dtls_session_offer(raddr);
 			err = dtls_connect(&comp->tls_conn, tls,
 					   comp->dtls_sock, raddr,
 					   dtls_estab_handler, NULL,
 					   dtls_close_handler, comp);
+			dtls_session_offer(NULL);
 			if (err) {
 				warning("dtls_srtp: dtls_connect()"
 					" failed (%m)\n", err);
@@ -497,6 +706,20 @@ static int media_alloc(struct menc_media **mp, struct menc_sess *sess,
 }
 
 
+static int cmd_stats(struct re_printf *pf, void *unused)
+{
+	(void)unused;
+
+	return re_hprintf(pf, "DTLS-SRTP: %H\n", hs_stats_print, &stats);
+}
+
+
+static const struct cmd cmdv[] = {
+
+{"dtls_srtp_stats", 0, 0, "DTLS-SRTP handshake statistics", cmd_stats},
+};
+
+
 static struct menc dtls_srtp = {
 	.id          = "dtls_srtp",
 	.sdp_proto   = "UDP/TLS/RTP/SAVPF",
@@ -509,8 +732,11 @@ static struct menc dtls_srtp = {
 static int module_init(void)
 {
 	struct list *mencl = baresip_mencl();
-	char ec[64] = "prime256v1";
-	const char *cn = "dtls@baresip";
+	uint64_t t0 = tmr_jiffies_usec();
+	uint32_t resumption = 0;
+	bool cache = false;
+	uint32_t rotate = 30;
+	bool cached = false;
 	int err;
 
 	err = tls_alloc(&tls, TLS_METHOD_DTLSV1, NULL, NULL);
@@ -524,15 +750,21 @@ static int module_init(void)
 
 	info ("dtls_srtp: use %s for elliptic curve cryptography\n", ec);
 
-	err = tls_set_selfsigned_ec(tls, cn, ec);
-	if (err) {
-		warning("dtls_srtp: failed to self-sign "
-			"ec-certificate (%m)\n", err);
-		return err;
-	}
-
 	tls_set_verify_client_trust_all(tls);
 
+	(void)conf_get_u32(conf_cur(), "dtls_srtp_resumption", &resumption);
+	(void)conf_get_bool(conf_cur(), "dtls_srtp_cert_cache", &cache);
+	(void)conf_get_u32(conf_cur(), "dtls_srtp_cert_rotate", &rotate);
+
+	if (resumption) {
+		err = dtls_session_cache_enable(tls, resumption);
+		if (err) {
+			warning("dtls_srtp: failed to enable session"
+				" resumption (%m)\n", err);
+			return err;
+		}
+	}
+
 	err = tls_set_srtp(tls, srtp_profiles);
 	if (err) {
 		warning("dtls_srtp: failed to enable SRTP profile (%m)\n",
@@ -540,18 +772,68 @@ static int module_init(void)
 		return err;
 	}
 
+	certfile[0] = '\0';
+	if (cache)
+		cached = cert_cache_load(rotate);
+
+	err = mutex_alloc(&keygen_mtx);
+	if (err)
+		return err;
+
+	if (cnd_init(&keygen_cnd) != thrd_success) {
+		keygen_mtx = mem_deref(keygen_mtx);
+		return ENOMEM;
+	}
+
+	keygen_err = 0;
+	if (!cached) {
+		keygen_busy = true;
+		err = re_thread_async_id((intptr_t)&tls, keygen_work,
+					 keygen_done, NULL);
+		if (err) {
+			keygen_busy = false;
+			return err;
+		}
+	}
+
 	menc_register(mencl, &dtls_srtp);
 
+	err = cmd_register(baresip_commands(), cmdv, RE_ARRAY_SIZE(cmdv));
+	if (err) {
+		menc_unregister(&dtls_srtp);
+		(void)keygen_wait();
+		re_thread_async_cancel((intptr_t)&tls);
+		cnd_destroy(&keygen_cnd);
+		keygen_mtx = mem_deref(keygen_mtx);
+		tls = mem_deref(tls);
+		return err;
+	}
+
 	debug("DTLS-SRTP ready with profiles %s\n", srtp_profiles);
 
+	info("dtls_srtp: module init took %llu us (%s certificate)\n",
+	     tmr_jiffies_usec() - t0, cached ? "cached" : "new");
+
 	return 0;
 }
 
 
 static int module_close(void)
 {
+	cmd_unregister(baresip_commands(), cmdv);
 	menc_unregister(&dtls_srtp);
+
+	/* the worker must be done with the context */
+	(void)keygen_wait();
+	re_thread_async_cancel((intptr_t)&tls);
+
+	if (keygen_mtx) {
+		cnd_destroy(&keygen_cnd);
+		keygen_mtx = mem_deref(keygen_mtx);
+	}
+
 	tls = mem_deref(tls);
+	dtls_session_cache_flush();
 
 	return 0;
 }
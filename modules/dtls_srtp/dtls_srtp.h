@@ -6,24 +6,44 @@
 
 
 enum {
-	LAYER_SRTP = 20,
-	LAYER_DTLS = 20, /* must be above zero */
+	LAYER_SRTP  = 20,
+	LAYER_DTLS  = 20, /* must be above zero */
+	LAYER_STATS = 19, /* below DTLS, sees handshake records */
+};
+
+/** DTLS handshake statistics */
+struct dtls_hs {
+	uint64_t ts_start;          /**< Handshake started [ms]          */
+	uint64_t ts_estab;          /**< Handshake finished [ms]         */
+	size_t bytes_tx;            /**< DTLS bytes sent                 */
+	size_t bytes_rx;            /**< DTLS bytes received             */
+	uint32_t flights;           /**< Number of round trips           */
+	bool last_tx;               /**< Last DTLS record was sent       */
+	bool resumed;               /**< Session was resumed             */
 };
 
 struct comp {
-	const struct dtls_srtp *ds; /* parent */
+	struct dtls_srtp *ds;       /* parent */
 	struct dtls_sock *dtls_sock;
 	struct tls_conn *tls_conn;
 	struct srtp_stream *tx;
 	struct srtp_stream *rx;
 	struct udp_helper *uh_srtp;
+	struct udp_helper *uh_stats;
 	void *app_sock;
+	struct dtls_hs hs;
 	bool negotiated;
 	bool is_rtp;
 };
 
 /* dtls.c */
 int dtls_print_sha256_fingerprint(struct re_printf *pf, const struct tls *tls);
+int dtls_stats_install(struct comp *comp);
+int dtls_session_cache_enable(struct tls *tls, uint32_t timeout);
+void dtls_session_offer(const struct sa *peer);
+void dtls_session_cache_flush(void);
+int dtls_cert_save(const struct tls *tls, const char *file);
+int dtls_cert_load(struct tls *tls, const char *file, uint32_t max_age);
 
 
 /* srtp.c */
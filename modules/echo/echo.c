@@ -11,6 +11,16 @@
  * REQUIRES: aubridge
  * NOTE: This module is experimental.
  *
+ * With media relay enabled, RTP is echoed back without decoding and
+ * re-encoding. For video, picture update requests from the caller are
+ * sent back to the caller, whose picture is echoed. The aubridge devices
+ * are used as fallback for streams where this is not possible.
+ *
+ * Example config:
+ \verbatim
+  echo_relay    yes
+ \endverbatim
+ *
  */
 
 struct session {
@@ -20,6 +30,22 @@ struct session {
 
 
 static struct list sessionl;
+static bool use_relay;
+
+
+static void relay_start(struct stream *strm)
+{
+	int err;
+
+	if (!strm)
+		return;
+
+	err = stream_relay_start(strm, strm);
+	if (err) {
+		info("echo: %s: using media bridge (%m)\n",
+		     stream_name(strm), err);
+	}
+}
 
 
 static void destructor(void *arg)
@@ -40,6 +66,13 @@ static void call_event_handler(struct call *call, enum call_event ev,
 
 	switch (ev) {
 
+	case CALL_EVENT_ESTABLISHED:
+		if (use_relay) {
+			relay_start(audio_strm(call_audio(call)));
+			relay_start(video_strm(call_video(call)));
+		}
+		break;
+
 	case CALL_EVENT_CLOSED:
 		debug("echo: CALL_CLOSED: %s\n", str);
 		mem_deref(sess->call_in);
@@ -124,6 +157,8 @@ static int module_init(void)
 
 	list_init(&sessionl);
 
+	(void)conf_get_bool(conf_cur(), "echo_relay", &use_relay);
+
 	err = uag_event_register(ua_event_handler, 0);
 	if (err)
 		return err;
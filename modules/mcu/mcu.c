@@ -0,0 +1,196 @@
+/**
+ * @file mcu.c Tiled video compositor
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "mcu.h"
+
+
+/**
+ * @defgroup mcu mcu
+ *
+ * Tiled video compositor (MCU)
+ *
+ * The decoded video of all calls that use the "mcu" display with the
+ * same device name is composited into one canvas, in a square grid of
+ * up to 16 tiles. The canvas is the video source of every call that
+ * uses the "mcu" source with that device name, so each participant
+ * sees all the participants, including itself.
+ *
+ * The canvas has the configured video size and frame rate. Tiles are
+ * scaled with SSE2 or NEON kernels where available, and a tile is only
+ * scaled again when its stream has a new frame.
+ *
+ * Sample config:
+ *
+ \verbatim
+  video_display           mcu,room0
+  video_source            mcu,room0
+ \endverbatim
+ *
+ * Commands:
+ *
+ \verbatim
+  mcu                     Show rooms and statistics
+  mcu_bench               Measure the compositing frame rate
+  mcu_selftest            Compare the SIMD kernels with the C kernels
+ \endverbatim
+ */
+
+
+enum {
+	BENCH_USEC = 500000,
+};
+
+
+static struct vidisp *vidisp;
+static struct vidsrc *vidsrc;
+
+
+static int cmd_mcu(struct re_printf *pf, void *arg)
+{
+	(void)arg;
+
+	return mcu_room_debug(pf);
+}
+
+
+/* composite n changed tiles of a given size per frame, as fast as
+ * possible */
+static int bench_run(struct re_printf *pf, const struct vidsz *size,
+		     unsigned n)
+{
+	struct mcu_scaler *scv[MCU_TILES_MAX] = {NULL};
+	struct vidframe *canvas = NULL, *frame = NULL;
+	struct vidrect rect;
+	struct vidsz tsz;
+	uint64_t t0, t = 0;
+	unsigned i, frames = 0;
+	int err;
+
+	err  = vidframe_alloc(&canvas, VID_FMT_YUV420P, size);
+	err |= vidframe_alloc(&frame, VID_FMT_YUV420P, size);
+	if (err)
+		goto out;
+
+	for (i = 0; i < size->w; i++) {
+		vidframe_draw_vline(frame, i, 0, size->h, i & 0xff,
+				    (i * 3) & 0xff, 255 - (i & 0xff));
+	}
+
+	mcu_layout(&rect, 0, n, size);
+	tsz.w = rect.w;
+	tsz.h = rect.h;
+
+	for (i = 0; i < n; i++) {
+		err = mcu_scaler_alloc(&scv[i], size, &tsz);
+		if (err)
+			goto out;
+	}
+
+	t0 = tmr_jiffies_usec();
+
+	while (t < BENCH_USEC) {
+
+		for (i = 0; i < n; i++) {
+			mcu_layout(&rect, i, n, size);
+			mcu_scaler_apply(scv[i], canvas, &rect, frame);
+		}
+
+		++frames;
+		t = tmr_jiffies_usec() - t0;
+	}
+
+	err = re_hprintf(pf, "%4u x %-4u %2u tiles: %7.1f fps\n",
+			 size->w, size->h, n, frames * 1e6 / (double)t);
+
+ out:
+	for (i = 0; i < n; i++)
+		mem_deref(scv[i]);
+
+	mem_deref(frame);
+	mem_deref(canvas);
+
+	return err;
+}
+
+
+static int cmd_bench(struct re_printf *pf, void *arg)
+{
+	static const struct vidsz sizev[] = {{1280, 720}, {1920, 1080}};
+	static const unsigned tilev[] = {4, 9, 16};
+	int err;
+	(void)arg;
+
+	err = re_hprintf(pf, "mcu: canvas frame rate, all tiles changed,"
+			 " %s kernels\n", mcu_simd_name());
+
+	for (size_t i = 0; i < RE_ARRAY_SIZE(sizev); i++) {
+		for (size_t j = 0; j < RE_ARRAY_SIZE(tilev); j++)
+			err |= bench_run(pf, &sizev[i], tilev[j]);
+	}
+
+	return err;
+}
+
+
+static int cmd_selftest(struct re_printf *pf, void *arg)
+{
+	int err;
+	(void)arg;
+
+	err = mcu_scale_selftest();
+
+	(void)re_hprintf(pf, "mcu: %s kernels: %s\n", mcu_simd_name(),
+			 err ? "differ from C" : "ok");
+
+	return err;
+}
+
+
+static const struct cmd cmdv[] = {
+	{"mcu",          0, 0, "Show MCU rooms",               cmd_mcu      },
+	{"mcu_bench",    0, 0, "Benchmark the MCU compositor", cmd_bench    },
+	{"mcu_selftest", 0, 0, "Compare SIMD kernels with C",  cmd_selftest },
+};
+
+
+static int module_init(void)
+{
+	int err;
+
+	err = vidisp_register(&vidisp, baresip_vidispl(),
+			      "mcu", mcu_disp_alloc,
+			      NULL, mcu_disp_display, 0);
+	if (err)
+		return err;
+
+	err = vidsrc_register(&vidsrc, baresip_vidsrcl(),
+			      "mcu", mcu_src_alloc, NULL);
+	if (err)
+		return err;
+
+	return cmd_register(baresip_commands(), cmdv, RE_ARRAY_SIZE(cmdv));
+}
+
+
+static int module_close(void)
+{
+	cmd_unregister(baresip_commands(), cmdv);
+
+	vidsrc = mem_deref(vidsrc);
+	vidisp = mem_deref(vidisp);
+
+	return 0;
+}
+
+
+EXPORT_SYM const struct mod_export DECL_EXPORTS(mcu) = {
+	"mcu",
+	"video",
+	module_init,
+	module_close,
+};
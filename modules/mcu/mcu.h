@@ -0,0 +1,49 @@
+/**
+ * @file mcu.h Tiled video compositor -- internal interface
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+
+
+enum {
+	MCU_TILES_MAX = 16,
+};
+
+
+/* Room */
+struct mcu_room;
+
+int  mcu_room_get(struct mcu_room **roomp, const char *device);
+void mcu_layout(struct vidrect *rect, unsigned idx, unsigned n,
+		const struct vidsz *canvas);
+int  mcu_room_debug(struct re_printf *pf);
+
+
+/* Display, one tile per incoming stream */
+int mcu_disp_alloc(struct vidisp_st **stp, const struct vidisp *vd,
+		   struct vidisp_prm *prm, const char *dev,
+		   vidisp_resize_h *resizeh, void *arg);
+int mcu_disp_display(struct vidisp_st *st, const char *title,
+		     const struct vidframe *frame, uint64_t timestamp);
+
+
+/* Source, the canvas for every participant */
+int mcu_src_alloc(struct vidsrc_st **stp, const struct vidsrc *vs,
+		  struct vidsrc_prm *prm,
+		  const struct vidsz *size, const char *fmt,
+		  const char *dev, vidsrc_frame_h *frameh,
+		  vidsrc_packet_h *packeth,
+		  vidsrc_error_h *errorh, void *arg);
+
+
+/* Scaler, YUV420P */
+struct mcu_scaler;
+
+int  mcu_scaler_alloc(struct mcu_scaler **scp, const struct vidsz *src,
+		      const struct vidsz *dst);
+bool mcu_scaler_match(const struct mcu_scaler *sc, const struct vidsz *src,
+		      const struct vidsz *dst);
+void mcu_scaler_apply(struct mcu_scaler *sc, struct vidframe *dst,
+		      const struct vidrect *rect, const struct vidframe *src);
+const char *mcu_simd_name(void);
+int  mcu_scale_selftest(void);
@@ -0,0 +1,461 @@
+/**
+ * @file mcu/room.c Tiled video compositor -- room, display and source
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <re_atomic.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "mcu.h"
+
+
+/*
+ * A room is identified by the device name of the display and source.
+ * Every display instance in the room is a tile, every source instance
+ * receives the canvas. The compositor thread scales the tiles that have
+ * a new frame into the canvas and passes the canvas to the sources at
+ * the configured video frame rate.
+ *
+ * The display keeps a copy of the latest decoded frame, the copy is
+ * scaled only once per output frame, and only if it changed.
+ */
+
+
+/** Compositor room */
+struct mcu_room {
+	struct le le;
+	char *device;
+	struct vidframe *canvas;   /**< Output frame, YUV420P            */
+	double fps;
+	struct list tilel;         /**< Displays (struct vidisp_st)      */
+	struct list srcl;          /**< Sources (struct vidsrc_st)       */
+	mtx_t *mtx;                /**< Protects the tiles               */
+	mtx_t *src_mtx;            /**< Protects the sources             */
+	bool relayout;
+	thrd_t thread;
+	RE_ATOMIC bool run;
+	uint64_t n_frames;         /**< Composited frames                */
+	uint64_t n_scaled;         /**< Scaled tiles                     */
+};
+
+/** One incoming video stream */
+struct vidisp_st {
+	struct le le;
+	struct mcu_room *room;
+	struct vidframe *frame;    /**< Latest frame, YUV420P            */
+	struct mcu_scaler *sc;
+	struct vidrect rect;       /**< Tile in the canvas               */
+	bool changed;              /**< New frame since last composite   */
+	bool visible;
+};
+
+/** One outgoing video stream */
+struct vidsrc_st {
+	struct le le;
+	struct mcu_room *room;
+	vidsrc_frame_h *frameh;
+	void *arg;
+};
+
+
+static struct list rooml;
+
+
+/**
+ * Calculate the tile of a stream in a square grid, centered in the
+ * canvas
+ *
+ * @param rect   Returned tile rectangle
+ * @param idx    Index of the stream
+ * @param n      Number of streams
+ * @param canvas Canvas size
+ */
+void mcu_layout(struct vidrect *rect, unsigned idx, unsigned n,
+		const struct vidsz *canvas)
+{
+	unsigned g = 1;
+
+	if (!rect || !canvas)
+		return;
+
+	while (g * g < n)
+		++g;
+
+	rect->w = (canvas->w / g) & ~1u;
+	rect->h = (canvas->h / g) & ~1u;
+	rect->x = (((canvas->w - g * rect->w) / 2) & ~1u) + idx % g * rect->w;
+	rect->y = (((canvas->h - g * rect->h) / 2) & ~1u) + idx / g * rect->h;
+}
+
+
+static void tile_scale(struct mcu_room *room, struct vidisp_st *t)
+{
+	struct vidsz sz = {t->rect.w, t->rect.h};
+
+	if (!mcu_scaler_match(t->sc, &t->frame->size, &sz)) {
+
+		t->sc = mem_deref(t->sc);
+
+		if (mcu_scaler_alloc(&t->sc, &t->frame->size, &sz))
+			return;
+	}
+
+	mcu_scaler_apply(t->sc, room->canvas, &t->rect, t->frame);
+	++room->n_scaled;
+}
+
+
+static void composite(struct mcu_room *room)
+{
+	struct le *le;
+	unsigned i = 0;
+
+	mtx_lock(room->mtx);
+
+	if (room->relayout) {
+
+		unsigned n = min(list_count(&room->tilel), MCU_TILES_MAX);
+
+		vidframe_fill(room->canvas, 0, 0, 0);
+
+		LIST_FOREACH(&room->tilel, le) {
+
+			struct vidisp_st *t = le->data;
+
+			t->visible = i < n;
+			t->changed = t->frame != NULL;
+			mcu_layout(&t->rect, i++, n, &room->canvas->size);
+		}
+
+		room->relayout = false;
+	}
+
+	LIST_FOREACH(&room->tilel, le) {
+
+		struct vidisp_st *t = le->data;
+
+		if (!t->changed || !t->visible)
+			continue;
+
+		tile_scale(room, t);
+		t->changed = false;
+	}
+
+	++room->n_frames;
+
+	mtx_unlock(room->mtx);
+}
+
+
+static int compositor_thread(void *arg)
+{
+	struct mcu_room *room = arg;
+	uint64_t ts = tmr_jiffies_usec();
+
+	while (re_atomic_rlx(&room->run)) {
+
+		struct le *le;
+
+		if (tmr_jiffies_usec() < ts) {
+			sys_msleep(2);
+			continue;
+		}
+
+		ts += (uint64_t)(VIDEO_TIMEBASE / room->fps);
+
+		mtx_lock(room->src_mtx);
+
+		if (!list_isempty(&room->srcl))
+			composite(room);
+
+		LIST_FOREACH(&room->srcl, le) {
+
+			struct vidsrc_st *st = le->data;
+
+			st->frameh(room->canvas, ts, st->arg);
+		}
+
+		mtx_unlock(room->src_mtx);
+	}
+
+	return 0;
+}
+
+
+static void room_destructor(void *arg)
+{
+	struct mcu_room *room = arg;
+
+	if (re_atomic_rlx(&room->run)) {
+		re_atomic_rlx_set(&room->run, false);
+		thrd_join(room->thread, NULL);
+	}
+
+	list_unlink(&room->le);
+
+	mem_deref(room->canvas);
+	mem_deref(room->device);
+	mem_deref(room->mtx);
+	mem_deref(room->src_mtx);
+}
+
+
+static struct mcu_room *room_find(const char *device)
+{
+	struct le *le;
+
+	LIST_FOREACH(&rooml, le) {
+
+		struct mcu_room *room = le->data;
+
+		if (0 == str_cmp(room->device, device))
+			return room;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Get a referenced room by device name, allocate it if not found. The
+ * canvas has the configured video size and frame rate.
+ *
+ * @param roomp Pointer to referenced room
+ * @param device Device name
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int mcu_room_get(struct mcu_room **roomp, const char *device)
+{
+	const struct config_video *cfg = &conf_config()->video;
+	struct mcu_room *room;
+	struct vidsz size;
+	int err;
+
+	if (!roomp)
+		return EINVAL;
+
+	room = room_find(device);
+	if (room) {
+		*roomp = mem_ref(room);
+		return 0;
+	}
+
+	room = mem_zalloc(sizeof(*room), room_destructor);
+	if (!room)
+		return ENOMEM;
+
+	size.w = cfg->width & ~1u;
+	size.h = cfg->height & ~1u;
+	room->fps = cfg->fps > 0 ? cfg->fps : 25;
+
+	err  = str_dup(&room->device, device ? device : "");
+	err |= mutex_alloc(&room->mtx);
+	err |= mutex_alloc(&room->src_mtx);
+	if (err)
+		goto out;
+
+	err = vidframe_alloc(&room->canvas, VID_FMT_YUV420P, &size);
+	if (err)
+		goto out;
+
+	vidframe_fill(room->canvas, 0, 0, 0);
+
+	list_append(&rooml, &room->le, room);
+
+	re_atomic_rlx_set(&room->run, true);
+	err = thread_create_name(&room->thread, "mcu", compositor_thread,
+				 room);
+	if (err) {
+		re_atomic_rlx_set(&room->run, false);
+		goto out;
+	}
+
+	info("mcu: room '%s' %u x %u, %.2f fps (%s)\n", room->device,
+	     size.w, size.h, room->fps, mcu_simd_name());
+
+ out:
+	if (err)
+		mem_deref(room);
+	else
+		*roomp = room;
+
+	return err;
+}
+
+
+/**
+ * Print the rooms and statistics
+ *
+ * @param pf Print function
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int mcu_room_debug(struct re_printf *pf)
+{
+	struct le *le;
+	int err = 0;
+
+	LIST_FOREACH(&rooml, le) {
+
+		const struct mcu_room *room = le->data;
+
+		err |= re_hprintf(pf, "room '%s' %u x %u, %.2f fps:"
+				  " %u tiles, %u sources,"
+				  " frames=%llu scaled=%llu\n",
+				  room->device, room->canvas->size.w,
+				  room->canvas->size.h, room->fps,
+				  list_count(&room->tilel),
+				  list_count(&room->srcl),
+				  room->n_frames, room->n_scaled);
+	}
+
+	return err;
+}
+
+
+static void disp_destructor(void *arg)
+{
+	struct vidisp_st *st = arg;
+
+	mtx_lock(st->room->mtx);
+	list_unlink(&st->le);
+	st->room->relayout = true;
+	mtx_unlock(st->room->mtx);
+
+	mem_deref(st->frame);
+	mem_deref(st->sc);
+	mem_deref(st->room);
+}
+
+
+int mcu_disp_alloc(struct vidisp_st **stp, const struct vidisp *vd,
+		   struct vidisp_prm *prm, const char *dev,
+		   vidisp_resize_h *resizeh, void *arg)
+{
+	struct mcu_room *room;
+	struct vidisp_st *st;
+	int err;
+	(void)prm;
+	(void)resizeh;
+	(void)arg;
+
+	if (!stp || !vd)
+		return EINVAL;
+
+	err = mcu_room_get(&room, dev);
+	if (err)
+		return err;
+
+	st = mem_zalloc(sizeof(*st), disp_destructor);
+	if (!st) {
+		mem_deref(room);
+		return ENOMEM;
+	}
+
+	st->room = room;
+
+	mtx_lock(room->mtx);
+	list_append(&room->tilel, &st->le, st);
+	room->relayout = true;
+	mtx_unlock(room->mtx);
+
+	*stp = st;
+
+	return 0;
+}
+
+
+int mcu_disp_display(struct vidisp_st *st, const char *title,
+		     const struct vidframe *frame, uint64_t timestamp)
+{
+	int err = 0;
+	(void)title;
+	(void)timestamp;
+
+	if (!st || !frame)
+		return EINVAL;
+
+	if (frame->size.w < 2 || frame->size.h < 2)
+		return 0;
+
+	mtx_lock(st->room->mtx);
+
+	if (!st->frame || !vidsz_cmp(&st->frame->size, &frame->size)) {
+
+		st->frame = mem_deref(st->frame);
+
+		err = vidframe_alloc(&st->frame, VID_FMT_YUV420P,
+				     &frame->size);
+		if (err)
+			goto out;
+	}
+
+	if (frame->fmt == VID_FMT_YUV420P)
+		vidframe_copy(st->frame, frame);
+	else
+		vidconv(st->frame, frame, NULL);
+
+	st->changed = true;
+
+ out:
+	mtx_unlock(st->room->mtx);
+
+	return err;
+}
+
+
+static void src_destructor(void *arg)
+{
+	struct vidsrc_st *st = arg;
+
+	mtx_lock(st->room->src_mtx);
+	list_unlink(&st->le);
+	mtx_unlock(st->room->src_mtx);
+
+	mem_deref(st->room);
+}
+
+
+int mcu_src_alloc(struct vidsrc_st **stp, const struct vidsrc *vs,
+		  struct vidsrc_prm *prm,
+		  const struct vidsz *size, const char *fmt,
+		  const char *dev, vidsrc_frame_h *frameh,
+		  vidsrc_packet_h *packeth,
+		  vidsrc_error_h *errorh, void *arg)
+{
+	struct mcu_room *room;
+	struct vidsrc_st *st;
+	int err;
+	(void)vs;
+	(void)size;
+	(void)fmt;
+	(void)packeth;
+	(void)errorh;
+
+	if (!stp || !prm || !frameh)
+		return EINVAL;
+
+	err = mcu_room_get(&room, dev);
+	if (err)
+		return err;
+
+	st = mem_zalloc(sizeof(*st), src_destructor);
+	if (!st) {
+		mem_deref(room);
+		return ENOMEM;
+	}
+
+	st->room   = room;
+	st->frameh = frameh;
+	st->arg    = arg;
+
+	mtx_lock(room->src_mtx);
+	list_append(&room->srcl, &st->le, st);
+	mtx_unlock(room->src_mtx);
+
+	*stp = st;
+
+	return 0;
+}
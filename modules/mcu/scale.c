@@ -0,0 +1,548 @@
+/**
+ * @file mcu/scale.c Tiled video compositor -- YUV420P scaling
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "mcu.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define MCU_SIMD "sse2"
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MCU_SIMD "neon"
+#else
+#define MCU_SIMD "c"
+#endif
+
+
+/*
+ * A source is first halved with a 2x2 box filter as long as it is at
+ * least twice the size of the tile, which avoids aliasing on large
+ * downscales and is cheap. The remaining step is bilinear, in a
+ * vertical pass over whole rows and a horizontal pass with precomputed
+ * indices and weights. The row kernels use SSE2 or NEON when available.
+ *
+ * All sizes and tile positions are even, so that the chroma planes are
+ * exactly half of the luma plane.
+ */
+
+
+enum {
+	HALVE_MAX = 4,
+};
+
+
+/** Bilinear mapping of one plane, weights in 1/256 */
+struct plane_map {
+	unsigned sw, sh;      /**< Source size      */
+	unsigned dw, dh;      /**< Destination size */
+	uint32_t *xv;         /**< Source column    */
+	uint16_t *fxv;        /**< Column weight    */
+	uint32_t *yv;         /**< Source row       */
+	uint16_t *fyv;        /**< Row weight       */
+};
+
+/** Scaler from one source size to one tile size */
+struct mcu_scaler {
+	struct vidsz src;
+	struct vidsz dst;
+	struct vidframe *halfv[HALVE_MAX];  /**< Intermediate frames  */
+	unsigned halvc;                     /**< Number of halvings   */
+	bool bilinear;                      /**< Final bilinear step  */
+	struct plane_map mapv[2];           /**< Luma and chroma      */
+	uint8_t *row;                       /**< Vertical pass output */
+};
+
+
+/* C kernels, also the reference for the SIMD kernels */
+static void blend_row_c(uint8_t *dst, const uint8_t *r0, const uint8_t *r1,
+			unsigned w, unsigned f)
+{
+	for (unsigned x = 0; x < w; x++)
+		dst[x] = (uint8_t)((r0[x] * (256 - f) + r1[x] * f + 128) >> 8);
+}
+
+
+/* 2x2 box filter of two source rows into one row of width w */
+static void halve_row_c(uint8_t *dst, const uint8_t *r0, const uint8_t *r1,
+			unsigned w)
+{
+	for (unsigned x = 0; x < w; x++) {
+		dst[x] = (uint8_t)((r0[2*x] + r0[2*x + 1] +
+				    r1[2*x] + r1[2*x + 1] + 2) >> 2);
+	}
+}
+
+
+static void blend_row(uint8_t *dst, const uint8_t *r0, const uint8_t *r1,
+		      unsigned w, unsigned f)
+{
+	unsigned x = 0;
+
+	if (!f) {
+		memcpy(dst, r0, w);
+		return;
+	}
+
+#if defined(__SSE2__)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i w0   = _mm_set1_epi16((short)(256 - f));
+		const __m128i w1   = _mm_set1_epi16((short)f);
+		const __m128i rnd  = _mm_set1_epi16(128);
+
+		for (; x + 16 <= w; x += 16) {
+
+			__m128i a = _mm_loadu_si128((const __m128i *)&r0[x]);
+			__m128i b = _mm_loadu_si128((const __m128i *)&r1[x]);
+			__m128i al = _mm_unpacklo_epi8(a, zero);
+			__m128i ah = _mm_unpackhi_epi8(a, zero);
+			__m128i bl = _mm_unpacklo_epi8(b, zero);
+			__m128i bh = _mm_unpackhi_epi8(b, zero);
+			__m128i lo, hi;
+
+			lo = _mm_add_epi16(_mm_mullo_epi16(al, w0),
+					   _mm_mullo_epi16(bl, w1));
+			hi = _mm_add_epi16(_mm_mullo_epi16(ah, w0),
+					   _mm_mullo_epi16(bh, w1));
+
+			lo = _mm_srli_epi16(_mm_add_epi16(lo, rnd), 8);
+			hi = _mm_srli_epi16(_mm_add_epi16(hi, rnd), 8);
+
+			_mm_storeu_si128((__m128i *)&dst[x],
+					 _mm_packus_epi16(lo, hi));
+		}
+	}
+#elif defined(__ARM_NEON)
+	{
+		const uint8x8_t w0 = vdup_n_u8((uint8_t)(256 - f));
+		const uint8x8_t w1 = vdup_n_u8((uint8_t)f);
+
+		for (; x + 16 <= w; x += 16) {
+
+			uint8x16_t a = vld1q_u8(&r0[x]);
+			uint8x16_t b = vld1q_u8(&r1[x]);
+			uint16x8_t lo, hi;
+
+			lo = vmull_u8(vget_low_u8(a), w0);
+			lo = vmlal_u8(lo, vget_low_u8(b), w1);
+			hi = vmull_u8(vget_high_u8(a), w0);
+			hi = vmlal_u8(hi, vget_high_u8(b), w1);
+
+			vst1q_u8(&dst[x], vcombine_u8(vrshrn_n_u16(lo, 8),
+						      vrshrn_n_u16(hi, 8)));
+		}
+	}
+#endif
+
+	blend_row_c(dst + x, r0 + x, r1 + x, w - x, f);
+}
+
+
+#if defined(__SSE2__)
+/* sum of the horizontal byte pairs of a and b, 16 bit */
+static inline __m128i pair_sum(__m128i a, __m128i b)
+{
+	const __m128i mask = _mm_set1_epi16(0x00ff);
+
+	return _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a, mask),
+					   _mm_srli_epi16(a, 8)),
+			     _mm_add_epi16(_mm_and_si128(b, mask),
+					   _mm_srli_epi16(b, 8)));
+}
+#endif
+
+
+/* same result as halve_row_c() */
+static void halve_row(uint8_t *dst, const uint8_t *r0, const uint8_t *r1,
+		      unsigned w)
+{
+	unsigned x = 0;
+
+#if defined(__SSE2__)
+	{
+		const __m128i rnd = _mm_set1_epi16(2);
+
+		for (; x + 16 <= w; x += 16) {
+
+			__m128i a0 = _mm_loadu_si128((const __m128i *)
+						     &r0[2*x]);
+			__m128i a1 = _mm_loadu_si128((const __m128i *)
+						     &r0[2*x + 16]);
+			__m128i b0 = _mm_loadu_si128((const __m128i *)
+						     &r1[2*x]);
+			__m128i b1 = _mm_loadu_si128((const __m128i *)
+						     &r1[2*x + 16]);
+			__m128i v0 = pair_sum(a0, b0);
+			__m128i v1 = pair_sum(a1, b1);
+
+			v0 = _mm_srli_epi16(_mm_add_epi16(v0, rnd), 2);
+			v1 = _mm_srli_epi16(_mm_add_epi16(v1, rnd), 2);
+
+			_mm_storeu_si128((__m128i *)&dst[x],
+					 _mm_packus_epi16(v0, v1));
+		}
+	}
+#elif defined(__ARM_NEON)
+	for (; x + 16 <= w; x += 16) {
+
+		uint8x16x2_t a = vld2q_u8(&r0[2*x]);
+		uint8x16x2_t b = vld2q_u8(&r1[2*x]);
+		uint16x8_t lo, hi;
+
+		lo = vaddl_u8(vget_low_u8(a.val[0]), vget_low_u8(a.val[1]));
+		lo = vaddw_u8(lo, vget_low_u8(b.val[0]));
+		lo = vaddw_u8(lo, vget_low_u8(b.val[1]));
+		hi = vaddl_u8(vget_high_u8(a.val[0]), vget_high_u8(a.val[1]));
+		hi = vaddw_u8(hi, vget_high_u8(b.val[0]));
+		hi = vaddw_u8(hi, vget_high_u8(b.val[1]));
+
+		vst1q_u8(&dst[x], vcombine_u8(vrshrn_n_u16(lo, 2),
+					      vrshrn_n_u16(hi, 2)));
+	}
+#endif
+
+	halve_row_c(dst + x, r0 + 2*x, r1 + 2*x, w - x);
+}
+
+
+static void plane_halve(uint8_t *dst, unsigned dls,
+			const uint8_t *src, unsigned sls,
+			unsigned dw, unsigned dh)
+{
+	for (unsigned y = 0; y < dh; y++) {
+
+		const uint8_t *r0 = src + 2*y * sls;
+
+		halve_row(dst + y * dls, r0, r0 + sls, dw);
+	}
+}
+
+
+static void plane_copy(uint8_t *dst, unsigned dls,
+		       const uint8_t *src, unsigned sls,
+		       unsigned w, unsigned h)
+{
+	for (unsigned y = 0; y < h; y++)
+		memcpy(dst + y * dls, src + y * sls, w);
+}
+
+
+static void plane_bilinear(const struct plane_map *pm, uint8_t *row,
+			   uint8_t *dst, unsigned dls,
+			   const uint8_t *src, unsigned sls)
+{
+	for (unsigned y = 0; y < pm->dh; y++) {
+
+		const uint8_t *r0 = src + pm->yv[y] * sls;
+		const uint8_t *r1 = r0 + (pm->yv[y] + 1 < pm->sh ? sls : 0);
+		uint8_t *d = dst + y * dls;
+
+		blend_row(row, r0, r1, pm->sw, pm->fyv[y]);
+		row[pm->sw] = row[pm->sw - 1];
+
+		for (unsigned x = 0; x < pm->dw; x++) {
+
+			const uint8_t *p = &row[pm->xv[x]];
+			unsigned f = pm->fxv[x];
+
+			d[x] = (uint8_t)((p[0] * (256 - f) + p[1] * f + 128)
+					 >> 8);
+		}
+	}
+}
+
+
+/* center aligned source positions in 16.16 fixed point */
+static void map_axis(uint32_t *iv, uint16_t *fv, unsigned sn, unsigned dn)
+{
+	for (unsigned i = 0; i < dn; i++) {
+
+		int64_t pos = ((2 * (int64_t)i + 1) * sn << 16) / (2 * dn)
+			- 0x8000;
+
+		if (pos < 0)
+			pos = 0;
+
+		iv[i] = (uint32_t)(pos >> 16);
+		fv[i] = (uint16_t)((pos >> 8) & 0xff);
+
+		if (iv[i] >= sn - 1) {
+			iv[i] = sn - 1;
+			fv[i] = 0;
+		}
+	}
+}
+
+
+static void map_reset(struct plane_map *pm)
+{
+	mem_deref(pm->xv);
+	mem_deref(pm->fxv);
+	mem_deref(pm->yv);
+	mem_deref(pm->fyv);
+}
+
+
+static int map_init(struct plane_map *pm, unsigned sw, unsigned sh,
+		    unsigned dw, unsigned dh)
+{
+	pm->sw = sw;
+	pm->sh = sh;
+	pm->dw = dw;
+	pm->dh = dh;
+
+	pm->xv  = mem_alloc(dw * sizeof(*pm->xv), NULL);
+	pm->fxv = mem_alloc(dw * sizeof(*pm->fxv), NULL);
+	pm->yv  = mem_alloc(dh * sizeof(*pm->yv), NULL);
+	pm->fyv = mem_alloc(dh * sizeof(*pm->fyv), NULL);
+	if (!pm->xv || !pm->fxv || !pm->yv || !pm->fyv)
+		return ENOMEM;
+
+	map_axis(pm->xv, pm->fxv, sw, dw);
+	map_axis(pm->yv, pm->fyv, sh, dh);
+
+	return 0;
+}
+
+
+static void destructor(void *arg)
+{
+	struct mcu_scaler *sc = arg;
+
+	for (unsigned i = 0; i < HALVE_MAX; i++)
+		mem_deref(sc->halfv[i]);
+
+	map_reset(&sc->mapv[0]);
+	map_reset(&sc->mapv[1]);
+	mem_deref(sc->row);
+}
+
+
+/**
+ * Allocate a scaler for YUV420P frames
+ *
+ * @param scp Pointer to allocated scaler
+ * @param src Source size
+ * @param dst Destination size, even
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int mcu_scaler_alloc(struct mcu_scaler **scp, const struct vidsz *src,
+		     const struct vidsz *dst)
+{
+	struct mcu_scaler *sc;
+	struct vidsz cur;
+	int err = 0;
+
+	if (!scp || !src || !dst || src->w < 2 || src->h < 2 ||
+	    !dst->w || !dst->h || (dst->w & 1) || (dst->h & 1))
+		return EINVAL;
+
+	sc = mem_zalloc(sizeof(*sc), destructor);
+	if (!sc)
+		return ENOMEM;
+
+	sc->src = *src;
+	sc->dst = *dst;
+
+	cur.w = src->w & ~1u;
+	cur.h = src->h & ~1u;
+
+	while (sc->halvc < HALVE_MAX &&
+	       cur.w >= 2 * dst->w && cur.h >= 2 * dst->h) {
+
+		cur.w = (cur.w / 2) & ~1u;
+		cur.h = (cur.h / 2) & ~1u;
+
+		/* the last halving writes into the tile */
+		if (vidsz_cmp(&cur, dst)) {
+			++sc->halvc;
+			break;
+		}
+
+		err = vidframe_alloc(&sc->halfv[sc->halvc], VID_FMT_YUV420P,
+				     &cur);
+		if (err)
+			goto out;
+
+		++sc->halvc;
+	}
+
+	if (vidsz_cmp(&cur, dst))
+		goto out;
+
+	sc->bilinear = true;
+
+	err  = map_init(&sc->mapv[0], cur.w, cur.h, dst->w, dst->h);
+	err |= map_init(&sc->mapv[1], cur.w / 2, cur.h / 2,
+			dst->w / 2, dst->h / 2);
+	if (err)
+		goto out;
+
+	sc->row = mem_alloc(cur.w + 1, NULL);
+	if (!sc->row)
+		err = ENOMEM;
+
+ out:
+	if (err)
+		mem_deref(sc);
+	else
+		*scp = sc;
+
+	return err;
+}
+
+
+/**
+ * Check if a scaler converts between the given sizes
+ *
+ * @param sc  Scaler
+ * @param src Source size
+ * @param dst Destination size
+ *
+ * @return True if match, otherwise false
+ */
+bool mcu_scaler_match(const struct mcu_scaler *sc, const struct vidsz *src,
+		      const struct vidsz *dst)
+{
+	if (!sc)
+		return false;
+
+	return vidsz_cmp(&sc->src, src) && vidsz_cmp(&sc->dst, dst);
+}
+
+
+/**
+ * Scale a YUV420P frame into a rectangle of a YUV420P frame
+ *
+ * @param sc   Scaler
+ * @param dst  Destination frame
+ * @param rect Destination rectangle, even position and scaler size
+ * @param src  Source frame
+ */
+void mcu_scaler_apply(struct mcu_scaler *sc, struct vidframe *dst,
+		      const struct vidrect *rect, const struct vidframe *src)
+{
+	const uint8_t *sv[3];
+	unsigned slv[3];
+	uint8_t *dv[3];
+	unsigned w, h;
+	int i;
+
+	if (!sc || !dst || !rect || !src)
+		return;
+
+	for (i = 0; i < 3; i++) {
+
+		unsigned sh = i ? 1 : 0;
+
+		sv[i]  = src->data[i];
+		slv[i] = src->linesize[i];
+		dv[i]  = dst->data[i] + (rect->y >> sh) * dst->linesize[i]
+			+ (rect->x >> sh);
+	}
+
+	w = sc->src.w & ~1u;
+	h = sc->src.h & ~1u;
+
+	for (unsigned s = 0; s < sc->halvc; s++) {
+
+		struct vidframe *hf = sc->halfv[s];
+		bool last = !hf;
+
+		w = (w / 2) & ~1u;
+		h = (h / 2) & ~1u;
+
+		for (i = 0; i < 3; i++) {
+
+			unsigned sh = i ? 1 : 0;
+			uint8_t *d = last ? dv[i] : hf->data[i];
+			unsigned dls = last ? dst->linesize[i]
+				: hf->linesize[i];
+
+			plane_halve(d, dls, sv[i], slv[i], w >> sh, h >> sh);
+
+			sv[i]  = d;
+			slv[i] = dls;
+		}
+
+		if (last)
+			return;
+	}
+
+	for (i = 0; i < 3; i++) {
+
+		const struct plane_map *pm = &sc->mapv[i ? 1 : 0];
+
+		if (sc->bilinear) {
+			plane_bilinear(pm, sc->row, dv[i], dst->linesize[i],
+				       sv[i], slv[i]);
+		}
+		else {
+			unsigned sh = i ? 1 : 0;
+
+			plane_copy(dv[i], dst->linesize[i], sv[i], slv[i],
+				   sc->dst.w >> sh, sc->dst.h >> sh);
+		}
+	}
+}
+
+
+/**
+ * Compare the scaling kernels with the C kernels, for all row widths
+ * up to a few SIMD blocks and random rows with saturated samples
+ *
+ * @return 0 if the results are identical, otherwise errorcode
+ */
+int mcu_scale_selftest(void)
+{
+	enum { W = 70 };
+	static const unsigned fv[] = {0, 1, 127, 128, 255};
+	uint8_t r0[2*W], r1[2*W], a[W], b[W];
+
+	for (unsigned i = 0; i < 2*W; i++) {
+		r0[i] = i % 7 ? (uint8_t)rand_u32() : 255;
+		r1[i] = i % 5 ? (uint8_t)rand_u32() : 255;
+	}
+
+	for (unsigned w = 1; w <= W; w++) {
+
+		halve_row(a, r0, r1, w);
+		halve_row_c(b, r0, r1, w);
+		if (memcmp(a, b, w)) {
+			warning("mcu: %s halve_row differs (w=%u)\n",
+				MCU_SIMD, w);
+			return EBADMSG;
+		}
+
+		for (size_t i = 0; i < RE_ARRAY_SIZE(fv); i++) {
+
+			blend_row(a, r0, r1, w, fv[i]);
+			blend_row_c(b, r0, r1, w, fv[i]);
+			if (memcmp(a, b, w)) {
+				warning("mcu: %s blend_row differs"
+					" (w=%u f=%u)\n", MCU_SIMD, w, fv[i]);
+				return EBADMSG;
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * Get the instruction set of the scaling kernels
+ *
+ * @return Name of instruction set
+ */
+const char *mcu_simd_name(void)
+{
+	return MCU_SIMD;
+}
@@ -12,10 +12,9 @@
 
 enum {
 	MAX_SRATE       = 48000,  /* Maximum sample rate in [Hz] */
-	MAX_CHANNELS    =     2,  /* Maximum number of channels  */
 	MAX_PTIME       =    60,  /* Maximum packet time in [ms] */
 
-	AUDIO_SAMPSZ    = MAX_SRATE * MAX_CHANNELS * MAX_PTIME / 1000
+	AUDIO_SAMPSZ    = MAX_SRATE * MAX_PTIME / 1000  /* per channel */
 };
 
 struct mix {
@@ -34,6 +33,7 @@ struct mixminus_enc {
 	int16_t *sampv;
 	int16_t *rsampv;
 	int16_t *fsampv;
+	size_t sampc;
 	struct auresamp resamp;
 	struct aufilt_prm prm;
 	struct le le_priv;
@@ -118,7 +118,9 @@ static int encode_update(struct aufilt_enc_st **stp, void **ctx,
 	if (!st)
 		return ENOMEM;
 
-	psize = AUDIO_SAMPSZ * sizeof(int16_t);
+	/* mono frames may be mixed with stereo frames */
+	st->sampc = AUDIO_SAMPSZ * max(prm->ch, 2);
+	psize = st->sampc * sizeof(int16_t);
 
 	st->sampv = mem_zalloc(psize, NULL);
 	if (!st->sampv)
@@ -208,7 +210,7 @@ static int decode_update(struct aufilt_dec_st **stp, void **ctx,
 	if (!st)
 		return ENOMEM;
 
-	psize = AUDIO_SAMPSZ * sizeof(int16_t);
+	psize = AUDIO_SAMPSZ * prm->ch * sizeof(int16_t);
 
 	st->fsampv = mem_zalloc(psize, NULL);
 	if (!st->fsampv)
@@ -284,7 +286,7 @@ static int encode(struct aufilt_enc_st *aufilt_enc_st, struct auframe *af)
 		}
 
 		if (enc->resamp.resample) {
-			outc = AUDIO_SAMPSZ;
+			outc = enc->sampc;
 			sampv_mix = enc->rsampv;
 
 			if (enc->prm.srate > mix->prm.srate) {
@@ -20,7 +20,7 @@ static int print_handler(const char *p, size_t size, void *arg)
 
 static void handle_command(struct mqtt *mqtt, const struct pl *msg)
 {
-	struct mbuf *resp = mbuf_alloc(2048);
+	struct mbuf *resp = mempool_mbuf(2048);
 	struct re_printf pf = {print_handler, resp};
 	struct odict *od = NULL, *od_resp = NULL;
 	char *cmd_buf = NULL;
@@ -28,6 +28,9 @@
   opus_dtx        {yes,no}   # Enable Discontinuous Transmission (DTX)
   opus_complexity {0-10}     # Encoder's computational complexity (10 max)
   opus_application {audio, voip} # Encoder's intended application
+  opus_ms_channels       6   # Total channels (1-255)
+  opus_ms_streams        4   # Streams, default from channels (1-8)
+  opus_ms_c_streams      2   # Coupled streams, default from channels
  \endverbatim
  *
  * References:
@@ -50,6 +53,14 @@ static uint32_t opus_ms_channels = 6;
 uint32_t opus_ms_streams = 4;
 uint32_t opus_ms_c_streams = 2;
 
+/* Streams and coupled streams per number of channels */
+static const struct {
+	uint8_t streams;
+	uint8_t coupled;
+} layoutv[] = {
+	{1, 0}, {1, 1}, {2, 1}, {2, 2}, {3, 2}, {4, 2}, {5, 2}, {5, 3}
+};
+
 
 static int opus_multistream_fmtp_enc(struct mbuf *mb,
 				     const struct sdp_format *fmt,
@@ -180,11 +191,32 @@ static int module_init(void)
 
 	(void)conf_get_u32(conf, "opus_ms_channels", &opus_ms_channels);
 
+	if (!opus_ms_channels || opus_ms_channels > 255) {
+		warning("opus_multistream: invalid channels (%u)\n",
+			opus_ms_channels);
+		return EINVAL;
+	}
+
 	opus_multistream.ch = opus_ms_channels;
 
+	/* default streams of the Vorbis channel order (RFC 7845) */
+	if (opus_ms_channels <= RE_ARRAY_SIZE(layoutv)) {
+		opus_ms_streams   = layoutv[opus_ms_channels - 1].streams;
+		opus_ms_c_streams = layoutv[opus_ms_channels - 1].coupled;
+	}
+
 	(void)conf_get_u32(conf, "opus_ms_streams", &opus_ms_streams);
 	(void)conf_get_u32(conf, "opus_ms_c_streams", &opus_ms_c_streams);
 
+	if (opus_ms_c_streams > opus_ms_streams ||
+	    opus_ms_streams + opus_ms_c_streams > 255 ||
+	    opus_ms_streams + opus_ms_c_streams < opus_ms_channels) {
+		warning("opus_multistream: %u streams with %u coupled"
+			" do not carry %u channels\n", opus_ms_streams,
+			opus_ms_c_streams, opus_ms_channels);
+		return EINVAL;
+	}
+
 	debug("opus_multistream: fmtp=\"%s\"\n", fmtp);
 
 	aucodec_register(baresip_aucodecl(), &opus_multistream);
@@ -7,6 +7,14 @@
 int  subscriber_init(void);
 void subscriber_close(void);
 void subscriber_close_all(void);
+uint64_t subscriber_jitter(uint64_t ms);
+
+
+typedef void (rls_part_h)(const struct pl *entity, const struct pl *pidf,
+			  void *arg);
+
+int  rls_decode(const struct pl *ctype_prm, const struct mbuf *mb,
+		rls_part_h *parth, void *arg);
 
 
 int  notifier_init(void);
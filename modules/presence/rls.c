@@ -0,0 +1,204 @@
+/**
+ * @file rls.c Resource list NOTIFY decoding (RFC 4662)
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "presence.h"
+
+
+/*
+ * A resource list NOTIFY carries a multipart/related body, with one
+ * application/rlmi+xml part and one application/pidf+xml part for each
+ * resource (RFC 2046 multipart syntax). Only the PIDF parts are used,
+ * the body is parsed in place and never beyond the message end.
+ */
+
+
+enum {
+	BOUNDARY_MAXLEN = 70,  /**< RFC 2046 */
+};
+
+
+/* Get the next line from rest, without the line ending */
+static bool line_next(struct pl *line, struct pl *rest)
+{
+	const char *nl;
+
+	if (!pl_isset(rest))
+		return false;
+
+	nl = pl_strchr(rest, '\n');
+
+	line->p = rest->p;
+	line->l = nl ? (size_t)(nl - rest->p) : rest->l;
+
+	pl_advance(rest, nl ? line->l + 1 : line->l);
+
+	if (line->l && line->p[line->l - 1] == '\r')
+		--line->l;
+
+	return true;
+}
+
+
+/* The boundary parameter, quoted or as a token */
+static int boundary_decode(struct pl *bnd, const struct pl *params)
+{
+	struct pl val, rest;
+	const char *q;
+	int err;
+
+	err = msg_param_decode(params, "boundary", &val);
+	if (err)
+		return err;
+
+	if (val.p[0] == '"') {
+
+		/* a quoted boundary may contain spaces */
+		rest.p = val.p + 1;
+		rest.l = params->l - (rest.p - params->p);
+
+		q = pl_strchr(&rest, '"');
+		if (!q)
+			return EBADMSG;
+
+		bnd->p = rest.p;
+		bnd->l = q - rest.p;
+	}
+	else {
+		*bnd = val;
+	}
+
+	if (!bnd->l || bnd->l > BOUNDARY_MAXLEN)
+		return EBADMSG;
+
+	return 0;
+}
+
+
+/* "--boundary" or the close delimiter "--boundary--" */
+static bool is_delim(const struct pl *line, const struct pl *bnd,
+		     bool *closep)
+{
+	struct pl pl = *line;
+	bool close = false;
+
+	if (pl.l < bnd->l + 2 || pl.p[0] != '-' || pl.p[1] != '-')
+		return false;
+
+	pl_advance(&pl, 2);
+
+	if (memcmp(pl.p, bnd->p, bnd->l))
+		return false;
+
+	pl_advance(&pl, bnd->l);
+
+	if (pl.l >= 2 && pl.p[0] == '-' && pl.p[1] == '-') {
+		close = true;
+		pl_advance(&pl, 2);
+	}
+
+	/* transport padding */
+	while (pl.l && (pl.p[0] == ' ' || pl.p[0] == '\t'))
+		pl_advance(&pl, 1);
+
+	if (pl.l)
+		return false;
+
+	*closep = close;
+
+	return true;
+}
+
+
+static void part_decode(const struct pl *part, rls_part_h *parth, void *arg)
+{
+	struct pl rest = *part, line, name, val, ent;
+	bool pidf = false;
+
+	/* part headers, up to the first empty line */
+	while (line_next(&line, &rest) && line.l) {
+
+		if (re_regex(line.p, line.l,
+			     "[^: \t]+[ \t]*:[ \t]*[^ \t;]+",
+			     &name, NULL, NULL, &val))
+			continue;
+
+		if (0 != pl_strcasecmp(&name, "Content-Type"))
+			continue;
+
+		pidf = 0 == pl_strcasecmp(&val, "application/pidf+xml");
+	}
+
+	if (!pidf)
+		return;
+
+	if (re_regex(rest.p, rest.l, "<presence[^>]+entity=\"[^\"]+\"",
+		     NULL, &ent)) {
+		debug("presence: rls: PIDF part without entity\n");
+		return;
+	}
+
+	parth(&ent, &rest, arg);
+}
+
+
+/**
+ * Decode a multipart/related resource list notification
+ *
+ * @param ctype_prm Content-Type parameters, with the boundary
+ * @param mb        Message body
+ * @param parth     Handler called for each PIDF part
+ * @param arg       Handler argument
+ *
+ * @return 0 if success, EBADMSG if the close delimiter is missing,
+ *         otherwise errorcode
+ */
+int rls_decode(const struct pl *ctype_prm, const struct mbuf *mb,
+	       rls_part_h *parth, void *arg)
+{
+	struct pl bnd, body, line, part = PL_INIT;
+	bool inpart = false, close = false;
+	int err;
+
+	if (!ctype_prm || !mb || !parth)
+		return EINVAL;
+
+	err = boundary_decode(&bnd, ctype_prm);
+	if (err)
+		return err;
+
+	body.p = (const char *)mbuf_buf(mb);
+	body.l = mbuf_get_left(mb);
+
+	while (!close) {
+
+		const char *start = body.p;
+
+		if (!line_next(&line, &body))
+			break;
+
+		if (!is_delim(&line, &bnd, &close))
+			continue;
+
+		if (inpart) {
+			/* the line ending before a delimiter belongs to it */
+			part.l = start - part.p;
+
+			if (part.l && part.p[part.l - 1] == '\n')
+				--part.l;
+			if (part.l && part.p[part.l - 1] == '\r')
+				--part.l;
+
+			part_decode(&part, parth, arg);
+		}
+
+		inpart = true;
+		part.p = body.p;
+	}
+
+	return close ? 0 : EBADMSG;
+}
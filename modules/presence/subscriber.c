@@ -14,32 +14,139 @@
  * For each entry in the address book marked with ;presence=p2p,
  * we send a SUBSCRIBE to that person, and expect to receive
  * a NOTIFY when her status changes.
+ *
+ * New SUBSCRIBEs are paced by a single timer, at most presence_sub_rate
+ * per second, and the expiry and retry intervals are jittered so that
+ * refreshes of a large contact list do not happen in lock-step.
+ *
+ * Contacts marked with ;presence=rls are served by one subscription to
+ * the resource list server (RFC 4662) configured with presence_rls,
+ * the multipart/related NOTIFY bodies carry one PIDF part per contact.
  */
 
 
 /** Constants */
 enum {
-	SHUTDOWN_DELAY = 500  /**< Delay before un-registering [ms] */
+	SHUTDOWN_DELAY = 500,  /**< Delay before un-registering [ms]  */
+	START_DELAY    = 1000, /**< Delay before first SUBSCRIBE [ms] */
+	PACE_TICK      = 100,  /**< Pacing timer interval [ms]        */
+	SUB_RATE       = 50,   /**< Default SUBSCRIBEs per second     */
+	SUB_EXPIRES    = 600,  /**< Subscription expiry [s]           */
+	HASH_SIZE      = 256,
 };
 
 
 struct presence {
 	struct le le;
+	struct le he;            /**< Member of presht, by URI        */
+	struct le qe;            /**< Member of pendl while waiting   */
 	struct sipsub *sub;
 	struct tmr tmr;
 	enum presence_status status;
 	unsigned failc;
-	struct contact *contact;
+	struct contact *contact; /**< NULL for the resource list      */
+	char *uri;
 	struct ua *ua;
+	bool rls;                /**< Served by the resource list     */
 	bool shutdown;
 };
 
 static struct list presencel;
+static struct hash *presht;         /**< Presence by URI            */
+static struct list pendl;           /**< Waiting to be subscribed   */
+static struct tmr tmr_pace;
+static uint32_t sub_rate = SUB_RATE;
+static struct presence *rls;        /**< Resource list subscription */
 
 
 static void tmr_handler(void *arg);
 
 
+/**
+ * Spread an interval by +/- 10 percent
+ *
+ * @param ms Interval in [ms]
+ *
+ * @return Interval with jitter in [ms]
+ */
+uint64_t subscriber_jitter(uint64_t ms)
+{
+	return ms - ms / 10 + rand_u32() % (ms / 5 + 1);
+}
+
+
+/* Hash key is the URI without the scheme, sip: and pres: are equal */
+static void uri_key(struct pl *key, const struct pl *uri)
+{
+	if (re_regex(uri->p, uri->l, "[^:]+:[^;>]+", NULL, key))
+		*key = *uri;
+}
+
+
+static uint32_t uri_hash(const struct pl *uri)
+{
+	struct pl key;
+
+	uri_key(&key, uri);
+
+	return hash_joaat_ci(key.p, key.l);
+}
+
+
+static bool uri_cmp_handler(struct le *le, void *arg)
+{
+	const struct presence *pres = le->data;
+	const struct pl *uri = arg;
+	struct pl pl, a, b;
+
+	pl_set_str(&pl, pres->uri);
+	uri_key(&a, &pl);
+	uri_key(&b, uri);
+
+	return 0 == pl_casecmp(&a, &b);
+}
+
+
+static bool contact_cmp_handler(struct le *le, void *arg)
+{
+	const struct presence *pres = le->data;
+
+	return pres->contact == arg;
+}
+
+
+static struct presence *presence_find(const struct pl *uri)
+{
+	struct le *le;
+
+	le = hash_lookup(presht, uri_hash(uri), uri_cmp_handler, (void *)uri);
+
+	return le ? le->data : NULL;
+}
+
+
+static void pace_handler(void *arg);
+
+
+static void enqueue(struct presence *pres, uint64_t delay)
+{
+	if (pres->qe.list)
+		return;
+
+	list_append(&pendl, &pres->qe, pres);
+
+	if (!tmr_isrunning(&tmr_pace))
+		tmr_start(&tmr_pace, delay, pace_handler, NULL);
+}
+
+
+static void retry(struct presence *pres, uint32_t wait)
+{
+	tmr_start(&pres->tmr, subscriber_jitter(wait * 1000ULL),
+		  tmr_handler, pres);
+}
+
+
 static uint32_t wait_term(const struct sipevent_substate *substate)
 {
 	uint32_t wait;
@@ -81,13 +188,68 @@ static uint32_t wait_fail(unsigned failc)
 }
 
 
+static enum presence_status pidf_status(const struct pl *pidf)
+{
+	enum presence_status status = PRESENCE_CLOSED;
+	struct pl pl;
+
+	if (!re_regex(pidf->p, pidf->l,
+		      "<basic[ \t]*>[^<]+</basic[ \t]*>", NULL, &pl, NULL)) {
+	    if (!pl_strcasecmp(&pl, "open"))
+		status = PRESENCE_OPEN;
+	}
+
+	if (!re_regex(pidf->p, pidf->l, "<rpid:away[ \t]*/>", NULL)) {
+
+		status = PRESENCE_CLOSED;
+	}
+	else if (!re_regex(pidf->p, pidf->l, "<rpid:busy[ \t]*/>", NULL)) {
+
+		status = PRESENCE_BUSY;
+	}
+	else if (!re_regex(pidf->p, pidf->l,
+			   "<rpid:on-the-phone[ \t]*/>", NULL)) {
+
+		status = PRESENCE_BUSY;
+	}
+
+	return status;
+}
+
+
+static void rls_part_handler(const struct pl *entity, const struct pl *pidf,
+			     void *arg)
+{
+	struct presence *pres = presence_find(entity);
+	(void)arg;
+
+	if (pres && pres->rls && pres->contact)
+		contact_set_presence(pres->contact, pidf_status(pidf));
+	else
+		debug("presence: rls: unknown entity %r\n", entity);
+}
+
+
+static void rls_set_unknown(void)
+{
+	struct le *le;
+
+	for (le = list_head(&presencel); le; le = le->next) {
+		struct presence *pres = le->data;
+
+		if (pres->rls)
+			contact_set_presence(pres->contact, PRESENCE_UNKNOWN);
+	}
+}
+
+
 static void notify_handler(struct sip *sip, const struct sip_msg *msg,
 			   void *arg)
 {
 	enum presence_status status = PRESENCE_CLOSED;
 	struct presence *pres = arg;
 	const struct sip_hdr *type_hdr, *length_hdr;
-	struct pl pl;
+	struct pl pidf;
 
 	if (pres->shutdown)
 		goto done;
@@ -106,6 +268,18 @@ static void notify_handler(struct sip *sip, const struct sip_msg *msg,
 		}
 	}
 
+	if (!pres->contact && type_hdr &&
+	    msg_ctype_cmp(&msg->ctyp, "multipart", "related")) {
+
+		int err = rls_decode(&msg->ctyp.params, msg->mb,
+				     rls_part_handler, NULL);
+		if (err)
+			warning("presence: rls: could not decode NOTIFY"
+				" (%m)\n", err);
+
+		goto done;
+	}
+
 	if (!type_hdr ||
 	    0 != pl_strcasecmp(&type_hdr->val, "application/pidf+xml")) {
 
@@ -121,34 +295,14 @@ static void notify_handler(struct sip *sip, const struct sip_msg *msg,
 		return;
 	}
 
-	if (!re_regex((const char *)mbuf_buf(msg->mb), mbuf_get_left(msg->mb),
-		      "<basic[ \t]*>[^<]+</basic[ \t]*>", NULL, &pl, NULL)) {
-	    if (!pl_strcasecmp(&pl, "open"))
-		status = PRESENCE_OPEN;
-	}
-
-	if (!re_regex((const char *)mbuf_buf(msg->mb), mbuf_get_left(msg->mb),
-		      "<rpid:away[ \t]*/>", NULL)) {
-
-		status = PRESENCE_CLOSED;
-	}
-	else if (!re_regex((const char *)mbuf_buf(msg->mb),
-			   mbuf_get_left(msg->mb),
-			   "<rpid:busy[ \t]*/>", NULL)) {
-
-		status = PRESENCE_BUSY;
-	}
-	else if (!re_regex((const char *)mbuf_buf(msg->mb),
-			   mbuf_get_left(msg->mb),
-			   "<rpid:on-the-phone[ \t]*/>", NULL)) {
-
-		status = PRESENCE_BUSY;
-	}
+	pl_set_mbuf(&pidf, msg->mb);
+	status = pidf_status(&pidf);
 
 done:
 	(void)sip_treply(NULL, sip, msg, 200, "OK");
 
-	contact_set_presence(pres->contact, status);
+	if (pres->contact)
+		contact_set_presence(pres->contact, status);
 
 	if (pres->shutdown)
 		mem_deref(pres);
@@ -163,8 +317,7 @@ static void close_handler(int err, const struct sip_msg *msg,
 
 	pres->sub = mem_deref(pres->sub);
 
-	info("presence: subscriber closed <%s>: ",
-	     contact_uri(pres->contact));
+	info("presence: subscriber closed <%s>: ", pres->uri);
 
 	if (substate) {
 		info("%s", sipevent_reason_name(substate->reason));
@@ -181,9 +334,12 @@ static void close_handler(int err, const struct sip_msg *msg,
 
 	info("; will retry in %u secs (failc=%u)\n", wait, pres->failc);
 
-	tmr_start(&pres->tmr, wait * 1000, tmr_handler, pres);
+	retry(pres, wait);
 
-	contact_set_presence(pres->contact, PRESENCE_UNKNOWN);
+	if (pres->contact)
+		contact_set_presence(pres->contact, PRESENCE_UNKNOWN);
+	else
+		rls_set_unknown();
 }
 
 
@@ -193,9 +349,15 @@ static void destructor(void *arg)
 
 	debug("presence: subscriber destroyed\n");
 
+	if (pres == rls)
+		rls = NULL;
+
 	list_unlink(&pres->le);
+	hash_unlink(&pres->he);
+	list_unlink(&pres->qe);
 	tmr_cancel(&pres->tmr);
 	mem_deref(pres->contact);
+	mem_deref(pres->uri);
 	mem_deref(pres->sub);
 	mem_deref(pres->ua);
 }
@@ -218,6 +380,7 @@ static int auth_handler(char **username, char **password,
 static int subscribe(struct presence *pres)
 {
 	const char *routev[1];
+	uint32_t expires;
 	struct ua *ua;
 	int err;
 
@@ -233,14 +396,22 @@ static int subscribe(struct presence *pres)
 
 	routev[0] = ua_outbound(ua);
 
+	/* desynchronize the refreshes */
+	expires = (uint32_t)subscriber_jitter(SUB_EXPIRES);
+
 	err = sipevent_subscribe(&pres->sub, uag_sipevent_sock(),
-				 contact_uri(pres->contact), NULL,
+				 pres->uri, NULL,
 				 account_aor(ua_account(ua)),
-				 "presence", NULL, 600,
+				 "presence", NULL, expires,
 				 ua_cuser(ua), routev, routev[0] ? 1 : 0,
 				 auth_handler, ua_account(ua), true, NULL,
 				 notify_handler, close_handler, pres,
-				 "%H", ua_print_supported, ua);
+				 "%H%s", ua_print_supported, ua,
+				 pres->contact ? "" :
+				 "Supported: eventlist\r\n"
+				 "Accept: multipart/related,"
+				 " application/rlmi+xml,"
+				 " application/pidf+xml\r\n");
 	if (err) {
 		warning("presence: sipevent_subscribe failed: %m\n", err);
 	}
@@ -249,20 +420,40 @@ static int subscribe(struct presence *pres)
 }
 
 
+static void pace_handler(void *arg)
+{
+	uint32_t n = max(sub_rate * PACE_TICK / 1000, 1u);
+	(void)arg;
+
+	while (n-- && !list_isempty(&pendl)) {
+
+		struct presence *pres = list_head(&pendl)->data;
+
+		list_unlink(&pres->qe);
+
+		if (subscribe(pres))
+			retry(pres, wait_fail(++pres->failc));
+	}
+
+	if (!list_isempty(&pendl))
+		tmr_start(&tmr_pace, PACE_TICK, pace_handler, NULL);
+}
+
+
 static void tmr_handler(void *arg)
 {
 	struct presence *pres = arg;
 
-	if (subscribe(pres)) {
-		tmr_start(&pres->tmr, wait_fail(++pres->failc) * 1000,
-			  tmr_handler, pres);
-	}
+	enqueue(pres, PACE_TICK);
 }
 
 
-static int presence_alloc(struct contact *contact)
+static int presence_alloc(struct presence **presp, struct contact *contact,
+			  const char *uri, bool list)
 {
 	struct presence *pres;
+	struct pl pl;
+	int err;
 
 	pres = mem_zalloc(sizeof(*pres), destructor);
 	if (!pres)
@@ -270,50 +461,84 @@ static int presence_alloc(struct contact *contact)
 
 	pres->status  = PRESENCE_UNKNOWN;
 	pres->contact = mem_ref(contact);
+	pres->rls     = list;
+
+	err = str_dup(&pres->uri, uri);
+	if (err) {
+		mem_deref(pres);
+		return err;
+	}
 
 	tmr_init(&pres->tmr);
-	tmr_start(&pres->tmr, 1000, tmr_handler, pres);
 
+	pl_set_str(&pl, pres->uri);
+	hash_append(presht, uri_hash(&pl), &pres->he, pres);
 	list_append(&presencel, &pres->le, pres);
 
+	/* resource list members are not subscribed individually */
+	if (!list)
+		enqueue(pres, START_DELAY);
+
+	if (presp)
+		*presp = pres;
+
 	return 0;
 }
 
 
+static int contact_presence(struct contact *contact, bool *listp)
+{
+	struct sip_addr *addr = contact_addr(contact);
+	struct pl val;
+
+	if (msg_param_decode(&addr->params, "presence", &val))
+		return ENOENT;
+
+	if (0 == pl_strcasecmp(&val, "p2p")) {
+		*listp = false;
+		return 0;
+	}
+
+	if (0 == pl_strcasecmp(&val, "rls")) {
+		*listp = true;
+		return 0;
+	}
+
+	return ENOENT;
+}
+
+
 static void contact_handler(struct contact *contact,
 				bool removed, void *arg)
 {
+	struct presence *pres;
 	struct le *le;
-	struct pl val;
-	struct presence *pres = NULL;
-	struct sip_addr *addr = contact_addr(contact);
+	struct pl uri;
+	bool list;
 	(void)arg;
 
-	if (0 == msg_param_decode(&addr->params, "presence", &val) &&
-				0 == pl_strcasecmp(&val, "p2p")) {
-		if (!removed) {
-			if (presence_alloc(contact) != 0) {
-				warning("presence: presence_alloc failed\n");
-				return;
-			}
-		}
-		else {
-			/* Find matching presence element for contact */
-			for (le = list_head(&presencel); le; le = le->next) {
-				pres = (struct presence*)le->data;
-				if (pres->contact == contact) {
-					break;
-				}
-				pres = NULL;
-			}
-
-			if (pres) {
-				mem_deref(pres);
-			}
-			else {
-				warning("presence: No contact to remove\n");
-			}
+	if (contact_presence(contact, &list))
+		return;
+
+	if (!removed) {
+		if (presence_alloc(NULL, contact, contact_uri(contact),
+				   list) != 0) {
+			warning("presence: presence_alloc failed\n");
 		}
+		return;
+	}
+
+	/* Find matching presence element for contact */
+	pl_set_str(&uri, contact_uri(contact));
+	le = hash_lookup(presht, uri_hash(&uri), contact_cmp_handler,
+			 contact);
+	pres = le ? le->data : NULL;
+
+	if (pres) {
+		mem_deref(pres);
+	}
+	else {
+		warning("presence: No contact to remove\n");
 	}
 }
 
@@ -321,23 +546,43 @@ static void contact_handler(struct contact *contact,
 int subscriber_init(void)
 {
 	struct contacts *contacts = baresip_contacts();
+	char rls_uri[256] = "";
+	unsigned nlist = 0;
 	struct le *le;
 	int err = 0;
 
+	sub_rate = SUB_RATE;
+	(void)conf_get_u32(conf_cur(), "presence_sub_rate", &sub_rate);
+	(void)conf_get_str(conf_cur(), "presence_rls", rls_uri,
+			   sizeof(rls_uri));
+
+	err = hash_alloc(&presht, HASH_SIZE);
+	if (err)
+		return err;
+
 	for (le = list_head(contact_list(contacts)); le; le = le->next) {
 
 		struct contact *c = le->data;
-		struct sip_addr *addr = contact_addr(c);
-		struct pl val;
+		bool list;
 
-		if (0 == msg_param_decode(&addr->params, "presence", &val) &&
-		    0 == pl_strcasecmp(&val, "p2p")) {
+		if (contact_presence(c, &list))
+			continue;
 
-			err |= presence_alloc(le->data);
-		}
+		err |= presence_alloc(NULL, c, contact_uri(c), list);
+		if (list)
+			++nlist;
+	}
+
+	if (str_isset(rls_uri)) {
+		err |= presence_alloc(&rls, NULL, rls_uri, false);
+	}
+	else if (nlist) {
+		warning("presence: %u contacts with presence=rls,"
+			" but presence_rls is not set\n", nlist);
 	}
 
-	info("Subscribing to %u contacts\n", list_count(&presencel));
+	info("Subscribing to %u contacts (%u via resource list)\n",
+	     list_count(&presencel) - nlist - (rls ? 1 : 0), nlist);
 
 	contact_set_update_handler(contacts, contact_handler, NULL);
 
@@ -350,7 +595,9 @@ int subscriber_init(void)
 void subscriber_close(void)
 {
 	contact_set_update_handler(baresip_contacts(), NULL, NULL);
+	tmr_cancel(&tmr_pace);
 	list_flush(&presencel);
+	presht = mem_deref(presht);
 }
 
 
@@ -362,6 +609,7 @@ void subscriber_close_all(void)
 	     list_count(&presencel));
 
 	contact_set_update_handler(baresip_contacts(), NULL, NULL);
+	tmr_cancel(&tmr_pace);
 
 	le = presencel.head;
 	while (le) {
@@ -0,0 +1,206 @@
+/**
+ * @file modules/sfu/sfu.c Video conference room with selective forwarding
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+
+/**
+ * @defgroup sfu sfu
+ *
+ * Video conference room using the selective forwarding unit
+ *
+ * Incoming calls are answered with video and join one room. Video is
+ * forwarded between the calls without decoding and re-encoding, every
+ * participant receives the video of one other participant. Audio is
+ * handled by the configured audio devices.
+ *
+ * NOTE: This module is experimental.
+ *
+ * Commands:
+ *
+ \verbatim
+ sfu                          Show room members and statistics
+ sfu_select <viewer> <source> Select video source by call-id
+ \endverbatim
+ */
+
+
+struct member {
+	struct le le;
+	struct call *call;
+};
+
+
+static struct list memberl;
+static struct sfu *room;
+
+
+static void destructor(void *arg)
+{
+	struct member *mb = arg;
+
+	list_unlink(&mb->le);
+	sfu_remove(room, mb->call);
+}
+
+
+static void call_event_handler(struct call *call, enum call_event ev,
+			       const char *str, void *arg)
+{
+	struct member *mb = arg;
+	int err;
+
+	switch (ev) {
+
+	case CALL_EVENT_ESTABLISHED:
+		err = sfu_add(room, call);
+		if (err) {
+			warning("sfu: %s: could not join room (%m)\n",
+				call_peeruri(call), err);
+		}
+		break;
+
+	case CALL_EVENT_CLOSED:
+		debug("sfu: CALL_CLOSED: %s\n", str);
+		mem_deref(mb->call);
+		mem_deref(mb);
+		break;
+
+	default:
+		break;
+	}
+}
+
+
+static int new_member(struct ua *ua, struct call *call)
+{
+	struct member *mb;
+	int err;
+
+	mb = mem_zalloc(sizeof(*mb), destructor);
+	if (!mb)
+		return ENOMEM;
+
+	mb->call = call;
+
+	call_set_handlers(call, call_event_handler, NULL, mb);
+
+	list_append(&memberl, &mb->le, mb);
+
+	err = ua_answer(ua, call, VIDMODE_ON);
+	if (err)
+		mem_deref(mb);
+
+	return err;
+}
+
+
+static void ua_event_handler(struct ua *ua, enum ua_event ev,
+			     struct call *call, const char *prm, void *arg)
+{
+	int err;
+	(void)prm;
+	(void)arg;
+
+	if (ev != UA_EVENT_CALL_INCOMING)
+		return;
+
+	info("sfu: CALL_INCOMING: peer=%s  -->  local=%s\n",
+	     call_peeruri(call), call_localuri(call));
+
+	err = new_member(ua, call);
+	if (err)
+		call_hangup(call, 500, "Server Error");
+}
+
+
+static int cmd_sfu(struct re_printf *pf, void *arg)
+{
+	(void)arg;
+
+	return sfu_debug(pf, room);
+}
+
+
+static int cmd_select(struct re_printf *pf, void *arg)
+{
+	const struct cmd_arg *carg = arg;
+	struct pl pl_viewer, pl_source;
+	char *viewer = NULL, *source = NULL;
+	int err;
+
+	err = re_regex(carg->prm, str_len(carg->prm), "[^ ]+[ ]+[^ ]+",
+		       &pl_viewer, NULL, &pl_source);
+	if (err) {
+		(void)re_hprintf(pf, "usage: sfu_select <viewer> <source>\n");
+		return EINVAL;
+	}
+
+	err  = pl_strdup(&viewer, &pl_viewer);
+	err |= pl_strdup(&source, &pl_source);
+	if (err)
+		goto out;
+
+	err = sfu_select(room, uag_call_find(viewer), uag_call_find(source));
+	if (err)
+		(void)re_hprintf(pf, "sfu: could not select source (%m)\n",
+				 err);
+
+ out:
+	mem_deref(viewer);
+	mem_deref(source);
+
+	return err;
+}
+
+
+static const struct cmd cmdv[] = {
+{"sfu",        0,       0, "Show SFU room",            cmd_sfu    },
+{"sfu_select", 0, CMD_PRM, "Select SFU video source",  cmd_select },
+};
+
+
+static int module_init(void)
+{
+	int err;
+
+	list_init(&memberl);
+
+	err = sfu_alloc(&room);
+	if (err)
+		return err;
+
+	err = uag_event_register(ua_event_handler, NULL);
+	if (err)
+		return err;
+
+	return cmd_register(baresip_commands(), cmdv, RE_ARRAY_SIZE(cmdv));
+}
+
+
+static int module_close(void)
+{
+	cmd_unregister(baresip_commands(), cmdv);
+	uag_event_unregister(ua_event_handler);
+
+	if (!list_isempty(&memberl)) {
+
+		info("sfu: flushing %u members\n", list_count(&memberl));
+		list_flush(&memberl);
+	}
+
+	room = mem_deref(room);
+
+	return 0;
+}
+
+
+const struct mod_export DECL_EXPORTS(sfu) = {
+	"sfu",
+	"application",
+	module_init,
+	module_close
+};
@@ -76,9 +76,10 @@ static int get_format(enum aufmt fmt)
 {
 	switch (fmt) {
 
-	case AUFMT_S16LE:  return SF_FORMAT_PCM_16;
-	case AUFMT_FLOAT:  return SF_FORMAT_FLOAT;
-	default:           return 0;
+	case AUFMT_S16LE:   return SF_FORMAT_PCM_16;
+	case AUFMT_S24_3LE: return SF_FORMAT_PCM_24;
+	case AUFMT_FLOAT:   return SF_FORMAT_FLOAT;
+	default:            return 0;
 	}
 }
 
@@ -111,9 +112,11 @@ static int openfile(SNDFILE **sfp,
 		return EINVAL;
 	}
 
+	/* the samples are written as they are, in any channel count */
 	sfinfo.samplerate = prm->srate;
 	sfinfo.channels   = prm->ch;
-	sfinfo.format     = SF_FORMAT_WAV | format;
+	sfinfo.format     = (prm->ch > 2 ? SF_FORMAT_WAVEX : SF_FORMAT_WAV) |
+			    format;
 
 	sf = sf_open(filename, SFM_WRITE, &sfinfo);
 	if (!sf) {
@@ -12,9 +12,10 @@ const char sdp_attr_crypto[] = "crypto";
 
 
 int sdes_encode_crypto(struct sdp_media *m, uint32_t tag, const char *suite,
-		       const char *key, size_t key_len)
+		       const char *key, size_t key_len, bool replace)
 {
-	return sdp_media_set_lattr(m, true, sdp_attr_crypto, "%u %s inline:%b",
+	return sdp_media_set_lattr(m, replace, sdp_attr_crypto,
+				   "%u %s inline:%b",
 				   tag, suite, key, key_len);
 }
 
@@ -33,17 +33,29 @@ struct menc_sess {
 };
 
 
+/** Rate-limited error reporting, at most one warning per interval */
+struct errlog {
+	RE_ATOMIC uint64_t ts;       /**< Time of last warning [ms]      */
+	RE_ATOMIC uint32_t suppressed;
+};
+
+
 struct menc_st {
 	/* one SRTP session per media line */
 	const struct menc_sess *sess;
 	uint8_t key_tx[32+12];
+	uint8_t key_alt[32+12];      /**< TX key of the fallback offer   */
 	/* base64_decoding worst case encoded 32+12 key */
 	uint8_t key_rx[46];
 	struct srtp *srtp_tx, *srtp_rx;
 	mtx_t *mtx_tx, *mtx_rx;
 	RE_ATOMIC bool use_srtp;
 	RE_ATOMIC bool got_sdp;
+	bool offer_alt;              /**< Fallback crypto line offered   */
 	char *crypto_suite;
+	struct pl suite_want;        /**< Remote suite to select         */
+	struct errlog errlog_tx;
+	struct errlog errlog_rx;
 
 	void *rtpsock;
 	void *rtcpsock;
@@ -60,6 +72,12 @@ static const char aes_128_gcm[]             = "AEAD_AES_128_GCM";
 static const char aes_256_gcm[]             = "AEAD_AES_256_GCM";
 
 static const char *preferred_suite = aes_cm_128_hmac_sha1_80;
+static bool prefer_aead;
+
+enum {
+	ERRLOG_INTERVAL = 1000,
+	SRTP_SKIP       = EAGAIN,  /**< Context is being replaced, skip */
+};
 
 
 static void destructor(void *arg)
@@ -99,6 +117,36 @@ static bool cryptosuite_issupported(const struct pl *suite)
 }
 
 
+/* Ranking of suites if AEAD is preferred, higher is better */
+static int cryptosuite_rank(const struct pl *suite)
+{
+	if (0 == pl_strcasecmp(suite, aes_128_gcm))             return 4;
+	if (0 == pl_strcasecmp(suite, aes_256_gcm))             return 3;
+	if (0 == pl_strcasecmp(suite, aes_cm_128_hmac_sha1_80)) return 2;
+	if (0 == pl_strcasecmp(suite, aes_cm_128_hmac_sha1_32)) return 1;
+
+	return 0;
+}
+
+
+static bool errlog_allow(struct errlog *el, uint32_t *suppressed)
+{
+	uint64_t now = tmr_jiffies();
+	uint64_t ts  = re_atomic_rlx(&el->ts);
+
+	if (ts && now < ts + ERRLOG_INTERVAL) {
+		re_atomic_rlx_add(&el->suppressed, 1);
+		return false;
+	}
+
+	re_atomic_rlx_set(&el->ts, now);
+	*suppressed = re_atomic_rlx(&el->suppressed);
+	re_atomic_rlx_set(&el->suppressed, 0);
+
+	return true;
+}
+
+
 /*
  * See RFC 5764 figure 3:
  *
@@ -111,7 +159,7 @@ static bool cryptosuite_issupported(const struct pl *suite)
  *                  +----------------+
  *
  */
-static bool is_rtp_or_rtcp(const struct mbuf *mb)
+static inline bool is_rtp_or_rtcp(const struct mbuf *mb)
 {
 	uint8_t b;
 
@@ -124,7 +172,7 @@ static bool is_rtp_or_rtcp(const struct mbuf *mb)
 }
 
 
-static bool is_rtcp_packet(const struct mbuf *mb)
+static inline bool is_rtcp_packet(const struct mbuf *mb)
 {
 	uint8_t pt;
 
@@ -209,37 +257,46 @@ static bool send_handler(int *err, struct sa *dst, struct mbuf *mb, void *arg)
 {
 	struct menc_st *st = arg;
 	size_t len = mbuf_get_left(mb);
+	uint32_t suppressed;
+	bool rtcp;
 	int lerr = 0;
 	(void)dst;
 
 	if (!re_atomic_rlx(&st->use_srtp) || !is_rtp_or_rtcp(mb))
 		return false;
 
-	lerr = mtx_trylock(st->mtx_tx) != thrd_success;
-	if (lerr)
+	rtcp = is_rtcp_packet(mb);
+
+	/* the context is being replaced (re-keying) */
+	if (mtx_trylock(st->mtx_tx) != thrd_success) {
+		lerr = SRTP_SKIP;
 		goto out;
+	}
 
 	if (!st->srtp_tx) {
 		lerr = EBUSY;
-		warning("srtp: srtp_tx not ready (%m)\n", err);
 		goto unlock_out;
 	}
 
-	if (is_rtcp_packet(mb)) {
+	if (rtcp)
 		lerr = srtcp_encrypt(st->srtp_tx, mb);
-	}
-	else {
+	else
 		lerr = srtp_encrypt(st->srtp_tx, mb);
-	}
 
 unlock_out:
 	mtx_unlock(st->mtx_tx);
 out:
+	if (lerr == SRTP_SKIP)
+		return true;  /* drop the packet, not an error */
+
 	if (lerr) {
-		warning("srtp: failed to encrypt %s-packet"
-			      " with %zu bytes (%m)\n",
-			      is_rtcp_packet(mb) ? "RTCP" : "RTP",
-			      len, lerr);
+		if (errlog_allow(&st->errlog_tx, &suppressed)) {
+			warning("srtp: failed to encrypt %s-packet"
+				" with %zu bytes (%m)"
+				" [%u similar suppressed]\n",
+				rtcp ? "RTCP" : "RTP",
+				len, lerr, suppressed);
+		}
 		*err = lerr;
 		return false;
 	}
@@ -252,6 +309,8 @@ static bool recv_handler(struct sa *src, struct mbuf *mb, void *arg)
 {
 	struct menc_st *st = arg;
 	size_t len = mbuf_get_left(mb);
+	uint32_t suppressed;
+	bool rtcp;
 	int err = 0;
 	(void)src;
 
@@ -261,41 +320,45 @@ static bool recv_handler(struct sa *src, struct mbuf *mb, void *arg)
 	if (!re_atomic_rlx(&st->use_srtp) || !is_rtp_or_rtcp(mb))
 		return false;
 
-	err = mtx_trylock(st->mtx_rx) != thrd_success;
-	if (err)
+	rtcp = is_rtcp_packet(mb);
+
+	/* the context is being replaced (re-keying) */
+	if (mtx_trylock(st->mtx_rx) != thrd_success) {
+		err = SRTP_SKIP;
 		goto out;
+	}
 
 	if (!st->srtp_rx) {
 		err = EBUSY;
-		warning("srtp: srtp_rx not ready (%m)\n", err);
 		mtx_unlock(st->mtx_rx);
 		goto out;
 	}
 
-	if (is_rtcp_packet(mb)) {
+	if (rtcp)
 		err = srtcp_decrypt(st->srtp_rx, mb);
-		if (err) {
-			warning("srtp: failed to decrypt RTCP packet"
-				" with %zu bytes (%m)\n", len, err);
-		}
-	}
-	else {
+	else
 		err = srtp_decrypt(st->srtp_rx, mb);
-		if (err) {
-			warning("srtp: failed to decrypt RTP packet"
-				" with %zu bytes (%m)\n", len, err);
-		}
-	}
 
 	mtx_unlock(st->mtx_rx);
 out:
+	if (err && err != SRTP_SKIP &&
+	    errlog_allow(&st->errlog_rx, &suppressed)) {
+		warning("srtp: failed to decrypt %s packet"
+			" with %zu bytes (%m) [%u similar suppressed]\n",
+			rtcp ? "RTCP" : "RTP", len, err, suppressed);
+	}
+
 	return err ? true : false;
 }
 
 
-/* a=crypto:<tag> <crypto-suite> <key-params> [<session-params>] */
+/*
+ * a=crypto:<tag> <crypto-suite> <key-params> [<session-params>]
+ *
+ * The fallback line (alt) is appended and carries its own key.
+ */
 static int sdp_enc(struct menc_st *st, struct sdp_media *m,
-		   uint32_t tag, const char *suite)
+		   uint32_t tag, const char *suite, bool alt)
 {
 	char key[128] = "";
 	size_t len, olen;
@@ -304,11 +367,42 @@ static int sdp_enc(struct menc_st *st, struct sdp_media *m,
 	len = get_master_keylen(resolve_suite(suite));
 
 	olen = sizeof(key);
-	err = base64_encode(st->key_tx, len, key, &olen);
+	err = base64_encode(alt ? st->key_alt : st->key_tx, len, key, &olen);
+	if (err)
+		return err;
+
+	return sdes_encode_crypto(m, tag, suite, key, olen, !alt);
+}
+
+
+/* offer AEAD first, and our preferred suite as fallback */
+static int sdp_enc_offer(struct menc_st *st, struct sdp_media *m)
+{
+	int err;
+
+	st->offer_alt = false;
+
+	if (!prefer_aead || 0 == str_casecmp(st->crypto_suite, aes_128_gcm))
+		return sdp_enc(st, m, 1, st->crypto_suite, false);
+
+	err  = sdp_enc(st, m, 1, aes_128_gcm, false);
+	err |= sdp_enc(st, m, 2, st->crypto_suite, true);
 	if (err)
 		return err;
 
-	return sdes_encode_crypto(m, tag, suite, key, olen);
+	st->offer_alt = true;
+
+	return 0;
+}
+
+
+/* the answer selected our fallback line -> send with its key */
+static void select_alt_key(struct menc_st *st)
+{
+	mtx_lock(st->mtx_tx);
+	st->srtp_tx = mem_deref(st->srtp_tx);
+	memcpy(st->key_tx, st->key_alt, sizeof(st->key_tx));
+	mtx_unlock(st->mtx_tx);
 }
 
 
@@ -384,6 +478,26 @@ static int start_crypto(struct menc_st *st, const struct pl *key_info)
 }
 
 
+static bool sdp_rank_handler(const char *name, const char *value,
+			     void *arg)
+{
+	struct pl *best = arg;
+	struct crypto c;
+	(void)name;
+
+	if (sdes_decode_crypto(&c, value))
+		return false;
+
+	if (0 != pl_strcmp(&c.key_method, "inline"))
+		return false;
+
+	if (cryptosuite_rank(&c.suite) > cryptosuite_rank(best))
+		*best = c.suite;
+
+	return false;
+}
+
+
 static bool sdp_attr_handler(const char *name, const char *value, void *arg)
 {
 	struct menc_st *st = arg;
@@ -399,27 +513,57 @@ static bool sdp_attr_handler(const char *name, const char *value, void *arg)
 	if (!cryptosuite_issupported(&c.suite))
 		return false;
 
-	/* receiving crypto-suite changed -> reset srtp_rx */
+	if (pl_isset(&st->suite_want) &&
+	    pl_casecmp(&c.suite, &st->suite_want))
+		return false;
+
+	/* receiving crypto-suite changed -> reset srtp_rx and srtp_tx */
 	if (st->srtp_rx && pl_strcmp(&c.suite, st->crypto_suite)) {
 		info ("srtp (%s-rx): cipher suite changed from %s to %r\n",
 			stream_name(st->strm), st->crypto_suite, &c.suite);
 		mtx_lock(st->mtx_rx);
 		st->srtp_rx = mem_deref(st->srtp_rx);
 		mtx_unlock(st->mtx_rx);
+
+		mtx_lock(st->mtx_tx);
+		st->srtp_tx = mem_deref(st->srtp_tx);
+		mtx_unlock(st->mtx_tx);
 	}
 
 	st->crypto_suite = mem_deref(st->crypto_suite);
 	pl_strdup(&st->crypto_suite, &c.suite);
 
+	if (st->offer_alt && c.tag == 2)
+		select_alt_key(st);
+
+	st->offer_alt = false;
+
 	if (start_crypto(st, &c.key_info))
 		return false;
 
-	sdp_enc(st, st->sdpm, c.tag, st->crypto_suite);
+	sdp_enc(st, st->sdpm, c.tag, st->crypto_suite, false);
 
 	return true;
 }
 
 
+static const char *crypto_apply(struct menc_st *st)
+{
+	struct pl best = PL_INIT;
+
+	st->suite_want = pl_null;
+
+	if (prefer_aead) {
+		(void)sdp_media_rattr_apply(st->sdpm, "crypto",
+					    sdp_rank_handler, &best);
+		st->suite_want = best;
+	}
+
+	return sdp_media_rattr_apply(st->sdpm, "crypto",
+				     sdp_attr_handler, st);
+}
+
+
 static int media_txrekey(struct menc_media *m)
 {
 	const char *rattr = NULL;
@@ -434,11 +578,11 @@ static int media_txrekey(struct menc_media *m)
 	mtx_unlock(st->mtx_tx);
 
 	rand_bytes(st->key_tx, sizeof(st->key_tx));
+	rand_bytes(st->key_alt, sizeof(st->key_alt));
 
 	if (sdp_media_rattr(st->sdpm, "crypto")) {
 
-		rattr = sdp_media_rattr_apply(st->sdpm, "crypto",
-					      sdp_attr_handler, st);
+		rattr = crypto_apply(st);
 		if (!rattr) {
 			warning("srtp: no valid a=crypto attribute from"
 				" remote peer\n");
@@ -542,6 +686,7 @@ static int media_alloc(struct menc_media **stp, struct menc_sess *sess,
 			goto out;
 
 		rand_bytes(st->key_tx, sizeof(st->key_tx));
+		rand_bytes(st->key_alt, sizeof(st->key_alt));
 	}
 
 	/* SDP handling */
@@ -551,8 +696,7 @@ static int media_alloc(struct menc_media **stp, struct menc_sess *sess,
 
 	if (sdp_media_rattr(st->sdpm, "crypto")) {
 
-		rattr = sdp_media_rattr_apply(st->sdpm, "crypto",
-					      sdp_attr_handler, st);
+		rattr = crypto_apply(st);
 		if (!rattr) {
 			warning("srtp: no valid a=crypto attribute from"
 				" remote peer\n");
@@ -560,7 +704,7 @@ static int media_alloc(struct menc_media **stp, struct menc_sess *sess,
 	}
 
 	if (!rattr)
-		err = sdp_enc(st, sdpm, 1, st->crypto_suite);
+		err = sdp_enc_offer(st, sdpm);
 
  out:
 	if (err)
@@ -601,6 +745,8 @@ static int mod_srtp_init(void)
 {
 	struct list *mencl = baresip_mencl();
 
+	(void)conf_get_bool(conf_cur(), "srtp_prefer_aead", &prefer_aead);
+
 	menc_register(mencl, &menc_srtp_opt);
 	menc_register(mencl, &menc_srtp_mand);
 	menc_register(mencl, &menc_srtp_mandf);
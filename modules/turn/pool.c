@@ -0,0 +1,604 @@
+/**
+ * @file pool.c  Pool of pre-established TURN allocations
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <re.h>
+#include <baresip.h>
+#include "turn.h"
+
+
+/*
+ * For every TURN server, transport and credentials in use we keep a
+ * number of authenticated allocations ready. The allocations are
+ * refreshed by the TURN client and handed over to a new media session
+ * instantly, after which the pool is replenished in the background.
+ */
+
+
+enum {
+	RETRY_MAX = 60000,   /**< Maximum wait after failure [ms]   */
+	REDNS_FAILC = 3,     /**< Re-resolve server after N failures */
+};
+
+
+struct turn_pool {
+	struct le le;
+	struct list allocl;          /**< Ready and pending allocations  */
+	struct stun_dns *dnsq;
+	struct dnsc *dnsc;
+	struct tmr tmr;
+	struct sa srv;
+	enum stun_scheme scheme;
+	char *host;
+	uint16_t port;
+	int proto;
+	int af;
+	char *user;
+	char *pass;
+	uint32_t failc;
+	bool resolving;
+
+	struct {
+		uint64_t hits;
+		uint64_t misses;
+		uint64_t allocs;
+		uint64_t fails;
+		uint64_t lat_sum;    /**< Sum of allocation latency [ms]  */
+		uint32_t lat_max;    /**< Max allocation latency [ms]     */
+	} stats;
+};
+
+
+struct turn_alloc {
+	struct le le;
+	struct turn_pool *pool;      /**< Owner, NULL when handed over   */
+	struct turnc *turnc;
+	struct udp_sock *us;
+	struct tcp_conn *tc;
+	struct tls_conn *tlsc;
+	struct mbuf *mb;
+	struct sa relay;
+	uint64_t ts;
+	bool ready;
+
+	turn_recv_h *recvh;
+	turn_close_h *closeh;
+	void *arg;
+};
+
+
+static struct list pooll;
+static uint32_t pool_size;
+
+
+static void pool_fill(struct turn_pool *pool);
+
+
+static void tmr_handler(void *arg)
+{
+	struct turn_pool *pool = arg;
+
+	pool_fill(pool);
+}
+
+
+static void alloc_destructor(void *arg)
+{
+	struct turn_alloc *ta = arg;
+
+	list_unlink(&ta->le);
+	mem_deref(ta->turnc);
+	mem_deref(ta->us);
+	mem_deref(ta->tlsc);
+	mem_deref(ta->tc);
+	mem_deref(ta->mb);
+}
+
+
+static void pool_destructor(void *arg)
+{
+	struct turn_pool *pool = arg;
+
+	tmr_cancel(&pool->tmr);
+	list_unlink(&pool->le);
+	list_flush(&pool->allocl);
+	mem_deref(pool->dnsq);
+	mem_deref(pool->host);
+	mem_deref(pool->user);
+	mem_deref(pool->pass);
+}
+
+
+static uint32_t pool_ready(const struct turn_pool *pool)
+{
+	struct le *le;
+	uint32_t n = 0;
+
+	for (le = pool->allocl.head; le; le = le->next) {
+		const struct turn_alloc *ta = le->data;
+
+		if (ta->ready)
+			++n;
+	}
+
+	return n;
+}
+
+
+static uint32_t failwait(uint32_t failc)
+{
+	return min(RETRY_MAX, (uint32_t)(1 << min(failc, 6)) * 1000);
+}
+
+
+static void alloc_close(struct turn_alloc *ta, int err)
+{
+	struct turn_pool *pool = ta->pool;
+
+	if (!pool) {
+		if (ta->closeh)
+			ta->closeh(err, ta->arg);
+		return;
+	}
+
+	/* still in the pool -- drop it and try again later */
+	++pool->stats.fails;
+	++pool->failc;
+
+	mem_deref(ta);
+
+	tmr_start(&pool->tmr, failwait(pool->failc),
+		  tmr_handler, pool);
+}
+
+
+static void alloc_turn_handler(int err, uint16_t scode, const char *reason,
+			       const struct sa *relay_addr,
+			       const struct sa *mapped_addr,
+			       const struct stun_msg *msg,
+			       void *arg)
+{
+	struct turn_alloc *ta = arg;
+	struct turn_pool *pool = ta->pool;
+	uint32_t lat;
+	(void)mapped_addr;
+	(void)msg;
+
+	if (err || scode) {
+		warning("turn: pool: allocation failed (%m %u %s)\n",
+			err, scode, reason);
+		alloc_close(ta, err ? err : EPROTO);
+		return;
+	}
+
+	if (ta->ready || !pool)
+		return;
+
+	lat = (uint32_t)(tmr_jiffies() - ta->ts);
+
+	ta->relay = *relay_addr;
+	ta->ready = true;
+
+	pool->failc = 0;
+	++pool->stats.allocs;
+	pool->stats.lat_sum += lat;
+	pool->stats.lat_max  = max(pool->stats.lat_max, lat);
+
+	debug("turn: pool: allocation ready %J (%u ms)\n", relay_addr, lat);
+}
+
+
+static void udp_recv_handler(const struct sa *src, struct mbuf *mb,
+			     void *arg)
+{
+	struct turn_alloc *ta = arg;
+
+	if (ta->recvh)
+		ta->recvh(src, mb, ta->arg);
+}
+
+
+static void tcp_recv_handler(struct mbuf *mb_pkt, void *arg)
+{
+	struct turn_alloc *ta = arg;
+	int err;
+
+	err = turn_tcp_recv(&ta->mb, mb_pkt, ta->turnc, ta->recvh, ta->arg);
+	if (err)
+		alloc_close(ta, err);
+}
+
+
+static void tcp_estab_handler(void *arg)
+{
+	struct turn_alloc *ta = arg;
+	struct turn_pool *pool = ta->pool;
+	int err;
+
+	if (!pool)
+		return;
+
+	err = turnc_alloc(&ta->turnc, NULL, IPPROTO_TCP, ta->tc, 0,
+			  &pool->srv, pool->user, pool->pass,
+			  TURN_DEFAULT_LIFETIME, alloc_turn_handler, ta);
+	if (err)
+		alloc_close(ta, err);
+}
+
+
+static void tcp_close_handler(int err, void *arg)
+{
+	struct turn_alloc *ta = arg;
+
+	alloc_close(ta, err ? err : ECONNRESET);
+}
+
+
+static int alloc_start(struct turn_pool *pool)
+{
+	struct turn_alloc *ta;
+	struct sa laddr;
+	int err = 0;
+
+	ta = mem_zalloc(sizeof(*ta), alloc_destructor);
+	if (!ta)
+		return ENOMEM;
+
+	ta->pool = pool;
+	ta->ts   = tmr_jiffies();
+
+	switch (pool->proto) {
+
+	case IPPROTO_UDP:
+		sa_init(&laddr, sa_af(&pool->srv));
+
+		err = udp_listen(&ta->us, &laddr, udp_recv_handler, ta);
+		if (err)
+			break;
+
+		err = turnc_alloc(&ta->turnc, NULL, IPPROTO_UDP,
+				  ta->us, LAYER, &pool->srv,
+				  pool->user, pool->pass,
+				  TURN_DEFAULT_LIFETIME,
+				  alloc_turn_handler, ta);
+		break;
+
+	case IPPROTO_TCP:
+		err = tcp_connect(&ta->tc, &pool->srv, tcp_estab_handler,
+				  tcp_recv_handler, tcp_close_handler, ta);
+		if (err)
+			break;
+#ifdef USE_TLS
+		if (pool->scheme == STUN_SCHEME_TURNS) {
+			err = tls_start_tcp(&ta->tlsc, uag_tls(), ta->tc, 0);
+			if (err)
+				break;
+		}
+#endif
+		break;
+
+	default:
+		err = EPROTONOSUPPORT;
+		break;
+	}
+
+	if (err) {
+		mem_deref(ta);
+		return err;
+	}
+
+	list_append(&pool->allocl, &ta->le, ta);
+
+	return 0;
+}
+
+
+static void dns_handler(int err, const struct sa *srv, void *arg)
+{
+	struct turn_pool *pool = arg;
+
+	pool->resolving = false;
+
+	if (err) {
+		warning("turn: pool: could not resolve %s (%m)\n",
+			pool->host, err);
+		++pool->failc;
+		tmr_start(&pool->tmr, failwait(pool->failc),
+			  tmr_handler, pool);
+		return;
+	}
+
+	pool->srv = *srv;
+
+	pool_fill(pool);
+}
+
+
+static int pool_resolve(struct turn_pool *pool)
+{
+	const char *stun_usage, *stun_proto;
+	int err;
+
+	stun_usage = pool->scheme == STUN_SCHEME_TURNS ?
+		stuns_usage_relay : stun_usage_relay;
+	stun_proto = pool->proto == IPPROTO_TCP ?
+		stun_proto_tcp : stun_proto_udp;
+
+	pool->dnsq = mem_deref(pool->dnsq);
+	pool->resolving = true;
+
+	err = stun_server_discover(&pool->dnsq, pool->dnsc,
+				   stun_usage, stun_proto,
+				   pool->af, pool->host, pool->port,
+				   dns_handler, pool);
+	if (err)
+		pool->resolving = false;
+
+	return err;
+}
+
+
+static void pool_fill(struct turn_pool *pool)
+{
+	int err = 0;
+
+	if (pool->resolving)
+		return;
+
+	if (!sa_isset(&pool->srv, SA_ALL) || pool->failc >= REDNS_FAILC) {
+
+		sa_init(&pool->srv, AF_UNSPEC);
+
+		err = pool_resolve(pool);
+		if (err)
+			goto out;
+
+		return;
+	}
+
+	while (list_count(&pool->allocl) < pool_size) {
+
+		err = alloc_start(pool);
+		if (err)
+			break;
+	}
+
+ out:
+	if (err) {
+		warning("turn: pool: replenish failed (%m)\n", err);
+		++pool->failc;
+		tmr_start(&pool->tmr, failwait(pool->failc),
+			  tmr_handler, pool);
+	}
+}
+
+
+static struct turn_pool *pool_find(int af, const struct stun_uri *srv,
+				   const char *user, const char *pass)
+{
+	struct le *le;
+
+	for (le = pooll.head; le; le = le->next) {
+		struct turn_pool *pool = le->data;
+
+		if (pool->af     == af &&
+		    pool->scheme == srv->scheme &&
+		    pool->proto  == srv->proto &&
+		    pool->port   == srv->port &&
+		    0 == str_casecmp(pool->host, srv->host) &&
+		    0 == str_cmp(pool->user, user) &&
+		    0 == str_cmp(pool->pass, pass))
+			return pool;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Start a pool of TURN allocations for a server, if not already running
+ *
+ * @param dnsc DNS Client
+ * @param af   Address family
+ * @param srv  TURN Server URI
+ * @param user TURN Username
+ * @param pass TURN Password
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int turnpool_warm(struct dnsc *dnsc, int af, const struct stun_uri *srv,
+		  const char *user, const char *pass)
+{
+	struct turn_pool *pool;
+	int err;
+
+	if (!dnsc || !srv || !user || !pass)
+		return EINVAL;
+
+	if (!pool_size)
+		return 0;
+
+	if (srv->scheme != STUN_SCHEME_TURN &&
+	    srv->scheme != STUN_SCHEME_TURNS)
+		return ENOTSUP;
+
+	if (pool_find(af, srv, user, pass))
+		return 0;
+
+	pool = mem_zalloc(sizeof(*pool), pool_destructor);
+	if (!pool)
+		return ENOMEM;
+
+	pool->dnsc   = dnsc;
+	pool->scheme = srv->scheme;
+	pool->port   = srv->port;
+	pool->proto  = srv->proto;
+	pool->af     = af;
+
+	err  = str_dup(&pool->host, srv->host);
+	err |= str_dup(&pool->user, user);
+	err |= str_dup(&pool->pass, pass);
+	if (err)
+		goto out;
+
+	err = pool_resolve(pool);
+	if (err)
+		goto out;
+
+	list_append(&pooll, &pool->le, pool);
+
+	info("turn: pool: warming %u allocations for %H\n",
+	     pool_size, stunuri_print, srv);
+
+ out:
+	if (err)
+		mem_deref(pool);
+
+	return err;
+}
+
+
+/**
+ * Get the resolved server address of a TURN pool
+ *
+ * @param af   Address family
+ * @param srv  TURN Server URI
+ * @param user TURN Username
+ * @param pass TURN Password
+ *
+ * @return Server address if resolved, otherwise NULL
+ */
+const struct sa *turnpool_srv(int af, const struct stun_uri *srv,
+			      const char *user, const char *pass)
+{
+	struct turn_pool *pool = pool_find(af, srv, user, pass);
+
+	if (!pool || !sa_isset(&pool->srv, SA_ALL))
+		return NULL;
+
+	return &pool->srv;
+}
+
+
+/**
+ * Take a ready TURN allocation out of the pool
+ *
+ * The pool is replenished in the background. The caller owns the
+ * returned allocation and must set its handlers.
+ *
+ * @param af   Address family
+ * @param srv  TURN Server URI
+ * @param user TURN Username
+ * @param pass TURN Password
+ *
+ * @return TURN allocation, NULL if none is ready
+ */
+struct turn_alloc *turnpool_get(int af, const struct stun_uri *srv,
+				const char *user, const char *pass)
+{
+	struct turn_pool *pool = pool_find(af, srv, user, pass);
+	struct turn_alloc *ta = NULL;
+	struct le *le;
+
+	if (!pool)
+		return NULL;
+
+	for (le = pool->allocl.head; le; le = le->next) {
+		struct turn_alloc *cand = le->data;
+
+		if (cand->ready) {
+			ta = cand;
+			break;
+		}
+	}
+
+	if (!ta) {
+		++pool->stats.misses;
+		return NULL;
+	}
+
+	list_unlink(&ta->le);
+	ta->pool = NULL;
+
+	++pool->stats.hits;
+
+	if (!tmr_isrunning(&pool->tmr))
+		tmr_start(&pool->tmr, 0, tmr_handler, pool);
+
+	return ta;
+}
+
+
+void turn_alloc_set_handlers(struct turn_alloc *ta, turn_recv_h *recvh,
+			     turn_close_h *closeh, void *arg)
+{
+	if (!ta)
+		return;
+
+	ta->recvh  = recvh;
+	ta->closeh = closeh;
+	ta->arg    = arg;
+}
+
+
+struct turnc *turn_alloc_turnc(const struct turn_alloc *ta)
+{
+	return ta ? ta->turnc : NULL;
+}
+
+
+const struct sa *turn_alloc_relay(const struct turn_alloc *ta)
+{
+	return ta ? &ta->relay : NULL;
+}
+
+
+int turnpool_debug(struct re_printf *pf, void *unused)
+{
+	struct le *le;
+	int err;
+	(void)unused;
+
+	err = re_hprintf(pf, "TURN pool (size %u):\n", pool_size);
+
+	for (le = pooll.head; le; le = le->next) {
+		const struct turn_pool *pool = le->data;
+		uint64_t req = pool->stats.hits + pool->stats.misses;
+		uint64_t avg = pool->stats.allocs ?
+			pool->stats.lat_sum / pool->stats.allocs : 0;
+
+		err |= re_hprintf(pf, "  %s:%s:%u;transport=%s (%J)\n",
+				  stunuri_scheme_name(pool->scheme),
+				  pool->host, pool->port,
+				  net_proto2name(pool->proto), &pool->srv);
+		err |= re_hprintf(pf, "    ready %u/%u, hits %llu, misses %llu"
+				  " (hit rate %llu%%)\n",
+				  pool_ready(pool), list_count(&pool->allocl),
+				  pool->stats.hits, pool->stats.misses,
+				  req ? 100 * pool->stats.hits / req : 0);
+		err |= re_hprintf(pf, "    allocations %llu, failures %llu,"
+				  " latency avg %llu ms, max %u ms\n",
+				  pool->stats.allocs, pool->stats.fails,
+				  avg, pool->stats.lat_max);
+	}
+
+	return err;
+}
+
+
+int turnpool_init(void)
+{
+	pool_size = 0;
+	conf_get_u32(conf_cur(), "turn_pool_size", &pool_size);
+
+	list_init(&pooll);
+
+	return 0;
+}
+
+
+void turnpool_close(void)
+{
+	list_flush(&pooll);
+}
@@ -5,6 +5,7 @@
  */
 #include <re.h>
 #include <baresip.h>
+#include "turn.h"
 
 
 /**
@@ -14,13 +15,13 @@
  */
 
 
-enum {LAYER = 0, LAYER_APP = 10};
 enum {COMPC = 2};
 
 
 struct mnat_sess {
 	struct list medial;
 	struct sa srv;
+	struct stun_uri uri;
 	struct stun_dns *dnsq;
 	char *user;
 	char *pass;
@@ -28,6 +29,7 @@ struct mnat_sess {
 	void *arg;
 	int mediac;
 	int proto;
+	int af;
 #ifdef USE_TLS
 	bool secure;
 #endif
@@ -43,6 +45,8 @@ struct mnat_media {
 		struct mnat_media *m;         /* pointer to parent */
 		struct sa addr;
 		struct turnc *turnc;
+		struct turn_alloc *ta;        /* pooled allocation */
+		struct tmr tmr;
 		struct udp_sock *sock;
 		struct udp_helper *uh_app;
 		struct tcp_conn *tc;
@@ -59,6 +63,7 @@ static void session_destructor(void *arg)
 
 	list_flush(&sess->medial);
 	mem_deref(sess->dnsq);
+	mem_deref(sess->uri.host);
 	mem_deref(sess->user);
 	mem_deref(sess->pass);
 }
@@ -75,8 +80,10 @@ static void media_destructor(void *arg)
 	for (i=0; i<COMPC; i++) {
 		struct comp *comp = &m->compv[i];
 
+		tmr_cancel(&comp->tmr);
 		mem_deref(comp->uh_app);
 		mem_deref(comp->turnc);
+		mem_deref(comp->ta);
 		mem_deref(comp->sock);
 		mem_deref(comp->tlsc);
 		mem_deref(comp->tc);
@@ -85,9 +92,10 @@ static void media_destructor(void *arg)
 }
 
 
-static void data_handler(struct comp *comp, const struct sa *src,
-			 struct mbuf *mb_pkt)
+static void data_handler(const struct sa *src, struct mbuf *mb_pkt,
+			 void *arg)
 {
+       struct comp *comp = arg;
        struct mbuf *mb = mbuf_alloc(mbuf_get_left(mb_pkt));
        if (!mb)
                return;
@@ -104,29 +112,40 @@ static void data_handler(struct comp *comp, const struct sa *src,
 }
 
 
-static void tcp_recv_handler(struct mbuf *mb_pkt, void *arg)
+/**
+ * Handle TURN framing on a TCP connection
+ *
+ * @param mbp    Pointer to re-assembly buffer
+ * @param mb_pkt Received TCP data
+ * @param turnc  TURN Client
+ * @param recvh  Handler for received application data (optional)
+ * @param arg    Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int turn_tcp_recv(struct mbuf **mbp, struct mbuf *mb_pkt,
+		  struct turnc *turnc, turn_recv_h *recvh, void *arg)
 {
-	struct comp *comp = arg;
-	struct mnat_media *m = comp->m;
+	struct mbuf *mbr = *mbp;
 	int err = 0;
 
 	/* re-assembly of fragments */
-	if (comp->mb) {
+	if (mbr) {
 		size_t pos;
 
-		pos = comp->mb->pos;
+		pos = mbr->pos;
 
-		comp->mb->pos = comp->mb->end;
+		mbr->pos = mbr->end;
 
-		err = mbuf_write_mem(comp->mb,
+		err = mbuf_write_mem(mbr,
 				     mbuf_buf(mb_pkt), mbuf_get_left(mb_pkt));
 		if (err)
-			goto out;
+			return err;
 
-		comp->mb->pos = pos;
+		mbr->pos = pos;
 	}
 	else {
-		comp->mb = mem_ref(mb_pkt);
+		mbr = *mbp = mem_ref(mb_pkt);
 	}
 
 	for (;;) {
@@ -135,54 +154,63 @@ static void tcp_recv_handler(struct mbuf *mb_pkt, void *arg)
 		struct sa src;
 		uint16_t typ;
 
-		if (mbuf_get_left(comp->mb) < 4)
+		if (mbuf_get_left(mbr) < 4)
 			break;
 
-		typ = ntohs(mbuf_read_u16(comp->mb));
-		len = ntohs(mbuf_read_u16(comp->mb));
+		typ = ntohs(mbuf_read_u16(mbr));
+		len = ntohs(mbuf_read_u16(mbr));
 
 		if (typ < 0x4000)
 			len += STUN_HEADER_SIZE;
 		else if (typ < 0x8000)
 			len += 4;
-		else {
-			err = EBADMSG;
-			goto out;
-		}
+		else
+			return EBADMSG;
 
-		comp->mb->pos -= 4;
+		mbr->pos -= 4;
 
-		if (mbuf_get_left(comp->mb) < len)
+		if (mbuf_get_left(mbr) < len)
 			break;
 
-		pos = comp->mb->pos;
-		end = comp->mb->end;
+		pos = mbr->pos;
+		end = mbr->end;
 
-		comp->mb->end = pos + len;
+		mbr->end = pos + len;
 
 		/* forward packet to TURN client */
-		err = turnc_recv(comp->turnc, &src, comp->mb);
+		err = turnc_recv(turnc, &src, mbr);
 		if (err)
-			goto out;
+			return err;
 
-		if (mbuf_get_left(comp->mb)) {
-			data_handler(comp, &src, comp->mb);
+		if (mbuf_get_left(mbr) && recvh) {
+			recvh(&src, mbr, arg);
 		}
 
 		/* 4 byte alignment */
 		while (len & 0x03)
 			++len;
 
-		comp->mb->pos = pos + len;
-		comp->mb->end = end;
+		mbr->pos = pos + len;
+		mbr->end = end;
 
-		if (comp->mb->pos >= comp->mb->end) {
-			comp->mb = mem_deref(comp->mb);
+		if (mbr->pos >= mbr->end) {
+			*mbp = mem_deref(mbr);
 			break;
 		}
 	}
 
- out:
+	return 0;
+}
+
+
+static void tcp_recv_handler(struct mbuf *mb_pkt, void *arg)
+{
+	struct comp *comp = arg;
+	struct mnat_media *m = comp->m;
+	int err;
+
+	err = turn_tcp_recv(&comp->mb, mb_pkt, comp->turnc,
+			    data_handler, comp);
 	if (err) {
 		m->sess->estabh(err, 0, NULL, m->sess->arg);
 	}
@@ -254,6 +282,56 @@ static void tcp_close_handler(int err, void *arg)
 }
 
 
+/* dst contains RTP packet -- [RTP Hdr].[Payload] */
+static bool send_handler(int *err, struct sa *dst, struct mbuf *mb, void *arg)
+{
+       struct comp *comp = arg;
+
+       /* relay packet via TURN */
+       *err = turnc_send(comp->turnc, dst, mb);
+
+       return true;
+}
+
+
+static void pool_estab_handler(void *arg)
+{
+	struct comp *comp = arg;
+
+	turn_handler(0, 0, NULL, turn_alloc_relay(comp->ta), NULL, NULL,
+		     comp);
+}
+
+
+static int pool_start(struct comp *comp, struct turn_alloc *ta)
+{
+	int err;
+
+	if (!comp->uh_app) {
+		err = udp_register_helper(&comp->uh_app, comp->sock,
+					  LAYER_APP,
+					  send_handler, NULL, comp);
+		if (err) {
+			mem_deref(ta);
+			return err;
+		}
+	}
+
+	comp->ta    = ta;
+	comp->turnc = mem_ref(turn_alloc_turnc(ta));
+
+	turn_alloc_set_handlers(ta, data_handler, tcp_close_handler, comp);
+
+	info("turn: [%u] using pooled allocation %J for '%s'\n", comp->ix,
+	     turn_alloc_relay(ta), sdp_media_name(comp->m->sdpm));
+
+	/* report the relay address from a clean stack */
+	tmr_start(&comp->tmr, 0, pool_estab_handler, comp);
+
+	return 0;
+}
+
+
 static int media_start(struct mnat_sess *sess, struct mnat_media *m)
 {
 	unsigned i;
@@ -262,10 +340,21 @@ static int media_start(struct mnat_sess *sess, struct mnat_media *m)
 	for (i=0; i<COMPC; i++) {
 
 		struct comp *comp = &m->compv[i];
+		struct turn_alloc *ta;
 
 		if (!comp->sock)
 			continue;
 
+		ta = turnpool_get(sess->af, &sess->uri,
+				  sess->user, sess->pass);
+		if (ta) {
+			err = pool_start(comp, ta);
+			if (err)
+				break;
+
+			continue;
+		}
+
 		switch (sess->proto) {
 
 		case IPPROTO_UDP:
@@ -329,18 +418,6 @@ static void dns_handler(int err, const struct sa *srv, void *arg)
 }
 
 
-/* dst contains RTP packet -- [RTP Hdr].[Payload] */
-static bool send_handler(int *err, struct sa *dst, struct mbuf *mb, void *arg)
-{
-       struct comp *comp = arg;
-
-       /* relay packet via TURN over TCP */
-       *err = turnc_send(comp->turnc, dst, mb);
-
-       return true;
-}
-
-
 static int session_alloc(struct mnat_sess **sessp,
 			 const struct mnat *mnat, struct dnsc *dnsc,
 			 int af, const struct stun_uri *srv,
@@ -349,6 +426,7 @@ static int session_alloc(struct mnat_sess **sessp,
 			 mnat_estab_h *estabh, void *arg)
 {
 	const char *stun_proto, *stun_usage;
+	const struct sa *pool_srv;
 	struct mnat_sess *sess;
 	int err;
 	(void)mnat;
@@ -394,16 +472,34 @@ static int session_alloc(struct mnat_sess **sessp,
 
 	err  = str_dup(&sess->user, user);
 	err |= str_dup(&sess->pass, pass);
+	err |= str_dup(&sess->uri.host, srv->host);
 	if (err)
 		goto out;
 
+	sess->uri.scheme = srv->scheme;
+	sess->uri.port   = srv->port;
+	sess->uri.proto  = srv->proto;
+
 	sess->proto  = srv->proto;
+	sess->af     = af;
 #ifdef USE_TLS
 	sess->secure = srv->scheme == STUN_SCHEME_TURNS;
 #endif
 	sess->estabh = estabh;
 	sess->arg    = arg;
 
+	err = turnpool_warm(dnsc, af, srv, user, pass);
+	if (err)
+		warning("turn: pool: %m\n", err);
+
+	/* server address is already known from the pool */
+	pool_srv = turnpool_srv(af, srv, user, pass);
+	if (pool_srv) {
+		sess->srv = *pool_srv;
+		err = 0;
+		goto out;
+	}
+
 	err = stun_server_discover(&sess->dnsq, dnsc,
 				   stun_usage, stun_proto,
 				   af, srv->host, srv->port,
@@ -512,17 +608,61 @@ static struct mnat mnat_turn = {
 };
 
 
+static void ua_event_handler(struct ua *ua, enum ua_event ev,
+			     struct call *call, const char *prm, void *arg)
+{
+	struct network *net = baresip_network();
+	struct account *acc = ua_account(ua);
+	int af = conf_config()->net.af;
+	(void)call;
+	(void)prm;
+	(void)arg;
+
+	if (ev != UA_EVENT_REGISTER_OK)
+		return;
+
+	if (0 != str_casecmp(account_medianat(acc), mnat_turn.id) ||
+	    !account_stun_uri(acc))
+		return;
+
+	if (af == AF_UNSPEC)
+		af = net_af_enabled(net, AF_INET) ? AF_INET : AF_INET6;
+
+	(void)turnpool_warm(net_dnsc(net), af, account_stun_uri(acc),
+			    account_stun_user(acc), account_stun_pass(acc));
+}
+
+
+static const struct cmd cmdv[] = {
+
+{"turnpool", 0, 0, "TURN allocation pool statistics", turnpool_debug},
+};
+
+
 static int module_init(void)
 {
+	int err;
+
+	err = turnpool_init();
+	if (err)
+		return err;
+
 	mnat_register(baresip_mnatl(), &mnat_turn);
 
-	return 0;
+	err = uag_event_register(ua_event_handler, NULL);
+	if (err)
+		return err;
+
+	return cmd_register(baresip_commands(), cmdv, RE_ARRAY_SIZE(cmdv));
 }
 
 
 static int module_close(void)
 {
+	cmd_unregister(baresip_commands(), cmdv);
+	uag_event_unregister(ua_event_handler);
 	mnat_unregister(&mnat_turn);
+	turnpool_close();
 
 	return 0;
 }
@@ -0,0 +1,37 @@
+/**
+ * @file turn.h TURN Module -- internal interface
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+
+
+enum {LAYER = 0, LAYER_APP = 10};
+
+
+typedef void (turn_recv_h)(const struct sa *src, struct mbuf *mb, void *arg);
+typedef void (turn_close_h)(int err, void *arg);
+
+int turn_tcp_recv(struct mbuf **mbp, struct mbuf *mb_pkt,
+		  struct turnc *turnc, turn_recv_h *recvh, void *arg);
+
+
+/*
+ * Pool of pre-established TURN allocations
+ */
+
+struct turn_alloc;
+
+int  turnpool_init(void);
+void turnpool_close(void);
+int  turnpool_warm(struct dnsc *dnsc, int af, const struct stun_uri *srv,
+		   const char *user, const char *pass);
+const struct sa *turnpool_srv(int af, const struct stun_uri *srv,
+			      const char *user, const char *pass);
+struct turn_alloc *turnpool_get(int af, const struct stun_uri *srv,
+				const char *user, const char *pass);
+int  turnpool_debug(struct re_printf *pf, void *unused);
+
+void turn_alloc_set_handlers(struct turn_alloc *ta, turn_recv_h *recvh,
+			     turn_close_h *closeh, void *arg);
+struct turnc *turn_alloc_turnc(const struct turn_alloc *ta);
+const struct sa *turn_alloc_relay(const struct turn_alloc *ta);
@@ -375,6 +375,9 @@ static int audio_codecs_decode(struct account *acc, const struct pl *prm)
 		if (msg_param_decode(prm, "audio_codecs", &acs))
 			return 0;
 
+		/* codec modules may not be loaded yet */
+		module_lazy_load("aucodec");
+
 		while (0 == csl_parse(&acs, cname, sizeof(cname))) {
 			struct aucodec *ac;
 			struct pl pl_cname, pl_srate, pl_ch = PL_INIT;
@@ -433,6 +436,8 @@ static int video_codecs_decode(struct account *acc, const struct pl *prm)
 		if (msg_param_decode(prm, "video_codecs", &vcs))
 			return 0;
 
+		module_lazy_load("vidcodec");
+
 		while (0 == csl_parse(&vcs, cname, sizeof(cname))) {
 			struct le *le;
 
@@ -56,6 +56,8 @@ const struct aucodec *aucodec_find(const struct list *aucodecl,
 {
 	struct le *le;
 
+	module_lazy_load("aucodec");
+
 	for (le=list_head(aucodecl); le; le=le->next) {
 
 		struct aucodec *ac = le->data;
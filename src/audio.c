@@ -54,10 +54,9 @@
 
 enum {
 	MAX_SRATE       = 48000,  /* Maximum sample rate in [Hz] */
-	MAX_CHANNELS    =     2,  /* Maximum number of channels  */
 	MAX_PTIME       =    60,  /* Maximum packet time in [ms] */
 
-	AUDIO_SAMPSZ    = MAX_SRATE * MAX_CHANNELS * MAX_PTIME / 1000,
+	AUDIO_SAMPSZ    = MAX_SRATE * MAX_PTIME / 1000,  /* per channel */
 };
 
 
@@ -113,6 +112,9 @@ struct autx {
 		RE_ATOMIC bool run;   /**< Audio transmit thread running   */
 	} thr;
 
+	struct bcast_member *bcm;     /**< Broadcast group membership      */
+	bool bcast_follow;            /**< Sends the payload of a leader   */
+
 	mtx_t *mtx;
 };
 
@@ -201,6 +203,10 @@ static void audio_destructor(void *arg)
 
 	debug("audio: destroyed (started=%d)\n", a->started);
 
+	/* leave the group without restarting the source */
+	a->tx.bcast_follow = false;
+	bcast_member_close(a->tx.bcm);
+
 	stop_tx(&a->tx, a);
 	stream_enable_rx(a->strm, false);
 	aurecv_stop(a->aur);
@@ -260,17 +266,11 @@ static int add_audio_codec(struct sdp_media *m, struct aucodec *ac)
 }
 
 
-static int append_rtpext(struct audio *au, struct mbuf *mb,
-			 enum aufmt fmt, const void *sampv, size_t sampc)
+static int append_rtpext(struct audio *au, struct mbuf *mb, double level)
 {
 	uint8_t data[1];
-	double level;
 	int err;
 
-	/* audio level must be calculated from the audio samples that
-	 * are actually sent on the network. */
-	level = aulevel_calc_dbov(fmt, sampv, sampc);
-
 	data[0] = (int)-level & 0x7f;
 
 	err = rtpext_encode(mb, au->extmap_aulevel, 1, data);
@@ -283,6 +283,58 @@ static int append_rtpext(struct audio *au, struct mbuf *mb,
 }
 
 
+/*
+ * Write the RTP header extensions at STREAM_PRESZ, the payload follows
+ * at mb->pos
+ */
+static int encode_rtpext(struct audio *a, struct mbuf *mb, double level,
+			 size_t *ext_lenp)
+{
+	struct bundle *bun = stream_bundle(a->strm);
+	bool bundled = bundle_state(bun) != BUNDLE_NONE;
+	size_t ext_len;
+	int err;
+
+	mb->pos = mb->end = STREAM_PRESZ;
+	*ext_lenp = 0;
+
+	if (!a->level_enabled && !bundled)
+		return 0;
+
+	/* skip the extension header */
+	mb->pos += RTPEXT_HDR_SIZE;
+
+	if (a->level_enabled) {
+		err = append_rtpext(a, mb, level);
+		if (err)
+			return err;
+	}
+
+	if (bundled) {
+		const char *mid = stream_mid(a->strm);
+
+		rtpext_encode(mb, bundle_extmap_mid(bun),
+			      str_len(mid), (void *)mid);
+	}
+
+	ext_len = mb->pos - STREAM_PRESZ;
+
+	/* write the Extension header at the beginning */
+	mb->pos = STREAM_PRESZ;
+
+	err = rtpext_hdr_encode(mb, ext_len - RTPEXT_HDR_SIZE);
+	if (err)
+		return err;
+
+	mb->pos = STREAM_PRESZ + ext_len;
+	mb->end = STREAM_PRESZ + ext_len;
+
+	*ext_lenp = ext_len;
+
+	return 0;
+}
+
+
 /*
  * Encode audio and send via stream
  *
@@ -291,19 +343,22 @@ static int append_rtpext(struct audio *au, struct mbuf *mb,
 static void encode_rtp_send(struct audio *a, struct autx *tx,
 			    struct auframe *af)
 {
-	struct bundle *bun = stream_bundle(a->strm);
-	bool bundled = bundle_state(bun) != BUNDLE_NONE;
 	size_t frame_size;  /* number of samples per channel */
 	size_t sampc_rtp;
 	size_t len;
 	size_t ext_len = 0;
 	uint32_t ts_delta = 0;
 	bool marker = tx->marker;
+	double level = 0.0;
 	int err;
 
 	if (!tx->ac || !tx->ac->ench)
 		return;
 
+	/* payload is forwarded by the media relay */
+	if (stream_is_relayed(a->strm))
+		return;
+
 	if (tx->ac->srate != af->srate || tx->ac->ch != af->ch) {
 		warning("audio: srate/ch of frame %u/%u vs audio codec %u/%u. "
 			"Use module auresamp!\n",
@@ -311,39 +366,15 @@ static void encode_rtp_send(struct audio *a, struct autx *tx,
 		return;
 	}
 
-	tx->mb->pos = tx->mb->end = STREAM_PRESZ;
-
-	if (a->level_enabled || bundled) {
-
-		/* skip the extension header */
-		tx->mb->pos += RTPEXT_HDR_SIZE;
-
-		if (a->level_enabled) {
-			err = append_rtpext(a, tx->mb, af->fmt,
-					    af->sampv, af->sampc);
-			if (err)
-				return;
-		}
-
-		if (bundled) {
-			const char *mid = stream_mid(a->strm);
-
-			rtpext_encode(tx->mb, bundle_extmap_mid(bun),
-				      str_len(mid), (void *)mid);
-		}
-
-		ext_len = tx->mb->pos - STREAM_PRESZ;
-
-		/* write the Extension header at the beginning */
-		tx->mb->pos = STREAM_PRESZ;
-
-		err = rtpext_hdr_encode(tx->mb, ext_len - RTPEXT_HDR_SIZE);
-		if (err)
-			return;
+	/* audio level must be calculated from the audio samples that
+	 * are actually sent on the network. The broadcast followers
+	 * get the same level. */
+	if (a->level_enabled || tx->bcm)
+		level = aulevel_calc_dbov(af->fmt, af->sampv, af->sampc);
 
-		tx->mb->pos = STREAM_PRESZ + ext_len;
-		tx->mb->end = STREAM_PRESZ + ext_len;
-	}
+	err = encode_rtpext(a, tx->mb, level, &ext_len);
+	if (err)
+		return;
 
 	len = mbuf_get_space(tx->mb);
 
@@ -366,6 +397,24 @@ static void encode_rtp_send(struct audio *a, struct autx *tx,
 	tx->mb->pos = STREAM_PRESZ;
 	tx->mb->end = STREAM_PRESZ + ext_len + len;
 
+	/* Convert from audio samplerate to RTP clockrate */
+	sampc_rtp = af->sampc * tx->ac->crate / tx->ac->srate;
+
+	/* The RTP clock rate used for generating the RTP timestamp is
+	 * independent of the number of channels and the encoding
+	 * However, MPA support variable packet durations. Thus, MPA
+	 * should update the ts according to its current internal state.
+	 */
+	frame_size = sampc_rtp / tx->ac->ch;
+	if (ts_delta && mbuf_get_left(tx->mb))
+		frame_size = ts_delta;
+
+	/* fan out the payload to the broadcast followers */
+	mtx_lock(a->tx.mtx);
+	bcast_send(tx->bcm, marker, tx->mb->buf + STREAM_PRESZ + ext_len,
+		   len, level, (uint32_t)frame_size);
+	mtx_unlock(a->tx.mtx);
+
 	if (mbuf_get_left(tx->mb)) {
 
 		uint32_t rtp_ts = tx->ts_ext & 0xffffffff;
@@ -378,25 +427,8 @@ static void encode_rtp_send(struct audio *a, struct autx *tx,
 			if (err)
 				goto out;
 		}
-
-		if (ts_delta) {
-			mtx_lock(a->tx.mtx);
-			tx->ts_ext += ts_delta;
-			mtx_unlock(a->tx.mtx);
-			goto out;
-		}
 	}
 
-	/* Convert from audio samplerate to RTP clockrate */
-	sampc_rtp = af->sampc * tx->ac->crate / tx->ac->srate;
-
-	/* The RTP clock rate used for generating the RTP timestamp is
-	 * independent of the number of channels and the encoding
-	 * However, MPA support variable packet durations. Thus, MPA
-	 * should update the ts according to its current internal state.
-	 */
-	frame_size = sampc_rtp / tx->ac->ch;
-
 	mtx_lock(a->tx.mtx);
 	tx->ts_ext += (uint32_t)frame_size;
 	mtx_unlock(a->tx.mtx);
@@ -543,8 +575,9 @@ static void ausrc_read_handler(struct auframe *af, void *arg)
 
 		++tx->stats.aubuf_overrun;
 
-		debug("audio: tx aubuf overrun (total %llu)\n",
-		      tx->stats.aubuf_overrun);
+		LOG_RATELIMIT(LEVEL_DEBUG,
+			      "audio: tx aubuf overrun (total %llu)\n",
+			      tx->stats.aubuf_overrun);
 	}
 
 	(void)aubuf_write_auframe(tx->aubuf, af);
@@ -626,7 +659,7 @@ static int stream_pt_handler(uint8_t pt, struct mbuf *mb, void *arg)
  * Stream receive handler for audio is called from RX thread if enabled
  */
 static void stream_recv_handler(const struct rtp_header *hdr,
-				struct rtpext *extv, size_t extc,
+				const struct rtpext_tbl *ext,
 				struct mbuf *mb, unsigned lostc, bool *ignore,
 				void *arg)
 {
@@ -637,7 +670,7 @@ static void stream_recv_handler(const struct rtp_header *hdr,
 	if (!a->aur)
 		return;
 
-	aurecv_receive(a->aur, hdr, extv, extc, mb, lostc, ignore);
+	aurecv_receive(a->aur, hdr, ext, mb, lostc, ignore);
 }
 
 
@@ -664,6 +697,22 @@ static int add_telev_codec(struct audio *a)
 }
 
 
+/* Channels of the largest frame, the codec with the most channels */
+static uint32_t max_channels(const struct list *aucodecl, uint32_t ch)
+{
+	struct le *le;
+
+	for (le = list_head(aucodecl); le; le = le->next) {
+
+		const struct aucodec *ac = le->data;
+
+		ch = max(ch, ac->ch);
+	}
+
+	return ch;
+}
+
+
 /**
  * Allocate an audio stream
  *
@@ -701,6 +750,7 @@ int audio_alloc(struct audio **ap, struct list *streaml,
 	struct autx *tx;
 	struct le *le;
 	uint32_t minptime = ptime;
+	size_t sampc;
 	int err;
 
 	if (!ap || !cfg)
@@ -733,10 +783,15 @@ int audio_alloc(struct audio **ap, struct list *streaml,
 	if (err)
 		goto out;
 
-	err = aurecv_alloc(&a->aur, &a->cfg, AUDIO_SAMPSZ, ptime);
+	sampc = AUDIO_SAMPSZ * max_channels(aucodecl,
+					    max(cfg->audio.channels_src, 2));
+
+	err = aurecv_alloc(&a->aur, &a->cfg, sampc, ptime);
 	if (err)
 		goto out;
 
+	stream_set_playout(a->strm, aurecv_playout(a->aur));
+
 	if (cfg->avt.rtp_bw.max) {
 		sdp_media_set_lbandwidth(stream_sdpmedia(a->strm),
 					 SDP_BANDWIDTH_AS,
@@ -767,6 +822,7 @@ int audio_alloc(struct audio **ap, struct list *streaml,
 
 		a->extmap_aulevel = stream_generate_extmap_id(a->strm);
 		aurecv_set_extmap(a->aur, a->extmap_aulevel);
+		stream_set_extmap(a->strm, a->extmap_aulevel, NULL, NULL);
 
 		err = sdp_media_set_lattr(stream_sdpmedia(a->strm), true,
 					  "extmap",
@@ -777,8 +833,7 @@ int audio_alloc(struct audio **ap, struct list *streaml,
 	}
 
 	tx->mb = mbuf_alloc(STREAM_PRESZ + 4096);
-	tx->sampv = mem_zalloc(AUDIO_SAMPSZ * aufmt_sample_size(tx->enc_fmt),
-			       NULL);
+	tx->sampv = mem_zalloc(sampc * aufmt_sample_size(tx->enc_fmt), NULL);
 
 	if (!tx->mb || !tx->sampv) {
 		err = ENOMEM;
@@ -1029,6 +1084,12 @@ static int start_source(struct autx *tx, struct audio *a, struct list *ausrcl)
 	if (!ac)
 		return 0;
 
+	/* a broadcast follower sends the payload of its leader */
+	if (tx->bcast_follow) {
+		stream_enable_tx(a->strm, true);
+		return 0;
+	}
+
 	srate_dsp    = ac->srate;
 	channels_dsp = ac->ch;
 
@@ -1219,6 +1280,9 @@ int audio_update(struct audio *a)
 		a->started = true;
 	}
 
+	/* the codec may have changed */
+	bcast_member_update(a->tx.bcm);
+
 	return err;
 }
 
@@ -1530,6 +1594,7 @@ static bool extmap_handler(const char *name, const char *value, void *arg)
 
 		a->extmap_aulevel = extmap.id;
 		aurecv_set_extmap(a->aur, a->extmap_aulevel);
+		stream_set_extmap(a->strm, a->extmap_aulevel, NULL, NULL);
 
 		err = sdp_media_set_lattr(stream_sdpmedia(a->strm), true,
 					  "extmap",
@@ -1937,3 +2002,131 @@ struct config_audio *audio_config(struct audio *au)
 {
 	return au ? &au->cfg : NULL;
 }
+
+
+/**
+ * Set the broadcast group membership of an audio stream. A follower
+ * stops its own source and sends the payload encoded by its leader.
+ *
+ * @param a      Audio object
+ * @param m      Broadcast member, NULL to leave the group
+ * @param follow True to follow a leader, false to encode
+ */
+void audio_set_bcast(struct audio *a, struct bcast_member *m, bool follow)
+{
+	struct autx *tx;
+	struct sdp_media *sdp;
+
+	if (!a)
+		return;
+
+	tx = &a->tx;
+
+	mtx_lock(tx->mtx);
+	tx->bcm = m;
+	mtx_unlock(tx->mtx);
+
+	if (follow == tx->bcast_follow)
+		return;
+
+	tx->bcast_follow = follow;
+
+	if (follow) {
+		stop_tx(tx, a);
+		stream_enable_tx(a->strm, true);
+
+		mtx_lock(tx->mtx);
+		tx->marker = true;
+		mtx_unlock(tx->mtx);
+		return;
+	}
+
+	/* encode again, with the own source */
+	sdp = stream_sdpmedia(a->strm);
+	if (!sdp_media_disabled(sdp) && (sdp_media_dir(sdp) & SDP_SENDONLY))
+		(void)start_source(tx, a, baresip_ausrcl());
+}
+
+
+/**
+ * Check if two audio streams encode with identical codec parameters,
+ * so that they can share one encoder
+ *
+ * @param a First audio object
+ * @param b Second audio object
+ *
+ * @return True if equal, otherwise false
+ */
+bool audio_tx_equal(const struct audio *a, const struct audio *b)
+{
+	const struct sdp_format *fa, *fb;
+
+	if (!a || !b || !a->tx.ac || a->tx.ac != b->tx.ac)
+		return false;
+
+	if (a->tx.ptime != b->tx.ptime)
+		return false;
+
+	fa = sdp_media_rformat(stream_sdpmedia(a->strm), NULL);
+	fb = sdp_media_rformat(stream_sdpmedia(b->strm), NULL);
+
+	if (!fa || !fb)
+		return false;
+
+	return 0 == str_casecmp(fa->params ? fa->params : "",
+				fb->params ? fb->params : "");
+}
+
+
+/**
+ * Send an audio payload encoded by the leader of a broadcast group,
+ * with the RTP timestamp, extensions and payload type of this stream
+ *
+ * @note This function has REAL-TIME properties
+ *
+ * @param a      Audio object
+ * @param marker Marker bit
+ * @param pld    Encoded payload
+ * @param len    Payload length, 0 to only advance the timestamp
+ * @param level  Audio level in [dBov]
+ * @param ts_inc RTP timestamp increment
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int audio_send_encoded(struct audio *a, bool marker, const uint8_t *pld,
+		       size_t len, double level, uint32_t ts_inc)
+{
+	struct autx *tx;
+	size_t ext_len;
+	int err = 0;
+
+	if (!a)
+		return EINVAL;
+
+	tx = &a->tx;
+
+	mtx_lock(tx->mtx);
+
+	if (len) {
+		err = encode_rtpext(a, tx->mb, level, &ext_len);
+		if (err)
+			goto out;
+
+		err = mbuf_write_mem(tx->mb, pld, len);
+		if (err)
+			goto out;
+
+		tx->mb->pos = STREAM_PRESZ;
+
+		err = stream_send(a->strm, ext_len != 0, marker || tx->marker,
+				  -1, tx->ts_ext & 0xffffffff, tx->mb);
+
+		tx->marker = false;
+	}
+
+ out:
+	tx->ts_ext += ts_inc;
+	mtx_unlock(tx->mtx);
+
+	return err;
+}
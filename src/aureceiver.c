@@ -48,6 +48,8 @@ struct audio_recv {
 	size_t sampvsz;               /**< Sample buffer size                */
 	uint64_t t;                   /**< Last auframe push time            */
 	uint32_t ptime;               /**< Packet time for receiving [us]    */
+	struct playout *po;           /**< Playout delay controller (opt.)   */
+	struct austretch *stretch;    /**< Time-stretching (with po)         */
 
 	double level_last;            /**< Last audio level value [dBov]     */
 	bool level_set;               /**< True if level_last is set         */
@@ -79,6 +81,8 @@ static void destructor(void *arg)
 	struct audio_recv *ar = arg;
 
 	mem_deref(ar->dec);
+	mem_deref(ar->po);
+	mem_deref(ar->stretch);
 	mem_deref(ar->aubuf);
 	mem_deref(ar->aubuf_mtx);
 	mem_deref(ar->sampv);
@@ -148,7 +152,8 @@ static int aurecv_alloc_aubuf(struct audio_recv *ar, const struct auframe *af)
 			err);
 	}
 
-	aubuf_set_mode(ar->aubuf, cfg->adaptive ?
+	/* the playout delay controller keeps the level by itself */
+	aubuf_set_mode(ar->aubuf, cfg->adaptive && !ar->po ?
 		       AUBUF_ADAPTIVE : AUBUF_FIXED);
 	aubuf_set_silence(ar->aubuf, cfg->silence);
 	mtx_unlock(ar->aubuf_mtx);
@@ -156,8 +161,33 @@ static int aurecv_alloc_aubuf(struct audio_recv *ar, const struct auframe *af)
 }
 
 
-static int aurecv_push_aubuf(struct audio_recv *ar, const struct auframe *af)
+/*
+ * Play a frame a bit faster or slower, to move the level of the audio
+ * buffer towards the target of the playout delay controller
+ */
+static void aurecv_stretch(struct audio_recv *ar, struct auframe *af)
+{
+	uint64_t bpms = (uint64_t)af->srate * af->ch *
+		aufmt_sample_size(af->fmt) / 1000;
+	size_t maxc = 0;
+
+	if (!bpms || !aubuf_started(ar->aubuf))
+		return;
+
+	/* a decoder filter may have its own sample buffer */
+	if (af->sampv == ar->sampv)
+		maxc = ar->sampvsz / aufmt_sample_size(af->fmt);
+
+	(void)austretch_process(ar->stretch, af, maxc,
+				(uint32_t)(aubuf_cur_size(ar->aubuf) / bpms),
+				playout_aubuf_target(ar->po));
+}
+
+
+static int aurecv_push_aubuf(struct audio_recv *ar, struct auframe *af)
 {
+	int32_t d, da;
+	uint64_t t;
 	int err;
 	uint64_t bpms;
 
@@ -167,9 +197,6 @@ static int aurecv_push_aubuf(struct audio_recv *ar, const struct auframe *af)
 			return err;
 	}
 
-#ifndef RELEASE
-	int32_t d, da;
-	uint64_t t;
 	t = tmr_jiffies_usec();
 	if (ar->t) {
 		d = (int32_t) (int64_t) ((t - ar->t) - ar->ptime);
@@ -179,7 +206,10 @@ static int aurecv_push_aubuf(struct audio_recv *ar, const struct auframe *af)
 	}
 
 	ar->t = t;
-#endif
+
+	if (ar->stretch)
+		aurecv_stretch(ar, af);
+
 	err = aubuf_write_auframe(ar->aubuf, af);
 	if (err)
 		return err;
@@ -246,7 +276,8 @@ static int aurecv_stream_decode(struct audio_recv *ar,
 	auframe_init(&af, ar->fmt, ar->sampv, sampc, ac->srate, ac->ch);
 	af.timestamp = ((uint64_t) hdr->ts) * AUDIO_TIMEBASE / ac->crate;
 
-	if (drop) {
+	/* with time-stretching the frame is drained smoothly instead */
+	if (drop && !ar->stretch) {
 		aubuf_drop_auframe(ar->aubuf, &af);
 		goto out;
 	}
@@ -264,24 +295,9 @@ static int aurecv_stream_decode(struct audio_recv *ar,
 }
 
 
-/* RFC 5285 -- A General Mechanism for RTP Header Extensions */
-static const struct rtpext *rtpext_find(const struct rtpext *extv, size_t extc,
-					uint8_t id)
-{
-	for (size_t i=0; i<extc; i++) {
-		const struct rtpext *rtpext = &extv[i];
-
-		if (rtpext->id == id)
-			return rtpext;
-	}
-
-	return NULL;
-}
-
-
 /* Handle incoming stream data from the network */
 void aurecv_receive(struct audio_recv *ar, const struct rtp_header *hdr,
-		    struct rtpext *extv, size_t extc,
+		    const struct rtpext_tbl *ext,
 		    struct mbuf *mb, unsigned lostc, bool *ignore)
 {
 	bool discard = false;
@@ -301,10 +317,12 @@ void aurecv_receive(struct audio_recv *ar, const struct rtp_header *hdr,
 
 	*ignore = false;
 
-	/* RFC 5285 -- A General Mechanism for RTP Header Extensions */
-	const struct rtpext *ext = rtpext_find(extv, extc, ar->extmap_aulevel);
-	if (ext) {
-		ar->level_last = -(double)(ext->data[0] & 0x7f);
+	/* RFC 6464 -- Client-to-Mixer Audio Level Indication */
+	size_t level_len = 0;
+	const uint8_t *level = rtpext_tbl_find(ext, ar->extmap_aulevel,
+					       &level_len);
+	if (level && level_len) {
+		ar->level_last = -(double)(level[0] & 0x7f);
 		ar->level_set = true;
 	}
 
@@ -425,6 +443,14 @@ int aurecv_alloc(struct audio_recv **aupp, const struct config_audio *cfg,
 
 	err  = mutex_alloc(&ar->mtx);
 	err |= mutex_alloc(&ar->aubuf_mtx);
+	if (err)
+		goto out;
+
+	if (cfg->playout_loss > 0.0) {
+		err  = playout_alloc(&ar->po, ptime, &cfg->buffer,
+				     cfg->playout_loss);
+		err |= austretch_alloc(&ar->stretch);
+	}
 
 out:
 	if (err)
@@ -476,6 +502,7 @@ int aurecv_decoder_set(struct audio_recv *ar,
 	}
 
 	ar->pt = pt;
+	playout_set_crate(ar->po, ac->crate);
 
 out:
 	mtx_unlock(ar->mtx);
@@ -547,6 +574,19 @@ double aurecv_level(const struct audio_recv *ar)
 }
 
 
+/**
+ * Get the playout delay controller of the audio receiver
+ *
+ * @param ar Audio receiver
+ *
+ * @return Playout delay controller, NULL if not enabled
+ */
+struct playout *aurecv_playout(const struct audio_recv *ar)
+{
+	return ar ? ar->po : NULL;
+}
+
+
 const struct aucodec *aurecv_codec(const struct audio_recv *ar)
 {
 	const struct aucodec *ac;
@@ -749,12 +789,12 @@ int aurecv_debug(struct re_printf *pf, const struct audio_recv *ar)
 			   aubuf_cur_size(ar->aubuf) / bpms,
 			   aubuf_maxsz(ar->aubuf) / bpms);
 	mtx_unlock(ar->aubuf_mtx);
-#ifndef RELEASE
 	err |= mbuf_printf(mb, "       SW jitter: %.2fms\n",
 			   (double) ar->stats.jitter / 1000);
 	err |= mbuf_printf(mb, "       deviation: %.2fms\n",
 			   (double) ar->stats.dmax / 1000);
-#endif
+	err |= mbuf_printf(mb, "%H", playout_debug, ar->po);
+	err |= mbuf_printf(mb, "%H", austretch_debug, ar->stretch);
 	err |= mbuf_printf(mb, "       n_discard: %llu\n",
 			   ar->stats.n_discard);
 	if (ar->level_set) {
@@ -65,6 +65,8 @@ const struct ausrc *ausrc_find(const struct list *ausrcl, const char *name)
 {
 	struct le *le;
 
+	module_lazy_load("ausrc");
+
 	for (le=list_head(ausrcl); le; le=le->next) {
 
 		struct ausrc *as = le->data;
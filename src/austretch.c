@@ -0,0 +1,456 @@
+/**
+ * @file austretch.c  Audio time-stretching of decoded frames (WSOLA)
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "core.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define STRETCH_SIMD "sse2"
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define STRETCH_SIMD "neon"
+#else
+#define STRETCH_SIMD "c"
+#endif
+
+
+/*
+ * Waveform similarity overlap-add (WSOLA) within one decoded frame.
+ *
+ * A frame is shortened or lengthened by an offset of about one pitch
+ * period. The offset is the one where the frame is most similar to its
+ * own start, over an overlap window, so the two crossfaded parts are in
+ * phase:
+ *
+ * Shrink by off:  out = in[0 .. ov] fading to in[off .. off + ov],
+ *                       in[off + ov .. n]
+ *
+ * Expand by off:  out = in[0 .. off],
+ *                       in[off .. off + ov] fading to in[0 .. ov],
+ *                       in[ov .. n]
+ *
+ * The similarity is searched on a mono mixdown, first on a decimated
+ * copy and then refined at the full sample rate.
+ *
+ * The playout rate follows the distance of the buffer level from its
+ * target, by at most a few percent. The rate accumulates a credit of
+ * samples, and a frame is stretched when the credit covers the
+ * smallest offset.
+ */
+
+
+enum {
+	OVERLAP_DIV  = 200,    /**< Overlap window, 5 ms                  */
+	SEEK_MIN_DIV = 400,    /**< Smallest offset, 2.5 ms               */
+	SEEK_MAX_DIV = 80,     /**< Largest offset, 12.5 ms               */
+	SEEK_SRATE   = 8000,   /**< Sample rate of the coarse search      */
+	RATE_MAX     = 5,      /**< Maximum rate change [%]               */
+	HORIZON      = 1000,   /**< Time to correct the level error [ms]  */
+};
+
+
+/** Time-stretching state */
+struct austretch {
+	float *monov;          /**< Mono mixdown, full rate, then coarse  */
+	size_t monoc;          /**< Number of frames in monov             */
+	uint8_t *tmp;          /**< Copy of the frame start               */
+	size_t tmpsz;          /**< Size of tmp in bytes                  */
+	double credit;         /**< Frames to remove (+) or add (-)       */
+	double rate;           /**< Rate change, speed-up is positive     */
+	uint32_t srate;        /**< Sample rate of last frame             */
+
+	struct {
+		uint64_t n_in;     /**< Input frames                      */
+		uint64_t n_out;    /**< Output frames                     */
+		uint64_t n_shrink; /**< Shortened audio frames            */
+		uint64_t n_expand; /**< Lengthened audio frames           */
+		uint64_t n_proc;   /**< Processed audio frames            */
+		uint64_t usec;     /**< Processing time [us]              */
+	} stats;
+};
+
+
+static void destructor(void *arg)
+{
+	struct austretch *st = arg;
+
+	mem_deref(st->monov);
+	mem_deref(st->tmp);
+}
+
+
+/* cross-correlation c = x * y, and energy e = y * y */
+static void xcorr(const float *x, const float *y, size_t n,
+		  float *c, float *e)
+{
+	float sc = 0.0f, se = 0.0f;
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	{
+		__m128 ac = _mm_setzero_ps();
+		__m128 ae = _mm_setzero_ps();
+		float vc[4], ve[4];
+
+		for (; i + 4 <= n; i += 4) {
+
+			__m128 a = _mm_loadu_ps(&x[i]);
+			__m128 b = _mm_loadu_ps(&y[i]);
+
+			ac = _mm_add_ps(ac, _mm_mul_ps(a, b));
+			ae = _mm_add_ps(ae, _mm_mul_ps(b, b));
+		}
+
+		_mm_storeu_ps(vc, ac);
+		_mm_storeu_ps(ve, ae);
+		sc = vc[0] + vc[1] + vc[2] + vc[3];
+		se = ve[0] + ve[1] + ve[2] + ve[3];
+	}
+#elif defined(__ARM_NEON)
+	{
+		float32x4_t ac = vdupq_n_f32(0.0f);
+		float32x4_t ae = vdupq_n_f32(0.0f);
+
+		for (; i + 4 <= n; i += 4) {
+
+			float32x4_t a = vld1q_f32(&x[i]);
+			float32x4_t b = vld1q_f32(&y[i]);
+
+			ac = vmlaq_f32(ac, a, b);
+			ae = vmlaq_f32(ae, b, b);
+		}
+
+		sc = vgetq_lane_f32(ac, 0) + vgetq_lane_f32(ac, 1) +
+			vgetq_lane_f32(ac, 2) + vgetq_lane_f32(ac, 3);
+		se = vgetq_lane_f32(ae, 0) + vgetq_lane_f32(ae, 1) +
+			vgetq_lane_f32(ae, 2) + vgetq_lane_f32(ae, 3);
+	}
+#endif
+
+	for (; i < n; i++) {
+		sc += x[i] * y[i];
+		se += y[i] * y[i];
+	}
+
+	*c = sc;
+	*e = se;
+}
+
+
+/* offset in [lo, hi] where x is most similar to its start */
+static size_t seek(const float *x, size_t ov, size_t lo, size_t hi)
+{
+	float best = -1.0f;
+	size_t off = lo;
+
+	for (size_t k = lo; k <= hi; k++) {
+
+		float c, e, score;
+
+		xcorr(x, x + k, ov, &c, &e);
+
+		/* normalised correlation, squared with sign */
+		score = e > 1e-9f ? c * (c < 0 ? -c : c) / e : 0.0f;
+		if (score > best) {
+			best = score;
+			off  = k;
+		}
+	}
+
+	return off;
+}
+
+
+static void mixdown(float *dst, const struct auframe *af, size_t nf)
+{
+	const float scale = 1.0f / (float)af->ch;
+
+	for (size_t k = 0; k < nf; k++) {
+
+		float v = 0.0f;
+
+		for (unsigned c = 0; c < af->ch; c++) {
+
+			const size_t i = k * af->ch + c;
+
+			if (af->fmt == AUFMT_S16LE)
+				v += ((const int16_t *)af->sampv)[i];
+			else
+				v += ((const float *)af->sampv)[i] * 32768.0f;
+		}
+
+		dst[k] = v * scale;
+	}
+}
+
+
+static size_t search(struct austretch *st, const struct auframe *af,
+		     size_t nf, size_t ov, size_t lo, size_t hi)
+{
+	const size_t dec = max(af->srate / SEEK_SRATE, 1u);
+	float *mono = st->monov;
+	float *coarse = st->monov + nf;
+	size_t off, klo, khi;
+
+	mixdown(mono, af, nf);
+
+	if (dec == 1)
+		return seek(mono, ov, lo, hi);
+
+	for (size_t j = 0; j < nf / dec; j++) {
+
+		float v = 0.0f;
+
+		for (size_t i = 0; i < dec; i++)
+			v += mono[j * dec + i];
+
+		coarse[j] = v;
+	}
+
+	off = seek(coarse, ov / dec, (lo + dec - 1) / dec, hi / dec) * dec;
+
+	klo = off > lo + dec ? off - dec : lo;
+	khi = min(off + dec, hi);
+
+	return seek(mono, ov, klo, khi);
+}
+
+
+static void fade(enum aufmt fmt, void *dst, const void *a, const void *b,
+		 size_t n, unsigned ch)
+{
+	const float step = 1.0f / (float)n;
+
+	for (size_t k = 0; k < n; k++) {
+
+		const float w = step * (float)k;
+
+		for (unsigned c = 0; c < ch; c++) {
+
+			const size_t i = k * ch + c;
+
+			if (fmt == AUFMT_S16LE) {
+				const float x = ((const int16_t *)a)[i];
+				const float y = ((const int16_t *)b)[i];
+
+				((int16_t *)dst)[i] =
+					(int16_t)(x + (y - x) * w);
+			}
+			else {
+				const float x = ((const float *)a)[i];
+				const float y = ((const float *)b)[i];
+
+				((float *)dst)[i] = x + (y - x) * w;
+			}
+		}
+	}
+}
+
+
+static void shrink(struct auframe *af, size_t nf, size_t ov, size_t off)
+{
+	const size_t sz = aufmt_sample_size(af->fmt) * af->ch;
+	uint8_t *p = af->sampv;
+
+	fade(af->fmt, p, p, p + off * sz, ov, af->ch);
+	memmove(p + ov * sz, p + (off + ov) * sz, (nf - off - ov) * sz);
+
+	af->sampc -= off * af->ch;
+}
+
+
+static void expand(struct austretch *st, struct auframe *af, size_t nf,
+		   size_t ov, size_t off)
+{
+	const size_t sz = aufmt_sample_size(af->fmt) * af->ch;
+	uint8_t *p = af->sampv;
+
+	/* the start is overwritten by the fade if off < ov */
+	memcpy(st->tmp, p, ov * sz);
+	memmove(p + (off + ov) * sz, p + ov * sz, (nf - ov) * sz);
+	fade(af->fmt, p + off * sz, p + off * sz, st->tmp, ov, af->ch);
+
+	af->sampc += off * af->ch;
+}
+
+
+static int buffers(struct austretch *st, const struct auframe *af,
+		   size_t nf, size_t ov)
+{
+	const size_t tmpsz = ov * aufmt_sample_size(af->fmt) * af->ch;
+
+	if (nf > st->monoc) {
+
+		float *monov = mem_alloc(2 * nf * sizeof(*monov), NULL);
+		if (!monov)
+			return ENOMEM;
+
+		mem_deref(st->monov);
+		st->monov = monov;
+		st->monoc = nf;
+	}
+
+	if (tmpsz > st->tmpsz) {
+
+		uint8_t *tmp = mem_alloc(tmpsz, NULL);
+		if (!tmp)
+			return ENOMEM;
+
+		mem_deref(st->tmp);
+		st->tmp   = tmp;
+		st->tmpsz = tmpsz;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Allocate a time-stretching state
+ *
+ * @param stp Pointer to allocated state
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int austretch_alloc(struct austretch **stp)
+{
+	struct austretch *st;
+
+	if (!stp)
+		return EINVAL;
+
+	st = mem_zalloc(sizeof(*st), destructor);
+	if (!st)
+		return ENOMEM;
+
+	*stp = st;
+
+	return 0;
+}
+
+
+/**
+ * Play an audio frame faster or slower, to move the buffer level towards
+ * its target. The frame is changed in place.
+ *
+ * @param st     Time-stretching state
+ * @param af     Audio frame, S16LE or FLOAT
+ * @param maxc   Capacity of the sample buffer [samples], 0 if the frame
+ *               can not be lengthened
+ * @param level  Buffer level [ms]
+ * @param target Target buffer level [ms]
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int austretch_process(struct austretch *st, struct auframe *af,
+		      size_t maxc, uint32_t level, uint32_t target)
+{
+	uint64_t t0 = tmr_jiffies_usec();
+	size_t nf, ov, lo, hi, off;
+	int32_t error, band;
+	int err = 0;
+
+	if (!st || !af || !af->ch || !af->srate || !af->sampv)
+		return EINVAL;
+
+	nf = af->sampc / af->ch;
+	st->stats.n_in += nf;
+
+	if (af->fmt != AUFMT_S16LE && af->fmt != AUFMT_FLOAT)
+		goto out;
+
+	if (af->srate != st->srate) {
+		st->srate  = af->srate;
+		st->credit = 0.0;
+	}
+
+	/* the level moves by one frame when the player reads */
+	error = (int32_t)level - (int32_t)target;
+	band  = (int32_t)(nf * 1000 / af->srate / 2);
+
+	if (error > band || error < -band) {
+		st->rate = (double)error / HORIZON;
+		st->rate = min(st->rate,  RATE_MAX / 100.0);
+		st->rate = max(st->rate, -RATE_MAX / 100.0);
+	}
+	else {
+		st->rate   = 0.0;
+		st->credit = 0.0;
+	}
+
+	st->credit += st->rate * (double)nf;
+
+	ov = af->srate / OVERLAP_DIV;
+	lo = af->srate / SEEK_MIN_DIV;
+	hi = af->srate / SEEK_MAX_DIV;
+	if (nf < ov + hi)
+		hi = nf > ov ? nf - ov : 0;
+
+	if (!lo || hi < lo ||
+	    (st->credit < (double)lo && st->credit > -(double)lo))
+		goto out;
+
+	if (st->credit < 0 && af->sampc + hi * af->ch > maxc)
+		goto out;
+
+	err = buffers(st, af, nf, ov);
+	if (err)
+		goto out;
+
+	off = search(st, af, nf, ov, lo, hi);
+
+	if (st->credit > 0) {
+		shrink(af, nf, ov, off);
+		st->credit -= (double)off;
+		++st->stats.n_shrink;
+	}
+	else {
+		expand(st, af, nf, ov, off);
+		st->credit += (double)off;
+		++st->stats.n_expand;
+	}
+
+ out:
+	st->stats.n_out += af->sampc / af->ch;
+	++st->stats.n_proc;
+	st->stats.usec += tmr_jiffies_usec() - t0;
+
+	return err;
+}
+
+
+/**
+ * Print the time-stretching statistics
+ *
+ * @param pf Print function
+ * @param st Time-stretching state
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int austretch_debug(struct re_printf *pf, const struct austretch *st)
+{
+	double audio_us;
+
+	if (!st)
+		return 0;
+
+	audio_us = st->srate ? st->stats.n_in * 1e6 / st->srate : 0.0;
+
+	return re_hprintf(pf, "       stretch (wsola, %s): rate %+.1f%%,"
+			  " ratio %.4f, %llu shortened, %llu lengthened\n"
+			  "                cpu %.1fus/frame (%.3f%%)\n",
+			  STRETCH_SIMD, st->rate * 100.0,
+			  st->stats.n_in ?
+			  (double)st->stats.n_out / st->stats.n_in : 1.0,
+			  st->stats.n_shrink, st->stats.n_expand,
+			  st->stats.n_proc ?
+			  (double)st->stats.usec / st->stats.n_proc : 0.0,
+			  audio_us > 0 ?
+			  100.0 * st->stats.usec / audio_us : 0.0);
+}
@@ -18,6 +18,8 @@ static struct baresip {
 	struct commands *commands;
 	struct player *player;
 	struct message *message;
+	struct rtpports *rtpports;
+	struct mediaclock *mediaclock;
 	struct list mnatl;
 	struct list mencl;
 	struct list aucodecl;
@@ -76,10 +78,43 @@ static int rmmod_handler(struct re_printf *pf, void *arg)
 }
 
 
+static int rtpports_handler(struct re_printf *pf, void *unused)
+{
+	(void)unused;
+
+	return rtpports_debug(pf, baresip.rtpports);
+}
+
+
+static int mediaclock_handler(struct re_printf *pf, void *unused)
+{
+	(void)unused;
+
+	return mediaclock_debug(pf, baresip.mediaclock);
+}
+
+
+static int setupstat_handler(struct re_printf *pf, void *arg)
+{
+	const struct cmd_arg *carg = arg;
+
+	if (0 == str_casecmp(carg->prm, "reset")) {
+		setupstat_reset();
+		return re_hprintf(pf, "call setup statistics cleared\n");
+	}
+
+	return setupstat_debug(pf, NULL);
+}
+
+
 static const struct cmd corecmdv[] = {
 	{"quit", 'q', 0, "Quit",                     cmd_quit             },
 	{"insmod", 0, CMD_PRM, "Load module",        insmod_handler       },
 	{"rmmod",  0, CMD_PRM, "Unload module",      rmmod_handler        },
+	{"rtpports", 0, 0, "RTP port allocator",     rtpports_handler     },
+	{"mediaclock", 0, 0, "Media clock workers",  mediaclock_handler   },
+	{"setupstat", 0, CMD_PRM, "Call setup stats", setupstat_handler   },
+	{"mempool", 0, 0, "Memory pool statistics",  mempool_debug        },
 };
 
 
@@ -99,6 +134,10 @@ int baresip_init(struct config *cfg)
 
 	baresip.net = mem_deref(baresip.net);
 
+	err = mempool_init();
+	if (err)
+		return err;
+
 	list_init(&baresip.mnatl);
 	list_init(&baresip.mencl);
 	list_init(&baresip.aucodecl);
@@ -134,6 +173,16 @@ int baresip_init(struct config *cfg)
 		return err;
 	}
 
+	baresip.rtpports = mem_deref(baresip.rtpports);
+	err = rtpports_alloc(&baresip.rtpports, &cfg->avt);
+	if (err)
+		return err;
+
+	baresip.mediaclock = mem_deref(baresip.mediaclock);
+	err = mediaclock_alloc(&baresip.mediaclock);
+	if (err)
+		return err;
+
 	err = cmd_register(baresip.commands, corecmdv,RE_ARRAY_SIZE(corecmdv));
 	if (err)
 		return err;
@@ -150,6 +199,8 @@ void baresip_close(void)
 	cmd_unregister(baresip.commands, corecmdv);
 
 	baresip.message = mem_deref(baresip.message);
+	baresip.rtpports = mem_deref(baresip.rtpports);
+	baresip.mediaclock = mem_deref(baresip.mediaclock);
 	baresip.player = mem_deref(baresip.player);
 	baresip.commands = mem_deref(baresip.commands);
 	baresip.contacts = mem_deref(baresip.contacts);
@@ -157,6 +208,8 @@ void baresip_close(void)
 	baresip.net = mem_deref(baresip.net);
 
 	ui_reset(&baresip.uis);
+
+	mempool_close();
 }
 
 
@@ -171,6 +224,28 @@ struct network *baresip_network(void)
 }
 
 
+/**
+ * Get the RTP port allocator
+ *
+ * @return RTP port allocator
+ */
+struct rtpports *baresip_rtpports(void)
+{
+	return baresip.rtpports;
+}
+
+
+/**
+ * Get the media clock service
+ *
+ * @return Media clock service
+ */
+struct mediaclock *baresip_mediaclock(void)
+{
+	return baresip.mediaclock;
+}
+
+
 /**
  * Get the contacts subsystem
  *
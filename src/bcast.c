@@ -0,0 +1,433 @@
+/**
+ * @file bcast.c  Audio broadcast group, encode once and send to many calls
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * A broadcast group is a set of calls that send the same audio, as used
+ * for paging and intercom. Calls that are sending with identical codec
+ * parameters share one encoder: the first of them in the group is the
+ * leader, which runs the only audio source, filter chain and encoder.
+ * Each encoded frame of the leader is handed to its followers, which
+ * send it with their own SSRC, sequence number, timestamp, RTP header
+ * extensions and SRTP context. The cost of a page is then one encoder
+ * invocation per ptime and codec, plus one packet per call.
+ *
+ * Calls that cannot share an encoder lead their own group of one. When
+ * a leader leaves, or its codec changes, the next member takes over and
+ * starts its own source.
+ *
+ * Members are added and removed in the main thread, the payload is sent
+ * from the transmit thread of the leader. The follower lists are
+ * protected by the group mutex.
+ */
+
+
+/** One call in a broadcast group */
+struct bcast_member {
+	struct le le;              /**< Member list entry                */
+	struct le fle;             /**< Follower list entry of leader    */
+	struct bcast *bc;          /**< Parent, NULL when closed         */
+	const struct call *call;   /**< Call (weak)                      */
+	struct audio *audio;       /**< Audio stream (weak)              */
+	struct bcast_member *leader;      /**< Current leader, or NULL   */
+	struct bcast_member *next_leader; /**< Leader after election     */
+	struct list followerl;     /**< Members sending our payload      */
+	bool follow;               /**< Audio is following a leader      */
+	uint64_t n_pkt;            /**< Packets sent to followers        */
+	uint64_t n_err;            /**< Send errors of followers         */
+};
+
+/** Audio broadcast group */
+struct bcast {
+	struct list memberl;
+	mtx_t *mtx;
+};
+
+
+static struct bcast_member *member_find(const struct bcast *bc,
+					const struct call *call)
+{
+	for (struct le *le = bc->memberl.head; le; le = le->next) {
+
+		struct bcast_member *m = le->data;
+
+		if (m->call == call)
+			return m;
+	}
+
+	return NULL;
+}
+
+
+static bool member_sending(const struct bcast_member *m)
+{
+	struct sdp_media *sdp = stream_sdpmedia(audio_strm(m->audio));
+
+	return !sdp_media_disabled(sdp) &&
+		(sdp_media_dir(sdp) & SDP_SENDONLY);
+}
+
+
+/* a sending member follows the first equal member that encodes itself */
+static struct bcast_member *find_leader(const struct bcast *bc,
+					const struct bcast_member *m)
+{
+	if (!member_sending(m))
+		return NULL;
+
+	for (struct le *le = bc->memberl.head; le; le = le->next) {
+
+		struct bcast_member *l = le->data;
+
+		if (l == m)
+			break;
+
+		if (!l->next_leader && member_sending(l) &&
+		    audio_tx_equal(l->audio, m->audio))
+			return l;
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Elect the leaders of the group. The audio sources are stopped and
+ * started outside of the group lock, since the transmit thread of a
+ * leader takes the lock while sending.
+ */
+static void elect(struct bcast *bc)
+{
+	struct le *le;
+
+	for (le = bc->memberl.head; le; le = le->next) {
+
+		struct bcast_member *m = le->data;
+
+		m->next_leader = find_leader(bc, m);
+	}
+
+	for (le = bc->memberl.head; le; le = le->next) {
+
+		struct bcast_member *m = le->data;
+
+		if (m->next_leader && !m->follow) {
+			m->follow = true;
+			audio_set_bcast(m->audio, m, true);
+		}
+	}
+
+	mtx_lock(bc->mtx);
+
+	for (le = bc->memberl.head; le; le = le->next) {
+
+		struct bcast_member *m = le->data;
+
+		if (m->leader == m->next_leader)
+			continue;
+
+		list_unlink(&m->fle);
+		m->leader = m->next_leader;
+
+		if (m->leader)
+			list_append(&m->leader->followerl, &m->fle, m);
+	}
+
+	mtx_unlock(bc->mtx);
+
+	for (le = bc->memberl.head; le; le = le->next) {
+
+		struct bcast_member *m = le->data;
+
+		if (!m->next_leader && m->follow) {
+			m->follow = false;
+			audio_set_bcast(m->audio, m, false);
+		}
+	}
+}
+
+
+static void member_destructor(void *arg)
+{
+	struct bcast_member *m = arg;
+
+	list_unlink(&m->le);
+	list_unlink(&m->fle);
+}
+
+
+/**
+ * Remove a member from its broadcast group, the audio stream encodes
+ * with its own source again. Followers of the member get a new leader.
+ *
+ * @param m Broadcast member
+ */
+void bcast_member_close(struct bcast_member *m)
+{
+	struct bcast *bc;
+
+	if (!m || !m->bc)
+		return;
+
+	bc = m->bc;
+
+	mtx_lock(bc->mtx);
+
+	list_unlink(&m->le);
+	list_unlink(&m->fle);
+	m->leader = NULL;
+
+	while (m->followerl.head) {
+
+		struct bcast_member *f = m->followerl.head->data;
+
+		list_unlink(&f->fle);
+		f->leader = NULL;
+	}
+
+	m->bc = NULL;
+
+	mtx_unlock(bc->mtx);
+
+	audio_set_bcast(m->audio, NULL, false);
+
+	elect(bc);
+
+	mem_deref(m);
+}
+
+
+/**
+ * Elect the leaders again after an SDP update of a member, since the
+ * codec or the direction may have changed
+ *
+ * @param m Broadcast member
+ */
+void bcast_member_update(struct bcast_member *m)
+{
+	if (!m || !m->bc)
+		return;
+
+	elect(m->bc);
+}
+
+
+/**
+ * Send an encoded audio frame of a leader to its followers
+ *
+ * @note This function has REAL-TIME properties
+ *
+ * @param m      Broadcast member of the leader
+ * @param marker Marker bit
+ * @param pld    Encoded payload
+ * @param len    Payload length
+ * @param level  Audio level in [dBov]
+ * @param ts_inc RTP timestamp increment
+ */
+void bcast_send(struct bcast_member *m, bool marker, const uint8_t *pld,
+		size_t len, double level, uint32_t ts_inc)
+{
+	struct bcast *bc;
+
+	if (!m || !m->bc)
+		return;
+
+	bc = m->bc;
+
+	mtx_lock(bc->mtx);
+
+	for (struct le *le = m->followerl.head; le; le = le->next) {
+
+		struct bcast_member *f = le->data;
+
+		if (audio_send_encoded(f->audio, marker, pld, len, level,
+				       ts_inc))
+			++m->n_err;
+		else if (len)
+			++m->n_pkt;
+	}
+
+	mtx_unlock(bc->mtx);
+}
+
+
+static void destructor(void *arg)
+{
+	struct bcast *bc = arg;
+	struct le *le;
+
+	while ((le = bc->memberl.head))
+		bcast_member_close(le->data);
+
+	mem_deref(bc->mtx);
+}
+
+
+/**
+ * Allocate an audio broadcast group
+ *
+ * @param bcp Pointer to allocated broadcast group
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int bcast_alloc(struct bcast **bcp)
+{
+	struct bcast *bc;
+	int err;
+
+	if (!bcp)
+		return EINVAL;
+
+	bc = mem_zalloc(sizeof(*bc), destructor);
+	if (!bc)
+		return ENOMEM;
+
+	err = mutex_alloc(&bc->mtx);
+	if (err) {
+		mem_deref(bc);
+		return err;
+	}
+
+	*bcp = bc;
+
+	return 0;
+}
+
+
+/**
+ * Add the audio stream of a call to a broadcast group. If an earlier
+ * member sends with the same codec parameters, the call stops its own
+ * audio source and sends the payload encoded by that member.
+ *
+ * @param bc   Broadcast group
+ * @param call Call with audio
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int bcast_add(struct bcast *bc, struct call *call)
+{
+	struct bcast_member *m;
+	struct audio *audio;
+	struct stream *strm;
+
+	if (!bc || !call)
+		return EINVAL;
+
+	audio = call_audio(call);
+	strm  = audio_strm(audio);
+	if (!strm)
+		return ENOENT;
+
+	if (member_find(bc, call) || stream_is_relayed(strm))
+		return EALREADY;
+
+	m = mem_zalloc(sizeof(*m), member_destructor);
+	if (!m)
+		return ENOMEM;
+
+	m->bc    = bc;
+	m->call  = call;
+	m->audio = audio;
+
+	audio_set_bcast(audio, m, false);
+
+	mtx_lock(bc->mtx);
+	list_append(&bc->memberl, &m->le, m);
+	mtx_unlock(bc->mtx);
+
+	elect(bc);
+
+	info("bcast: %s joined (%u members, %u encoders)\n",
+	     call_peeruri(call), list_count(&bc->memberl),
+	     bcast_encoders(bc));
+
+	return 0;
+}
+
+
+/**
+ * Remove the audio stream of a call from a broadcast group
+ *
+ * @param bc   Broadcast group
+ * @param call Call
+ */
+void bcast_remove(struct bcast *bc, const struct call *call)
+{
+	if (!bc)
+		return;
+
+	bcast_member_close(member_find(bc, call));
+}
+
+
+/**
+ * Get the number of audio encoders running in a broadcast group
+ *
+ * @param bc Broadcast group
+ *
+ * @return Number of members that encode their own audio
+ */
+unsigned bcast_encoders(const struct bcast *bc)
+{
+	unsigned n = 0;
+
+	if (!bc)
+		return 0;
+
+	for (struct le *le = bc->memberl.head; le; le = le->next) {
+
+		const struct bcast_member *m = le->data;
+
+		if (!m->follow)
+			++n;
+	}
+
+	return n;
+}
+
+
+/**
+ * Print the broadcast group members and statistics
+ *
+ * @param pf Print function
+ * @param bc Broadcast group
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int bcast_debug(struct re_printf *pf, const struct bcast *bc)
+{
+	int err;
+
+	if (!bc)
+		return 0;
+
+	err = re_hprintf(pf, "Broadcast group (%u members, %u encoders)\n",
+			 list_count(&bc->memberl), bcast_encoders(bc));
+
+	for (struct le *le = bc->memberl.head; le; le = le->next) {
+
+		const struct bcast_member *m = le->data;
+
+		if (m->follow) {
+			err |= re_hprintf(pf, "  %s -> follows %s\n",
+					  call_peeruri(m->call),
+					  m->leader ?
+					  call_peeruri(m->leader->call) : "-");
+			continue;
+		}
+
+		err |= re_hprintf(pf, "  %s -> encodes for %u followers"
+				  " (pkt=%llu err=%llu)\n",
+				  call_peeruri(m->call),
+				  list_count(&m->followerl),
+				  m->n_pkt, m->n_err);
+	}
+
+	return err;
+}
@@ -4,6 +4,7 @@
  * Copyright (C) 2017 Alfred E. Heggestad
  */
 
+#include <string.h>
 #include <re.h>
 #include <baresip.h>
 #include "core.h"
@@ -128,6 +129,37 @@ static int add_rtcp_stats(struct odict *od_parent, const struct rtcp_stats *rs)
 }
 
 
+/* Call setup timeline, milliseconds since the call was created */
+static int add_setup_timeline(struct odict *od_parent, const struct call *call)
+{
+	struct odict *od = NULL;
+	int err;
+
+	err = odict_alloc(&od, 16);
+	if (err)
+		return err;
+
+	for (int i=CALL_SETUP_START+1; i<CALL_SETUP_MAX; i++) {
+
+		int64_t t = call_setup_time(call, i);
+
+		if (t < 0)
+			continue;
+
+		err = odict_entry_add(od, call_setup_name(i), ODICT_INT, t);
+		if (err)
+			goto out;
+	}
+
+	err = odict_entry_add(od_parent, "setup", ODICT_OBJECT, od);
+
+ out:
+	mem_deref(od);
+
+	return err;
+}
+
+
 /**
  * Encode an event to a dictionary
  *
@@ -250,6 +282,12 @@ int event_encode_dict(struct odict *od, struct ua *ua, enum ua_event ev,
 			goto out;
 	}
 
+	if (ev == UA_EVENT_CALL_ESTABLISHED && call) {
+		err = add_setup_timeline(od, call);
+		if (err)
+			goto out;
+	}
+
  out:
 
 	return err;
@@ -382,10 +420,13 @@ void module_event(const char *module, const char *event, struct ua *ua,
 	if (!module || !event)
 		return;
 
-	buf = mem_zalloc(EVENT_MAXSZ, NULL);
+	buf = mempool_alloc(EVENT_MAXSZ);
 	if (!buf)
 		return;
 
+	/* pooled memory is not zeroed */
+	memset(buf, 0, EVENT_MAXSZ);
+
 	if (-1 == re_snprintf(buf, len, "%s,%s,", module, event))
 		goto out;
 
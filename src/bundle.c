@@ -245,42 +245,53 @@ static struct stream *lookup_remote_ssrc(const struct list *streaml,
 }
 
 
-static int get_rtcp_ssrc(const struct rtcp_msg *msg, uint32_t *ssrcp)
+/*
+ * Get the sender SSRC of the first packet in an RTCP compound. It is the
+ * first word after the header for all supported packet types, so the
+ * packet is not decoded. The header is checked like rtcp_hdr_decode()
+ * does, and the packet must fit in the buffer.
+ */
+static int get_rtcp_ssrc(const struct mbuf *mb, uint32_t *ssrcp)
 {
-	uint32_t ssrc;
+	enum { HDR_SIZE = 4, RTCP_VER = 2 };
+	const uint8_t *p = mbuf_buf(mb);
+	uint8_t count, pt;
+	size_t len;
 
-	switch (msg->hdr.pt) {
+	if (mbuf_get_left(mb) < HDR_SIZE + 4)
+		return EBADMSG;
 
-	case RTCP_APP:
-		ssrc = msg->r.app.src;
-		break;
+	if ((p[0] >> 6) != RTCP_VER)
+		return EBADMSG;
 
-	case RTCP_SR:
-		ssrc = msg->r.sr.ssrc;
-		break;
+	count = p[0] & 0x1f;
+	pt    = p[1];
+	len   = ((size_t)p[2] << 8 | p[3]) * 4 + HDR_SIZE;
 
-	case RTCP_SDES:
-		ssrc = msg->r.sdesv->src;
-		break;
+	if (len < HDR_SIZE + 4 || len > mbuf_get_left(mb))
+		return EBADMSG;
 
-	case RTCP_PSFB:
-		ssrc = msg->r.fb.ssrc_packet;
-		break;
+	switch (pt) {
 
+	case RTCP_SDES:
 	case RTCP_BYE:
-		ssrc = msg->r.bye.srcv[0];
+		if (!count)
+			return EBADMSG;
 		break;
 
+	case RTCP_APP:
+	case RTCP_SR:
+	case RTCP_PSFB:
 	case RTCP_RR:
-		ssrc = msg->r.rr.ssrc;
 		break;
 
 	default:
-		warning("bundle: rtcp not sup (pt=%d)\n", msg->hdr.pt);
+		warning("bundle: rtcp not sup (pt=%d)\n", pt);
 		return ENOTSUP;
 	}
 
-	*ssrcp = ssrc;
+	*ssrcp = (uint32_t)p[4] << 24 | (uint32_t)p[5] << 16 |
+		(uint32_t)p[6] << 8 | p[7];
 
 	return 0;
 }
@@ -366,17 +377,7 @@ static bool udp_helper_recv_handler(struct sa *src, struct mbuf *mb, void *arg)
 		ssrc = hdr.ssrc;
 	}
 	else {
-		struct rtcp_msg *msg;
-
-		err = rtcp_decode(&msg, mb);
-		if (err) {
-			warning("rtcp decode error (%m)\n", err);
-			return false;
-		}
-
-		err = get_rtcp_ssrc(msg, &ssrc);
-		mem_deref(msg);
-
+		err = get_rtcp_ssrc(mb, &ssrc);
 		if (err)
 			return false;
 	}
@@ -56,6 +56,7 @@ struct call {
 	time_t time_start;        /**< Time when call started               */
 	time_t time_conn;         /**< Time when call initiated             */
 	time_t time_stop;         /**< Time when call stopped               */
+	uint64_t setupv[CALL_SETUP_MAX]; /**< Setup milestones [jiffies]   */
 	bool outgoing;            /**< True if outgoing, false if incoming  */
 	bool answered;            /**< True if call has been answered       */
 	bool got_offer;           /**< Got SDP Offer from Peer              */
@@ -114,6 +115,19 @@ static void set_state(struct call *call, enum call_state st)
 }
 
 
+/* only the first occurrence of each milestone is recorded */
+static void setup_mark(struct call *call, enum call_setup_step step)
+{
+	if (call->setupv[step])
+		return;
+
+	call->setupv[step] = tmr_jiffies();
+
+	debug("call: setup %s at %lld ms\n", call_setup_name(step),
+	      call_setup_time(call, step));
+}
+
+
 static const struct sdp_format *sdp_media_rcodec(const struct sdp_media *m)
 {
 	const struct list *lst;
@@ -219,6 +233,8 @@ static void mnat_handler(int err, uint16_t scode, const char *reason,
 	info("call: media-nat '%s' established/gathered\n",
 	     call->acc->mnatid);
 
+	setup_mark(call, CALL_SETUP_GATHERED);
+
 	/* Re-INVITE */
 	if (!call->mnat_wait) {
 		info("call: medianat established -- sending Re-INVITE\n");
@@ -294,6 +310,10 @@ static int update_streams(struct call *call)
 	else
 		video_stop(call->video);
 
+	if (!err && (stream_is_ready(audio_strm(call->audio)) ||
+		     stream_is_ready(video_strm(call->video))))
+		setup_mark(call, CALL_SETUP_MEDIA);
+
 	return err;
 }
 
@@ -338,6 +358,9 @@ static void call_destructor(void *arg)
 	if (call->state != CALL_STATE_IDLE)
 		print_summary(call);
 
+	if (call->setupv[CALL_SETUP_ESTABLISHED])
+		setupstat_add(call);
+
 	call_stream_stop(call);
 	list_unlink(&call->le);
 	tmr_cancel(&call->tmr_dtmf);
@@ -433,6 +456,8 @@ static void menc_event_handler(enum menc_event event,
 	switch (event) {
 
 	case MENC_EVENT_SECURE:
+		setup_mark(call, CALL_SETUP_SECURE);
+
 		if (strstr(prm, "audio")) {
 			stream_set_secure(audio_strm(call->audio), true);
 			stream_start_rtcp(audio_strm(call->audio));
@@ -487,6 +512,8 @@ static void stream_mnatconn_handler(struct stream *strm, void *arg)
 	int err;
 	MAGIC_CHECK(call);
 
+	setup_mark(call, CALL_SETUP_MNATCONN);
+
 	if (call->mencs) {
 		err = stream_start_mediaenc(strm);
 		if (err) {
@@ -525,6 +552,8 @@ static void stream_rtpestab_handler(struct stream *strm, void *arg)
 	struct call *call = arg;
 	MAGIC_CHECK(call);
 
+	setup_mark(call, CALL_SETUP_RTP);
+
 	ua_event(call->ua, UA_EVENT_CALL_RTPESTAB, call,
 		 "%s", sdp_media_name(stream_sdpmedia(strm)));
 }
@@ -740,6 +769,9 @@ int call_streams_alloc(struct call *call)
 	strm_prm.rtcp_mux = call->acc->rtcp_mux;
 
 	/* Audio stream */
+	module_lazy_load("aucodec");
+	module_lazy_load("aufilt");
+
 	err = audio_alloc(&call->audio, &call->streaml, &strm_prm,
 			  call->cfg, acc, call->sdp,
 			  acc->mnat, call->mnats, acc->menc, call->mencs,
@@ -752,6 +784,8 @@ int call_streams_alloc(struct call *call)
 
 	/* Video stream */
 	if (call->use_video) {
+		module_lazy_load("vidfilt");
+
 		err = video_alloc(&call->video, &call->streaml, &strm_prm,
 				  call->cfg, call->sdp,
 				  acc->mnat, call->mnats,
@@ -839,6 +873,8 @@ int call_alloc(struct call **callp, const struct config *cfg, struct list *lst,
 
 	MAGIC_INIT(call);
 
+	setup_mark(call, CALL_SETUP_START);
+
 	call->config_avt = cfg->avt;
 	call->config_call = cfg->call;
 
@@ -912,6 +948,9 @@ int call_alloc(struct call **callp, const struct config *cfg, struct list *lst,
 
 	/* We require at least one video codec, and at least one
 	   video source or video display */
+	if (vidmode != VIDMODE_OFF)
+		module_lazy_load("vidcodec");
+
 	call->use_video = (vidmode != VIDMODE_OFF)
 		&& (list_head(account_vidcodecl(call->acc)) != NULL)
 		&& (NULL != vidsrc_find(baresip_vidsrcl(), NULL)
@@ -1225,7 +1264,10 @@ int call_progress_dir(struct call *call, enum sdp_dir adir, enum sdp_dir vdir)
 	if (err)
 		goto out;
 
+	setup_mark(call, CALL_SETUP_PROGRESS);
+
 	if (call->got_offer) {
+		setup_mark(call, CALL_SETUP_SDP);
 		ua_event(call->ua, UA_EVENT_CALL_LOCAL_SDP, call, "answer");
 		err = call_update_media(call);
 	}
@@ -1315,6 +1357,14 @@ int call_answer(struct call *call, uint16_t scode, enum vidmode vmode)
 	call->answered = true;
 	call->ans_queued = false;
 
+	if (!err) {
+		if (call->got_offer)
+			setup_mark(call, CALL_SETUP_SDP);
+
+		if (scode >= 200 && scode < 300)
+			setup_mark(call, CALL_SETUP_ANSWERED);
+	}
+
 	mem_deref(desc);
 
 	return err;
@@ -1576,6 +1626,18 @@ int call_debug(struct re_printf *pf, const struct call *call)
 	err |= re_hprintf(pf, " direction: %s\n",
 			  call->outgoing ? "Outgoing" : "Incoming");
 
+	/* Call setup timeline */
+	err |= re_hprintf(pf, " setup:");
+	for (int i=CALL_SETUP_START+1; i<CALL_SETUP_MAX; i++) {
+
+		int64_t t = call_setup_time(call, i);
+
+		if (t >= 0)
+			err |= re_hprintf(pf, " %s=%lldms",
+					  call_setup_name(i), t);
+	}
+	err |= re_hprintf(pf, "\n");
+
 	/* SDP debug */
 	err |= sdp_session_debug(pf, call->sdp);
 
@@ -1791,14 +1853,24 @@ static int sipsess_answer_handler(const struct sip_msg *msg, void *arg)
 
 	debug("call: got SDP answer (%zu bytes)\n", mbuf_get_left(msg->mb));
 
+	if (call->outgoing)
+		setup_mark(call, CALL_SETUP_TRYING);
+
 	if (sip_msg_hdr_has_value(msg, SIP_HDR_SUPPORTED, "replaces"))
 		call->supported |= REPLACES;
 
 	call->got_offer = false;
 	if (!pl_strcmp(&msg->cseq.met, "INVITE") &&
-	    msg->scode >= 200 && msg->scode < 300)
+	    msg->scode >= 200 && msg->scode < 300) {
+		setup_mark(call, CALL_SETUP_ANSWERED);
 		call_event_handler(call, CALL_EVENT_ANSWERED, "%s",
                                    call->peer_uri);
+	}
+	else if (!pl_strcmp(&msg->cseq.met, "PRACK") &&
+		 msg->scode >= 200 && msg->scode < 300) {
+		/* our PRACK was acknowledged */
+		setup_mark(call, CALL_SETUP_PRACK);
+	}
 
 	if (msg_ctype_cmp(&msg->ctyp, "multipart", "mixed"))
 		(void)sdp_decode_multipart(&msg->ctyp.params, msg->mb);
@@ -1809,6 +1881,8 @@ static int sipsess_answer_handler(const struct sip_msg *msg, void *arg)
 		return err;
 	}
 
+	setup_mark(call, CALL_SETUP_SDP);
+
 	/* note: before update_media */
 	if (call->config_avt.bundle) {
 
@@ -1856,6 +1930,8 @@ static void sipsess_estab_handler(const struct sip_msg *msg, void *arg)
 		return;
 
 	set_state(call, CALL_STATE_ESTABLISHED);
+	setup_mark(call, CALL_SETUP_ANSWERED);
+	setup_mark(call, CALL_SETUP_ESTABLISHED);
 
 	if (call->got_offer)
 		(void)update_streams(call);
@@ -2072,6 +2148,8 @@ static void prack_handler(const struct sip_msg *msg, void *arg)
 	if (!msg || !call)
 		return;
 
+	setup_mark(call, CALL_SETUP_PRACK);
+
 	if (call->ans_queued && !call->answered)
 		(void)call_answer(call, 200, VIDMODE_ON);
 
@@ -2229,6 +2307,8 @@ int call_accept(struct call *call, struct sipsess_sock *sess_sock,
 		return err;
 	}
 
+	setup_mark(call, CALL_SETUP_PROGRESS);
+
 	err = str_dup(&call->id,
 		      sip_dialog_callid(sipsess_dialog(call->sess)));
 	if (err)
@@ -2281,9 +2361,14 @@ static void sipsess_progr_handler(const struct sip_msg *msg, void *arg)
 
 	call->msg_src = msg->src;
 
+	/* includes DNS lookup and transport setup for the INVITE */
+	setup_mark(call, CALL_SETUP_TRYING);
+
 	if (msg->scode <= 100)
 		return;
 
+	setup_mark(call, CALL_SETUP_PROGRESS);
+
 	/* check for 18x and content-type
 	 *
 	 * 1. start media-stream if application/sdp
@@ -2305,6 +2390,9 @@ static void sipsess_progr_handler(const struct sip_msg *msg, void *arg)
 	else
 		media = false;
 
+	if (media)
+		setup_mark(call, CALL_SETUP_SDP);
+
 	switch (msg->scode) {
 
 	case 180:
@@ -2433,6 +2521,7 @@ static int send_invite(struct call *call)
 
 	/* save call setup timer */
 	call->time_conn = time(NULL);
+	setup_mark(call, CALL_SETUP_INVITE);
 
 	ua_event(call->ua, UA_EVENT_CALL_LOCAL_SDP, call, "offer");
 
@@ -2525,6 +2614,52 @@ uint32_t call_setup_duration(const struct call *call)
 }
 
 
+/**
+ * Get the time when a call setup milestone was reached
+ *
+ * @param call  Call object
+ * @param step  Call setup milestone
+ *
+ * @return Milliseconds since the call was created, -1 if not reached
+ */
+int64_t call_setup_time(const struct call *call, enum call_setup_step step)
+{
+	if (!call || step >= CALL_SETUP_MAX || !call->setupv[step])
+		return -1;
+
+	return (int64_t)(call->setupv[step] - call->setupv[CALL_SETUP_START]);
+}
+
+
+/**
+ * Get the name of a call setup milestone
+ *
+ * @param step  Call setup milestone
+ *
+ * @return Name of the milestone
+ */
+const char *call_setup_name(enum call_setup_step step)
+{
+	switch (step) {
+
+	case CALL_SETUP_START:       return "start";
+	case CALL_SETUP_GATHERED:    return "gathered";
+	case CALL_SETUP_INVITE:      return "invite";
+	case CALL_SETUP_TRYING:      return "trying";
+	case CALL_SETUP_PROGRESS:    return "progress";
+	case CALL_SETUP_PRACK:       return "prack";
+	case CALL_SETUP_SDP:         return "sdp";
+	case CALL_SETUP_ANSWERED:    return "answered";
+	case CALL_SETUP_ESTABLISHED: return "established";
+	case CALL_SETUP_MEDIA:       return "media";
+	case CALL_SETUP_MNATCONN:    return "mnatconn";
+	case CALL_SETUP_SECURE:      return "secure";
+	case CALL_SETUP_RTP:         return "rtp";
+	default:                     return "???";
+	}
+}
+
+
 /**
  * Get the audio object for the current call
  *
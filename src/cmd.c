@@ -12,14 +12,23 @@
 
 enum {
 	KEYCODE_DEL = 0x7f,
-	LONG_PREFIX = '/'
+	LONG_PREFIX = '/',
+	HASH_SIZE   = 256,
 };
 
 
+/** Index entry for a long command */
+struct cmd_ent {
+	struct le he;            /**< Member of commands->ht           */
+	const struct cmd *cmd;
+};
+
 struct cmds {
 	struct le le;
+	struct commands *commands;
 	const struct cmd *cmdv;
 	size_t cmdc;
+	struct cmd_ent *entv;    /**< Hash index entries, one per cmd  */
 };
 
 struct cmd_ctx {
@@ -30,6 +39,8 @@ struct cmd_ctx {
 
 struct commands {
 	struct list cmdl;        /**< List of command blocks (struct cmds) */
+	struct hash *ht;         /**< Long commands, case-insensitive     */
+	const struct cmd *keyv[256];  /**< Short commands, by key         */
 };
 
 
@@ -42,8 +53,21 @@ static int cmd_print_all(struct re_printf *pf,
 static void destructor(void *arg)
 {
 	struct cmds *cmds = arg;
+	size_t i;
+
+	for (i=0; i<cmds->cmdc; i++) {
+
+		const struct cmd *cmd = &cmds->cmdv[i];
+		uint8_t key = (uint8_t)cmd->key;
+
+		hash_unlink(&cmds->entv[i].he);
+
+		if (cmds->commands->keyv[key] == cmd)
+			cmds->commands->keyv[key] = NULL;
+	}
 
 	list_unlink(&cmds->le);
+	mem_deref(cmds->entv);
 }
 
 
@@ -60,6 +84,7 @@ static void commands_destructor(void *data)
 	struct commands *commands = data;
 
 	list_flush(&commands->cmdl);
+	mem_deref(commands->ht);
 }
 
 
@@ -115,26 +140,34 @@ struct cmds *cmds_find(const struct commands *commands,
 static const struct cmd *cmd_find_by_key(const struct commands *commands,
 					 char key)
 {
-	struct le *le;
-
 	if (!commands)
 		return NULL;
 
-	for (le = commands->cmdl.tail; le; le = le->prev) {
+	return commands->keyv[(uint8_t)key];
+}
 
-		struct cmds *cmds = le->data;
-		size_t i;
 
-		for (i=0; i<cmds->cmdc; i++) {
+static bool name_cmp_handler(struct le *le, void *arg)
+{
+	const struct cmd_ent *ent = le->data;
+	const struct pl *name = arg;
 
-			const struct cmd *cmd = &cmds->cmdv[i];
+	return 0 == pl_strcasecmp(name, ent->cmd->name);
+}
 
-			if (cmd->key == key && cmd->h)
-				return cmd;
-		}
-	}
 
-	return NULL;
+static const struct cmd *cmd_lookup(const struct commands *commands,
+				    const struct pl *name)
+{
+	struct le *le;
+
+	if (!commands || !pl_isset(name))
+		return NULL;
+
+	le = hash_lookup(commands->ht, hash_joaat_ci(name->p, name->l),
+			 name_cmp_handler, (void *)name);
+
+	return le ? ((struct cmd_ent *)le->data)->cmd : NULL;
 }
 
 
@@ -312,51 +345,79 @@ static int cmd_report(const struct cmd *cmd, struct re_printf *pf,
 int cmd_process_long(struct commands *commands, const char *str, size_t len,
 		     struct re_printf *pf_resp, void *data)
 {
-	struct cmd_arg arg;
 	const struct cmd *cmd_long;
-	char *name = NULL, *prm = NULL;
+	char *prm = NULL;
 	struct pl pl_name, pl_prm;
 	int err;
 
 	if (!str || !len)
 		return EINVAL;
 
-	memset(&arg, 0, sizeof(arg));
-
 	err = re_regex(str, len, "[^ ]+[ ]*[~]*", &pl_name, NULL, &pl_prm);
 	if (err) {
 		return err;
 	}
 
-	err = pl_strdup(&name, &pl_name);
-	if (pl_isset(&pl_prm))
-		err |= pl_strdup(&prm, &pl_prm);
-	if (err)
-		goto out;
-
-	cmd_long = cmd_find_long(commands, name);
-	if (cmd_long) {
-
-		arg.key      = LONG_PREFIX;
-		arg.prm      = prm;
-		arg.data     = data;
-
-		if (cmd_long->h)
-			err = cmd_long->h(pf_resp, &arg);
+	cmd_long = cmd_lookup(commands, &pl_name);
+	if (!cmd_long) {
+		(void)re_hprintf(pf_resp, "command not found (%r)\n",
+				 &pl_name);
+		return ENOTSUP;
 	}
-	else {
-		(void)re_hprintf(pf_resp, "command not found (%s)\n", name);
-		err = ENOTSUP;
+
+	if (pl_isset(&pl_prm)) {
+		err = pl_strdup(&prm, &pl_prm);
+		if (err)
+			return err;
 	}
 
- out:
-	mem_deref(name);
+	err = cmd_process_args(commands, cmd_long, prm, NULL, pf_resp, data);
+
 	mem_deref(prm);
 
 	return err;
 }
 
 
+/**
+ * Run a long command with already decoded arguments
+ *
+ * The parameter string is passed to the handler as-is, without being
+ * copied or tokenised. Handlers that understand structured arguments
+ * may use the odict instead.
+ *
+ * @param commands Commands container
+ * @param cmd      Command, from cmd_find_long()
+ * @param prm      Optional parameter string
+ * @param od       Optional structured arguments
+ * @param pf_resp  Print function for response
+ * @param data     Application data
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int cmd_process_args(struct commands *commands, const struct cmd *cmd,
+		     const char *prm, const struct odict *od,
+		     struct re_printf *pf_resp, void *data)
+{
+	struct cmd_arg arg;
+
+	if (!commands || !cmd)
+		return EINVAL;
+
+	if (!cmd->h)
+		return 0;
+
+	memset(&arg, 0, sizeof(arg));
+
+	arg.key      = LONG_PREFIX;
+	arg.prm      = (char *)prm;
+	arg.od       = od;
+	arg.data     = data;
+
+	return cmd->h(pf_resp, &arg);
+}
+
+
 static int cmd_process_edit(struct commands *commands,
 			    struct cmd_ctx **ctxp, char key,
 			    struct re_printf *pf, void *data)
@@ -451,9 +512,37 @@ int cmd_register(struct commands *commands,
 	if (!cmds)
 		return ENOMEM;
 
+	cmds->entv = mem_zalloc(cmdc * sizeof(*cmds->entv), NULL);
+	if (!cmds->entv) {
+		mem_deref(cmds);
+		return ENOMEM;
+	}
+
+	cmds->commands = commands;
 	cmds->cmdv = cmdv;
 	cmds->cmdc = cmdc;
 
+	for (i=0; i<cmdc; i++) {
+
+		const struct cmd *cmd = &cmdv[i];
+		struct cmd_ent *ent = &cmds->entv[i];
+
+		ent->cmd = cmd;
+
+		if (!cmd->h)
+			continue;
+
+		if (cmd->key && !commands->keyv[(uint8_t)cmd->key])
+			commands->keyv[(uint8_t)cmd->key] = cmd;
+
+		if (str_isset(cmd->name)) {
+			hash_append(commands->ht,
+				    hash_joaat_ci(cmd->name,
+						  str_len(cmd->name)),
+				    &ent->he, ent);
+		}
+	}
+
 	list_append(&commands->cmdl, &cmds->le, cmds);
 
 	return 0;
@@ -483,26 +572,14 @@ void cmd_unregister(struct commands *commands, const struct cmd *cmdv)
 const struct cmd *cmd_find_long(const struct commands *commands,
 				const char *name)
 {
-	struct le *le;
+	struct pl pl;
 
-	if (!commands || !name)
+	if (!name)
 		return NULL;
 
-	for (le = commands->cmdl.tail; le; le = le->prev) {
-
-		struct cmds *cmds = le->data;
-		size_t i;
-
-		for (i=0; i<cmds->cmdc; i++) {
-
-			const struct cmd *cmd = &cmds->cmdv[i];
-
-			if (0 == str_casecmp(name, cmd->name) && cmd->h)
-				return cmd;
-		}
-	}
+	pl_set_str(&pl, name);
 
-	return NULL;
+	return cmd_lookup(commands, &pl);
 }
 
 
@@ -749,6 +826,7 @@ int cmd_print(struct re_printf *pf, const struct commands *commands)
 int cmd_init(struct commands **commandsp)
 {
 	struct commands *commands;
+	int err;
 
 	if (!commandsp)
 		return EINVAL;
@@ -759,6 +837,12 @@ int cmd_init(struct commands **commandsp)
 
 	list_init(&commands->cmdl);
 
+	err = hash_alloc(&commands->ht, HASH_SIZE);
+	if (err) {
+		mem_deref(commands);
+		return err;
+	}
+
 	*commandsp = commands;
 
 	return 0;
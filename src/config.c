@@ -67,7 +67,8 @@ static struct config core_config = {
 		{20, 160},
 		false,
 		-35.0,
-		101
+		101,
+		0.0
 	},
 
 	/** Video */
@@ -81,6 +82,7 @@ static struct config core_config = {
 		30,
 		true,
 		VID_FMT_YUV420P,
+		1,
 	},
 
 	/** Audio/Video Transport */
@@ -474,6 +476,14 @@ int config_parse_conf(struct config *cfg, const struct conf *conf)
 
 	(void)conf_get_float(conf, "audio_silence", &cfg->audio.silence);
 	(void)conf_get_u32(conf, "audio_telev_pt", &cfg->audio.telev_pt);
+	(void)conf_get_float(conf, "audio_playout_loss",
+			     &cfg->audio.playout_loss);
+	if (cfg->audio.playout_loss < 0.0 ||
+	    cfg->audio.playout_loss >= 100.0) {
+		warning("config: audio_playout_loss out of range (%.2f)\n",
+			cfg->audio.playout_loss);
+		cfg->audio.playout_loss = 0.0;
+	}
 
 	/* Video */
 	(void)conf_get_csv(conf, "video_source",
@@ -491,6 +501,7 @@ int config_parse_conf(struct config *cfg, const struct conf *conf)
 	(void)conf_get_u32(conf, "video_burst_bits", &cfg->video.burst_bits);
 	(void)conf_get_float(conf, "video_fps", &cfg->video.fps);
 	(void)conf_get_bool(conf, "video_fullscreen", &cfg->video.fullscreen);
+	(void)conf_get_u32(conf, "video_simulcast", &cfg->video.simulcast);
 
 	conf_get_vidfmt(conf, "videnc_format", &cfg->video.enc_fmt);
 
@@ -538,6 +549,10 @@ int config_parse_conf(struct config *cfg, const struct conf *conf)
 	if (0 == conf_get(conf, "rtp_rxmode", &rxmode)) {
 		cfg->avt.rxmode = resolve_receive_mode(&rxmode);
 	}
+	(void)conf_get_u32(conf, "rtp_batch", &cfg->avt.rtp_batch);
+	(void)conf_get_u32(conf, "rtp_port_pool", &cfg->avt.rtp_port_pool);
+	(void)conf_get_u32(conf, "rtp_port_quarantine",
+			   &cfg->avt.rtp_port_quarantine);
 
 	if (err) {
 		warning("config: configure parse error (%m)\n", err);
@@ -634,6 +649,7 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 "audio_buffer_mode\t%s\t\t# fixed, adaptive\n"
 			 "audio_silence\t\t%.1lf\t\t# in [dB]\n"
 			 "audio_telev_pt\t\t%u\n"
+			 "audio_playout_loss\t%.2f\t\t# in [%%]\n"
 			 "\n",
 			 cfg->audio.audio_path,
 			 cfg->audio.play_mod,  cfg->audio.play_dev,
@@ -651,7 +667,8 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 range_print, &cfg->audio.buffer,
 			 cfg->audio.adaptive ? "adaptive" : "fixed",
 			 cfg->audio.silence,
-			 cfg->audio.telev_pt);
+			 cfg->audio.telev_pt,
+			 cfg->audio.playout_loss);
 	if (err)
 		return err;
 
@@ -665,13 +682,15 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 "video_fps\t\t%.2f\n"
 			 "video_fullscreen\t%s\n"
 			 "videnc_format\t\t%s\n"
+			 "video_simulcast\t\t%u\n"
 			 "\n",
 			 cfg->video.src_mod, cfg->video.src_dev,
 			 cfg->video.disp_mod, cfg->video.disp_dev,
 			 cfg->video.width, cfg->video.height,
 			 cfg->video.bitrate, cfg->video.fps,
 			 cfg->video.fullscreen ? "yes" : "no",
-			 vidfmt_name(cfg->video.enc_fmt));
+			 vidfmt_name(cfg->video.enc_fmt),
+			 cfg->video.simulcast);
 	if (err)
 		return err;
 
@@ -689,6 +708,9 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 "rtp_timeout\t\t%u # in seconds\n"
 			 "avt_bundle\t\t%s\n"
 			 "rtp_rxmode\t\t\t%s\n"
+			 "rtp_batch\t\t%u\n"
+			 "rtp_port_pool\t\t%u\n"
+			 "rtp_port_quarantine\t%u # in seconds\n"
 			 "\n"
 			 "# Network\n"
 			 "net_interface\t\t%s\n"
@@ -707,6 +729,9 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 cfg->avt.rtp_timeout,
 			 cfg->avt.bundle ? "yes" : "no",
 			 rtp_receive_mode_str(cfg->avt.rxmode),
+			 cfg->avt.rtp_batch,
+			 cfg->avt.rtp_port_pool,
+			 cfg->avt.rtp_port_quarantine,
 
 			 cfg->net.ifname,
 			 net_af_str(cfg->net.af)
@@ -895,6 +920,8 @@ static int core_config_template(struct re_printf *pf, const struct config *cfg)
 			  "audio_silence\t\t%.1lf\t\t# in [dB]\n"
 			  "audio_telev_pt\t\t%u\t\t"
 			  "# payload type for telephone-event\n"
+			  "#audio_playout_loss\t1.0\t\t"
+			  "# late-loss target in [%%], 0 = off\n"
 			  "\n"
 			  ,
 			  default_audio_path(),
@@ -915,6 +942,7 @@ static int core_config_template(struct re_printf *pf, const struct config *cfg)
 			  "video_fps\t\t%.2f\n"
 			  "video_fullscreen\tno\n"
 			  "videnc_format\t\t%s\n"
+			  "#video_simulcast\t1\t\t# layers, 1-3\n"
 			  ,
 			  default_video_device(),
 			  default_video_display(),
@@ -940,6 +968,10 @@ static int core_config_template(struct re_printf *pf, const struct config *cfg)
 			  "#rtp_timeout\t\t60\n"
 			  "#avt_bundle\t\tno\n"
 			  "#rtp_rxmode\t\tmain\n"
+			  "#rtp_batch\t\t0\t\t# datagrams per syscall,"
+				" 0=off\n"
+			  "#rtp_port_pool\t\t0\t\t# pre-bound sockets\n"
+			  "#rtp_port_quarantine\t10\t\t# in seconds\n"
 			  "\n# Network\n"
 			  "#dns_server\t\t1.1.1.1:53\n"
 			  "#dns_server\t\t1.0.0.1:53\n"
@@ -950,7 +982,11 @@ static int core_config_template(struct re_printf *pf, const struct config *cfg)
 			  "# Play tones\n"
 			  "#file_ausrc\t\taufile\n"
 			  "#file_srate\t\t16000\n"
-			  "#file_channels\t\t1\n",
+			  "#file_channels\t\t1\n"
+			  "\n"
+			  "# Logging\n"
+			  "#log_async\t\tno\t\t# write from a background"
+				" thread\n",
 			  cfg->avt.audio.jbuf_del.min,
 			  cfg->avt.audio.jbuf_del.max,
 			  cfg->avt.video.jbuf_del.min,
@@ -1187,6 +1223,7 @@ int config_write_template(const char *file, const struct config *cfg)
 	(void)re_fprintf(f, "#module\t\t\t" "v4l2" MOD_EXT "\n");
 #endif
 	(void)re_fprintf(f, "#module\t\t\t" "vidbridge" MOD_EXT "\n");
+	(void)re_fprintf(f, "#module\t\t\t" "mcu" MOD_EXT "\n");
 
 	(void)re_fprintf(f, "\n# Video display modules\n");
 #ifdef LINUX
@@ -1216,6 +1253,11 @@ int config_write_template(const char *file, const struct config *cfg)
 	(void)re_fprintf(f, "#module\t\t\t" "srtp" MOD_EXT "\n");
 	(void)re_fprintf(f, "#module\t\t\t" "dtls_srtp" MOD_EXT "\n");
 	(void)re_fprintf(f, "#module\t\t\t" "gzrtp" MOD_EXT "\n");
+
+	(void)re_fprintf(f, "\n# Modules loaded on first lookup"
+			 " of their types (module[,type]*)\n");
+	(void)re_fprintf(f, "#module_lazy\t\t" "avcodec" MOD_EXT
+			 ",vidcodec\n");
 	(void)re_fprintf(f, "\n");
 
 	(void)re_fprintf(f, "\n#------------------------------------"
@@ -1231,6 +1273,7 @@ int config_write_template(const char *file, const struct config *cfg)
 	(void)re_fprintf(f, "#module_app\t\t"  "mwi"MOD_EXT"\n");
 	(void)re_fprintf(f, "#module_app\t\t" "presence"MOD_EXT"\n");
 	(void)re_fprintf(f, "#module_app\t\t" "serreg"MOD_EXT"\n");
+	(void)re_fprintf(f, "#module_app\t\t" "sfu"MOD_EXT"\n");
 	(void)re_fprintf(f, "#module_app\t\t" "syslog"MOD_EXT"\n");
 	(void)re_fprintf(f, "#module_app\t\t" "mqtt" MOD_EXT "\n");
 	(void)re_fprintf(f, "#module_app\t\t" "ctrl_tcp" MOD_EXT "\n");
@@ -1246,6 +1289,17 @@ int config_write_template(const char *file, const struct config *cfg)
 
 	(void)re_fprintf(f, "# DTLS SRTP parameters\n");
 	(void)re_fprintf(f, "#dtls_srtp_use_ec\tprime256v1\n");
+	(void)re_fprintf(f, "#dtls_srtp_resumption\t0\t"
+			 "# session lifetime [s], 0 = disabled\n");
+	(void)re_fprintf(f, "#dtls_srtp_cert_cache\tno\t"
+			 "# keep certificate across restarts\n");
+	(void)re_fprintf(f, "#dtls_srtp_cert_rotate\t30\t"
+			 "# certificate lifetime [days], 0 = never\n");
+	(void)re_fprintf(f, "\n");
+
+	(void)re_fprintf(f, "# SRTP parameters\n");
+	(void)re_fprintf(f, "#srtp_prefer_aead\tno\t"
+			 "# offer and select AEAD_AES_128_GCM first\n");
 	(void)re_fprintf(f, "\n");
 
 	(void)re_fprintf(f, "\n# UI Modules parameters\n");
@@ -1279,7 +1333,7 @@ int config_write_template(const char *file, const struct config *cfg)
 
 	(void)re_fprintf(f, "\n# Opus Multistream codec parameters\n");
 	(void)re_fprintf(f,
-			 "#opus_ms_channels\t2\t#total channels (2 or 4)\n");
+			 "#opus_ms_channels\t2\t#total channels (1-255)\n");
 	(void)re_fprintf(f,
 			 "#opus_ms_streams\t2\t#number of streams\n");
 	(void)re_fprintf(f,
@@ -1387,6 +1441,10 @@ int config_write_template(const char *file, const struct config *cfg)
 	(void)re_fprintf(f, "\n# ice\n"
 			    "#ice_policy\t\tall\t# all, relay (candidates)\n");
 
+	(void)re_fprintf(f, "\n# turn\n"
+			    "#turn_pool_size\t\t0\t# pre-established "
+			    "allocations per server\n");
+
 	if (f)
 		(void)fclose(f);
 
@@ -103,9 +103,14 @@ struct account {
  */
 
 struct audio;
+struct bcast_member;
 
 int  audio_send_digit(struct audio *a, char key);
 void audio_sdp_attr_decode(struct audio *a);
+void audio_set_bcast(struct audio *a, struct bcast_member *m, bool follow);
+bool audio_tx_equal(const struct audio *a, const struct audio *b);
+int  audio_send_encoded(struct audio *a, bool marker, const uint8_t *pld,
+			size_t len, double level, uint32_t ts_inc);
 
 
 /*
@@ -114,6 +119,36 @@ void audio_sdp_attr_decode(struct audio *a);
 int aucodec_print(struct re_printf *pf, const struct aucodec *ac);
 
 
+/*
+ * Audio time-stretching
+ */
+
+struct austretch;
+
+int  austretch_alloc(struct austretch **stp);
+int  austretch_process(struct austretch *st, struct auframe *af,
+		       size_t maxc, uint32_t level, uint32_t target);
+int  austretch_debug(struct re_printf *pf, const struct austretch *st);
+
+
+/*
+ * Audio playout delay controller
+ */
+
+struct playout;
+
+int  playout_alloc(struct playout **pop, uint32_t ptime,
+		   const struct range *bounds, double loss);
+void playout_set_crate(struct playout *po, uint32_t crate);
+bool playout_arrival(struct playout *po, const struct rtp_header *hdr,
+		     uint64_t now);
+void playout_update(struct playout *po, uint32_t jitter);
+uint32_t playout_target(const struct playout *po);
+uint32_t playout_reorder(const struct playout *po);
+uint32_t playout_aubuf_target(const struct playout *po);
+int  playout_debug(struct re_printf *pf, const struct playout *po);
+
+
 /*
  * Audio Receiver Pipeline
  */
@@ -131,7 +166,7 @@ void aurecv_set_extmap(struct audio_recv *ar, uint8_t aulevel);
 int  aurecv_set_module(struct audio_recv *ar, const char *module);
 int  aurecv_set_device(struct audio_recv *ar, const char *device);
 void aurecv_receive(struct audio_recv *ar, const struct rtp_header *hdr,
-		    struct rtpext *extv, size_t extc,
+		    const struct rtpext_tbl *ext,
 		    struct mbuf *mb, unsigned lostc, bool *ignore);
 int  aurecv_start_player(struct audio_recv *ar, struct list *auplayl);
 bool aurecv_player_started(const struct audio_recv *ar);
@@ -144,6 +179,7 @@ bool aurecv_started(const struct audio_recv *ar);
 bool aurecv_filt_empty(const struct audio_recv *ar);
 bool aurecv_level_set(const struct audio_recv *ar);
 double aurecv_level(const struct audio_recv *ar);
+struct playout *aurecv_playout(const struct audio_recv *ar);
 int aurecv_debug(struct re_printf *pf, const struct audio_recv *ar);
 int aurecv_print_pipeline(struct re_printf *pf, const struct audio_recv *ar);
 
@@ -214,11 +250,32 @@ void     metric_inc_err(struct metric *metric);
 
 struct metric *metric_alloc(void);
 
+/*
+ * Log
+ */
+
+/** Rate limiter state for one log call site */
+struct log_ratelimit {
+	RE_ATOMIC uint64_t tat;         /**< Theoretical arrival time [ms] */
+	RE_ATOMIC uint32_t suppressed;  /**< Messages suppressed          */
+};
+
+void loglv_ratelimit(struct log_ratelimit *rl, enum log_level level,
+		     const char *fmt, ...);
+
+#define LOG_RATELIMIT(level, ...)					\
+	do {								\
+		static struct log_ratelimit log_rl_;			\
+		loglv_ratelimit(&log_rl_, (level), __VA_ARGS__);	\
+	} while (0)
+
+
 /*
  * Module
  */
 
-int module_init(const struct conf *conf);
+int  module_init(const struct conf *conf);
+void module_lazy_load(const char *type);
 
 
 /*
@@ -247,6 +304,29 @@ void reg_set_custom_hdrs(struct reg *reg, const struct list *hdrs);
 
 int rtpstat_print(struct re_printf *pf, const struct call *call);
 
+
+/*
+ * RTP Header Extensions
+ */
+
+/** Decoded RTP header extensions, indexed by ID */
+struct rtpext_tbl {
+	uint16_t present;            /**< Bitmask of decoded IDs      */
+	struct {
+		const uint8_t *data; /**< Payload, points into packet */
+		uint8_t len;         /**< Payload length              */
+	} extv[RTPEXT_ID_MAX + 1];
+};
+
+typedef void (rtpext_h)(uint8_t id, const uint8_t *data, size_t len,
+			void *arg);
+
+int rtpext_tbl_decode(struct rtpext_tbl *tbl, uint16_t type,
+		      const uint8_t *p, size_t len, uint16_t mask);
+const uint8_t *rtpext_tbl_find(const struct rtpext_tbl *tbl, uint8_t id,
+			       size_t *lenp);
+
+
 /*
  * STUN URI
  */
@@ -304,10 +384,13 @@ struct rtp_header;
 enum {STREAM_PRESZ = 4+12}; /* same as RTP_HEADER_SIZE */
 
 typedef void (stream_rtp_h)(const struct rtp_header *hdr,
-			    struct rtpext *extv, size_t extc,
+			    const struct rtpext_tbl *ext,
 			    struct mbuf *mb, unsigned lostc, bool *ignore,
 			    void *arg);
 typedef int (stream_pt_h)(uint8_t pt, struct mbuf *mb, void *arg);
+typedef void (stream_relay_h)(struct stream *strm,
+			      const struct rtp_header *hdr,
+			      struct mbuf *mb, void *arg);
 
 
 int  stream_alloc(struct stream **sp, struct list *streaml,
@@ -333,18 +416,29 @@ struct rtp_sock *stream_rtp_sock(const struct stream *strm);
 const struct sa *stream_raddr(const struct stream *strm);
 const char *stream_mid(const struct stream *strm);
 uint8_t stream_generate_extmap_id(struct stream *strm);
+void stream_set_extmap(struct stream *strm, uint8_t id,
+		       rtpext_h *exth, void *arg);
 
 /* Send */
 void stream_update_encoder(struct stream *s, int pt_enc);
 int  stream_pt_enc(const struct stream *strm);
 int  stream_send(struct stream *s, bool ext, bool marker, int pt, uint32_t ts,
 		 struct mbuf *mb);
+int  stream_send_flush(struct stream *s);
+int  stream_send_relay(struct stream *s, bool marker, int pt, uint32_t ts,
+		       struct mbuf *mb);
+struct stream *stream_relay_peer(const struct stream *s);
 int  stream_resend(struct stream *s, uint16_t seq, bool ext, bool marker,
 		  int pt, uint32_t ts, struct mbuf *mb);
+int  stream_send_ssrc(struct stream *s, uint32_t ssrc, uint16_t seq,
+		     bool ext, bool marker, int pt, uint32_t ts,
+		     struct mbuf *mb);
 
 /* Receive */
 void stream_flush(struct stream *s);
 int  stream_ssrc_rx(const struct stream *strm, uint32_t *ssrc);
+int  stream_set_forward(struct stream *s, stream_relay_h *fwdh, void *arg);
+void stream_set_playout(struct stream *s, struct playout *po);
 
 
 struct bundle *stream_bundle(const struct stream *strm);
@@ -418,9 +512,15 @@ bool u32mask_enabled(uint32_t mask, uint8_t bit);
 
 struct video;
 
+struct sfu_member;
+
 int  video_decoder_set(struct video *v, struct vidcodec *vc, int pt_rx,
 		       const char *fmtp);
 int  video_print(struct re_printf *pf, const struct video *v);
+int  video_forward(struct video *v, bool marker, uint8_t pt, uint32_t ts,
+		   struct mbuf *mb);
+void video_request_picup(struct video *v);
+void video_set_sfu(struct video *v, struct sfu_member *m);
 
 
 /*
@@ -494,6 +594,117 @@ struct media_track *mediatrack_lookup_media(const struct list *medial,
 void mediatrack_close(struct media_track *media, int err);
 void mediatrack_sdp_attr_decode(struct media_track *media);
 
+/*
+ * RTP port allocator
+ */
+
+struct rtpports;
+struct rtpport;
+
+int  rtpports_alloc(struct rtpports **mgrp, const struct config_avt *cfg);
+int  rtpports_debug(struct re_printf *pf, const struct rtpports *mgr);
+int  rtpport_alloc(struct rtpport **rpp, struct rtpports *mgr,
+		   const struct range *ports, int af,
+		   rtp_recv_h *recvh, rtcp_recv_h *rtcph, void *arg);
+struct rtp_sock *rtpport_sock(const struct rtpport *rp);
+struct rtpports *baresip_rtpports(void);
+
+
+/*
+ * Media clock
+ */
+
+struct mediaclock;
+
+int  mediaclock_alloc(struct mediaclock **mcsp);
+int  mediaclock_debug(struct re_printf *pf, const struct mediaclock *mcs);
+struct mediaclock *baresip_mediaclock(void);
+
+
+/*
+ * Call setup statistics
+ */
+
+void setupstat_add(const struct call *call);
+void setupstat_reset(void);
+int  setupstat_debug(struct re_printf *pf, void *unused);
+
+
+/*
+ * Memory pools
+ */
+
+int  mempool_init(void);
+void mempool_close(void);
+
+
+/*
+ * Media relay
+ */
+
+struct media_relay;
+
+/** Payload type and timestamp mapping of forwarded RTP */
+struct relay_map {
+	int8_t ptmap[128];         /**< RX payload type to TX type       */
+	uint32_t srate;            /**< Clock rate of mapped format      */
+	uint32_t ssrc;             /**< Current source SSRC              */
+	bool ssrc_set;
+	bool rebase;               /**< Rebase timestamps on next packet */
+	uint32_t ts_off;           /**< Outgoing minus incoming ts       */
+	uint32_t ts_last;          /**< Last outgoing timestamp          */
+};
+
+int  relay_alloc(struct media_relay **rlp, struct stream *a,
+		 struct stream *b);
+int  relay_check(struct media_relay *rl);
+void relay_close(struct media_relay *rl);
+void relay_recv(struct stream *strm, const struct rtp_header *hdr,
+		struct mbuf *mb, void *arg);
+int  relay_debug(struct re_printf *pf, const struct media_relay *rl);
+void relay_map_reset(struct relay_map *map);
+int  relay_map_pt(struct relay_map *map, const struct stream *src,
+		  const struct stream *dst, uint8_t pt);
+bool relay_map_ts(struct relay_map *map, const struct rtp_header *hdr,
+		  uint32_t gap_ms, uint32_t *tsp);
+
+
+/*
+ * Selective forwarding unit
+ */
+
+void sfu_member_close(struct sfu_member *m);
+void sfu_member_update(struct sfu_member *m);
+void sfu_picup(struct sfu_member *m);
+
+
+/*
+ * Audio broadcast group
+ */
+
+void bcast_member_close(struct bcast_member *m);
+void bcast_member_update(struct bcast_member *m);
+void bcast_send(struct bcast_member *m, bool marker, const uint8_t *pld,
+		size_t len, double level, uint32_t ts_inc);
+
+
+/*
+ * Batched RTP socket I/O
+ */
+
+struct rtpio_rx;
+struct rtpio_tx;
+
+int  rtpio_rx_alloc(struct rtpio_rx **riop, struct udp_sock *us,
+		    uint32_t batch);
+int  rtpio_rx_debug(struct re_printf *pf, const struct rtpio_rx *rio);
+int  rtpio_tx_alloc(struct rtpio_tx **tiop, struct udp_sock *us,
+		    uint32_t batch);
+void rtpio_tx_begin(struct rtpio_tx *tio);
+int  rtpio_tx_end(struct rtpio_tx *tio, bool flush);
+int  rtpio_tx_debug(struct re_printf *pf, const struct rtpio_tx *tio);
+
+
 /*
  * Stream RTP receiver
  */
@@ -513,6 +724,8 @@ void rtprecv_handle_rtcp(const struct sa *src, struct rtcp_msg *msg,
 			 void *arg);
 void rtprecv_set_socket(struct rtp_receiver *rx, struct rtp_sock *rtp);
 void rtprecv_set_ssrc(struct rtp_receiver *rx, uint32_t ssrc);
+void rtprecv_set_extmap(struct rtp_receiver *rx, uint8_t id,
+			rtpext_h *exth, void *arg);
 uint64_t rtprecv_ts_last(struct rtp_receiver *rx);
 void rtprecv_set_ts_last(struct rtp_receiver *rx, uint64_t ts_last);
 void rtprecv_flush(struct rtp_receiver *rx);
@@ -526,3 +739,6 @@ void rtprecv_mnat_connected_handler(const struct sa *raddr1,
 int  rtprecv_start_rtcp(struct rtp_receiver *rx, const char *cname,
 			const struct sa *peer, bool pinhole);
 bool rtprecv_running(const struct rtp_receiver *rx);
+void rtprecv_set_relay(struct rtp_receiver *rx, stream_relay_h *relayh,
+		       void *arg);
+void rtprecv_set_playout(struct rtp_receiver *rx, struct playout *po);
@@ -10,6 +10,7 @@
 #include <stdint.h>
 #include <re.h>
 #include <baresip.h>
+#include "core.h"
 
 #include <stdlib.h>
 
@@ -60,6 +61,7 @@ struct jbuf {
 	uint32_t min;        /**< [# frames] Minimum # of frames to buffer   */
 	uint32_t max;        /**< [# frames] Maximum # of frames to buffer   */
 	uint32_t wish;       /**< [# frames] Wish size for adaptive mode     */
+	bool wish_ext;       /**< Wish size is set by jbuf_set_wish()        */
 	uint16_t seq_put;    /**< Sequence number for last jbuf_put()        */
 	uint16_t seq_get;    /**< Sequence number of last played frame       */
 	uint32_t ssrc;       /**< Previous ssrc                              */
@@ -160,10 +162,12 @@ static void packet_alloc(struct jbuf *jb, struct packet **f)
 
 #if JBUF_STAT
 		STAT_INC(n_overflow);
-		DEBUG_WARNING("drop 1 old frame seq=%u (total dropped %u)\n",
-			   f0->hdr.seq, jb->stat.n_overflow);
+		LOG_RATELIMIT(LEVEL_WARN, "jbuf: drop 1 old frame seq=%u"
+			      " (total dropped %u)\n",
+			      f0->hdr.seq, jb->stat.n_overflow);
 #else
-		DEBUG_WARNING("drop 1 old frame seq=%u\n", f0->hdr.seq);
+		LOG_RATELIMIT(LEVEL_WARN, "jbuf: drop 1 old frame seq=%u\n",
+			      f0->hdr.seq);
 #endif
 
 		plot_jbuf_event(jb, 'O');
@@ -287,6 +291,39 @@ int jbuf_set_type(struct jbuf *jb, enum jbuf_type jbtype)
 }
 
 
+/**
+ * Set the wish size of the jitter buffer. The wish size is then no
+ * longer adapted to reordering by the jitter buffer itself.
+ *
+ * @param jb    The jitter buffer.
+ * @param wish  Wish size in [frames]
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int jbuf_set_wish(struct jbuf *jb, uint32_t wish)
+{
+	if (!jb)
+		return EINVAL;
+
+	mtx_lock(jb->lock);
+
+	wish = max(wish, jb->min);
+	if (jb->max && wish >= jb->max)
+		wish = jb->max - 1;
+
+	if (wish != jb->wish)
+		DEBUG_INFO("wish size set %u --> %u\n", jb->wish, wish);
+
+	jb->wish     = wish;
+	jb->wish_ext = true;
+	tmr_cancel(&jb->tmr);
+
+	mtx_unlock(jb->lock);
+
+	return 0;
+}
+
+
 static void wish_down(void *arg)
 {
 	struct jbuf *jb = arg;
@@ -397,7 +434,7 @@ int jbuf_put(struct jbuf *jb, const struct rtp_header *hdr, void *mem)
 
 	if (jb->running) {
 
-		if (jb->jbtype == JBUF_ADAPTIVE)
+		if (jb->jbtype == JBUF_ADAPTIVE && !jb->wish_ext)
 			calc_rdiff(jb, seq);
 
 		/* Packet arrived too late to be put into buffer */
@@ -535,7 +572,9 @@ int jbuf_get(struct jbuf *jb, struct rtp_header *hdr, void **mem)
 	if (jb->seq_get) {
 		const int16_t seq_diff = f->hdr.seq - jb->seq_get;
 		if (seq_less(f->hdr.seq, jb->seq_get)) {
-			DEBUG_WARNING("get: seq=%u too late\n", f->hdr.seq);
+			LOG_RATELIMIT(LEVEL_WARN,
+				      "jbuf: get: seq=%u too late\n",
+				      f->hdr.seq);
 		}
 		else if (seq_diff > 1) {
 			STAT_ADD(n_lost, 1);
@@ -3,25 +3,217 @@
  *
  * Copyright (C) 2010 Alfred E. Heggestad
  */
-
+#include <string.h>
 #include <re.h>
 #include <baresip.h>
+#include "core.h"
+
+
+/*
+ * With asynchronous logging enabled, messages are formatted by the
+ * calling thread and pushed to a bounded lock-free ring (multiple
+ * producers, one consumer). A background thread drains the ring and
+ * writes to stdout and the registered log handlers, so media threads
+ * never block on terminal or syslog I/O. If the ring is full, messages
+ * are dropped and counted.
+ */
+
+
+enum {
+	RING_SIZE   = 512,      /* must be a power of two */
+	SLOT_SIZE   = 240,      /* longer messages are heap allocated */
+	DRAIN_WAIT  = 50,       /* ms */
+	RL_BURST    = 10,
+	RL_INTERVAL = 100,      /* ms */
+};
+
+
+struct log_slot {
+	RE_ATOMIC size_t seq;
+	enum log_level level;
+	char *msg;
+	char buf[SLOT_SIZE];
+};
 
 
 static struct {
 	struct list logl;
-	enum log_level level;
+	RE_ATOMIC int level;
 	bool enable_stdout;
 	bool timestamps;
 	bool color;
+
+	/* asynchronous logging */
+	RE_ATOMIC bool async;
+	RE_ATOMIC bool run;
+	RE_ATOMIC bool idle;
+	RE_ATOMIC size_t tail;
+	RE_ATOMIC uint32_t dropped;
+	RE_ATOMIC unsigned writers;  /* producers that saw async enabled */
+	size_t head;
+	mtx_t *mtx;
+	cnd_t wake;
+	thrd_t thr;
 } lg = {
-	LIST_INIT,
-	LEVEL_INFO,
-	true,
-	false,
-	true
+	.logl          = LIST_INIT,
+	.level         = LEVEL_INFO,
+	.enable_stdout = true,
+	.timestamps    = false,
+	.color         = true,
 };
 
+static struct log_slot ring[RING_SIZE];
+
+
+static void output(enum log_level level, const char *msg)
+{
+	struct le *le;
+
+	if (lg.enable_stdout) {
+
+		bool color = level == LEVEL_WARN || level == LEVEL_ERROR;
+
+		color = color && lg.color;
+		if (color)
+			(void)re_fprintf(stdout, "\x1b[31m"); /* Red */
+
+		(void)re_fprintf(stdout, "%s", msg);
+
+		if (color)
+			(void)re_fprintf(stdout, "\x1b[;m");
+	}
+
+	le = lg.logl.head;
+
+	while (le) {
+
+		struct log *log = le->data;
+		le = le->next;
+
+		if (log->h)
+			log->h(level, msg);
+	}
+}
+
+
+static bool ring_push(enum log_level level, const char *msg, size_t len)
+{
+	struct log_slot *slot;
+	size_t pos = re_atomic_rlx(&lg.tail);
+
+	for (;;) {
+		intptr_t dif;
+
+		slot = &ring[pos & (RING_SIZE - 1)];
+		dif  = (intptr_t)re_atomic_acq(&slot->seq) - (intptr_t)pos;
+
+		if (dif == 0) {
+			if (re_atomic_compare_exchange_weak(&lg.tail, &pos,
+						pos + 1,
+						re_memory_order_relaxed,
+						re_memory_order_relaxed))
+				break;
+		}
+		else if (dif < 0) {
+			return false;  /* full */
+		}
+		else {
+			pos = re_atomic_rlx(&lg.tail);
+		}
+	}
+
+	slot->level = level;
+
+	if (len < sizeof(slot->buf)) {
+		memcpy(slot->buf, msg, len + 1);
+		slot->msg = slot->buf;
+	}
+	else {
+		slot->msg = mem_alloc(len + 1, NULL);
+		if (slot->msg)
+			memcpy(slot->msg, msg, len + 1);
+	}
+
+	re_atomic_rls_set(&slot->seq, pos + 1);
+
+	return true;
+}
+
+
+/* Single consumer, called with lg.mtx held */
+static size_t ring_drain(void)
+{
+	uint32_t dropped;
+	size_t n = 0;
+
+	for (;;) {
+		struct log_slot *slot = &ring[lg.head & (RING_SIZE - 1)];
+
+		if (re_atomic_acq(&slot->seq) != lg.head + 1)
+			break;
+
+		if (slot->msg)
+			output(slot->level, slot->msg);
+
+		if (slot->msg != slot->buf)
+			mem_deref(slot->msg);
+		slot->msg = NULL;
+
+		re_atomic_rls_set(&slot->seq, lg.head + RING_SIZE);
+		++lg.head;
+		++n;
+	}
+
+	dropped = re_atomic_rlx(&lg.dropped);
+	if (dropped) {
+		char buf[64];
+
+		re_atomic_rlx_sub(&lg.dropped, dropped);
+
+		re_snprintf(buf, sizeof(buf),
+			    "log: dropped %u messages\n", dropped);
+		output(LEVEL_WARN, buf);
+	}
+
+	return n;
+}
+
+
+static int drain_thread(void *arg)
+{
+	(void)arg;
+
+	mtx_lock(lg.mtx);
+
+	for (;;) {
+		bool run = re_atomic_acq(&lg.run);
+		struct timespec ts;
+		size_t n;
+
+		n = ring_drain();
+		if (!run)
+			break;
+		if (n)
+			continue;
+
+		timespec_get(&ts, TIME_UTC);
+		ts.tv_nsec += DRAIN_WAIT * 1000000L;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_nsec -= 1000000000L;
+			++ts.tv_sec;
+		}
+
+		/* producers signal only while we are idle */
+		re_atomic_rls_set(&lg.idle, true);
+		(void)cnd_timedwait(&lg.wake, lg.mtx, &ts);
+		re_atomic_rls_set(&lg.idle, false);
+	}
+
+	mtx_unlock(lg.mtx);
+
+	return 0;
+}
+
 
 /**
  * Register a log handler
@@ -33,7 +225,13 @@ void log_register_handler(struct log *log)
 	if (!log)
 		return;
 
+	if (lg.mtx)
+		mtx_lock(lg.mtx);
+
 	list_append(&lg.logl, &log->le, log);
+
+	if (lg.mtx)
+		mtx_unlock(lg.mtx);
 }
 
 
@@ -47,7 +245,13 @@ void log_unregister_handler(struct log *log)
 	if (!log)
 		return;
 
+	if (lg.mtx)
+		mtx_lock(lg.mtx);
+
 	list_unlink(&log->le);
+
+	if (lg.mtx)
+		mtx_unlock(lg.mtx);
 }
 
 
@@ -58,7 +262,7 @@ void log_unregister_handler(struct log *log)
  */
 void log_level_set(enum log_level level)
 {
-	lg.level = level;
+	re_atomic_rlx_set(&lg.level, level);
 }
 
 
@@ -69,7 +273,7 @@ void log_level_set(enum log_level level)
  */
 enum log_level log_level_get(void)
 {
-	return lg.level;
+	return (enum log_level)re_atomic_rlx(&lg.level);
 }
 
 
@@ -99,7 +303,7 @@ const char *log_level_name(enum log_level level)
  */
 void log_enable_debug(bool enable)
 {
-	lg.level = enable ? LEVEL_DEBUG : LEVEL_INFO;
+	log_level_set(enable ? LEVEL_DEBUG : LEVEL_INFO);
 }
 
 
@@ -110,7 +314,7 @@ void log_enable_debug(bool enable)
  */
 void log_enable_info(bool enable)
 {
-	lg.level = enable ? LEVEL_INFO : LEVEL_WARN;
+	log_level_set(enable ? LEVEL_INFO : LEVEL_WARN);
 }
 
 
@@ -147,6 +351,76 @@ void log_enable_color(bool enable)
 }
 
 
+/**
+ * Enable asynchronous logging from a background thread
+ *
+ * When disabled again, all pending messages are written before the
+ * function returns.
+ *
+ * @param enable True to enable, false to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int log_enable_async(bool enable)
+{
+	int err;
+
+	if (enable == (lg.mtx != NULL))
+		return 0;
+
+	if (!enable) {
+		re_atomic_seq_set(&lg.async, false);
+
+		/* a producer that saw async enabled is counted in writers,
+		 * wait until it has pushed its message */
+		while (re_atomic_seq(&lg.writers))
+			thrd_yield();
+
+		re_atomic_rls_set(&lg.run, false);
+		cnd_signal(&lg.wake);
+
+		thrd_join(lg.thr, NULL);
+
+		/* messages pushed while the thread was stopping, all
+		 * producers have published their slots */
+		ring_drain();
+
+		cnd_destroy(&lg.wake);
+		lg.mtx = mem_deref(lg.mtx);
+
+		return 0;
+	}
+
+	for (size_t i=0; i<RING_SIZE; i++)
+		re_atomic_rlx_set(&ring[i].seq, i);
+
+	re_atomic_rlx_set(&lg.tail, 0);
+	lg.head = 0;
+
+	err = mutex_alloc(&lg.mtx);
+	if (err)
+		return err;
+
+	if (cnd_init(&lg.wake) != thrd_success) {
+		lg.mtx = mem_deref(lg.mtx);
+		return ENOMEM;
+	}
+
+	re_atomic_rls_set(&lg.run, true);
+
+	err = thread_create_name(&lg.thr, "log", drain_thread, NULL);
+	if (err) {
+		cnd_destroy(&lg.wake);
+		lg.mtx = mem_deref(lg.mtx);
+		return err;
+	}
+
+	re_atomic_rls_set(&lg.async, true);
+
+	return 0;
+}
+
+
 /**
  * Print a message to the logging system
  *
@@ -160,9 +434,9 @@ void vlog(enum log_level level, const char *fmt, va_list ap)
 	char *p = buf;
 	size_t s = sizeof(buf);
 	int n;
-	struct le *le;
 
-	if (level < lg.level)
+	/* checked before any formatting is done */
+	if ((int)level < re_atomic_rlx(&lg.level))
 		return;
 
 	if (lg.timestamps) {
@@ -174,33 +448,30 @@ void vlog(enum log_level level, const char *fmt, va_list ap)
 		s -= n;
 	}
 
-	if (re_vsnprintf(p, s, fmt, ap) < 0)
+	n = re_vsnprintf(p, s, fmt, ap);
+	if (n < 0)
 		return;
 
-	if (lg.enable_stdout) {
-
-		bool color = level == LEVEL_WARN || level == LEVEL_ERROR;
-
-		color = color && lg.color;
-		if (color)
-			(void)re_fprintf(stdout, "\x1b[31m"); /* Red */
-
-		(void)re_fprintf(stdout, "%s", buf);
-
-		if (color)
-			(void)re_fprintf(stdout, "\x1b[;m");
+	if (!re_atomic_acq(&lg.async)) {
+		output(level, buf);
+		return;
 	}
 
-	le = lg.logl.head;
+	/* fence against log_enable_async(false) */
+	re_atomic_seq_add(&lg.writers, 1);
 
-	while (le) {
+	if (!re_atomic_seq(&lg.async)) {
+		re_atomic_seq_sub(&lg.writers, 1);
+		output(level, buf);
+		return;
+	}
 
-		struct log *log = le->data;
-		le = le->next;
+	if (!ring_push(level, buf, (size_t)(p - buf) + n))
+		re_atomic_rlx_add(&lg.dropped, 1);
+	else if (re_atomic_acq(&lg.idle))
+		cnd_signal(&lg.wake);
 
-		if (log->h)
-			log->h(level, buf);
-	}
+	re_atomic_seq_sub(&lg.writers, 1);
 }
 
 
@@ -221,6 +492,57 @@ void loglv(enum log_level level, const char *fmt, ...)
 }
 
 
+/**
+ * Print a message to the logging system, rate-limited per call site
+ *
+ * Each call site may log a burst of messages, then one message per
+ * interval. Suppressed messages are counted and reported with the next
+ * message that passes. Use the LOG_RATELIMIT() macro, which provides
+ * the per call site state.
+ *
+ * @param rl    Rate limiter state
+ * @param level Log level
+ * @param fmt   Formatted message
+ * @param ...   Variable arguments
+ */
+void loglv_ratelimit(struct log_ratelimit *rl, enum log_level level,
+		     const char *fmt, ...)
+{
+	uint64_t now, tat, ntat;
+	uint32_t suppressed;
+	va_list ap;
+
+	if (!rl || (int)level < re_atomic_rlx(&lg.level))
+		return;
+
+	/* token bucket as a generic cell rate algorithm (GCRA) */
+	now = tmr_jiffies();
+	tat = re_atomic_rlx(&rl->tat);
+
+	do {
+		ntat = max(tat, now) + RL_INTERVAL;
+
+		if (ntat - now > (uint64_t)RL_BURST * RL_INTERVAL) {
+			re_atomic_rlx_add(&rl->suppressed, 1);
+			return;
+		}
+	} while (!re_atomic_compare_exchange_weak(&rl->tat, &tat, ntat,
+						  re_memory_order_relaxed,
+						  re_memory_order_relaxed));
+
+	va_start(ap, fmt);
+	vlog(level, fmt, ap);
+	va_end(ap);
+
+	suppressed = re_atomic_rlx(&rl->suppressed);
+	if (suppressed) {
+		re_atomic_rlx_sub(&rl->suppressed, suppressed);
+		loglv(level, "(suppressed %u similar messages)\n",
+		      suppressed);
+	}
+}
+
+
 /**
  * Print a DEBUG message to the logging system
  *
@@ -94,6 +94,7 @@ int main(int argc, char *argv[])
 	const char *modv[16];
 	struct tmr tmr_quit;
 	bool sip_trace = false;
+	bool log_async = false;
 	size_t execmdc = 0;
 	size_t modc = 0;
 	size_t i;
@@ -233,6 +234,13 @@ int main(int argc, char *argv[])
 
 	re_thread_async_init(ASYNC_WORKERS);
 
+	(void)conf_get_bool(conf_cur(), "log_async", &log_async);
+	if (log_async) {
+		err = log_enable_async(true);
+		if (err)
+			warning("main: async logging failed (%m)\n", err);
+	}
+
 	/*
 	 * Set the network interface before initializing the config
 	 */
@@ -341,6 +349,9 @@ int main(int argc, char *argv[])
 
 	baresip_close();
 
+	/* flush pending messages to the log handlers of modules */
+	(void)log_enable_async(false);
+
 	/* NOTE: modules must be unloaded after all application
 	 *       activity has stopped.
 	 */
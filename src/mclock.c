@@ -0,0 +1,500 @@
+/**
+ * @file mclock.c  Media clock -- shared periodic timers for media devices
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#ifdef HAVE_TIMERFD
+#include <sys/timerfd.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <string.h>
+#include <time.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * Media devices without a hardware clock (file, bridge) need a callback
+ * every packet-time. Instead of one polling thread per device, clocks
+ * are served by a pool of worker threads, one per CPU core. A worker
+ * keeps its clocks sorted by deadline and sleeps on a timerfd until the
+ * next one is due. Devices that block in their callback can ask for a
+ * dedicated worker.
+ */
+
+
+enum {
+	RESYNC_US = 1000000,  /**< Skip ahead if this late [us] */
+};
+
+
+struct mediaclock {
+	struct list workerl;        /**< Running workers                 */
+	unsigned maxw;              /**< Max. number of shared workers   */
+	mtx_t *mtx;                 /**< Protects workerl and worker->n  */
+};
+
+struct mclock_worker {
+	struct le le;               /**< Member of mediaclock workerl    */
+	struct mediaclock *mcs;     /**< Clock service (referenced)      */
+	unsigned n;                 /**< Number of clocks                */
+	bool dedicated;             /**< Reserved for a single clock     */
+
+	/* Protected by mtx */
+	struct list clockl;         /**< Clocks sorted by deadline       */
+	struct mclock *cur;         /**< Clock in callback, or NULL      */
+	bool cur_del;               /**< Current clock was removed       */
+	bool run;
+	uint64_t ticks;             /**< Number of callbacks             */
+	uint64_t resync;            /**< Number of resynchronizations    */
+	mtx_t *mtx;
+	cnd_t cnd;                  /**< Signalled after each callback   */
+#ifdef HAVE_TIMERFD
+	int fd;                     /**< Timer file descriptor           */
+#else
+	cnd_t wake;                 /**< Signalled on changes            */
+#endif
+	thrd_t thr;
+};
+
+struct mclock {
+	struct le le;               /**< Member of worker clockl         */
+	struct mclock_worker *w;    /**< Worker (referenced)             */
+	uint64_t period;            /**< Packet-time [us]                */
+	uint64_t next;              /**< Next deadline [us]              */
+	uint64_t ts;                /**< Timestamp of next callback [us] */
+	mclock_h *h;
+	void *arg;
+};
+
+
+static uint64_t now_us(void)
+{
+#ifdef HAVE_TIMERFD
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+	return tmr_jiffies_usec();
+#endif
+}
+
+
+static unsigned cpu_count(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? (unsigned)n : 1;
+#else
+	return 4;
+#endif
+}
+
+
+/* Wake up the worker, called with worker mutex held */
+static void worker_kick(struct mclock_worker *w)
+{
+#ifdef HAVE_TIMERFD
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_nsec = 1;  /* in the past, expires now */
+
+	(void)timerfd_settime(w->fd, TFD_TIMER_ABSTIME, &its, NULL);
+#else
+	cnd_signal(&w->wake);
+#endif
+}
+
+
+/* Sleep until deadline (0 for no deadline), called with mutex held */
+static void worker_wait(struct mclock_worker *w, uint64_t deadline)
+{
+#ifdef HAVE_TIMERFD
+	struct itimerspec its;
+	uint64_t exp;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec  = deadline / 1000000;
+	its.it_value.tv_nsec = (deadline % 1000000) * 1000;
+
+	(void)timerfd_settime(w->fd, TFD_TIMER_ABSTIME, &its, NULL);
+
+	mtx_unlock(w->mtx);
+	if (read(w->fd, &exp, sizeof(exp)) < 0) {
+		/* interrupted, the caller checks the deadline again */
+	}
+	mtx_lock(w->mtx);
+#else
+	struct timespec ts;
+	uint64_t now, us;
+
+	if (!deadline) {
+		cnd_wait(&w->wake, w->mtx);
+		return;
+	}
+
+	now = now_us();
+	us  = deadline > now ? deadline - now : 0;
+
+	timespec_get(&ts, TIME_UTC);
+	us += ts.tv_nsec / 1000;
+	ts.tv_sec  += us / 1000000;
+	ts.tv_nsec  = (us % 1000000) * 1000;
+
+	(void)cnd_timedwait(&w->wake, w->mtx, &ts);
+#endif
+}
+
+
+static void clock_insert(struct mclock_worker *w, struct mclock *c)
+{
+	struct le *le;
+
+	for (le = w->clockl.head; le; le = le->next) {
+		const struct mclock *x = le->data;
+
+		if (x->next > c->next)
+			break;
+	}
+
+	if (le)
+		list_insert_before(&w->clockl, le, &c->le, c);
+	else
+		list_append(&w->clockl, &c->le, c);
+}
+
+
+static int worker_thread(void *arg)
+{
+	struct mclock_worker *w = arg;
+
+	mtx_lock(w->mtx);
+
+	while (w->run) {
+
+		struct mclock *c = list_ledata(list_head(&w->clockl));
+		uint64_t now = now_us();
+		uint64_t ts;
+
+		if (!c || c->next > now) {
+			worker_wait(w, c ? c->next : 0);
+			continue;
+		}
+
+		list_unlink(&c->le);
+
+		/* do not burst after a long stall */
+		if (now - c->next > RESYNC_US) {
+			c->next = now;
+			++w->resync;
+		}
+
+		ts = c->ts;
+		c->next += c->period;
+		c->ts   += c->period;
+
+		w->cur = c;
+		w->cur_del = false;
+		mtx_unlock(w->mtx);
+
+		c->h(ts, c->arg);
+
+		mtx_lock(w->mtx);
+		if (!w->cur_del)
+			clock_insert(w, c);
+
+		w->cur = NULL;
+		++w->ticks;
+		cnd_broadcast(&w->cnd);
+	}
+
+	mtx_unlock(w->mtx);
+
+	/* the thread holds its own reference */
+	mem_deref(w);
+
+	return 0;
+}
+
+
+static void worker_destructor(void *arg)
+{
+	struct mclock_worker *w = arg;
+
+#ifdef HAVE_TIMERFD
+	if (w->fd >= 0)
+		(void)close(w->fd);
+#else
+	cnd_destroy(&w->wake);
+#endif
+	cnd_destroy(&w->cnd);
+	mem_deref(w->mtx);
+	mem_deref(w->mcs);
+}
+
+
+static int worker_alloc(struct mclock_worker **wp, struct mediaclock *mcs,
+			bool dedicated)
+{
+	struct mclock_worker *w;
+	int err;
+
+	w = mem_zalloc(sizeof(*w), worker_destructor);
+	if (!w)
+		return ENOMEM;
+
+	w->mcs = mem_ref(mcs);
+
+#ifdef HAVE_TIMERFD
+	w->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (w->fd < 0) {
+		err = errno;
+		goto out;
+	}
+#else
+	if (cnd_init(&w->wake) != thrd_success) {
+		err = ENOMEM;
+		goto out;
+	}
+#endif
+
+	if (cnd_init(&w->cnd) != thrd_success) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = mutex_alloc(&w->mtx);
+	if (err)
+		goto out;
+
+	w->dedicated = dedicated;
+	w->run       = true;
+
+	err = thread_create_name(&w->thr, "mclock", worker_thread, w);
+	if (err)
+		goto out;
+
+	/* the thread holds a reference, released on exit. It does not
+	 * exit before run is cleared, which needs a clock of the worker */
+	mem_ref(w);
+
+ out:
+	if (err)
+		mem_deref(w);
+	else
+		*wp = w;
+
+	return err;
+}
+
+
+/* Pick a worker for a new clock, called with service mutex held */
+static int worker_get(struct mclock_worker **wp, struct mediaclock *mcs,
+		      bool dedicated)
+{
+	struct mclock_worker *best = NULL;
+	unsigned nw = 0;
+	struct le *le;
+	int err;
+
+	for (le = mcs->workerl.head; le && !dedicated; le = le->next) {
+		struct mclock_worker *w = le->data;
+
+		if (w->dedicated)
+			continue;
+
+		++nw;
+		if (!best || w->n < best->n)
+			best = w;
+	}
+
+	if (best && nw >= mcs->maxw) {
+		++best->n;
+		*wp = mem_ref(best);
+		return 0;
+	}
+
+	err = worker_alloc(&best, mcs, dedicated);
+	if (err)
+		return err;
+
+	best->n = 1;
+	list_append(&mcs->workerl, &best->le, best);
+
+	*wp = best;
+
+	return 0;
+}
+
+
+static void clock_destructor(void *arg)
+{
+	struct mclock *c = arg;
+	struct mclock_worker *w = c->w;
+	struct mediaclock *mcs = w->mcs;
+	bool self, stop;
+
+	mtx_lock(mcs->mtx);
+	stop = --w->n == 0;
+	if (stop)
+		list_unlink(&w->le);
+	mtx_unlock(mcs->mtx);
+
+	self = thrd_equal(thrd_current(), w->thr);
+
+	mtx_lock(w->mtx);
+	list_unlink(&c->le);
+
+	if (w->cur == c) {
+		w->cur_del = true;
+
+		/* wait for the callback, unless called from it */
+		while (!self && w->cur == c)
+			cnd_wait(&w->cnd, w->mtx);
+	}
+
+	if (stop) {
+		w->run = false;
+		worker_kick(w);
+	}
+	mtx_unlock(w->mtx);
+
+	if (stop) {
+		if (self)
+			thrd_detach(w->thr);
+		else
+			thrd_join(w->thr, NULL);
+	}
+
+	mem_deref(w);
+}
+
+
+/**
+ * Start a periodic media clock
+ *
+ * The handler is called from a media clock thread every packet-time,
+ * with the nominal timestamp of the packet. Late callbacks are caught
+ * up. The handler is not running anymore when the clock is dereferenced.
+ *
+ * @param mcp    Pointer to allocated media clock
+ * @param ptime  Packet-time in [ms]
+ * @param flags  Media clock flags (enum mclock_flags)
+ * @param h      Clock handler
+ * @param arg    Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int mclock_start(struct mclock **mcp, uint32_t ptime, int flags,
+		 mclock_h *h, void *arg)
+{
+	struct mediaclock *mcs = baresip_mediaclock();
+	struct mclock_worker *w;
+	struct mclock *c;
+	int err;
+
+	if (!mcp || !ptime || !h || !mcs)
+		return EINVAL;
+
+	c = mem_zalloc(sizeof(*c), NULL);
+	if (!c)
+		return ENOMEM;
+
+	mtx_lock(mcs->mtx);
+	err = worker_get(&w, mcs, flags & MCLOCK_DEDICATED);
+	mtx_unlock(mcs->mtx);
+	if (err) {
+		mem_deref(c);
+		return err;
+	}
+
+	c->w      = w;
+	c->period = ptime * 1000ULL;
+	c->h      = h;
+	c->arg    = arg;
+
+	mem_destructor(c, clock_destructor);
+
+	mtx_lock(w->mtx);
+	c->ts   = tmr_jiffies_usec();
+	c->next = now_us() + c->period;
+	clock_insert(w, c);
+	if (w->clockl.head == &c->le)
+		worker_kick(w);
+	mtx_unlock(w->mtx);
+
+	*mcp = c;
+
+	return 0;
+}
+
+
+static void mediaclock_destructor(void *arg)
+{
+	struct mediaclock *mcs = arg;
+
+	mem_deref(mcs->mtx);
+}
+
+
+int mediaclock_alloc(struct mediaclock **mcsp)
+{
+	struct mediaclock *mcs;
+	int err;
+
+	if (!mcsp)
+		return EINVAL;
+
+	mcs = mem_zalloc(sizeof(*mcs), mediaclock_destructor);
+	if (!mcs)
+		return ENOMEM;
+
+	err = mutex_alloc(&mcs->mtx);
+	if (err) {
+		mem_deref(mcs);
+		return err;
+	}
+
+	mcs->maxw = cpu_count();
+
+	*mcsp = mcs;
+
+	return 0;
+}
+
+
+int mediaclock_debug(struct re_printf *pf, const struct mediaclock *mcs)
+{
+	struct le *le;
+	int err;
+
+	if (!mcs)
+		return 0;
+
+	err = re_hprintf(pf, "Media clock (max %u shared workers)\n",
+			 mcs->maxw);
+
+	mtx_lock(mcs->mtx);
+
+	for (le = mcs->workerl.head; le; le = le->next) {
+		struct mclock_worker *w = le->data;
+
+		mtx_lock(w->mtx);
+		err |= re_hprintf(pf, "  worker %p: clocks=%u%s ticks=%llu"
+				  " resync=%llu\n",
+				  w, w->n, w->dedicated ? " (dedicated)" : "",
+				  w->ticks, w->resync);
+		mtx_unlock(w->mtx);
+	}
+
+	mtx_unlock(mcs->mtx);
+
+	return err;
+}
@@ -0,0 +1,623 @@
+/**
+ * @file mempool.c  Per-thread memory pools for media hot paths
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * Every thread that allocates from the pools gets its own pool, so the
+ * allocating thread never contends with other threads. A pool has one
+ * size class per power of two, for plain memory and for mbufs.
+ *
+ * Each class has an explicit free list. An object in use belongs to the
+ * user only, and is released with mem_deref() as usual, from any
+ * thread. The destructor of the object then takes a new reference and
+ * puts the object on the free list of its class, under the lock of the
+ * free list, so the owner thread sees all writes to the object before
+ * it is handed out again. Free objects are handed out last in, first
+ * out.
+ *
+ * A class grows up to a limit, beyond that the allocation falls back
+ * to the heap and is counted as a miss. The pool of a thread is freed
+ * when the thread exits, the free objects are freed then. Objects
+ * still in use stay valid and are freed when they are released.
+ */
+
+
+enum {
+	RAW_MIN_SHIFT  = 6,                  /**< 64 bytes               */
+	RAW_CLASSES    = 17,                 /**< up to 4 MB             */
+	MBUF_MIN_SHIFT = 8,                  /**< 256 bytes              */
+	MBUF_CLASSES   = 9,                  /**< up to 64 KB            */
+	CLASS_OBJ_MAX  = 1024,               /**< Objects per class      */
+	CLASS_MEM_MAX  = 16 * 1024 * 1024,   /**< Bytes per class        */
+};
+
+
+/** Free list of a size class, shared with the objects of the class */
+struct pool_free {
+	mtx_t *mtx;           /**< Protects all fields         */
+	struct list freel;    /**< Free objects                */
+	uint32_t objc;        /**< Number of objects           */
+	bool closed;          /**< Pool is gone, free objects  */
+};
+
+/** Pool entry, placed after the object data */
+struct pool_ent {
+	struct le le;         /**< Member of free list         */
+	struct pool_free *fl; /**< Free list, referenced       */
+};
+
+/** Pooled mbuf */
+struct pool_mbuf {
+	struct mbuf mb;       /**< Must be first               */
+	struct pool_ent ent;
+};
+
+/** Size class */
+struct pool_class {
+	size_t size;          /**< Object size                 */
+	struct pool_free *fl; /**< Free list                   */
+	uint64_t n_alloc;     /**< Allocations from the class  */
+	uint64_t n_miss;      /**< Allocations from the heap   */
+	uint64_t n_last;      /**< n_alloc at last debug       */
+};
+
+/** Memory pool of one thread */
+struct pool {
+	struct le le;
+	unsigned id;
+	struct pool_class rawv[RAW_CLASSES];
+	struct pool_class mbufv[MBUF_CLASSES];
+	uint64_t t_last;      /**< Time of last debug [ms]     */
+};
+
+static struct {
+	tss_t key;
+	mtx_t mtx;            /**< Protects the pool list      */
+	struct list pooll;
+	unsigned id;
+	bool inited;
+} mempool;
+
+
+/*
+ * Put a released object on its free list. Returns false if the pool is
+ * gone, the object is then freed and the caller frees its resources.
+ */
+static bool ent_release(void *obj, struct pool_ent *ent)
+{
+	struct pool_free *fl = ent->fl;
+	bool keep;
+
+	mtx_lock(fl->mtx);
+
+	keep = !fl->closed;
+	if (keep)
+		list_prepend(&fl->freel, &ent->le, mem_ref(obj));
+	else
+		--fl->objc;
+
+	mtx_unlock(fl->mtx);
+
+	if (!keep)
+		mem_deref(fl);
+
+	return keep;
+}
+
+
+/*
+ * Plain memory has the pool entry after the data. The destructor only
+ * gets the data, so each class has its own destructor that knows the
+ * offset.
+ */
+#define RAW_ENT(obj, i)							\
+	((struct pool_ent *)((uint8_t *)(obj) +				\
+			     ((size_t)1 << (RAW_MIN_SHIFT + (i)))))
+
+#define RAW_DESTRUCTOR(i)						\
+	static void raw_destructor_##i(void *obj)			\
+	{								\
+		(void)ent_release(obj, RAW_ENT(obj, i));		\
+	}
+
+RAW_DESTRUCTOR(0)  RAW_DESTRUCTOR(1)  RAW_DESTRUCTOR(2)  RAW_DESTRUCTOR(3)
+RAW_DESTRUCTOR(4)  RAW_DESTRUCTOR(5)  RAW_DESTRUCTOR(6)  RAW_DESTRUCTOR(7)
+RAW_DESTRUCTOR(8)  RAW_DESTRUCTOR(9)  RAW_DESTRUCTOR(10) RAW_DESTRUCTOR(11)
+RAW_DESTRUCTOR(12) RAW_DESTRUCTOR(13) RAW_DESTRUCTOR(14) RAW_DESTRUCTOR(15)
+RAW_DESTRUCTOR(16)
+
+static mem_destroy_h * const raw_destructorv[RAW_CLASSES] = {
+	raw_destructor_0,  raw_destructor_1,  raw_destructor_2,
+	raw_destructor_3,  raw_destructor_4,  raw_destructor_5,
+	raw_destructor_6,  raw_destructor_7,  raw_destructor_8,
+	raw_destructor_9,  raw_destructor_10, raw_destructor_11,
+	raw_destructor_12, raw_destructor_13, raw_destructor_14,
+	raw_destructor_15, raw_destructor_16,
+};
+
+
+static void mbuf_destructor(void *arg)
+{
+	struct pool_mbuf *pm = arg;
+
+	if (!ent_release(pm, &pm->ent))
+		mem_deref(pm->mb.buf);
+}
+
+
+static void free_destructor(void *arg)
+{
+	struct pool_free *fl = arg;
+
+	mem_deref(fl->mtx);
+}
+
+
+static int class_init(struct pool_class *pc, size_t size)
+{
+	struct pool_free *fl;
+	int err;
+
+	fl = mem_zalloc(sizeof(*fl), free_destructor);
+	if (!fl)
+		return ENOMEM;
+
+	err = mutex_alloc(&fl->mtx);
+	if (err) {
+		mem_deref(fl);
+		return err;
+	}
+
+	pc->size = size;
+	pc->fl   = fl;
+
+	return 0;
+}
+
+
+/* free the free objects, objects in use are freed on release */
+static void class_close(struct pool_class *pc)
+{
+	struct pool_free *fl = pc->fl;
+	struct le *le;
+
+	if (!fl)
+		return;
+
+	mtx_lock(fl->mtx);
+	fl->closed = true;
+	mtx_unlock(fl->mtx);
+
+	do {
+		mtx_lock(fl->mtx);
+		le = list_head(&fl->freel);
+		list_unlink(le);
+		mtx_unlock(fl->mtx);
+
+		if (le)
+			mem_deref(le->data);
+
+	} while (le);
+
+	pc->fl = mem_deref(fl);
+}
+
+
+static void pool_destructor(void *arg)
+{
+	struct pool *p = arg;
+	unsigned i;
+
+	mtx_lock(&mempool.mtx);
+	list_unlink(&p->le);
+	mtx_unlock(&mempool.mtx);
+
+	for (i = 0; i < RAW_CLASSES; i++)
+		class_close(&p->rawv[i]);
+
+	for (i = 0; i < MBUF_CLASSES; i++)
+		class_close(&p->mbufv[i]);
+}
+
+
+/* called on thread exit */
+static void tss_destructor(void *arg)
+{
+	mem_deref(arg);
+}
+
+
+static struct pool *pool_get(void)
+{
+	struct pool *p;
+	unsigned i;
+	int err = 0;
+
+	if (!mempool.inited)
+		return NULL;
+
+	p = tss_get(mempool.key);
+	if (p)
+		return p;
+
+	p = mem_zalloc(sizeof(*p), pool_destructor);
+	if (!p)
+		return NULL;
+
+	for (i = 0; i < RAW_CLASSES; i++)
+		err |= class_init(&p->rawv[i],
+				  (size_t)1 << (RAW_MIN_SHIFT + i));
+
+	for (i = 0; i < MBUF_CLASSES; i++)
+		err |= class_init(&p->mbufv[i],
+				  (size_t)1 << (MBUF_MIN_SHIFT + i));
+
+	p->t_last = tmr_jiffies();
+
+	if (err || tss_set(mempool.key, p) != thrd_success) {
+		mem_deref(p);
+		return NULL;
+	}
+
+	mtx_lock(&mempool.mtx);
+	p->id = ++mempool.id;
+	list_append(&mempool.pooll, &p->le, p);
+	mtx_unlock(&mempool.mtx);
+
+	return p;
+}
+
+
+static struct pool_class *class_find(struct pool_class *classv, size_t n,
+				     unsigned shift, size_t size)
+{
+	unsigned i = 0;
+
+	while (i < n && ((size_t)1 << (shift + i)) < size)
+		++i;
+
+	return i < n ? &classv[i] : NULL;
+}
+
+
+/* a free object of the class, the reference of the free list */
+static void *class_get(struct pool_class *pc)
+{
+	struct pool_free *fl = pc->fl;
+	struct le *le;
+
+	mtx_lock(fl->mtx);
+	le = list_head(&fl->freel);
+	list_unlink(le);
+	mtx_unlock(fl->mtx);
+
+	if (!le)
+		return NULL;
+
+	++pc->n_alloc;
+
+	return le->data;
+}
+
+
+/* reserve a new object in the class, false if the class is full */
+static bool class_reserve(struct pool_class *pc)
+{
+	struct pool_free *fl = pc->fl;
+	bool ok;
+
+	/* the object count is read by mempool_debug() */
+	mtx_lock(fl->mtx);
+
+	ok = fl->objc < CLASS_OBJ_MAX &&
+		(fl->objc + 1) * pc->size <= CLASS_MEM_MAX;
+	if (ok)
+		++fl->objc;
+
+	mtx_unlock(fl->mtx);
+
+	if (ok)
+		++pc->n_alloc;
+	else
+		++pc->n_miss;
+
+	return ok;
+}
+
+
+/* undo class_reserve() after a failed allocation */
+static void class_unreserve(struct pool_class *pc)
+{
+	mtx_lock(pc->fl->mtx);
+	--pc->fl->objc;
+	mtx_unlock(pc->fl->mtx);
+
+	--pc->n_alloc;
+	++pc->n_miss;
+}
+
+
+/**
+ * Allocate memory from the pool of the calling thread. The memory is
+ * not initialised and must not be reallocated.
+ *
+ * @param size Number of bytes
+ *
+ * @return Pointer to memory, release with mem_deref()
+ */
+void *mempool_alloc(size_t size)
+{
+	struct pool_class *pc;
+	struct pool_ent *ent;
+	struct pool *p;
+	void *obj;
+	size_t i;
+
+	p  = pool_get();
+	pc = p ? class_find(p->rawv, RAW_CLASSES, RAW_MIN_SHIFT, size) : NULL;
+	if (!pc)
+		return mem_alloc(size, NULL);
+
+	obj = class_get(pc);
+	if (obj)
+		return obj;
+
+	if (!class_reserve(pc))
+		return mem_alloc(size, NULL);
+
+	i   = pc - p->rawv;
+	obj = mem_alloc(pc->size + sizeof(*ent), raw_destructorv[i]);
+	if (!obj) {
+		class_unreserve(pc);
+		return NULL;
+	}
+
+	ent = RAW_ENT(obj, i);
+	memset(&ent->le, 0, sizeof(ent->le));
+	ent->fl = mem_ref(pc->fl);
+
+	return obj;
+}
+
+
+/**
+ * Allocate an mbuf from the pool of the calling thread
+ *
+ * @param size Minimum buffer size
+ *
+ * @return Empty mbuf, release with mem_deref()
+ */
+struct mbuf *mempool_mbuf(size_t size)
+{
+	struct pool_class *pc;
+	struct pool_mbuf *pm;
+	struct pool *p;
+	struct mbuf *mb;
+
+	p  = pool_get();
+	pc = p ? class_find(p->mbufv, MBUF_CLASSES, MBUF_MIN_SHIFT, size)
+		: NULL;
+	if (!pc)
+		return mbuf_alloc(size);
+
+	mb = class_get(pc);
+	if (mb) {
+		mb->pos = mb->end = 0;
+
+		if (mb->size < size && mbuf_resize(mb, pc->size)) {
+			mem_deref(mb);
+			return mbuf_alloc(size);
+		}
+
+		return mb;
+	}
+
+	if (!class_reserve(pc))
+		return mbuf_alloc(size);
+
+	pm = mem_zalloc(sizeof(*pm), mbuf_destructor);
+	if (!pm) {
+		class_unreserve(pc);
+		return NULL;
+	}
+
+	pm->ent.fl = mem_ref(pc->fl);
+
+	if (mbuf_resize(&pm->mb, pc->size)) {
+		mem_deref(pm);
+		return NULL;
+	}
+
+	return &pm->mb;
+}
+
+
+/**
+ * Duplicate an mbuf into an mbuf from the pool of the calling thread
+ *
+ * @param mbs Source mbuf
+ *
+ * @return Copy of the mbuf with the same position, release with
+ *         mem_deref()
+ */
+struct mbuf *mempool_mbuf_dup(const struct mbuf *mbs)
+{
+	struct mbuf *mb;
+
+	if (!mbs)
+		return NULL;
+
+	mb = mempool_mbuf(mbs->end);
+	if (!mb)
+		return NULL;
+
+	memcpy(mb->buf, mbs->buf, mbs->end);
+	mb->pos = mbs->pos;
+	mb->end = mbs->end;
+
+	return mb;
+}
+
+
+/**
+ * Allocate a video frame from the pool of the calling thread. The
+ * frame is not initialised.
+ *
+ * @param vfp Pointer to allocated video frame
+ * @param fmt Video format
+ * @param sz  Size of video frame
+ *
+ * @return 0 for success, otherwise error code
+ */
+int mempool_vidframe(struct vidframe **vfp, enum vidfmt fmt,
+		     const struct vidsz *sz)
+{
+	struct vidframe *vf;
+
+	if (!vfp || !sz || !sz->w || !sz->h)
+		return EINVAL;
+
+	vf = mempool_alloc(sizeof(*vf) + vidframe_size(fmt, sz));
+	if (!vf)
+		return ENOMEM;
+
+	vidframe_init_buf(vf, fmt, sz, (uint8_t *)(vf + 1));
+
+	*vfp = vf;
+
+	return 0;
+}
+
+
+static int class_debug(struct re_printf *pf, const struct pool_class *pc,
+		       const char *type, uint64_t dt)
+{
+	uint32_t objc, inuse;
+
+	if (!pc->n_alloc && !pc->n_miss)
+		return 0;
+
+	mtx_lock(pc->fl->mtx);
+	objc  = pc->fl->objc;
+	inuse = objc - list_count(&pc->fl->freel);
+	mtx_unlock(pc->fl->mtx);
+
+	return re_hprintf(pf, "    %-4s %8zu: %8llu allocs/s"
+			  "  in use %9zu bytes  high-water %9zu bytes"
+			  "  (%llu allocs, %llu misses)\n",
+			  type, pc->size,
+			  dt ? (pc->n_alloc - pc->n_last) * 1000 / dt : 0,
+			  inuse * pc->size, objc * pc->size,
+			  pc->n_alloc, pc->n_miss);
+}
+
+
+/**
+ * Print the memory pools of all threads and their statistics. The
+ * allocation rate is measured since the previous call.
+ *
+ * @param pf     Print function
+ * @param unused Unused parameter
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int mempool_debug(struct re_printf *pf, void *unused)
+{
+	uint64_t now = tmr_jiffies();
+	struct le *le;
+	int err = 0;
+	(void)unused;
+
+	if (!mempool.inited)
+		return re_hprintf(pf, "memory pools not initialised\n");
+
+	mtx_lock(&mempool.mtx);
+
+	err |= re_hprintf(pf, "Memory pools (%u threads):\n",
+			  list_count(&mempool.pooll));
+
+	LIST_FOREACH(&mempool.pooll, le) {
+
+		struct pool *p = le->data;
+		uint64_t dt = now - p->t_last;
+		unsigned i;
+
+		err |= re_hprintf(pf, "  pool %u:\n", p->id);
+
+		for (i = 0; i < RAW_CLASSES; i++) {
+			err |= class_debug(pf, &p->rawv[i], "mem", dt);
+			p->rawv[i].n_last = p->rawv[i].n_alloc;
+		}
+
+		for (i = 0; i < MBUF_CLASSES; i++) {
+			err |= class_debug(pf, &p->mbufv[i], "mbuf", dt);
+			p->mbufv[i].n_last = p->mbufv[i].n_alloc;
+		}
+
+		p->t_last = now;
+	}
+
+	mtx_unlock(&mempool.mtx);
+
+	return err;
+}
+
+
+/**
+ * Initialise the memory pools
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int mempool_init(void)
+{
+	if (mempool.inited)
+		return 0;
+
+	if (mtx_init(&mempool.mtx, mtx_plain) != thrd_success)
+		return ENOMEM;
+
+	if (tss_create(&mempool.key, tss_destructor) != thrd_success) {
+		mtx_destroy(&mempool.mtx);
+		return ENOMEM;
+	}
+
+	list_init(&mempool.pooll);
+	mempool.inited = true;
+
+	return 0;
+}
+
+
+/**
+ * Close the memory pools. The pool of the calling thread is freed, the
+ * media threads must have exited.
+ */
+void mempool_close(void)
+{
+	struct pool *p;
+
+	if (!mempool.inited)
+		return;
+
+	p = tss_get(mempool.key);
+	(void)tss_set(mempool.key, NULL);
+	mem_deref(p);
+
+	if (!list_isempty(&mempool.pooll)) {
+		warning("mempool: %u pools of running threads\n",
+			list_count(&mempool.pooll));
+	}
+
+	mempool.inited = false;
+
+	tss_delete(mempool.key);
+	mtx_destroy(&mempool.mtx);
+}
@@ -54,6 +54,8 @@ const struct menc *menc_find(const struct list *mencl, const char *id)
 	if (!mencl)
 		return NULL;
 
+	module_lazy_load("menc");
+
 	for (le = mencl->head; le; le = le->next) {
 		struct menc *me = le->data;
 
@@ -56,6 +56,8 @@ const struct mnat *mnat_find(const struct list *mnatl, const char *id)
 	if (!mnatl)
 		return NULL;
 
+	module_lazy_load("mnat");
+
 	for (le=mnatl->head; le; le=le->next) {
 
 		mnat = le->data;
@@ -8,6 +8,30 @@
 #include "core.h"
 
 
+/*
+ * Modules listed with "module_lazy" are not loaded at startup. They are
+ * recorded as pending, with the types they register:
+ *
+ *     module_lazy   avcodec.so,vidcodec
+ *     module_lazy   avformat.so,ausrc,vidsrc
+ *
+ * A pending module is loaded on the first lookup of one of its types,
+ * e.g. a codec search or the codec list of a new call. Types are
+ * aucodec, vidcodec, aufilt, vidfilt, ausrc, auplay, vidsrc, vidisp,
+ * menc and mnat. A module without types is loaded on the first lookup
+ * of any type.
+ */
+
+struct lazy_mod {
+	struct le le;
+	char *path;
+	char *name;
+	char *types;                   /**< Comma separated, or NULL */
+};
+
+static struct list lazyl;          /**< Pending modules (struct lazy_mod) */
+
+
 /*
  * Append module extension, if not exist
  *
@@ -59,6 +83,7 @@ static int load_module(struct mod **modp, const struct pl *modpath,
 	char file[FS_PATH_MAX];
 	char namestr[256];
 	struct mod *m = NULL;
+	uint64_t t0 = tmr_jiffies_usec();
 	int err = 0;
 
 	if (!name)
@@ -92,14 +117,60 @@ static int load_module(struct mod **modp, const struct pl *modpath,
  out:
 	if (err) {
 		warning("module %r: %m\n", name, err);
+		return err;
 	}
-	else if (modp)
+
+	info("module: %r loaded in %llu us\n", name,
+	     tmr_jiffies_usec() - t0);
+
+	if (modp)
 		*modp = m;
 
 	return err;
 }
 
 
+static void lazy_destructor(void *arg)
+{
+	struct lazy_mod *lm = arg;
+
+	list_unlink(&lm->le);
+	mem_deref(lm->path);
+	mem_deref(lm->name);
+	mem_deref(lm->types);
+}
+
+
+static int module_lazy_handler(const struct pl *val, void *arg)
+{
+	const struct pl *path = arg;
+	struct pl name, types = PL_INIT;
+	struct lazy_mod *lm;
+	int err;
+
+	/* Format: "module[,type]*" */
+	if (re_regex(val->p, val->l, "[^,]+,[^]+", &name, &types))
+		name = *val;
+
+	lm = mem_zalloc(sizeof(*lm), lazy_destructor);
+	if (!lm)
+		return ENOMEM;
+
+	err  = pl_strdup(&lm->path, path);
+	err |= pl_strdup(&lm->name, &name);
+	if (pl_isset(&types))
+		err |= pl_strdup(&lm->types, &types);
+	if (err) {
+		mem_deref(lm);
+		return err;
+	}
+
+	list_append(&lazyl, &lm->le, lm);
+
+	return 0;
+}
+
+
 static int module_handler(const struct pl *val, void *arg)
 {
 	(void)load_module(NULL, arg, val);
@@ -131,6 +202,7 @@ static int module_app_handler(const struct pl *val, void *arg)
 int module_init(const struct conf *conf)
 {
 	struct pl path;
+	uint64_t t0 = tmr_jiffies();
 	int err;
 
 	if (!conf)
@@ -143,14 +215,89 @@ int module_init(const struct conf *conf)
 	if (err)
 		return err;
 
+	err = conf_apply(conf, "module_lazy", module_lazy_handler, &path);
+	if (err)
+		return err;
+
 	err = conf_apply(conf, "module_app", module_app_handler, &path);
 	if (err)
 		return err;
 
+	info("module: %u modules loaded in %llu ms (%u deferred)\n",
+	     list_count(mod_list()), tmr_jiffies() - t0,
+	     list_count(&lazyl));
+
 	return 0;
 }
 
 
+static bool lazy_has_type(const struct lazy_mod *lm, const char *type)
+{
+	struct pl types, t;
+
+	if (!lm->types)
+		return true;
+
+	pl_set_str(&types, lm->types);
+
+	while (0 == re_regex(types.p, types.l, "[^,]+", &t)) {
+
+		if (0 == pl_strcasecmp(&t, type))
+			return true;
+
+		pl_advance(&types, t.p + t.l - types.p);
+	}
+
+	return false;
+}
+
+
+/**
+ * Load the modules pending from "module_lazy" for a type
+ *
+ * Called on lookup of codecs, filters, devices or displays. Modules that
+ * fail to load are dropped and not tried again.
+ *
+ * @param type Module type, e.g. "aucodec"
+ */
+void module_lazy_load(const char *type)
+{
+	struct le *le;
+
+	if (list_isempty(&lazyl) || !type)
+		return;
+
+	le = list_head(&lazyl);
+	while (le) {
+
+		struct lazy_mod *lm = le->data;
+		struct pl path, name;
+		uint64_t t0;
+
+		if (!lazy_has_type(lm, type)) {
+			le = le->next;
+			continue;
+		}
+
+		/* note: the module init may use this list again */
+		list_unlink(&lm->le);
+
+		t0 = tmr_jiffies();
+
+		pl_set_str(&path, lm->path);
+		pl_set_str(&name, lm->name);
+		(void)load_module(NULL, &path, &name);
+
+		info("module: %s loaded on first %s lookup in %llu ms\n",
+		     lm->name, type, tmr_jiffies() - t0);
+
+		mem_deref(lm);
+
+		le = list_head(&lazyl);
+	}
+}
+
+
 /**
  * Unload all application modules in reverse order
  */
@@ -158,6 +305,9 @@ void module_app_unload(void)
 {
 	struct le *le = list_tail(mod_list());
 
+	/* modules that were never used are not loaded anymore */
+	list_flush(&lazyl);
+
 	/* unload in reverse order */
 	while (le) {
 		struct mod *mod = le->data;
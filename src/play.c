@@ -19,6 +19,8 @@ struct play {
 	struct play **playp;
 	mtx_t lock;
 	struct mbuf *mb;
+	struct wavmap *wav;
+	size_t wpos;
 	struct auplay_st *auplay;
 	char *mod;
 	char *dev;
@@ -118,6 +120,34 @@ static bool check_restart(void *arg)
 }
 
 
+static void write_wav(struct play *play, struct auframe *af)
+{
+	int16_t *sampv = af->sampv;
+	size_t pos = 0;
+	size_t n;
+
+	while (pos < af->sampc) {
+
+		/* convert only the window needed for this frame */
+		n = wavmap_read(play->wav, play->wpos, sampv + pos,
+				af->sampc - pos);
+
+		play->wpos += n;
+		pos += n;
+
+		if (pos < af->sampc) {
+			if (!check_restart(play))
+				break;
+
+			play->wpos = 0;
+		}
+	}
+
+	if (pos < af->sampc)
+		memset(sampv + pos, 0, (af->sampc - pos) * sizeof(*sampv));
+}
+
+
 /*
  * NOTE: DSP cannot be destroyed inside handler
  */
@@ -134,6 +164,11 @@ static void write_handler(struct auframe *af, void *arg)
 	if (play->eof)
 		goto silence;
 
+	if (play->wav) {
+		write_wav(play, af);
+		goto out;
+	}
+
 	while (pos < sz) {
 		left = mbuf_get_left(play->mb);
 		count = (left > sz - pos) ? sz - pos : left;
@@ -155,6 +190,7 @@ static void write_handler(struct auframe *af, void *arg)
 	if (play->eof)
 		memset((uint8_t *)af->sampv + pos, 0, sz - pos);
 
+ out:
 	mtx_unlock(&play->lock);
 }
 
@@ -175,6 +211,7 @@ static void destructor(void *arg)
 	mem_deref(play->mod);
 	mem_deref(play->dev);
 	mem_deref(play->mb);
+	mem_deref(play->wav);
 	mtx_destroy(&play->lock);
 	mem_deref(play->aubuf);
 	mem_deref(play->filename);
@@ -187,66 +224,43 @@ static void destructor(void *arg)
 }
 
 
-static int aufile_load(struct mbuf *mb, const char *filename,
-		       uint32_t *srate, uint8_t *channels)
+static int play_start(struct play **playp, struct player *player,
+		      struct play *play, uint32_t srate, uint8_t ch,
+		      int repeat, const char *play_mod, const char *play_dev)
 {
-	struct aufile_prm prm;
-	struct aufile *af;
+	struct auplay_prm wprm;
 	int err;
 
-	err = aufile_open(&af, &prm, filename, AUFILE_READ);
-	if (err)
-		return err;
+	tmr_init(&play->tmr);
+	play->repeat = repeat ? repeat : 1;
 
-	while (!err) {
-		uint8_t buf[4096];
-		size_t i, n;
-		int16_t *p = (void *)buf;
-
-		n = sizeof(buf);
-
-		err = aufile_read(af, buf, &n);
-		if (err || !n)
-			break;
-
-		switch (prm.fmt) {
-
-		case AUFMT_S16LE:
-			/* convert from Little-Endian to Native-Endian */
-			for (i=0; i<n/2; i++) {
-				int16_t s = sys_ltohs(*p++);
-				err |= mbuf_write_u16(mb, s);
-			}
-
-			break;
-
-		case AUFMT_PCMA:
-			for (i=0; i<n; i++) {
-				err |= mbuf_write_u16(mb,
-						      g711_alaw2pcm(buf[i]));
-			}
-			break;
-
-		case AUFMT_PCMU:
-			for (i=0; i<n; i++) {
-				err |= mbuf_write_u16(mb,
-						      g711_ulaw2pcm(buf[i]));
-			}
-			break;
-
-		default:
-			err = ENOSYS;
-			break;
-		}
+	err = mtx_init(&play->lock, mtx_plain) != thrd_success;
+	if (err) {
+		err = ENOMEM;
+		goto out;
 	}
 
-	mem_deref(af);
+	wprm.ch         = ch;
+	wprm.srate      = srate;
+	wprm.ptime      = PTIME;
+	wprm.fmt        = AUFMT_S16LE;
+
+	err = auplay_alloc(&play->auplay, baresip_auplayl(),
+			   play_mod, &wprm,
+			   play_dev, write_handler, play);
+	if (err)
+		goto out;
 
-	if (!err) {
-		mb->pos = 0;
+	list_append(&player->playl, &play->le, play);
+	tmr_start(&play->tmr, PTIME,  tmr_polling, play);
 
-		*srate    = prm.srate;
-		*channels = prm.channels;
+ out:
+	if (err) {
+		mem_deref(play);
+	}
+	else if (playp) {
+		play->playp = playp;
+		*playp = play;
 	}
 
 	return err;
@@ -272,9 +286,7 @@ int play_tone(struct play **playp, struct player *player,
 	      uint8_t ch, int repeat,
 	      const char *play_mod, const char *play_dev)
 {
-	struct auplay_prm wprm;
 	struct play *play;
-	int err;
 
 	if (!player)
 		return EINVAL;
@@ -285,40 +297,39 @@ int play_tone(struct play **playp, struct player *player,
 	if (!play)
 		return ENOMEM;
 
-	tmr_init(&play->tmr);
-	play->repeat = repeat ? repeat : 1;
-	play->mb     = mem_ref(tone);
+	play->mb = mem_ref(tone);
 
-	err = mtx_init(&play->lock, mtx_plain) != thrd_success;
-	if (err) {
-		err = ENOMEM;
-		goto out;
-	}
+	return play_start(playp, player, play, srate, ch, repeat,
+			  play_mod, play_dev);
+}
 
-	wprm.ch         = ch;
-	wprm.srate      = srate;
-	wprm.ptime      = PTIME;
-	wprm.fmt        = AUFMT_S16LE;
 
-	err = auplay_alloc(&play->auplay, baresip_auplayl(),
-			   play_mod, &wprm,
-			   play_dev, write_handler, play);
-	if (err)
-		goto out;
+/*
+ * Stream a WAV file from a shared memory-mapping, without loading it
+ */
+static int play_wav(struct play **playp, struct player *player,
+		    const char *path, int repeat,
+		    const char *play_mod, const char *play_dev)
+{
+	struct wavmap *wav;
+	struct play *play;
+	int err;
 
-	list_append(&player->playl, &play->le, play);
-	tmr_start(&play->tmr, PTIME,  tmr_polling, play);
+	err = wavmap_open(&wav, path);
+	if (err)
+		return err;
 
- out:
-	if (err) {
-		mem_deref(play);
-	}
-	else if (playp) {
-		play->playp = playp;
-		*playp = play;
+	play = mem_zalloc(sizeof(*play), destructor);
+	if (!play) {
+		mem_deref(wav);
+		return ENOMEM;
 	}
 
-	return err;
+	play->wav = wav;
+
+	return play_start(playp, player, play, wavmap_srate(wav),
+			  wavmap_channels(wav), repeat,
+			  play_mod, play_dev);
 }
 
 
@@ -529,10 +540,7 @@ int play_file(struct play **playp, struct player *player,
 	char file[FS_PATH_MAX];
 	char path[FS_PATH_MAX];
 	const struct ausrc *ausrc;
-	struct mbuf *mb = NULL;
 	int delay = 0;
-	uint32_t srate = 0;
-	uint8_t ch = 0;
 	struct play *play = NULL;
 
 	char srcn[FS_PATH_MAX];
@@ -571,21 +579,11 @@ int play_file(struct play **playp, struct player *player,
 		}
 	}
 
-	mb = mbuf_alloc(1024);
-	if (!mb)
-		return ENOMEM;
-
-	err = aufile_load(mb, path, &srate, &ch);
-	if (err) {
+	err = play_wav(&play, player, path, repeat, play_mod, play_dev);
+	if (err)
 		warning("play: %s: %m\n", path, err);
-		goto out;
-	}
-
-	err = play_tone(&play, player, mb, srate,
-	                ch, repeat, play_mod, play_dev);
 
  out:
-	mem_deref(mb);
 	if (play)
 		play->delay = delay;
 
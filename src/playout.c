@@ -0,0 +1,320 @@
+/**
+ * @file playout.c  Audio playout delay controller
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <re.h>
+#include <re_atomic.h>
+#include <rem.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The controller measures the transit delay of every incoming packet,
+ * i.e. the arrival time minus the RTP timestamp. Relative to the
+ * fastest packet in a sliding window, the transit delay is the time a
+ * packet must be buffered to be played out in time. The quantile of
+ * the relative delay at one minus the target late-loss rate is the
+ * minimum playout delay that meets the target.
+ *
+ * The RTP interarrival jitter from RTCP is a floor of the estimate,
+ * which matters while the window is short. The reordering depth sets
+ * the jitter buffer wish size, the rest of the playout delay is the
+ * target level of the audio buffer.
+ *
+ * The target follows a larger delay at once and a smaller delay by
+ * at most one packet time per update.
+ */
+
+
+enum {
+	WINDOW      = 500,    /**< Transit samples, 10 seconds at 20 ms  */
+	UPDATE_PKTS = 50,     /**< Packets between updates               */
+	JITTER_MUL  = 2,      /**< RTCP jitter multiplier for the floor  */
+};
+
+
+/** Playout delay controller */
+struct playout {
+	uint32_t ptime;            /**< Packet time [ms]                 */
+	struct range bounds;       /**< Playout delay bounds [ms]        */
+	double loss;               /**< Target late-loss rate (0-1)      */
+	RE_ATOMIC uint32_t crate;  /**< RTP clock rate [Hz]              */
+
+	int64_t transitv[WINDOW];  /**< Transit delay [us]               */
+	int64_t sortv[WINDOW];     /**< Sorted copy of transitv          */
+	uint32_t n;                /**< Number of samples in window      */
+	uint32_t idx;              /**< Next sample index                */
+	uint32_t pkts;             /**< Packets since last update        */
+	int64_t tmin;              /**< Window minimum at last update    */
+
+	bool started;
+	uint32_t ssrc;             /**< Synchronization source           */
+	uint32_t ts_last;          /**< Last RTP timestamp               */
+	int64_t ts_ext;            /**< Extended RTP timestamp           */
+	uint64_t t0;               /**< Arrival of first packet [us]     */
+	uint16_t seq_max;          /**< Highest sequence number          */
+	uint32_t reorder_cur;      /**< Reordering depth since update    */
+
+	RE_ATOMIC uint32_t target; /**< Playout delay [ms]               */
+	RE_ATOMIC uint32_t reorder;/**< Reordering depth [packets]       */
+
+	struct {
+		uint32_t quantile; /**< Measured delay quantile [us]     */
+		uint32_t jitter;   /**< RTCP interarrival jitter [us]    */
+		uint64_t n_pkt;    /**< Measured packets                 */
+		uint64_t n_late;   /**< Packets later than the target    */
+	} stats;
+};
+
+
+static int cmp_i64(const void *a, const void *b)
+{
+	const int64_t x = *(const int64_t *)a;
+	const int64_t y = *(const int64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+
+static void playout_reset(struct playout *po, uint32_t ssrc)
+{
+	po->n       = 0;
+	po->idx     = 0;
+	po->pkts    = 0;
+	po->tmin    = 0;
+	po->started = false;
+	po->ssrc    = ssrc;
+	po->reorder_cur = 0;
+}
+
+
+/**
+ * Allocate a playout delay controller
+ *
+ * @param pop    Pointer to allocated controller
+ * @param ptime  Packet time [ms]
+ * @param bounds Playout delay bounds [ms]
+ * @param loss   Target late-loss rate [%]
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int playout_alloc(struct playout **pop, uint32_t ptime,
+		  const struct range *bounds, double loss)
+{
+	struct playout *po;
+
+	if (!pop || !ptime || !bounds || loss <= 0.0 || loss >= 100.0)
+		return EINVAL;
+
+	po = mem_zalloc(sizeof(*po), NULL);
+	if (!po)
+		return ENOMEM;
+
+	po->ptime  = ptime;
+	po->bounds = *bounds;
+	po->loss   = loss / 100.0;
+
+	re_atomic_rlx_set(&po->target, bounds->min);
+
+	*pop = po;
+
+	return 0;
+}
+
+
+/**
+ * Set the RTP clock rate of the received payload
+ *
+ * @param po    Playout delay controller
+ * @param crate RTP clock rate [Hz]
+ */
+void playout_set_crate(struct playout *po, uint32_t crate)
+{
+	if (!po)
+		return;
+
+	re_atomic_rlx_set(&po->crate, crate);
+}
+
+
+/**
+ * Measure the arrival of an RTP packet, before the jitter buffer
+ *
+ * @param po  Playout delay controller
+ * @param hdr RTP header
+ * @param now Arrival time [us]
+ *
+ * @return True if the controller should be updated
+ */
+bool playout_arrival(struct playout *po, const struct rtp_header *hdr,
+		     uint64_t now)
+{
+	uint32_t crate;
+	int64_t transit, late;
+	int16_t dseq;
+
+	if (!po || !hdr)
+		return false;
+
+	crate = re_atomic_rlx(&po->crate);
+	if (!crate)
+		return false;
+
+	if (po->started && hdr->ssrc != po->ssrc)
+		playout_reset(po, hdr->ssrc);
+
+	if (!po->started) {
+		po->started = true;
+		po->ssrc    = hdr->ssrc;
+		po->ts_last = hdr->ts;
+		po->ts_ext  = 0;
+		po->t0      = now;
+		po->seq_max = hdr->seq;
+	}
+
+	po->ts_ext += (int32_t)(hdr->ts - po->ts_last);
+	po->ts_last = hdr->ts;
+
+	dseq = (int16_t)(hdr->seq - po->seq_max);
+	if (dseq > 0)
+		po->seq_max = hdr->seq;
+	else
+		po->reorder_cur = max(po->reorder_cur, (uint32_t)-dseq);
+
+	transit = (int64_t)(now - po->t0) - po->ts_ext * 1000000 / crate;
+
+	po->transitv[po->idx] = transit;
+	po->idx = (po->idx + 1) % WINDOW;
+	if (po->n < WINDOW)
+		++po->n;
+
+	/* late for the current playout delay, minus the frame size */
+	++po->stats.n_pkt;
+	late = (int64_t)re_atomic_rlx(&po->target) - po->ptime;
+	if (po->n > UPDATE_PKTS && transit - po->tmin > late * 1000)
+		++po->stats.n_late;
+
+	return ++po->pkts >= UPDATE_PKTS;
+}
+
+
+/**
+ * Update the playout delay from the measured transit delays
+ *
+ * @param po     Playout delay controller
+ * @param jitter RTCP interarrival jitter of the stream [us]
+ */
+void playout_update(struct playout *po, uint32_t jitter)
+{
+	uint32_t target, old, reorder;
+	int64_t delay;
+	uint32_t q;
+
+	if (!po || !po->n)
+		return;
+
+	po->pkts = 0;
+
+	memcpy(po->sortv, po->transitv, po->n * sizeof(po->sortv[0]));
+	qsort(po->sortv, po->n, sizeof(po->sortv[0]), cmp_i64);
+
+	q = (uint32_t)((1.0 - po->loss) * po->n);
+	if (q >= po->n)
+		q = po->n - 1;
+
+	po->tmin = po->sortv[0];
+	delay    = po->sortv[q] - po->tmin;
+
+	po->stats.quantile = (uint32_t)delay;
+	po->stats.jitter   = jitter;
+
+	delay = max(delay, (int64_t)jitter * JITTER_MUL);
+
+	/* one packet time for the frame size */
+	target = (uint32_t)((delay + 999) / 1000) + po->ptime;
+	target = max(target, po->bounds.min);
+	target = min(target, po->bounds.max);
+
+	old = re_atomic_rlx(&po->target);
+	if (target + po->ptime < old)
+		target = old - po->ptime;
+
+	re_atomic_rlx_set(&po->target, target);
+
+	reorder = re_atomic_rlx(&po->reorder);
+	reorder = max(po->reorder_cur, reorder ? reorder - 1 : 0);
+	re_atomic_rlx_set(&po->reorder, reorder);
+	po->reorder_cur = 0;
+}
+
+
+/**
+ * Get the playout delay
+ *
+ * @param po Playout delay controller
+ *
+ * @return Playout delay of jitter buffer and audio buffer [ms]
+ */
+uint32_t playout_target(const struct playout *po)
+{
+	return po ? re_atomic_rlx(&po->target) : 0;
+}
+
+
+/**
+ * Get the wish size of the jitter buffer
+ *
+ * @param po Playout delay controller
+ *
+ * @return Reordering depth [packets]
+ */
+uint32_t playout_reorder(const struct playout *po)
+{
+	return po ? re_atomic_rlx(&po->reorder) : 0;
+}
+
+
+/**
+ * Get the target level of the audio buffer, the playout delay without
+ * the delay of the jitter buffer
+ *
+ * @param po Playout delay controller
+ *
+ * @return Target level [ms]
+ */
+uint32_t playout_aubuf_target(const struct playout *po)
+{
+	uint32_t target, jbuf;
+
+	if (!po)
+		return 0;
+
+	target = re_atomic_rlx(&po->target);
+	jbuf   = re_atomic_rlx(&po->reorder) * po->ptime;
+
+	return target > jbuf + po->bounds.min ? target - jbuf :
+		po->bounds.min;
+}
+
+
+int playout_debug(struct re_printf *pf, const struct playout *po)
+{
+	if (!po)
+		return 0;
+
+	return re_hprintf(pf, "       playout: target %ums (aubuf %ums,"
+			  " jbuf %u packets), loss target %.1f%%\n"
+			  "                %.1f%% quantile %.2fms,"
+			  " rtcp jitter %.2fms, late %.2f%%\n",
+			  playout_target(po), playout_aubuf_target(po),
+			  playout_reorder(po), po->loss * 100.0,
+			  (1.0 - po->loss) * 100.0,
+			  po->stats.quantile / 1000.0,
+			  po->stats.jitter / 1000.0,
+			  po->stats.n_pkt ?
+			  100.0 * po->stats.n_late / po->stats.n_pkt : 0.0);
+}
@@ -0,0 +1,386 @@
+/**
+ * @file relay.c  Media relay -- forward RTP between two streams
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The relay forwards RTP payloads received on one stream to the other
+ * stream, without decoding and re-encoding. Payload types are mapped by
+ * codec name, sample rate and channels. SSRC and sequence numbers are
+ * taken from the sending stream, timestamps are rebased when the source
+ * SSRC changes so that the outgoing timeline stays continuous.
+ *
+ * A stream may be relayed to itself (echo).
+ *
+ * The payload type and timestamp mapping (struct relay_map) is shared
+ * with the selective forwarding unit.
+ */
+
+
+enum {
+	PT_UNKNOWN = -1,
+	PT_DROP    = -2,
+	TS_GAP_MS  = 20,   /**< Timestamp gap on source change [ms] */
+};
+
+
+struct relay_leg {
+	struct stream *src;        /**< Receiving stream (weak)        */
+	struct stream *dst;        /**< Sending stream (weak)          */
+	struct relay_map map;      /**< Payload type and timestamps    */
+	bool marker;               /**< Set marker bit on next packet  */
+	uint64_t n_fwd;            /**< Forwarded packets              */
+	uint64_t n_drop;           /**< Dropped packets                */
+};
+
+struct media_relay {
+	struct relay_leg legv[2];
+	unsigned legc;
+	mtx_t *mtx;
+};
+
+
+static void destructor(void *arg)
+{
+	struct media_relay *rl = arg;
+
+	mem_deref(rl->mtx);
+}
+
+
+static bool format_match(const struct sdp_format *a,
+			 const struct sdp_format *b)
+{
+	return a && b &&
+		0 == str_casecmp(a->name, b->name) &&
+		a->srate == b->srate &&
+		a->ch == b->ch;
+}
+
+
+/* negotiated format of the sending stream with the same codec */
+static const struct sdp_format *format_find(const struct sdp_media *m,
+					    const struct sdp_format *fmt)
+{
+	struct le *le;
+
+	LIST_FOREACH(sdp_media_format_lst(m, false), le) {
+
+		const struct sdp_format *rf = le->data;
+
+		if (rf->sup && format_match(fmt, rf))
+			return rf;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Forget all payload type mappings, e.g. after an SDP update
+ *
+ * @param map Payload type and timestamp mapping
+ */
+void relay_map_reset(struct relay_map *map)
+{
+	if (!map)
+		return;
+
+	memset(map->ptmap, PT_UNKNOWN, sizeof(map->ptmap));
+}
+
+
+/**
+ * Map a received payload type to the payload type of the same format
+ * on the sending stream
+ *
+ * @param map Payload type and timestamp mapping
+ * @param src Receiving stream
+ * @param dst Sending stream
+ * @param pt  Received payload type
+ *
+ * @return Payload type to send, or negative if there is no such format
+ */
+int relay_map_pt(struct relay_map *map, const struct stream *src,
+		 const struct stream *dst, uint8_t pt)
+{
+	const struct sdp_format *lf, *rf;
+
+	if (!map || !src || !dst || pt >= 128)
+		return PT_DROP;
+
+	if (map->ptmap[pt] != PT_UNKNOWN)
+		return map->ptmap[pt];
+
+	lf = sdp_media_lformat(stream_sdpmedia(src), pt);
+	rf = lf ? format_find(stream_sdpmedia(dst), lf) : NULL;
+
+	if (rf && rf->pt >= 0 && rf->pt < 128) {
+		map->ptmap[pt] = (int8_t)rf->pt;
+
+		if (str_casecmp(rf->name, "telephone-event"))
+			map->srate = rf->srate;
+	}
+	else {
+		info("relay: %s: no matching format for pt %u\n",
+		     stream_name(src), pt);
+		map->ptmap[pt] = PT_DROP;
+	}
+
+	return map->ptmap[pt];
+}
+
+
+/**
+ * Map a received RTP timestamp to the outgoing timeline. When the
+ * source SSRC changes, or a rebase was requested, the outgoing timeline
+ * continues from the last sent timestamp plus a gap.
+ *
+ * @param map    Payload type and timestamp mapping
+ * @param hdr    Received RTP header
+ * @param gap_ms Gap between the old and the new source [ms]
+ * @param tsp    Returns the outgoing timestamp
+ *
+ * @return True if the timeline was rebased, otherwise false
+ */
+bool relay_map_ts(struct relay_map *map, const struct rtp_header *hdr,
+		  uint32_t gap_ms, uint32_t *tsp)
+{
+	bool rebased = false;
+
+	if (!map || !hdr || !tsp)
+		return false;
+
+	if (map->rebase || !map->ssrc_set || hdr->ssrc != map->ssrc) {
+
+		/* continue the outgoing timeline */
+		if (map->ssrc_set) {
+			map->ts_off = map->ts_last +
+				map->srate * gap_ms / 1000 - hdr->ts;
+			rebased = true;
+		}
+
+		map->ssrc = hdr->ssrc;
+		map->ssrc_set = true;
+		map->rebase = false;
+	}
+
+	*tsp = hdr->ts + map->ts_off;
+
+	return rebased;
+}
+
+
+/**
+ * Check that every format negotiated on a receiving stream is also
+ * negotiated on the stream it is relayed to
+ *
+ * @param rl Media relay
+ *
+ * @return 0 if the payload can be relayed, ENOTSUP if transcoding is needed
+ */
+int relay_check(struct media_relay *rl)
+{
+	int err = 0;
+
+	if (!rl)
+		return EINVAL;
+
+	mtx_lock(rl->mtx);
+
+	for (unsigned i=0; i<rl->legc; i++) {
+
+		struct relay_leg *leg = &rl->legv[i];
+		const struct sdp_media *rx;
+		struct le *le;
+
+		if (!leg->dst)
+			continue;
+
+		rx = stream_sdpmedia(leg->src);
+
+		if (!sdp_media_rformat(rx, NULL)) {
+			err = ENOTSUP;
+			break;
+		}
+
+		LIST_FOREACH(sdp_media_format_lst(rx, false), le) {
+
+			const struct sdp_format *fmt = le->data;
+
+			if (!fmt->sup)
+				continue;
+
+			if (!format_find(stream_sdpmedia(leg->dst), fmt)) {
+				info("relay: %s: %s/%u not negotiated on %s\n",
+				     stream_name(leg->src), fmt->name,
+				     fmt->srate, stream_name(leg->dst));
+				err = ENOTSUP;
+				break;
+			}
+		}
+
+		if (err)
+			break;
+
+		relay_map_reset(&leg->map);
+	}
+
+	mtx_unlock(rl->mtx);
+
+	return err;
+}
+
+
+/**
+ * Allocate a media relay between two streams
+ *
+ * @param rlp Pointer to allocated media relay
+ * @param a   First stream
+ * @param b   Second stream, may be the same as the first
+ *
+ * @return 0 if success, ENOTSUP if the formats differ, otherwise errorcode
+ */
+int relay_alloc(struct media_relay **rlp, struct stream *a, struct stream *b)
+{
+	struct media_relay *rl;
+	int err;
+
+	if (!rlp || !a || !b)
+		return EINVAL;
+
+	rl = mem_zalloc(sizeof(*rl), destructor);
+	if (!rl)
+		return ENOMEM;
+
+	err = mutex_alloc(&rl->mtx);
+	if (err)
+		goto out;
+
+	rl->legv[0].src = a;
+	rl->legv[0].dst = b;
+	rl->legc = 1;
+
+	if (a != b) {
+		rl->legv[1].src = b;
+		rl->legv[1].dst = a;
+		rl->legc = 2;
+	}
+
+	err = relay_check(rl);
+
+ out:
+	if (err)
+		mem_deref(rl);
+	else
+		*rlp = rl;
+
+	return err;
+}
+
+
+/**
+ * Detach a media relay from its streams, no more packets are forwarded
+ *
+ * @param rl Media relay
+ */
+void relay_close(struct media_relay *rl)
+{
+	if (!rl)
+		return;
+
+	mtx_lock(rl->mtx);
+	for (unsigned i=0; i<rl->legc; i++) {
+		rl->legv[i].src = NULL;
+		rl->legv[i].dst = NULL;
+	}
+	mtx_unlock(rl->mtx);
+}
+
+
+/**
+ * Forward one received RTP packet, called from the RTP receiver
+ *
+ * @param strm Receiving stream
+ * @param hdr  RTP header
+ * @param mb   RTP payload, with room for the RTP header in front
+ * @param arg  Media relay
+ */
+void relay_recv(struct stream *strm, const struct rtp_header *hdr,
+		struct mbuf *mb, void *arg)
+{
+	struct media_relay *rl = arg;
+	struct relay_leg *leg = NULL;
+	bool marker;
+	uint32_t ts;
+	int pt;
+
+	if (!rl || !hdr || !mb || hdr->pt >= 128)
+		return;
+
+	mtx_lock(rl->mtx);
+
+	for (unsigned i=0; i<rl->legc; i++) {
+		if (rl->legv[i].src == strm)
+			leg = &rl->legv[i];
+	}
+
+	if (!leg || !leg->dst)
+		goto out;
+
+	pt = relay_map_pt(&leg->map, leg->src, leg->dst, hdr->pt);
+	if (pt < 0) {
+		++leg->n_drop;
+		goto out;
+	}
+
+	if (relay_map_ts(&leg->map, hdr, TS_GAP_MS, &ts))
+		leg->marker = true;
+
+	marker = hdr->m || leg->marker;
+
+	if (stream_send_relay(leg->dst, marker, pt, ts, mb)) {
+		++leg->n_drop;
+		goto out;
+	}
+
+	leg->map.ts_last = ts;
+	leg->marker = false;
+	++leg->n_fwd;
+
+ out:
+	mtx_unlock(rl->mtx);
+}
+
+
+int relay_debug(struct re_printf *pf, const struct media_relay *rl)
+{
+	int err = 0;
+
+	if (!rl)
+		return 0;
+
+	mtx_lock(rl->mtx);
+
+	for (unsigned i=0; i<rl->legc; i++) {
+
+		const struct relay_leg *leg = &rl->legv[i];
+
+		if (!leg->src)
+			continue;
+
+		err |= re_hprintf(pf, " relay %s -> %s: fwd=%llu drop=%llu\n",
+				  stream_name(leg->src), stream_name(leg->dst),
+				  leg->n_fwd, leg->n_drop);
+	}
+
+	mtx_unlock(rl->mtx);
+
+	return err;
+}
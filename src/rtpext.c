@@ -0,0 +1,113 @@
+/**
+ * @file rtpext.c  RTP Header Extensions -- ID-indexed table
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/* RFC 8285 -- two-byte header, 0x100 followed by 4 bits appbits */
+enum {
+	RTPEXT_TYPE_TWOBYTE = 0x1000,
+	RTPEXT_TYPE_APPBITS = 0x000f,
+	RTPEXT_ID_STOP      = 15,
+};
+
+
+/**
+ * Decode an RTP header extension block into an ID-indexed table
+ *
+ * The one-byte and two-byte header forms are supported. Only IDs in
+ * the mask are stored, and their payload is referenced in place.
+ *
+ * @param tbl  Table to decode into
+ * @param type Extension type from the RTP header ("defined by profile")
+ * @param p    Extension data
+ * @param len  Length of extension data in bytes
+ * @param mask Bitmask of wanted IDs
+ *
+ * @return 0 if success, ENOTSUP for unknown type, otherwise errorcode
+ */
+int rtpext_tbl_decode(struct rtpext_tbl *tbl, uint16_t type,
+		      const uint8_t *p, size_t len, uint16_t mask)
+{
+	bool twobyte;
+	size_t i = 0;
+
+	if (!tbl || (!p && len))
+		return EINVAL;
+
+	tbl->present = 0;
+
+	if (type == RTPEXT_TYPE_MAGIC)
+		twobyte = false;
+	else if ((type & ~RTPEXT_TYPE_APPBITS) == RTPEXT_TYPE_TWOBYTE)
+		twobyte = true;
+	else
+		return ENOTSUP;
+
+	while (i < len) {
+
+		uint8_t id;
+		size_t elen;
+
+		if (twobyte) {
+			id = p[i++];
+			if (!id)
+				continue;  /* padding */
+
+			if (i >= len)
+				return EBADMSG;
+
+			elen = p[i++];
+		}
+		else {
+			id   = p[i] >> 4;
+			elen = (p[i] & 0x0f) + 1;
+			++i;
+
+			if (!id)
+				continue;  /* padding */
+
+			if (id == RTPEXT_ID_STOP)
+				break;
+		}
+
+		if (i + elen > len)
+			return EBADMSG;
+
+		if (id <= RTPEXT_ID_MAX && (mask & (1u << id))) {
+			tbl->extv[id].data = &p[i];
+			tbl->extv[id].len  = (uint8_t)elen;
+			tbl->present |= (uint16_t)(1u << id);
+		}
+
+		i += elen;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Find a decoded RTP header extension by ID
+ *
+ * @param tbl  Decoded table
+ * @param id   Extension ID
+ * @param lenp Optional pointer to length of payload
+ *
+ * @return Extension payload if found, otherwise NULL
+ */
+const uint8_t *rtpext_tbl_find(const struct rtpext_tbl *tbl, uint8_t id,
+			       size_t *lenp)
+{
+	if (!tbl || id > RTPEXT_ID_MAX || !(tbl->present & (1u << id)))
+		return NULL;
+
+	if (lenp)
+		*lenp = tbl->extv[id].len;
+
+	return tbl->extv[id].data;
+}
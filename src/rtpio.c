@@ -0,0 +1,516 @@
+/**
+ * @file rtpio.c  Batched RTP socket I/O
+ *
+ * Drains up to N datagrams per wakeup with recvmmsg() and flushes
+ * queued outgoing datagrams with sendmmsg(). Both sides hook into the
+ * UDP socket as the lowest UDP helper, so media NAT and encryption
+ * helpers above still see every packet.
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_MMSG
+#include <sys/socket.h>
+#endif
+#include <re.h>
+#include <re_atomic.h>
+#include <baresip.h>
+#include "core.h"
+
+
+enum {
+	RTPIO_LAYER  = -1000,  /* below all other UDP helpers          */
+	RTPIO_MAX    = 64,     /* max. datagrams per syscall            */
+	RTPIO_RXSZ   = 8192,   /* receive buffer size, see RTP_RECV_SIZE */
+	RTPIO_TXSZ   = 2048,   /* max. size of a queued datagram        */
+};
+
+
+struct rtpio_stats {
+	RE_ATOMIC uint64_t calls;  /**< Number of syscalls             */
+	RE_ATOMIC uint64_t pkts;   /**< Number of datagrams            */
+};
+
+
+/** Batched receive, attached to the thread that allocated it */
+struct rtpio_rx {
+	struct udp_sock *us;        /**< UDP socket                     */
+	struct udp_helper *uh;      /**< Lowest layer UDP helper        */
+	struct re_fhs *fhs;         /**< File descriptor handler        */
+	re_sock_t fd;               /**< Socket file descriptor         */
+	uint32_t batch;             /**< Max. datagrams per syscall     */
+	struct mbuf *mbv[RTPIO_MAX];/**< Pooled receive buffers         */
+	struct rtpio_stats stats;   /**< Receive statistics             */
+};
+
+
+/** Batched transmit, queues datagrams between begin and flush */
+struct rtpio_tx {
+	struct udp_sock *us;        /**< UDP socket                     */
+	struct udp_helper *uh;      /**< Lowest layer UDP helper        */
+	re_sock_t fd;               /**< Socket file descriptor         */
+	uint32_t batch;             /**< Max. datagrams per syscall     */
+	RE_ATOMIC bool active;      /**< Queueing is active             */
+	mtx_t *mtx;                 /**< Protects owner                 */
+	thrd_t owner;               /**< Thread that may queue          */
+	uint32_t n;                 /**< Number of queued datagrams     */
+	struct sa dstv[RTPIO_MAX];  /**< Destination addresses          */
+	size_t lenv[RTPIO_MAX];     /**< Datagram lengths               */
+	uint8_t *buf;               /**< Datagram slots of RTPIO_TXSZ   */
+	struct rtpio_stats stats;   /**< Transmit statistics            */
+};
+
+
+static int stats_print(struct re_printf *pf, const char *name,
+		       const struct rtpio_stats *stats)
+{
+	uint64_t calls = re_atomic_rlx(&stats->calls);
+	uint64_t pkts  = re_atomic_rlx(&stats->pkts);
+
+	return re_hprintf(pf, " %s.batch: syscalls=%llu packets=%llu"
+			  " (%.2f syscalls/pkt)\n",
+			  name, calls, pkts,
+			  pkts ? (double)calls / (double)pkts : 0.0);
+}
+
+
+#ifdef HAVE_MMSG
+
+
+static uint32_t batch_size(uint32_t batch)
+{
+	return min(batch, RTPIO_MAX);
+}
+
+
+static bool rx_helper_recv(struct sa *src, struct mbuf *mb, void *arg)
+{
+	(void)src;
+	(void)mb;
+	(void)arg;
+
+	return false;
+}
+
+
+static bool rx_helper_send(int *err, struct sa *dst, struct mbuf *mb,
+			   void *arg)
+{
+	(void)err;
+	(void)dst;
+	(void)mb;
+	(void)arg;
+
+	return false;
+}
+
+
+static int rx_buf(struct mbuf **mbp)
+{
+	struct mbuf *mb = *mbp;
+
+	if (mb && mem_nrefs(mb) > 1)
+		mb = mem_deref(mb);
+
+	if (!mb) {
+		mb = mbuf_alloc(RTPIO_RXSZ);
+		if (!mb)
+			return ENOMEM;
+	}
+	else if (mb->size < RTPIO_RXSZ) {
+		int err = mbuf_resize(mb, RTPIO_RXSZ);
+		if (err)
+			return err;
+	}
+
+	mb->pos = 0;
+	mb->end = 0;
+	*mbp = mb;
+
+	return 0;
+}
+
+
+static void rx_read_handler(int flags, void *arg)
+{
+	struct rtpio_rx *rio = arg;
+	struct mmsghdr msgv[RTPIO_MAX];
+	struct iovec iov[RTPIO_MAX];
+	struct sa srcv[RTPIO_MAX];
+	uint32_t i, vlen = 0;
+	int n;
+
+	if (!(flags & FD_READ))
+		return;
+
+	memset(msgv, 0, sizeof(msgv));
+
+	/* buffers kept by a handler (e.g. the jitter buffer)
+	   are replaced, all others are reused */
+	for (i=0; i<rio->batch; i++) {
+
+		if (rx_buf(&rio->mbv[i]))
+			break;
+
+		iov[i].iov_base = rio->mbv[i]->buf;
+		iov[i].iov_len  = rio->mbv[i]->size;
+
+		msgv[i].msg_hdr.msg_iov     = &iov[i];
+		msgv[i].msg_hdr.msg_iovlen  = 1;
+		msgv[i].msg_hdr.msg_name    = &srcv[i].u;
+		msgv[i].msg_hdr.msg_namelen = sizeof(srcv[i].u);
+		++vlen;
+	}
+
+	if (!vlen)
+		return;
+
+	n = recvmmsg(rio->fd, msgv, vlen, MSG_DONTWAIT, NULL);
+	re_atomic_rlx_add(&rio->stats.calls, 1);
+	if (n <= 0)
+		return;
+
+	re_atomic_rlx_add(&rio->stats.pkts, n);
+
+	for (i=0; i<(uint32_t)n; i++) {
+		struct mbuf *mb = rio->mbv[i];
+
+		srcv[i].len = msgv[i].msg_hdr.msg_namelen;
+		mb->pos = 0;
+		mb->end = msgv[i].msg_len;
+
+		udp_recv_helper(rio->us, &srcv[i], mb, rio->uh);
+	}
+}
+
+
+static void rx_destructor(void *arg)
+{
+	struct rtpio_rx *rio = arg;
+	uint32_t i;
+
+	rio->fhs = fd_close(rio->fhs);
+	mem_deref(rio->uh);
+	mem_deref(rio->us);
+
+	for (i=0; i<RE_ARRAY_SIZE(rio->mbv); i++)
+		mem_deref(rio->mbv[i]);
+}
+
+
+/**
+ * Allocate a batched receiver for a UDP socket
+ *
+ * The socket must be detached from all threads, the receiver listens
+ * on the socket in the calling thread.
+ *
+ * @param riop  Pointer to allocated receiver
+ * @param us    UDP socket
+ * @param batch Max. number of datagrams per syscall
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtpio_rx_alloc(struct rtpio_rx **riop, struct udp_sock *us,
+		   uint32_t batch)
+{
+	struct rtpio_rx *rio;
+	struct sa laddr;
+	int err;
+
+	if (!riop || !us || !batch)
+		return EINVAL;
+
+	err = udp_local_get(us, &laddr);
+	if (err)
+		return err;
+
+	rio = mem_zalloc(sizeof(*rio), rx_destructor);
+	if (!rio)
+		return ENOMEM;
+
+	rio->us    = mem_ref(us);
+	rio->fd    = udp_sock_fd(us, sa_af(&laddr));
+	rio->batch = batch_size(batch);
+
+	if (rio->fd == RE_BAD_SOCK) {
+		err = EBADF;
+		goto out;
+	}
+
+	err = udp_register_helper(&rio->uh, us, RTPIO_LAYER,
+				  rx_helper_send, rx_helper_recv, rio);
+	if (err)
+		goto out;
+
+	err = fd_listen(&rio->fhs, rio->fd, FD_READ, rx_read_handler, rio);
+
+ out:
+	if (err)
+		mem_deref(rio);
+	else
+		*riop = rio;
+
+	return err;
+}
+
+
+static int tx_flush(struct rtpio_tx *tio)
+{
+	struct mmsghdr msgv[RTPIO_MAX];
+	struct iovec iov[RTPIO_MAX];
+	uint32_t i, done = 0;
+	int err = 0;
+
+	if (!tio->n)
+		return 0;
+
+	memset(msgv, 0, sizeof(msgv));
+
+	for (i=0; i<tio->n; i++) {
+
+		iov[i].iov_base = tio->buf + i * RTPIO_TXSZ;
+		iov[i].iov_len  = tio->lenv[i];
+
+		msgv[i].msg_hdr.msg_iov     = &iov[i];
+		msgv[i].msg_hdr.msg_iovlen  = 1;
+		msgv[i].msg_hdr.msg_name    = &tio->dstv[i].u;
+		msgv[i].msg_hdr.msg_namelen = tio->dstv[i].len;
+	}
+
+	while (done < tio->n) {
+
+		int n = sendmmsg(tio->fd, &msgv[done], tio->n - done, 0);
+		re_atomic_rlx_add(&tio->stats.calls, 1);
+		if (n < 0) {
+			err = errno;
+			if (err == EINTR)
+				continue;
+
+			break;
+		}
+
+		done += n;
+	}
+
+	re_atomic_rlx_add(&tio->stats.pkts, done);
+	tio->n = 0;
+
+	return err;
+}
+
+
+static bool tx_helper_send(int *err, struct sa *dst, struct mbuf *mb,
+			   void *arg)
+{
+	struct rtpio_tx *tio = arg;
+	size_t len = mbuf_get_left(mb);
+	bool owner;
+
+	if (!re_atomic_acq(&tio->active))
+		return false;
+
+	mtx_lock(tio->mtx);
+	owner = re_atomic_rlx(&tio->active) &&
+		thrd_equal(tio->owner, thrd_current());
+	mtx_unlock(tio->mtx);
+
+	/* RTCP and STUN from other threads are sent directly */
+	if (!owner)
+		return false;
+
+	if (tio->n == tio->batch || len > RTPIO_TXSZ) {
+		*err = tx_flush(tio);
+		if (len > RTPIO_TXSZ)
+			return false;
+	}
+
+	memcpy(tio->buf + tio->n * RTPIO_TXSZ, mbuf_buf(mb), len);
+	tio->lenv[tio->n] = len;
+	tio->dstv[tio->n] = *dst;
+	++tio->n;
+
+	return true;
+}
+
+
+static bool tx_helper_recv(struct sa *src, struct mbuf *mb, void *arg)
+{
+	(void)src;
+	(void)mb;
+	(void)arg;
+
+	return false;
+}
+
+
+static void tx_destructor(void *arg)
+{
+	struct rtpio_tx *tio = arg;
+
+	mem_deref(tio->uh);
+	mem_deref(tio->us);
+	mem_deref(tio->buf);
+	mem_deref(tio->mtx);
+}
+
+
+/**
+ * Allocate a batched transmitter for a UDP socket
+ *
+ * @param tiop  Pointer to allocated transmitter
+ * @param us    UDP socket
+ * @param batch Max. number of datagrams per syscall
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtpio_tx_alloc(struct rtpio_tx **tiop, struct udp_sock *us,
+		   uint32_t batch)
+{
+	struct rtpio_tx *tio;
+	struct sa laddr;
+	int err;
+
+	if (!tiop || !us || !batch)
+		return EINVAL;
+
+	err = udp_local_get(us, &laddr);
+	if (err)
+		return err;
+
+	tio = mem_zalloc(sizeof(*tio), tx_destructor);
+	if (!tio)
+		return ENOMEM;
+
+	tio->us    = mem_ref(us);
+	tio->fd    = udp_sock_fd(us, sa_af(&laddr));
+	tio->batch = batch_size(batch);
+
+	if (tio->fd == RE_BAD_SOCK) {
+		err = EBADF;
+		goto out;
+	}
+
+	tio->buf = mem_alloc((size_t)tio->batch * RTPIO_TXSZ, NULL);
+	if (!tio->buf) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = mutex_alloc(&tio->mtx);
+	if (err)
+		goto out;
+
+	err = udp_register_helper(&tio->uh, us, RTPIO_LAYER,
+				  tx_helper_send, tx_helper_recv, tio);
+
+ out:
+	if (err)
+		mem_deref(tio);
+	else
+		*tiop = tio;
+
+	return err;
+}
+
+
+/**
+ * Start queueing datagrams sent from the calling thread
+ *
+ * @param tio Batched transmitter
+ */
+void rtpio_tx_begin(struct rtpio_tx *tio)
+{
+	if (!tio)
+		return;
+
+	mtx_lock(tio->mtx);
+	tio->owner = thrd_current();
+	re_atomic_rls_set(&tio->active, true);
+	mtx_unlock(tio->mtx);
+}
+
+
+/**
+ * Stop queueing datagrams, optionally flushing the queue
+ *
+ * @param tio   Batched transmitter
+ * @param flush True to send all queued datagrams
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtpio_tx_end(struct rtpio_tx *tio, bool flush)
+{
+	if (!tio)
+		return 0;
+
+	mtx_lock(tio->mtx);
+	re_atomic_rls_set(&tio->active, false);
+	mtx_unlock(tio->mtx);
+
+	return flush ? tx_flush(tio) : 0;
+}
+
+
+#else
+
+
+int rtpio_rx_alloc(struct rtpio_rx **riop, struct udp_sock *us,
+		   uint32_t batch)
+{
+	(void)riop;
+	(void)us;
+	(void)batch;
+
+	return ENOSYS;
+}
+
+
+int rtpio_tx_alloc(struct rtpio_tx **tiop, struct udp_sock *us,
+		   uint32_t batch)
+{
+	(void)tiop;
+	(void)us;
+	(void)batch;
+
+	return ENOSYS;
+}
+
+
+void rtpio_tx_begin(struct rtpio_tx *tio)
+{
+	(void)tio;
+}
+
+
+int rtpio_tx_end(struct rtpio_tx *tio, bool flush)
+{
+	(void)tio;
+	(void)flush;
+
+	return 0;
+}
+
+
+#endif
+
+
+int rtpio_rx_debug(struct re_printf *pf, const struct rtpio_rx *rio)
+{
+	if (!rio)
+		return 0;
+
+	return stats_print(pf, "rx", &rio->stats);
+}
+
+
+int rtpio_tx_debug(struct re_printf *pf, const struct rtpio_tx *tio)
+{
+	if (!tio)
+		return 0;
+
+	return stats_print(pf, "tx", &tio->stats);
+}
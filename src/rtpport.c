@@ -0,0 +1,521 @@
+/**
+ * @file rtpport.c  RTP port allocator
+ *
+ * Process-wide allocator for RTP/RTCP port pairs. Free pairs are kept
+ * in a FIFO in release order, so allocation is O(1) and a released
+ * pair is reused as late as possible. A released pair is quarantined
+ * for a while to avoid stray late packets from the previous session.
+ * Optionally a pool of pre-bound and pre-configured sockets is kept.
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+enum {
+	RTP_RECV_SIZE   = 8192,
+	RTP_SOCKBUF     = 65536,
+	BIND_TRIES      = 8,
+	POOL_INTERVAL   = 20,     /* pool refill interval [ms] */
+	QUARANTINE_DEF  = 10,     /* default quarantine [s]    */
+	PORT_MIN        = 1024,   /* lowest port, if min is 0  */
+};
+
+
+/** Port allocator */
+struct rtpports {
+	uint16_t base;          /**< First even port                  */
+	uint32_t npairs;        /**< Number of port pairs             */
+	uint32_t gen;           /**< Generation, bumped on new range  */
+	uint32_t *usedv;        /**< Bitmap of pairs in use           */
+	uint16_t *fifo;         /**< Free pairs, oldest release first */
+	uint32_t *relv;         /**< Release time per pair [ms]       */
+	uint32_t head;          /**< FIFO head                        */
+	uint32_t nfree;         /**< Number of free pairs             */
+	uint32_t quarantine;    /**< Quarantine time [ms]             */
+
+	struct list pool;       /**< Pre-bound sockets                */
+	uint32_t pool_size;     /**< Wanted pool size                 */
+	int pool_af;            /**< Address family for the pool      */
+	struct tmr tmr_pool;    /**< Pool refill timer                */
+
+	struct {
+		uint64_t allocs;    /**< Number of allocations        */
+		uint64_t fails;     /**< Failed allocations           */
+		uint64_t bindfails; /**< Bind failures (port busy)    */
+		uint64_t early;     /**< Reused within quarantine     */
+		uint64_t hits;      /**< Allocations from the pool    */
+		uint64_t lat_sum;   /**< Sum of allocation time [us]  */
+		uint64_t lat_max;   /**< Max. allocation time [us]    */
+	} stats;
+};
+
+
+/** An allocated port pair with its RTP socket */
+struct rtpport {
+	struct le le;           /**< Pool list element                */
+	struct rtpports *mgr;   /**< Port allocator, referenced when
+				     handed out                       */
+	bool pooled;            /**< In the pool, not handed out      */
+	struct rtp_sock *rtp;   /**< RTP socket                       */
+	uint32_t pair;          /**< Pair index                       */
+	uint32_t gen;           /**< Allocator generation             */
+	rtp_recv_h *recvh;      /**< RTP receive handler              */
+	rtcp_recv_h *rtcph;     /**< RTCP receive handler             */
+	void *arg;              /**< Handler argument                 */
+};
+
+
+static inline bool pair_used(const struct rtpports *mgr, uint32_t pair)
+{
+	return 0 != (mgr->usedv[pair / 32] & (1u << (pair % 32)));
+}
+
+
+static inline void pair_set_used(struct rtpports *mgr, uint32_t pair,
+				 bool used)
+{
+	if (used)
+		mgr->usedv[pair / 32] |=  (1u << (pair % 32));
+	else
+		mgr->usedv[pair / 32] &= ~(1u << (pair % 32));
+}
+
+
+static void pair_release(struct rtpports *mgr, uint32_t pair)
+{
+	if (!pair_used(mgr, pair))
+		return;
+
+	pair_set_used(mgr, pair, false);
+
+	mgr->fifo[(mgr->head + mgr->nfree) % mgr->npairs] = (uint16_t)pair;
+	mgr->relv[pair] = (uint32_t)tmr_jiffies();
+	++mgr->nfree;
+}
+
+
+static int pair_get(struct rtpports *mgr, uint32_t *pairp)
+{
+	uint32_t pair;
+
+	if (!mgr->nfree)
+		return EADDRINUSE;
+
+	pair = mgr->fifo[mgr->head];
+	mgr->head = (mgr->head + 1) % mgr->npairs;
+	--mgr->nfree;
+
+	/* all other free pairs were released later */
+	if (mgr->relv[pair] &&
+	    (uint32_t)tmr_jiffies() - mgr->relv[pair] < mgr->quarantine)
+		++mgr->stats.early;
+
+	pair_set_used(mgr, pair, true);
+	*pairp = pair;
+
+	return 0;
+}
+
+
+static void tables_free(struct rtpports *mgr)
+{
+	mgr->usedv = mem_deref(mgr->usedv);
+	mgr->fifo  = mem_deref(mgr->fifo);
+	mgr->relv  = mem_deref(mgr->relv);
+	mgr->npairs = 0;
+	mgr->nfree  = 0;
+	mgr->head   = 0;
+}
+
+
+/* the first even port and the last port, min 0 means any port */
+static void range_get(const struct range *r, uint32_t *minp, uint32_t *maxp)
+{
+	uint32_t min = r->min ? r->min : PORT_MIN;
+
+	*minp = min + (min & 1);
+	*maxp = min(r->max, 65535);
+}
+
+
+static int tables_alloc(struct rtpports *mgr, const struct range *ports)
+{
+	uint32_t min, max;
+	uint32_t i;
+
+	tables_free(mgr);
+	++mgr->gen;
+
+	range_get(ports, &min, &max);
+
+	if (min + 1 > max)
+		return EINVAL;
+
+	mgr->base   = (uint16_t)min;
+	mgr->npairs = (max - min + 1) / 2;
+
+	mgr->usedv = mem_zalloc((mgr->npairs + 31) / 32 * sizeof(uint32_t),
+				NULL);
+	mgr->fifo  = mem_alloc(mgr->npairs * sizeof(uint16_t), NULL);
+	mgr->relv  = mem_zalloc(mgr->npairs * sizeof(uint32_t), NULL);
+	if (!mgr->usedv || !mgr->fifo || !mgr->relv) {
+		tables_free(mgr);
+		return ENOMEM;
+	}
+
+	/* random order, like rtp_listen() port probing */
+	for (i=0; i<mgr->npairs; i++)
+		mgr->fifo[i] = (uint16_t)i;
+
+	for (i=mgr->npairs - 1; i>0; i--) {
+		uint32_t j = rand_u32() % (i + 1);
+		uint16_t t = mgr->fifo[i];
+
+		mgr->fifo[i] = mgr->fifo[j];
+		mgr->fifo[j] = t;
+	}
+
+	mgr->nfree = mgr->npairs;
+
+	return 0;
+}
+
+
+static bool range_match(const struct rtpports *mgr, const struct range *r)
+{
+	uint32_t min, max;
+
+	range_get(r, &min, &max);
+
+	return mgr->npairs && min == mgr->base &&
+		mgr->npairs == (max - min + 1) / 2;
+}
+
+
+static void rtp_recv_handler(const struct sa *src,
+			     const struct rtp_header *hdr,
+			     struct mbuf *mb, void *arg)
+{
+	struct rtpport *rp = arg;
+
+	if (rp->recvh)
+		rp->recvh(src, hdr, mb, rp->arg);
+}
+
+
+static void rtcp_recv_handler(const struct sa *src, struct rtcp_msg *msg,
+			      void *arg)
+{
+	struct rtpport *rp = arg;
+
+	if (rp->rtcph)
+		rp->rtcph(src, msg, rp->arg);
+}
+
+
+static void rtpport_destructor(void *arg)
+{
+	struct rtpport *rp = arg;
+
+	list_unlink(&rp->le);
+	rp->rtp = mem_deref(rp->rtp);
+
+	if (rp->mgr->gen == rp->gen)
+		pair_release(rp->mgr, rp->pair);
+
+	if (!rp->pooled)
+		mem_deref(rp->mgr);
+}
+
+
+/* Bind a new port pair, the sockets get the default configuration */
+static int port_bind(struct rtpport **rpp, struct rtpports *mgr, int af)
+{
+	struct rtpport *rp;
+	struct sa laddr;
+	int err = 0;
+	int i;
+
+	rp = mem_zalloc(sizeof(*rp), rtpport_destructor);
+	if (!rp)
+		return ENOMEM;
+
+	rp->mgr    = mgr;
+	rp->pooled = true;
+	rp->gen    = mgr->gen;
+
+	/* we listen on all interfaces */
+	sa_init(&laddr, af);
+
+	for (i=0; i<BIND_TRIES; i++) {
+
+		uint16_t port;
+
+		err = pair_get(mgr, &rp->pair);
+		if (err)
+			break;
+
+		port = mgr->base + 2 * rp->pair;
+
+		err = rtp_listen(&rp->rtp, IPPROTO_UDP, &laddr,
+				 port, port + 1, true,
+				 rtp_recv_handler, rtcp_recv_handler, rp);
+		if (!err)
+			break;
+
+		/* busy, most likely another process */
+		++mgr->stats.bindfails;
+		pair_release(mgr, rp->pair);
+	}
+
+	if (err) {
+		rp->gen = 0;
+		mem_deref(rp);
+		return err;
+	}
+
+	udp_rxsz_set(rtp_sock(rp->rtp), RTP_RECV_SIZE);
+	udp_sockbuf_set(rtp_sock(rp->rtp), RTP_SOCKBUF);
+
+	*rpp = rp;
+
+	return 0;
+}
+
+
+static void pool_fill(void *arg)
+{
+	struct rtpports *mgr = arg;
+	struct rtpport *rp;
+	int err;
+
+	if (list_count(&mgr->pool) >= mgr->pool_size)
+		return;
+
+	err = port_bind(&rp, mgr, mgr->pool_af);
+	if (err) {
+		warning("rtpport: could not pre-bind socket (%m)\n", err);
+		tmr_start(&mgr->tmr_pool, 1000, pool_fill, mgr);
+		return;
+	}
+
+	list_append(&mgr->pool, &rp->le, rp);
+
+	tmr_start(&mgr->tmr_pool, POOL_INTERVAL, pool_fill, mgr);
+}
+
+
+static void pool_flush(struct rtpports *mgr)
+{
+	list_flush(&mgr->pool);
+}
+
+
+static void rtpports_destructor(void *arg)
+{
+	struct rtpports *mgr = arg;
+
+	tmr_cancel(&mgr->tmr_pool);
+	pool_flush(mgr);
+	tables_free(mgr);
+}
+
+
+/**
+ * Allocate the RTP port allocator
+ *
+ * @param mgrp Pointer to allocated port allocator
+ * @param cfg  AVT configuration
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtpports_alloc(struct rtpports **mgrp, const struct config_avt *cfg)
+{
+	struct rtpports *mgr;
+	int err;
+
+	if (!mgrp || !cfg)
+		return EINVAL;
+
+	mgr = mem_zalloc(sizeof(*mgr), rtpports_destructor);
+	if (!mgr)
+		return ENOMEM;
+
+	mgr->quarantine = (cfg->rtp_port_quarantine ?
+			   cfg->rtp_port_quarantine : QUARANTINE_DEF) * 1000;
+	mgr->pool_size  = cfg->rtp_port_pool;
+	mgr->pool_af    = AF_INET;
+	tmr_init(&mgr->tmr_pool);
+
+	/* an invalid range fails at allocation time */
+	err = tables_alloc(mgr, &cfg->rtp_ports);
+	if (err) {
+		warning("rtpport: invalid rtp_ports %u-%u (%m)\n",
+			cfg->rtp_ports.min, cfg->rtp_ports.max, err);
+	}
+	else if (mgr->pool_size) {
+		tmr_start(&mgr->tmr_pool, POOL_INTERVAL, pool_fill, mgr);
+	}
+
+	*mgrp = mgr;
+
+	return 0;
+}
+
+
+/**
+ * Allocate an RTP/RTCP port pair with a listening RTP socket
+ *
+ * A pre-bound socket from the pool is used if available. The socket
+ * has its receive size and default socket buffers configured.
+ *
+ * @param rpp   Pointer to allocated port pair
+ * @param mgr   Port allocator
+ * @param ports Configured port range
+ * @param af    Address family
+ * @param recvh RTP receive handler
+ * @param rtcph RTCP receive handler
+ * @param arg   Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtpport_alloc(struct rtpport **rpp, struct rtpports *mgr,
+		  const struct range *ports, int af,
+		  rtp_recv_h *recvh, rtcp_recv_h *rtcph, void *arg)
+{
+	struct rtpport *rp = NULL;
+	uint64_t t0, lat;
+	struct le *le;
+	int err = 0;
+
+	if (!rpp || !mgr || !ports)
+		return EINVAL;
+
+	t0 = tmr_jiffies_usec();
+
+	/* the configuration was changed */
+	if (!range_match(mgr, ports)) {
+
+		pool_flush(mgr);
+
+		err = tables_alloc(mgr, ports);
+		if (err)
+			goto out;
+	}
+
+	for (le = mgr->pool.head; le; le = le->next) {
+
+		struct rtpport *prp = le->data;
+
+		if (sa_af(rtp_local(prp->rtp)) == af) {
+			rp = prp;
+			break;
+		}
+	}
+
+	if (rp) {
+		list_unlink(&rp->le);
+		++mgr->stats.hits;
+	}
+	else {
+		err = port_bind(&rp, mgr, af);
+		if (err)
+			goto out;
+	}
+
+	rp->mgr    = mem_ref(mgr);
+	rp->pooled = false;
+	rp->recvh  = recvh;
+	rp->rtcph  = rtcph;
+	rp->arg    = arg;
+
+	if (mgr->pool_size) {
+		mgr->pool_af = af;
+		tmr_start(&mgr->tmr_pool, 0, pool_fill, mgr);
+	}
+
+ out:
+	lat = tmr_jiffies_usec() - t0;
+
+	if (err) {
+		++mgr->stats.fails;
+	}
+	else {
+		++mgr->stats.allocs;
+		mgr->stats.lat_sum += lat;
+		mgr->stats.lat_max  = max(mgr->stats.lat_max, lat);
+		*rpp = rp;
+	}
+
+	return err;
+}
+
+
+/**
+ * Get the RTP socket of an allocated port pair
+ *
+ * @param rp Port pair
+ *
+ * @return RTP socket
+ */
+struct rtp_sock *rtpport_sock(const struct rtpport *rp)
+{
+	return rp ? rp->rtp : NULL;
+}
+
+
+/**
+ * Print the RTP port allocator state
+ *
+ * @param pf  Print function
+ * @param mgr Port allocator
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtpports_debug(struct re_printf *pf, const struct rtpports *mgr)
+{
+	uint32_t now = (uint32_t)tmr_jiffies();
+	uint32_t quar = 0;
+	uint32_t i;
+	int err;
+
+	if (!mgr)
+		return 0;
+
+	for (i=0; i<mgr->nfree; i++) {
+
+		uint32_t pair = mgr->fifo[(mgr->head + i) % mgr->npairs];
+
+		if (mgr->relv[pair] &&
+		    now - mgr->relv[pair] < mgr->quarantine)
+			++quar;
+	}
+
+	err  = re_hprintf(pf, "--- RTP ports ---\n");
+	err |= re_hprintf(pf, " range:       %u-%u (%u pairs)\n",
+			  mgr->base, mgr->base + 2 * mgr->npairs - 1,
+			  mgr->npairs);
+	err |= re_hprintf(pf, " in use:      %u (%u%%)\n",
+			  mgr->npairs - mgr->nfree,
+			  mgr->npairs ?
+			  100 * (mgr->npairs - mgr->nfree) / mgr->npairs : 0);
+	err |= re_hprintf(pf, " quarantined: %u (%u seconds)\n",
+			  quar, mgr->quarantine / 1000);
+	err |= re_hprintf(pf, " pool:        %u/%u\n",
+			  list_count(&mgr->pool), mgr->pool_size);
+	err |= re_hprintf(pf, " allocs:      %llu (pool hits %llu,"
+			  " fails %llu)\n",
+			  mgr->stats.allocs, mgr->stats.hits,
+			  mgr->stats.fails);
+	err |= re_hprintf(pf, " bind fails:  %llu, early reuse %llu\n",
+			  mgr->stats.bindfails, mgr->stats.early);
+	err |= re_hprintf(pf, " latency:     avg %llu us, max %llu us\n",
+			  mgr->stats.allocs ?
+			  mgr->stats.lat_sum / mgr->stats.allocs : 0,
+			  mgr->stats.lat_max);
+
+	return err;
+}
@@ -32,9 +32,14 @@ struct rtp_receiver {
 	bool rtp_estab;                /**< True if RTP stream established   */
 	RE_ATOMIC bool run;            /**< True if RX thread is running     */
 	bool start_rtcp;               /**< Start RTCP flag                  */
+	bool attach;                   /**< Attach new socket in RX thread   */
 	char *cname;                   /**< Canonical Name for RTCP send     */
 	struct sa rtcp_peer;           /**< RTCP address of Peer             */
 	bool pinhole;                  /**< Open RTCP NAT pinhole flag       */
+	struct rtpio_rx *rio;          /**< Batched RTP receive (optional)   */
+	stream_relay_h *relayh;        /**< Media relay handler (optional)   */
+	void *relayarg;                /**< Media relay argument             */
+	struct playout *po;            /**< Playout delay control (optional) */
 	mtx_t *mtx;                    /**< Mutex protects above fields      */
 
 	/* Unprotected data */
@@ -49,6 +54,12 @@ struct rtp_receiver {
 	struct tmr tmr;                /**< Timer for stopping RX thread     */
 	int pt;                        /**< Previous payload type            */
 	int pt_tel;                    /**< Payload type for tel event       */
+	uint32_t batch;                /**< Datagrams per RTP syscall        */
+	RE_ATOMIC uint16_t extmask;    /**< Negotiated RTP extension IDs     */
+	struct {
+		rtpext_h *h;           /**< RTP extension handler            */
+		void *arg;             /**< Handler argument                 */
+	} exth[RTPEXT_ID_MAX + 1];
 };
 
 
@@ -160,6 +171,42 @@ static void pass_mnat_work(struct rtp_receiver *rx, const struct sa *raddr1,
 }
 
 
+/* attach the RTP socket to the calling thread */
+static int rtprecv_attach(struct rtp_receiver *rx)
+{
+	struct rtpio_rx *rio = NULL;
+	int err;
+
+	if (rx->batch) {
+		udp_thread_detach(rtp_sock(rx->rtp));
+
+		err = rtpio_rx_alloc(&rio, rtp_sock(rx->rtp), rx->batch);
+		if (!err) {
+			mtx_lock(rx->mtx);
+			mem_deref(rx->rio);
+			rx->rio = rio;
+			mtx_unlock(rx->mtx);
+			return 0;
+		}
+
+		warning("rtp_receiver: batched receive disabled (%m)\n",
+			err);
+	}
+
+	return udp_thread_attach(rtp_sock(rx->rtp));
+}
+
+
+static void rtprecv_detach(struct rtp_receiver *rx)
+{
+	mtx_lock(rx->mtx);
+	rx->rio = mem_deref(rx->rio);
+	mtx_unlock(rx->mtx);
+
+	udp_thread_detach(rtp_sock(rx->rtp));
+}
+
+
 static void rtprecv_periodic(void *arg)
 {
 	struct rtp_receiver *rx = arg;
@@ -167,8 +214,17 @@ static void rtprecv_periodic(void *arg)
 	if (re_atomic_rlx(&rx->run)) {
 		mtx_lock(rx->mtx);
 		bool pinhole    = rx->pinhole;
+		bool attach     = rx->attach;
+		rx->attach      = false;
 		mtx_unlock(rx->mtx);
 		tmr_start(&rx->tmr, 10, rtprecv_periodic, rx);
+
+		/* the socket was replaced, see rtprecv_set_socket() */
+		if (attach) {
+			(void)rtprecv_attach(rx);
+			(void)udp_thread_attach(rtcp_sock(rx->rtp));
+		}
+
 		mtx_lock(rx->mtx);
 		if (rx->start_rtcp) {
 			int err = 0;
@@ -189,7 +245,7 @@ static void rtprecv_periodic(void *arg)
 		}
 	}
 	else {
-		udp_thread_detach(rtp_sock(rx->rtp));
+		rtprecv_detach(rx);
 		udp_thread_detach(rtcp_sock(rx->rtp));
 		re_cancel();
 	}
@@ -205,7 +261,7 @@ static int rtprecv_thread(void *arg)
 	info("rtp_receiver: RTP RX thread started\n");
 	tmr_start(&rx->tmr, 10, rtprecv_periodic, rx);
 
-	err = udp_thread_attach(rtp_sock(rx->rtp));
+	err = rtprecv_attach(rx);
 	if (err) {
 		warning("rtp_receiver: could not attach to RTP socket (%m)\n",
 			err);
@@ -248,29 +304,35 @@ static int lostcalc(struct rtp_receiver *rx, uint16_t seq)
 }
 
 
+static void call_rtpext_handlers(const struct rtp_receiver *rx,
+				 const struct rtpext_tbl *ext)
+{
+	for (uint8_t id=RTPEXT_ID_MIN; id<=RTPEXT_ID_MAX; id++) {
+
+		if (!(ext->present & (1u << id)) || !rx->exth[id].h)
+			continue;
+
+		rx->exth[id].h(id, ext->extv[id].data, ext->extv[id].len,
+			       rx->exth[id].arg);
+	}
+}
+
+
 static int handle_rtp(struct rtp_receiver *rx, const struct rtp_header *hdr,
 		      struct mbuf *mb, unsigned lostc, bool drop)
 {
-	struct rtpext extv[8];
-	size_t extc = 0;
+	const uint16_t extmask = re_atomic_acq(&rx->extmask);
+	struct rtpext_tbl ext;
 	bool ignore = drop;
 
-	/* RFC 5285 -- A General Mechanism for RTP Header Extensions */
-	if (hdr->ext && hdr->x.len && mb) {
+	ext.present = 0;
 
-		const size_t pos = mb->pos;
-		const size_t end = mb->end;
-		const size_t ext_stop = mb->pos;
-		size_t i;
-		int err;
+	/* RFC 8285 -- A General Mechanism for RTP Header Extensions */
+	if (extmask && hdr->ext && hdr->x.len && mb) {
 
-		if (hdr->x.type != RTPEXT_TYPE_MAGIC) {
-			debug("stream: unknown ext type ignored (0x%04x)\n",
-			     hdr->x.type);
-			goto handler;
-		}
+		const size_t ext_len = hdr->x.len*sizeof(uint32_t);
+		int err;
 
-		size_t ext_len = hdr->x.len*sizeof(uint32_t);
 		if (mb->pos < ext_len) {
 			warning("rtp_receiver: corrupt rtp packet,"
 				" not enough space for rtpext of %zu bytes\n",
@@ -278,29 +340,25 @@ static int handle_rtp(struct rtp_receiver *rx, const struct rtp_header *hdr,
 			return 0;
 		}
 
-		mb->pos = mb->pos - ext_len;
-		mb->end = ext_stop;
-
-		for (i=0; i<RE_ARRAY_SIZE(extv) && mbuf_get_left(mb); i++) {
-
-			err = rtpext_decode(&extv[i], mb);
-			if (err) {
-				warning("rtp_receiver: rtpext_decode failed "
-					"(%m)\n", err);
-				return 0;
-			}
+		err = rtpext_tbl_decode(&ext, hdr->x.type,
+					mb->buf + mb->pos - ext_len, ext_len,
+					extmask);
+		if (err == ENOTSUP) {
+			debug("stream: unknown ext type ignored (0x%04x)\n",
+			     hdr->x.type);
+		}
+		else if (err) {
+			warning("rtp_receiver: rtpext decode failed (%m)\n",
+				err);
+			return 0;
 		}
 
-		extc = i;
-
-		mb->pos = pos;
-		mb->end = end;
+		call_rtpext_handlers(rx, &ext);
 	}
 
- handler:
 	stream_stop_natpinhole(rx->strm);
 
-	rx->rtph(hdr, extv, extc, mb, lostc, &ignore, rx->arg);
+	rx->rtph(hdr, &ext, mb, lostc, &ignore, rx->arg);
 	if (ignore)
 		return EAGAIN;
 
@@ -346,6 +404,23 @@ static int decode_frame(struct rtp_receiver *rx)
 }
 
 
+static void playout_measure(struct rtp_receiver *rx, struct playout *po,
+			    const struct rtp_header *hdr)
+{
+	struct rtcp_stats stats;
+	uint32_t jitter = 0;
+
+	if (!playout_arrival(po, hdr, tmr_jiffies_usec()))
+		return;
+
+	if (!rtcp_stats(rx->rtp, hdr->ssrc, &stats))
+		jitter = stats.rx.jit;
+
+	playout_update(po, jitter);
+	(void)jbuf_set_wish(rx->jbuf, playout_reorder(po));
+}
+
+
 static bool rtprecv_filter_pt(struct rtp_receiver *rx,
 			      const struct rtp_header *hdr)
 {
@@ -373,6 +448,9 @@ void rtprecv_decode(const struct sa *src, const struct rtp_header *hdr,
 		     struct mbuf *mb, void *arg)
 {
 	struct rtp_receiver *rx = arg;
+	stream_relay_h *relayh;
+	struct playout *po;
+	void *relayarg;
 	uint32_t ssrc0;
 	bool flush = false;
 	bool first = false;
@@ -427,14 +505,34 @@ void rtprecv_decode(const struct sa *src, const struct rtp_header *hdr,
 		rx->pseq = hdr->seq - 1;
 		flush = true;
 	}
+
+	relayh   = rx->relayh;
+	relayarg = mem_ref(rx->relayarg);
+	po       = mem_ref(rx->po);
 	mtx_unlock(rx->mtx);
 
+	/* Relayed payload bypasses jitter buffer and decoder */
+	if (relayh) {
+		relayh(rx->strm, hdr, mb, relayarg);
+		mem_deref(relayarg);
+		mem_deref(po);
+		return;
+	}
+
 	if (rtprecv_filter_pt(rx, hdr)) {
 		err = pass_pt_work(rx, hdr->pt, mb);
-		if (err && err != ENODATA)
+		if (err && err != ENODATA) {
+			mem_deref(po);
 			return;
+		}
 	}
 
+	/* telephone-events may have another clock rate */
+	if (po && (!rx->pt_tel || hdr->pt != rx->pt_tel))
+		playout_measure(rx, po, hdr);
+
+	mem_deref(po);
+
 	if (rx->jbuf) {
 
 		/* Put frame in Jitter Buffer */
@@ -446,10 +544,11 @@ void rtprecv_decode(const struct sa *src, const struct rtp_header *hdr,
 
 		err = jbuf_put(rx->jbuf, hdr, mb);
 		if (err) {
-			info("stream: %s: dropping %u bytes from %J"
-			     " [seq=%u, ts=%u] (%m)\n",
-			     rx->name, mb->end,
-			     src, hdr->seq, hdr->ts, err);
+			LOG_RATELIMIT(LEVEL_INFO,
+				      "stream: %s: dropping %u bytes from %J"
+				      " [seq=%u, ts=%u] (%m)\n",
+				      rx->name, mb->end,
+				      src, hdr->seq, hdr->ts, err);
 			metric_inc_err(rx->metric);
 		}
 
@@ -528,6 +627,102 @@ void rtprecv_set_socket(struct rtp_receiver *rx, struct rtp_sock *rtp)
 	mtx_lock(rx->mtx);
 	rx->rtp = rtp;
 	mtx_unlock(rx->mtx);
+
+	/* the RX thread owns the sockets, like in rtprecv_start_thread()
+	   they are detached here and attached in the RX thread */
+	if (re_atomic_rlx(&rx->run)) {
+		udp_thread_detach(rtp_sock(rtp));
+		udp_thread_detach(rtcp_sock(rtp));
+
+		mtx_lock(rx->mtx);
+		rx->attach = true;
+		mtx_unlock(rx->mtx);
+		return;
+	}
+
+	if (rx->batch)
+		(void)rtprecv_attach(rx);
+}
+
+
+/**
+ * Set a media relay handler, received RTP is passed to the handler
+ * instead of the jitter buffer and decoder
+ *
+ * @param rx      RTP Receiver object
+ * @param relayh  Relay handler, NULL to stop relaying
+ * @param arg     Handler argument, referenced while set
+ */
+void rtprecv_set_relay(struct rtp_receiver *rx, stream_relay_h *relayh,
+		       void *arg)
+{
+	void *old;
+
+	if (!rx)
+		return;
+
+	mtx_lock(rx->mtx);
+	old = rx->relayarg;
+	rx->relayh   = relayh;
+	rx->relayarg = mem_ref(arg);
+	mtx_unlock(rx->mtx);
+
+	mem_deref(old);
+
+	if (!relayh && rx->jbuf)
+		jbuf_flush(rx->jbuf);
+}
+
+
+/**
+ * Set the playout delay controller, which measures the arrival of
+ * packets and sets the wish size of the jitter buffer
+ *
+ * @param rx  RTP Receiver object
+ * @param po  Playout delay controller, NULL to stop. Referenced while set
+ */
+void rtprecv_set_playout(struct rtp_receiver *rx, struct playout *po)
+{
+	struct playout *old;
+
+	if (!rx)
+		return;
+
+	mtx_lock(rx->mtx);
+	old = rx->po;
+	rx->po = mem_ref(po);
+	mtx_unlock(rx->mtx);
+
+	mem_deref(old);
+}
+
+
+/**
+ * Register a negotiated RTP header extension ID
+ *
+ * Packets are only scanned for extensions once at least one ID is
+ * registered, and only registered IDs are decoded. Handlers should be
+ * registered before the receiver is started.
+ *
+ * @param rx   RTP Receiver
+ * @param id   Extension ID (1-14)
+ * @param exth Optional extension handler
+ * @param arg  Handler argument
+ */
+void rtprecv_set_extmap(struct rtp_receiver *rx, uint8_t id,
+			rtpext_h *exth, void *arg)
+{
+	uint16_t extmask;
+
+	if (!rx || id < RTPEXT_ID_MIN || id > RTPEXT_ID_MAX)
+		return;
+
+	mtx_lock(rx->mtx);
+	extmask = re_atomic_rlx(&rx->extmask);
+	rx->exth[id].h   = exth;
+	rx->exth[id].arg = arg;
+	re_atomic_rls_set(&rx->extmask, (uint16_t)(extmask | (1u << id)));
+	mtx_unlock(rx->mtx);
 }
 
 
@@ -657,6 +852,11 @@ int rtprecv_debug(struct re_printf *pf, const struct rtp_receiver *rx)
 	mtx_unlock(rx->mtx);
 
 	err  = re_hprintf(pf, " rx.enabled: %s\n", enabled ? "yes" : "no");
+
+	mtx_lock(rx->mtx);
+	err |= rtpio_rx_debug(pf, rx->rio);
+	mtx_unlock(rx->mtx);
+
 	err |= jbuf_debug(pf, rx->jbuf);
 
 	return err;
@@ -678,6 +878,9 @@ static void destructor(void *arg)
 		udp_thread_detach(rtcp_sock(rx->rtp));
 	}
 
+	mem_deref(rx->rio);
+	mem_deref(rx->relayarg);
+	mem_deref(rx->po);
 	mem_deref(rx->metric);
 	mem_deref(rx->name);
 	mem_deref(rx->mtx);
@@ -710,6 +913,7 @@ int rtprecv_alloc(struct rtp_receiver **rxp,
 	rx->arg    = arg;
 	rx->pseq   = -1;
 	rx->pt     = -1;
+	rx->batch  = cfg->rtp_batch;
 	err  = str_dup(&rx->name, name);
 	err |= mutex_alloc(&rx->mtx);
 	if (err)
@@ -764,7 +968,7 @@ int rtprecv_start_thread(struct rtp_receiver *rx)
 	if (re_atomic_rlx(&rx->run))
 		return 0;
 
-	udp_thread_detach(rtp_sock(rx->rtp));
+	rtprecv_detach(rx);
 	udp_thread_detach(rtcp_sock(rx->rtp));
 	re_atomic_rlx_set(&rx->run, true);
 	err = thread_create_name(&rx->thr,
@@ -772,7 +976,7 @@ int rtprecv_start_thread(struct rtp_receiver *rx)
 				 rtprecv_thread, rx);
 	if (err) {
 		re_atomic_rlx_set(&rx->run, false);
-		udp_thread_attach(rtp_sock(rx->rtp));
+		rtprecv_attach(rx);
 		udp_thread_attach(rtcp_sock(rx->rtp));
 	}
 
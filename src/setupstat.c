@@ -0,0 +1,143 @@
+/**
+ * @file setupstat.c  Call setup latency histograms
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The setup timeline of every established call is added to one
+ * histogram per milestone when the call is destroyed. Bucket bounds
+ * are in milliseconds since the call was created.
+ */
+
+
+enum { BUCKETS = 10 };
+
+static const uint32_t boundv[BUCKETS - 1] = {
+	20, 50, 100, 200, 500, 1000, 2000, 5000, 10000
+};
+
+struct hist {
+	uint32_t n;
+	uint64_t sum;
+	uint64_t max;
+	uint32_t bucketv[BUCKETS];
+};
+
+static struct {
+	uint32_t calls;
+	struct hist histv[CALL_SETUP_MAX];
+} setupstat;
+
+
+static void hist_add(struct hist *h, uint64_t t)
+{
+	unsigned i;
+
+	for (i=0; i<RE_ARRAY_SIZE(boundv); i++) {
+		if (t < boundv[i])
+			break;
+	}
+
+	++h->bucketv[i];
+	++h->n;
+	h->sum += t;
+	h->max = max(h->max, t);
+}
+
+
+/* upper bound of the bucket that holds the given percentile */
+static uint32_t hist_percentile(const struct hist *h, unsigned pct)
+{
+	uint32_t need = (h->n * pct + 99) / 100;
+	uint32_t acc = 0;
+
+	for (unsigned i=0; i<RE_ARRAY_SIZE(boundv); i++) {
+
+		acc += h->bucketv[i];
+		if (acc >= need)
+			return boundv[i];
+	}
+
+	return (uint32_t)h->max;
+}
+
+
+/**
+ * Add the setup timeline of a call to the histograms
+ *
+ * @param call Call object
+ */
+void setupstat_add(const struct call *call)
+{
+	if (!call)
+		return;
+
+	++setupstat.calls;
+
+	for (int i=CALL_SETUP_START+1; i<CALL_SETUP_MAX; i++) {
+
+		int64_t t = call_setup_time(call, i);
+
+		if (t >= 0)
+			hist_add(&setupstat.histv[i], (uint64_t)t);
+	}
+}
+
+
+/**
+ * Clear all call setup histograms
+ */
+void setupstat_reset(void)
+{
+	memset(&setupstat, 0, sizeof(setupstat));
+}
+
+
+/**
+ * Print the call setup histograms
+ *
+ * @param pf     Print function
+ * @param unused Unused parameter
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int setupstat_debug(struct re_printf *pf, void *unused)
+{
+	int err;
+	(void)unused;
+
+	err = re_hprintf(pf, "Call setup latency (%u calls) [ms]\n",
+			 setupstat.calls);
+
+	err |= re_hprintf(pf, "  %-12s %6s %6s %6s %6s %6s |", "milestone",
+			  "n", "avg", "p50", "p95", "max");
+	for (unsigned i=0; i<RE_ARRAY_SIZE(boundv); i++)
+		err |= re_hprintf(pf, " <%-5u", boundv[i]);
+	err |= re_hprintf(pf, " more\n");
+
+	for (int i=CALL_SETUP_START+1; i<CALL_SETUP_MAX; i++) {
+
+		const struct hist *h = &setupstat.histv[i];
+
+		if (!h->n)
+			continue;
+
+		err |= re_hprintf(pf, "  %-12s %6u %6llu %6u %6u %6llu |",
+				  call_setup_name(i), h->n, h->sum / h->n,
+				  hist_percentile(h, 50),
+				  hist_percentile(h, 95), h->max);
+
+		for (unsigned j=0; j<BUCKETS; j++)
+			err |= re_hprintf(pf, " %6u", h->bucketv[j]);
+
+		err |= re_hprintf(pf, "\n");
+	}
+
+	return err;
+}
@@ -0,0 +1,420 @@
+/**
+ * @file sfu.c  Selective forwarding unit (SFU) for video
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The SFU forwards encoded video between the calls of a room. Every
+ * member views one other member, its source. RTP received from a source
+ * is not decoded, the payload is queued to the video transmitter of each
+ * viewer as-is. The viewer's RTP socket writes its own SSRC and sequence
+ * numbers, and timestamps are rebased when the viewer switches to a new
+ * source, so every viewer sees one continuous stream. Payload types and
+ * timestamps are mapped as in the media relay.
+ *
+ * Forwarded packets go through the paced transmit queue of the viewer
+ * and are kept in its NACK history, so retransmissions requested by a
+ * viewer are served locally. Picture update requests (FIR/PLI) from
+ * viewers are aggregated into at most one request per interval towards
+ * the source. Packet loss from a source also triggers a request.
+ *
+ * Video RTP and RTCP are handled in the main thread, and so is the SFU.
+ */
+
+
+enum {
+	TS_GAP_MS  = 33,   /**< Timestamp gap on source switch [ms] */
+};
+
+
+/** One call in the SFU, as source and as viewer */
+struct sfu_member {
+	struct le le;
+	struct sfu *sfu;           /**< Parent, NULL when closed         */
+	const struct call *call;   /**< Call (weak)                      */
+	struct video *video;       /**< Video stream (weak)              */
+	struct stream *strm;       /**< Generic stream (weak)            */
+
+	/* source direction */
+	uint16_t seq;              /**< Last received sequence number    */
+	bool seq_set;
+	uint64_t n_rx;             /**< Packets received                 */
+	uint64_t n_loss;           /**< Sequence gaps detected           */
+
+	/* viewer direction */
+	struct sfu_member *src;    /**< Selected source (weak)           */
+	struct relay_map map;      /**< Source PT and ts to viewer       */
+	uint64_t n_fwd;            /**< Forwarded packets                */
+	uint64_t n_drop;           /**< Dropped packets                  */
+	uint64_t n_picup;          /**< Picture updates from the viewer  */
+};
+
+/** Selective forwarding unit */
+struct sfu {
+	struct list memberl;
+};
+
+
+static void member_set_source(struct sfu_member *m, struct sfu_member *src)
+{
+	if (m->src == src)
+		return;
+
+	m->src = src;
+	m->map.rebase = true;
+	relay_map_reset(&m->map);
+
+	if (src) {
+		debug("sfu: %s views %s\n", call_peeruri(m->call),
+		      call_peeruri(src->call));
+		video_request_picup(src->video);
+	}
+}
+
+
+/* first other member, for viewers without a source */
+static struct sfu_member *default_source(const struct sfu *sfu,
+					 const struct sfu_member *m)
+{
+	for (struct le *le = sfu->memberl.head; le; le = le->next) {
+
+		struct sfu_member *src = le->data;
+
+		if (src != m)
+			return src;
+	}
+
+	return NULL;
+}
+
+
+static struct sfu_member *member_find(const struct sfu *sfu,
+				      const struct call *call)
+{
+	for (struct le *le = sfu->memberl.head; le; le = le->next) {
+
+		struct sfu_member *m = le->data;
+
+		if (m->call == call)
+			return m;
+	}
+
+	return NULL;
+}
+
+
+static void forward(struct sfu_member *m, const struct rtp_header *hdr,
+		    struct mbuf *mb)
+{
+	size_t pos = mb->pos;
+	uint32_t ts;
+	int pt;
+
+	pt = relay_map_pt(&m->map, m->src->strm, m->strm, hdr->pt);
+	if (pt < 0) {
+		++m->n_drop;
+		return;
+	}
+
+	(void)relay_map_ts(&m->map, hdr, TS_GAP_MS, &ts);
+
+	if (video_forward(m->video, hdr->m, pt, ts, mb)) {
+		++m->n_drop;
+	}
+	else {
+		m->map.ts_last = ts;
+		++m->n_fwd;
+	}
+
+	mb->pos = pos;
+}
+
+
+static void sfu_recv(struct stream *strm, const struct rtp_header *hdr,
+		     struct mbuf *mb, void *arg)
+{
+	struct sfu_member *src = arg;
+	(void)strm;
+
+	if (!src->sfu || !hdr || !mb || hdr->pt >= 128)
+		return;
+
+	++src->n_rx;
+
+	/* lost packets, the viewers need a new picture */
+	if (src->seq_set && hdr->seq != (uint16_t)(src->seq + 1)) {
+		++src->n_loss;
+		video_request_picup(src->video);
+	}
+
+	src->seq = hdr->seq;
+	src->seq_set = true;
+
+	for (struct le *le = src->sfu->memberl.head; le; le = le->next) {
+
+		struct sfu_member *m = le->data;
+
+		if (m->src == src)
+			forward(m, hdr, mb);
+	}
+}
+
+
+static void member_destructor(void *arg)
+{
+	struct sfu_member *m = arg;
+
+	list_unlink(&m->le);
+}
+
+
+/**
+ * Remove a member from its SFU, the video stream decodes and encodes
+ * again. Viewers of the member switch to another source.
+ *
+ * @param m SFU member
+ */
+void sfu_member_close(struct sfu_member *m)
+{
+	struct sfu *sfu;
+
+	if (!m || !m->sfu)
+		return;
+
+	sfu = m->sfu;
+	m->sfu = NULL;
+
+	list_unlink(&m->le);
+
+	(void)stream_set_forward(m->strm, NULL, NULL);
+	video_set_sfu(m->video, NULL);
+
+	for (struct le *le = sfu->memberl.head; le; le = le->next) {
+
+		struct sfu_member *v = le->data;
+
+		if (v->src == m)
+			member_set_source(v, default_source(sfu, v));
+	}
+
+	mem_deref(m);
+}
+
+
+/**
+ * Reset the payload type mappings of a member after an SDP update
+ *
+ * @param m SFU member
+ */
+void sfu_member_update(struct sfu_member *m)
+{
+	if (!m || !m->sfu)
+		return;
+
+	relay_map_reset(&m->map);
+
+	for (struct le *le = m->sfu->memberl.head; le; le = le->next) {
+
+		struct sfu_member *v = le->data;
+
+		if (v->src == m)
+			relay_map_reset(&v->map);
+	}
+}
+
+
+/**
+ * Handle a picture update request (FIR/PLI) from a viewer, passed on to
+ * the source of the viewer
+ *
+ * @param m SFU member
+ */
+void sfu_picup(struct sfu_member *m)
+{
+	if (!m || !m->sfu || !m->src)
+		return;
+
+	++m->n_picup;
+	video_request_picup(m->src->video);
+}
+
+
+static void destructor(void *arg)
+{
+	struct sfu *sfu = arg;
+	struct le *le;
+
+	while ((le = sfu->memberl.head))
+		sfu_member_close(le->data);
+}
+
+
+/**
+ * Allocate a selective forwarding unit for video
+ *
+ * @param sfup Pointer to allocated SFU
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sfu_alloc(struct sfu **sfup)
+{
+	struct sfu *sfu;
+
+	if (!sfup)
+		return EINVAL;
+
+	sfu = mem_zalloc(sizeof(*sfu), destructor);
+	if (!sfu)
+		return ENOMEM;
+
+	*sfup = sfu;
+
+	return 0;
+}
+
+
+/**
+ * Add the video stream of a call to an SFU. The new member views the
+ * first other member, and members without a source view the new member.
+ *
+ * @param sfu  Selective forwarding unit
+ * @param call Call with video
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sfu_add(struct sfu *sfu, struct call *call)
+{
+	struct sfu_member *m;
+	struct video *video;
+	struct stream *strm;
+	int err;
+
+	if (!sfu || !call)
+		return EINVAL;
+
+	video = call_video(call);
+	strm  = video_strm(video);
+	if (!strm)
+		return ENOENT;
+
+	if (member_find(sfu, call) || stream_is_relayed(strm))
+		return EALREADY;
+
+	m = mem_zalloc(sizeof(*m), member_destructor);
+	if (!m)
+		return ENOMEM;
+
+	m->sfu   = sfu;
+	m->call  = call;
+	m->video = video;
+	m->strm  = strm;
+	relay_map_reset(&m->map);
+
+	err = stream_set_forward(strm, sfu_recv, m);
+	if (err) {
+		mem_deref(m);
+		return err;
+	}
+
+	video_set_sfu(video, m);
+
+	list_append(&sfu->memberl, &m->le, m);
+
+	member_set_source(m, default_source(sfu, m));
+
+	for (struct le *le = sfu->memberl.head; le; le = le->next) {
+
+		struct sfu_member *v = le->data;
+
+		if (v != m && !v->src)
+			member_set_source(v, m);
+	}
+
+	info("sfu: %s joined (%u members)\n", call_peeruri(call),
+	     list_count(&sfu->memberl));
+
+	return 0;
+}
+
+
+/**
+ * Remove the video stream of a call from an SFU
+ *
+ * @param sfu  Selective forwarding unit
+ * @param call Call
+ */
+void sfu_remove(struct sfu *sfu, const struct call *call)
+{
+	if (!sfu)
+		return;
+
+	sfu_member_close(member_find(sfu, call));
+}
+
+
+/**
+ * Select the source that a viewer receives
+ *
+ * @param sfu    Selective forwarding unit
+ * @param viewer Call of the viewer
+ * @param source Call of the source
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sfu_select(struct sfu *sfu, const struct call *viewer,
+	       const struct call *source)
+{
+	struct sfu_member *m, *src;
+
+	if (!sfu || !viewer || !source || viewer == source)
+		return EINVAL;
+
+	m   = member_find(sfu, viewer);
+	src = member_find(sfu, source);
+	if (!m || !src)
+		return ENOENT;
+
+	member_set_source(m, src);
+
+	return 0;
+}
+
+
+/**
+ * Print the SFU members and forwarding statistics
+ *
+ * @param pf  Print function
+ * @param sfu Selective forwarding unit
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int sfu_debug(struct re_printf *pf, const struct sfu *sfu)
+{
+	int err;
+
+	if (!sfu)
+		return 0;
+
+	err = re_hprintf(pf, "SFU (%u members)\n",
+			 list_count(&sfu->memberl));
+
+	for (struct le *le = sfu->memberl.head; le; le = le->next) {
+
+		const struct sfu_member *m = le->data;
+
+		err |= re_hprintf(pf, "  %s <- %s\n"
+				  "    rx=%llu loss=%llu fwd=%llu drop=%llu"
+				  " picup=%llu\n",
+				  call_peeruri(m->call),
+				  m->src ? call_peeruri(m->src->call) : "-",
+				  m->n_rx, m->n_loss, m->n_fwd, m->n_drop,
+				  m->n_picup);
+	}
+
+	return err;
+}
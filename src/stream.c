@@ -17,7 +17,6 @@
 
 
 enum {
-	RTP_RECV_SIZE = 8192,
 	RTP_CHECK_INTERVAL = 1000,  /* how often to check for RTP [ms] */
 	PORT_DISCARD = 9,
 };
@@ -30,6 +29,8 @@ struct sender {
 	struct sa raddr_rtcp;  /**< Remote RTCP address             */
 	int pt_enc;            /**< Payload type for encoding       */
 	RE_ATOMIC bool enabled;/**< True if enabled                 */
+	struct rtpio_tx *rio;  /**< Batched RTP transmit (optional) */
+	RE_ATOMIC bool relayed;/**< Payload comes from media relay  */
 	mtx_t *lock;
 };
 
@@ -56,6 +57,7 @@ struct stream {
 	struct sdp_media *sdp;   /**< SDP Media line                        */
 	enum sdp_dir ldir;       /**< SDP direction of the stream           */
 	struct rtp_sock *rtp;    /**< RTP Socket                            */
+	struct rtpport *port;    /**< RTP port pair, owns the RTP socket    */
 	struct rtcp_stats rtcp_stats;/**< RTCP statistics                   */
 	const struct mnat *mnat; /**< Media NAT traversal module            */
 	struct mnat_media *mns;  /**< Media NAT traversal state             */
@@ -88,6 +90,9 @@ struct stream {
 
 	struct rtp_receiver *rx;
 	struct rxmain rxm;
+
+	struct media_relay *relay;  /**< Media relay (optional)         */
+	struct stream *relay_peer;  /**< Other end of the relay         */
 };
 
 
@@ -133,6 +138,8 @@ static void stream_destructor(void *arg)
 	if (s->cfg.rtp_stats)
 		print_rtp_stats(s);
 
+	stream_relay_stop(s);
+
 	mem_deref(s->tx.metric);
 
 	tmr_cancel(&s->rxm.tmr_rtp);
@@ -145,7 +152,9 @@ static void stream_destructor(void *arg)
 	mem_deref(s->mencs);
 	mem_deref(s->mns);
 	mem_deref(s->bundle);  /* NOTE: deref before rtp */
+	mem_deref(s->tx.rio);
 	mem_deref(s->rtp);
+	mem_deref(s->port);
 	mem_deref(s->cname);
 	mem_deref(s->peer);
 	mem_deref(s->mid);
@@ -363,36 +372,40 @@ void stream_process_rtcp(struct stream *strm, struct rtcp_msg *msg)
 
 static int stream_sock_alloc(struct stream *s, int af)
 {
-	struct sa laddr;
 	uint8_t tos;
 	int err;
 
 	if (!s)
 		return EINVAL;
 
-	/* we listen on all interfaces */
-	sa_init(&laddr, af);
-
-	err = rtp_listen(&s->rtp, IPPROTO_UDP, &laddr,
-			 s->cfg.rtp_ports.min, s->cfg.rtp_ports.max,
-			 true, rtprecv_decode, rtprecv_handle_rtcp, s->rx);
+	/* receive size and audio socket buffers are already set */
+	err = rtpport_alloc(&s->port, baresip_rtpports(), &s->cfg.rtp_ports,
+			    af, rtprecv_decode, rtprecv_handle_rtcp, s->rx);
 	if (err) {
-		warning("stream: rtp_listen failed: af=%s ports=%u-%u"
+		warning("stream: rtpport_alloc failed: af=%s ports=%u-%u"
 			" (%m)\n", net_af2name(af),
 			s->cfg.rtp_ports.min, s->cfg.rtp_ports.max, err);
 		return err;
 	}
 
+	s->rtp = mem_ref(rtpport_sock(s->port));
+
 	tos = s->type == MEDIA_AUDIO ? s->cfg.rtp_tos : s->cfg.rtpv_tos;
 	(void)udp_settos(rtp_sock(s->rtp), tos);
 	(void)udp_settos(rtcp_sock(s->rtp), tos);
 
-	udp_rxsz_set(rtp_sock(s->rtp), RTP_RECV_SIZE);
-
 	if (s->type == MEDIA_VIDEO)
 		udp_sockbuf_set(rtp_sock(s->rtp), 65536 * 8);
-	else
-		udp_sockbuf_set(rtp_sock(s->rtp), 65536);
+
+	/* video frames are sent in bursts, see stream_send_flush() */
+	if (s->type == MEDIA_VIDEO && s->cfg.rtp_batch) {
+		err = rtpio_tx_alloc(&s->tx.rio, rtp_sock(s->rtp),
+				     s->cfg.rtp_batch);
+		if (err) {
+			warning("stream: batched transmit disabled (%m)\n",
+				err);
+		}
+	}
 
 	rtprecv_set_socket(s->rx, s->rtp);
 	return 0;
@@ -696,6 +709,24 @@ int stream_bundle_init(struct stream *strm, bool offerer)
 }
 
 
+/**
+ * Register a negotiated RTP header extension on the receive side
+ *
+ * @param strm Stream object
+ * @param id   Extension ID from extmap
+ * @param exth Optional handler, called for each packet carrying the ID
+ * @param arg  Handler argument
+ */
+void stream_set_extmap(struct stream *strm, uint8_t id,
+		       rtpext_h *exth, void *arg)
+{
+	if (!strm)
+		return;
+
+	rtprecv_set_extmap(strm->rx, id, exth, arg);
+}
+
+
 uint8_t stream_generate_extmap_id(struct stream *strm)
 {
 	uint8_t id;
@@ -725,26 +756,11 @@ struct sdp_media *stream_sdpmedia(const struct stream *strm)
 }
 
 
-/**
- * Write stream data to the network
- *
- * @param s		Stream object
- * @param ext		Extension bit
- * @param marker	Marker bit
- * @param pt		Payload type
- * @param ts		Timestamp
- * @param mb		Payload buffer
- *
- * @return int	0 if success, errorcode otherwise
- */
-int stream_send(struct stream *s, bool ext, bool marker, int pt, uint32_t ts,
-		struct mbuf *mb)
+static int send_rtp(struct stream *s, bool ext, bool marker, int pt,
+		    uint32_t ts, struct mbuf *mb)
 {
 	int err = 0;
 
-	if (!s)
-		return EINVAL;
-
 	if (!re_atomic_acq(&s->tx.enabled))
 		return 0;
 
@@ -761,8 +777,10 @@ int stream_send(struct stream *s, bool ext, bool marker, int pt, uint32_t ts,
 
 	if (pt >= 0) {
 		mtx_lock(s->tx.lock);
+		rtpio_tx_begin(s->tx.rio);
 		err = rtp_send(s->rtp, &s->tx.raddr_rtp, ext, marker, pt, ts,
 			       tmr_jiffies_rt_usec(), mb);
+		err |= rtpio_tx_end(s->tx.rio, marker);
 		mtx_unlock(s->tx.lock);
 		if (err)
 			metric_inc_err(s->tx.metric);
@@ -772,6 +790,293 @@ int stream_send(struct stream *s, bool ext, bool marker, int pt, uint32_t ts,
 }
 
 
+/**
+ * Write stream data to the network
+ *
+ * @param s		Stream object
+ * @param ext		Extension bit
+ * @param marker	Marker bit
+ * @param pt		Payload type
+ * @param ts		Timestamp
+ * @param mb		Payload buffer
+ *
+ * @return int	0 if success, errorcode otherwise
+ */
+int stream_send(struct stream *s, bool ext, bool marker, int pt, uint32_t ts,
+		struct mbuf *mb)
+{
+	if (!s)
+		return EINVAL;
+
+	/* the media relay owns the sender */
+	if (re_atomic_acq(&s->tx.relayed))
+		return 0;
+
+	return send_rtp(s, ext, marker, pt, ts, mb);
+}
+
+
+/**
+ * Send a relayed RTP payload, called from the media relay
+ *
+ * @param s		Stream object
+ * @param marker	Marker bit
+ * @param pt		Payload type
+ * @param ts		Timestamp
+ * @param mb		Payload buffer
+ *
+ * @return int	0 if success, errorcode otherwise
+ */
+int stream_send_relay(struct stream *s, bool marker, int pt, uint32_t ts,
+		      struct mbuf *mb)
+{
+	if (!s)
+		return EINVAL;
+
+	return send_rtp(s, false, marker, pt, ts, mb);
+}
+
+
+/**
+ * Send an RTP packet with its own SSRC and sequence number, used for the
+ * simulcast layers that share the RTP socket of the stream
+ *
+ * @param s		Stream object
+ * @param ssrc		Synchronization source
+ * @param seq		Sequence number
+ * @param ext		Extension bit
+ * @param marker	Marker bit
+ * @param pt		Payload type
+ * @param ts		Timestamp
+ * @param mb		Payload buffer, with headroom for the RTP header,
+ *			starting with the header extensions of the layer
+ *
+ * @return int	0 if success, errorcode otherwise
+ */
+int stream_send_ssrc(struct stream *s, uint32_t ssrc, uint16_t seq,
+		     bool ext, bool marker, int pt, uint32_t ts,
+		     struct mbuf *mb)
+{
+	struct rtp_header hdr;
+	size_t pos;
+	int err;
+
+	if (!s || !mb || pt < 0 || mb->pos < RTP_HEADER_SIZE)
+		return EINVAL;
+
+	if (!re_atomic_acq(&s->tx.enabled) || re_atomic_rlx(&s->hold) ||
+	    re_atomic_acq(&s->tx.relayed))
+		return 0;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.ver  = RTP_VERSION;
+	hdr.x    = ext;
+	hdr.m    = marker;
+	hdr.pt   = pt;
+	hdr.seq  = seq;
+	hdr.ts   = ts;
+	hdr.ssrc = ssrc;
+
+	metric_add_packet(s->tx.metric, mbuf_get_left(mb));
+
+	pos = mb->pos;
+	mb->pos -= RTP_HEADER_SIZE;
+
+	err = rtp_hdr_encode(mb, &hdr);
+	if (err)
+		goto out;
+
+	mb->pos -= RTP_HEADER_SIZE;
+
+	mtx_lock(s->tx.lock);
+	rtpio_tx_begin(s->tx.rio);
+	err  = udp_send(rtp_sock(s->rtp), &s->tx.raddr_rtp, mb);
+	err |= rtpio_tx_end(s->tx.rio, marker);
+	mtx_unlock(s->tx.lock);
+
+ out:
+	mb->pos = pos;
+
+	if (err)
+		metric_inc_err(s->tx.metric);
+
+	return err;
+}
+
+
+/**
+ * Flush RTP packets queued by batched transmit
+ *
+ * @param s		Stream object
+ *
+ * @return int	0 if success, errorcode otherwise
+ */
+int stream_send_flush(struct stream *s)
+{
+	int err;
+
+	if (!s)
+		return EINVAL;
+
+	mtx_lock(s->tx.lock);
+	err = rtpio_tx_end(s->tx.rio, true);
+	mtx_unlock(s->tx.lock);
+
+	if (err)
+		metric_inc_err(s->tx.metric);
+
+	return err;
+}
+
+
+static void relay_attach(struct stream *s, struct stream *peer,
+			 struct media_relay *rl)
+{
+	s->relay = rl;
+	s->relay_peer = peer;
+	re_atomic_rls_set(&s->tx.relayed, true);
+	rtprecv_set_relay(s->rx, relay_recv, rl);
+}
+
+
+static void relay_detach(struct stream *s)
+{
+	rtprecv_set_relay(s->rx, NULL, NULL);
+	re_atomic_rls_set(&s->tx.relayed, false);
+	s->relay = mem_deref(s->relay);
+	s->relay_peer = NULL;
+}
+
+
+/**
+ * Relay RTP between two streams without decoding and encoding
+ *
+ * Received RTP payloads are forwarded to the other stream, and the
+ * local encoder output of both streams is discarded. Picture update
+ * requests for relayed video are sent to the peer of the other stream.
+ * Every format negotiated on one stream must be negotiated on the other,
+ * otherwise the caller should keep bridging decoded media.
+ *
+ * @param a  First stream
+ * @param b  Second stream, or the same stream for echo
+ *
+ * @return 0 if success, ENOTSUP if the formats differ, otherwise errorcode
+ */
+int stream_relay_start(struct stream *a, struct stream *b)
+{
+	struct media_relay *rl;
+	int err;
+
+	if (!a || !b || a->type != b->type)
+		return EINVAL;
+
+	if (a->relay || b->relay)
+		return EALREADY;
+
+	err = relay_alloc(&rl, a, b);
+	if (err)
+		return err;
+
+	relay_attach(a, b, rl);
+	if (b != a)
+		relay_attach(b, a, mem_ref(rl));
+
+	info("stream: %s: relaying RTP to %s\n", media_name(a->type),
+	     b == a ? "self" : b->peer);
+
+	return 0;
+}
+
+
+/**
+ * Stop relaying RTP, both ends of the relay resume normal operation
+ *
+ * @param s  Stream object
+ */
+void stream_relay_stop(struct stream *s)
+{
+	struct stream *peer;
+
+	if (!s || !s->relay)
+		return;
+
+	peer = s->relay_peer;
+
+	relay_close(s->relay);
+
+	if (peer && peer != s)
+		relay_detach(peer);
+	relay_detach(s);
+}
+
+
+/**
+ * Check if the stream is relaying RTP
+ *
+ * @param s  Stream object
+ *
+ * @return True if relayed, otherwise false
+ */
+bool stream_is_relayed(const struct stream *s)
+{
+	return s ? re_atomic_acq(&s->tx.relayed) : false;
+}
+
+
+/**
+ * Get the stream that receives the RTP which this stream sends while
+ * relayed, i.e. the source of the relayed media
+ *
+ * @param s  Stream object
+ *
+ * @return Relay peer, the stream itself for echo, or NULL if not relayed
+ */
+struct stream *stream_relay_peer(const struct stream *s)
+{
+	return s ? s->relay_peer : NULL;
+}
+
+
+/**
+ * Pass received RTP to a forwarding handler instead of the jitter buffer
+ * and decoder. Unlike the media relay, the sender is not taken over.
+ *
+ * @param s     Stream object
+ * @param fwdh  Forwarding handler, NULL to decode again
+ * @param arg   Handler argument, referenced while set
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int stream_set_forward(struct stream *s, stream_relay_h *fwdh, void *arg)
+{
+	if (!s)
+		return EINVAL;
+
+	if (s->relay)
+		return EALREADY;
+
+	rtprecv_set_relay(s->rx, fwdh, arg);
+
+	return 0;
+}
+
+
+/**
+ * Measure incoming RTP with a playout delay controller, which also sets
+ * the wish size of the jitter buffer
+ *
+ * @param s   Stream object
+ * @param po  Playout delay controller, referenced while set
+ */
+void stream_set_playout(struct stream *s, struct playout *po)
+{
+	if (!s)
+		return;
+
+	rtprecv_set_playout(s->rx, po);
+}
+
+
 /**
  * Write stream data to the network
  *
@@ -951,6 +1256,12 @@ int stream_update(struct stream *s)
 
 	stream_enable(s, true);
 
+	if (s->relay && relay_check(s->relay)) {
+		info("stream: %s: formats differ, stopping media relay\n",
+		     media_name(s->type));
+		stream_relay_stop(s);
+	}
+
 	return 0;
 }
 
@@ -1686,6 +1997,8 @@ int stream_debug(struct re_printf *pf, const struct stream *s)
 
 	err |= mbuf_printf(mb, " tx.enabled: %s\n",
 			   re_atomic_rlx(&s->tx.enabled) ? "yes" : "no");
+	err |= rtpio_tx_debug(&pfmb, s->tx.rio);
+	err |= relay_debug(&pfmb, s->relay);
 	err |= rtprecv_debug(&pfmb, s->rx);
 	err |= rtp_debug(&pfmb, s->rtp);
 
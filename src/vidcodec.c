@@ -6,6 +6,7 @@
 
 #include <re.h>
 #include <baresip.h>
+#include "core.h"
 
 
 /**
@@ -53,6 +54,8 @@ const struct vidcodec *vidcodec_find(const struct list *vidcodecl,
 {
 	struct le *le;
 
+	module_lazy_load("vidcodec");
+
 	for (le=list_head(vidcodecl); le; le=le->next) {
 
 		struct vidcodec *vc = le->data;
@@ -83,6 +86,8 @@ const struct vidcodec *vidcodec_find_encoder(const struct list *vidcodecl,
 {
 	struct le *le;
 
+	module_lazy_load("vidcodec");
+
 	for (le=list_head(vidcodecl); le; le=le->next) {
 
 		struct vidcodec *vc = le->data;
@@ -111,6 +116,8 @@ const struct vidcodec *vidcodec_find_decoder(const struct list *vidcodecl,
 {
 	struct le *le;
 
+	module_lazy_load("vidcodec");
+
 	for (le=list_head(vidcodecl); le; le=le->next) {
 
 		struct vidcodec *vc = le->data;
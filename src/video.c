@@ -31,9 +31,17 @@ enum {
 	NACK_BLPSZ	= 16,		       /**< NACK bitmask size        */
 	NACK_QUEUE_TIME	= 500,		       /**< in [ms]                  */
 	PKT_SIZE	= 1280,		       /**< max. Packet size in bytes*/
+	SIMCAST_MAX	= 3,		       /**< max. Simulcast layers    */
 };
 
 
+/** RTP stream identifiers of simulcast layers, full to quarter size */
+static const char * const simcast_ridv[SIMCAST_MAX] = {"f", "h", "q"};
+
+/* RFC 8852 */
+static const char uri_rid[] = "urn:ietf:params:rtp-hdrext:sdes:rtp-stream-id";
+
+
 /**
  * \page GenericVideoStream Generic Video Stream
  *
@@ -62,6 +70,36 @@ enum {
  *</pre>
  */
 
+/**
+ * Video stream - simulcast layer
+ *
+ * Layer 0 has the full resolution and is sent with the SSRC of the RTP
+ * socket. Each further layer is scaled down by two from the previous
+ * one, has its own encoder, SSRC, sequence numbers and send queue, and
+ * is paced at its own share of the send bitrate.
+ */
+struct vtx_layer {
+	unsigned idx;                      /**< Layer index, 0 is full    */
+	char rid[16];                      /**< RTP stream identifier     */
+	struct videnc_state *enc;          /**< Video encoder state       */
+	struct vidframe *frame;            /**< Scaled frame (idx > 0)    */
+	uint32_t bitrate;                  /**< Encoder bitrate [bit/s]   */
+	uint32_t rate;                     /**< Pacing rate [bit/s]       */
+	uint32_t ssrc;                     /**< SSRC (idx > 0)            */
+	uint16_t seq;                      /**< Next sequence (idx > 0)   */
+	struct list sendq;                 /**< Tx-Queue (struct vidqent) */
+	struct list sendqnb;               /**< Tx-Queue NACK wait buffer */
+	uint64_t start_jfs;                /**< Pacing window start [us]  */
+	uint64_t target_jfs;               /**< Next send time [us]       */
+	uint64_t sent;                     /**< Bits sent in window       */
+	bool neg;                          /**< Negotiated with the peer  */
+	bool paused;                       /**< Paused by peer or app     */
+	RE_ATOMIC bool active;             /**< Negotiated and not paused */
+	unsigned skipc;                    /**< Number of frames skipped  */
+	uint64_t frames;                   /**< Number of frames encoded  */
+};
+
+
 /**
  * Video stream - transmitter/encoder direction
 
@@ -74,27 +112,33 @@ enum {
  | |___|-->| vidsrc |-->! vidconv !-->| vidfilt |-->| encoder |---> RTP
  |         |        |   !         !   |         |   |         |
  '         '--------'   '- - - - -'   '---------'   '---------'
-                         (optional)
+                         (optional)       |
+                                          |   .- - - - -.   .---------.
+                                          |   !         !   |         |
+                                          '-->! scaling !-->| encoder |-->
+                                              !         !   |         |
+                                              '- - - - -'   '---------'
+                                            (simulcast layers)
  \endverbatim
  */
 struct vtx {
 	struct video *video;               /**< Parent                    */
 	const struct vidcodec *vc;         /**< Current Video encoder     */
-	struct videnc_state *enc;          /**< Video encoder state       */
+	struct vtx_layer layerv[SIMCAST_MAX]; /**< Simulcast layers       */
+	unsigned layerc;                   /**< Number of layers          */
+	struct vtx_layer *enc_layer;       /**< Layer being encoded       */
 	struct vidsrc_prm vsrc_prm;        /**< Video source parameters   */
 	struct vidsz vsrc_size;            /**< Video source size         */
 	struct vidsrc *vs;                 /**< Video source module       */
 	struct vidsrc_st *vsrc;            /**< Video source              */
 	mtx_t *lock_enc;                   /**< Lock for encoder          */
 	struct vidframe *frame;            /**< Source frame              */
-	mtx_t *lock_tx;                    /**< Protect the sendq         */
-	struct list sendq;                 /**< Tx-Queue (struct vidqent) */
-	struct list sendqnb;               /**< Tx-Queue NACK wait buffer */
-	unsigned skipc;                    /**< Number of frames skipped  */
+	mtx_t *lock_tx;                    /**< Protect the send queues   */
 	struct list filtl;                 /**< Filters in encoding order */
 	enum vidfmt fmt;                   /**< Outgoing pixel format     */
 	char device[128];                  /**< Source device name        */
 	uint32_t ts_offset;                /**< Random timestamp offset   */
+	uint8_t extmap_rid;                /**< RID extension ID, 0 = off */
 	bool picup;                        /**< Send picture update       */
 	int frames;                        /**< Number of frames sent     */
 	double efps;                       /**< Estimated frame-rate      */
@@ -102,6 +146,7 @@ struct vtx {
 	uint64_t ts_last;                  /**< Last RTP timestamp sent   */
 	thrd_t thrd;                       /**< Tx-Thread                 */
 	RE_ATOMIC bool run;                /**< Tx-Thread is active       */
+	RE_ATOMIC bool fwd;                /**< Payload forwarded by SFU  */
 	cnd_t wait;                        /**< Tx-Thread wait            */
 
 	/** Statistics */
@@ -165,6 +210,8 @@ struct video {
 	struct tmr tmr;         /**< Timer for frame-rate estimation      */
 	char *peer;             /**< Peer URI                             */
 	bool nack_pli;          /**< Send NACK/PLI to peer                */
+	bool simcast_lattr;     /**< Simulcast layers are in local SDP    */
+	struct sfu_member *sfu; /**< SFU membership (optional)            */
 	video_err_h *errh;      /**< Error handler                        */
 	void *arg;              /**< Error handler argument               */
 };
@@ -186,6 +233,20 @@ static void request_picture_update(struct vrx *vrx);
 static void video_stop_source(struct video *v);
 
 
+/*
+ * A layer has a quarter of the pixels of the next higher layer, and gets
+ * a quarter of its bitrate. The shares of all layers add up to bitrate.
+ */
+static inline uint32_t layer_bitrate(uint32_t bitrate, unsigned idx,
+				     unsigned layerc)
+{
+	const uint64_t total  = ((1ull << (2 * layerc)) - 1) / 3;
+	const uint64_t weight = 1ull << (2 * (layerc - 1 - idx));
+
+	return max((uint32_t)(bitrate * weight / total), 1u);
+}
+
+
 static void vidqent_destructor(void *arg)
 {
 	struct vidqent *qent = arg;
@@ -195,12 +256,18 @@ static void vidqent_destructor(void *arg)
 }
 
 
+/*
+ * The header extensions are written per packet: the MID of the stream
+ * when bundled, and the RID of the simulcast layer (extmap_rid set).
+ */
 static int vidqent_alloc(struct vidqent **qentp, struct stream *strm,
 			 bool marker, uint8_t pt, uint32_t ts,
+			 uint8_t extmap_rid, const char *rid,
 			 const uint8_t *hdr, size_t hdr_len,
 			 const uint8_t *pld, size_t pld_len)
 {
 	struct bundle *bun = stream_bundle(strm);
+	bool bundled = bundle_state(bun) != BUNDLE_NONE;
 	struct vidqent *qent;
 	int err = 0;
 
@@ -216,7 +283,7 @@ static int vidqent_alloc(struct vidqent **qentp, struct stream *strm,
 	qent->pt     = pt;
 	qent->ts     = ts;
 
-	qent->mb = mbuf_alloc(RTP_PRESZ + hdr_len + pld_len + RTP_TRAILSZ);
+	qent->mb = mempool_mbuf(RTP_PRESZ + hdr_len + pld_len + RTP_TRAILSZ);
 	if (!qent->mb) {
 		err = ENOMEM;
 		goto out;
@@ -224,9 +291,11 @@ static int vidqent_alloc(struct vidqent **qentp, struct stream *strm,
 
 	qent->mb->pos = qent->mb->end = RTP_PRESZ;
 
-	if (bundle_state(bun) != BUNDLE_NONE) {
+	if (!str_isset(rid))
+		extmap_rid = 0;
+
+	if (bundled || extmap_rid) {
 
-		const char *mid = stream_mid(strm);
 		size_t ext_len = 0;
 		size_t start = qent->mb->pos;
 		size_t pos;
@@ -236,8 +305,17 @@ static int vidqent_alloc(struct vidqent **qentp, struct stream *strm,
 
 		pos = qent->mb->pos;
 
-		rtpext_encode(qent->mb, bundle_extmap_mid(bun),
-			      str_len(mid), (void *)mid);
+		if (bundled) {
+			const char *mid = stream_mid(strm);
+
+			rtpext_encode(qent->mb, bundle_extmap_mid(bun),
+				      str_len(mid), (void *)mid);
+		}
+
+		if (extmap_rid) {
+			rtpext_encode(qent->mb, extmap_rid,
+				      str_len(rid), (void *)rid);
+		}
 
 		ext_len = qent->mb->pos - pos;
 
@@ -271,12 +349,25 @@ static int vidqent_alloc(struct vidqent **qentp, struct stream *strm,
 }
 
 
+static void vtx_flush(struct vtx *vtx)
+{
+	mtx_lock(vtx->lock_tx);
+	for (unsigned i=0; i<vtx->layerc; i++) {
+		list_flush(&vtx->layerv[i].sendq);
+		list_flush(&vtx->layerv[i].sendqnb);
+	}
+	mtx_unlock(vtx->lock_tx);
+}
+
+
 static void video_destructor(void *arg)
 {
 	struct video *v = arg;
 	struct vtx *vtx = &v->vtx;
 	struct vrx *vrx = &v->vrx;
 
+	sfu_member_close(v->sfu);
+
 	stream_enable(v->strm, false);
 
 	/* transmit */
@@ -285,16 +376,16 @@ static void video_destructor(void *arg)
 		cnd_signal(&vtx->wait);
 		thrd_join(vtx->thrd, NULL);
 	}
-	mtx_lock(vtx->lock_tx);
-	list_flush(&vtx->sendq);
-	list_flush(&vtx->sendqnb);
-	mtx_unlock(vtx->lock_tx);
+	vtx_flush(vtx);
 	mem_deref(vtx->lock_tx);
 
 	mem_deref(vtx->vsrc);
 	mtx_lock(vtx->lock_enc);
 	mem_deref(vtx->frame);
-	mem_deref(vtx->enc);
+	for (unsigned i=0; i<vtx->layerc; i++) {
+		mem_deref(vtx->layerv[i].frame);
+		mem_deref(vtx->layerv[i].enc);
+	}
 	list_flush(&vtx->filtl);
 	mtx_unlock(vtx->lock_enc);
 	mem_deref(vtx->lock_enc);
@@ -335,30 +426,41 @@ static int packet_handler(bool marker, uint64_t ts,
 {
 	struct vtx *vtx = (struct vtx *)&vid->vtx;
 	struct stream *strm = vid->strm;
+	struct vtx_layer *l;
 	struct vidqent *qent;
+	char rid[sizeof(l->rid)];
+	uint8_t extmap_rid;
 	uint32_t rtp_ts;
 	int pt;
 	int err;
 
 	MAGIC_CHECK(vid);
 
+	/* the encoder runs under lock_enc, packets of the layer being
+	 * encoded, or of the full layer for packetized sources */
+	l = vtx->enc_layer ? vtx->enc_layer : &vtx->layerv[0];
+
 	mtx_lock(vtx->lock_tx);
-	if (!vtx->ts_base)
-		vtx->ts_base = ts;
-	vtx->ts_last = ts;
+	if (!l->idx) {
+		if (!vtx->ts_base)
+			vtx->ts_base = ts;
+		vtx->ts_last = ts;
+	}
 	pt = stream_pt_enc(strm);
+	extmap_rid = vtx->extmap_rid;
+	str_ncpy(rid, l->rid, sizeof(rid));
 	mtx_unlock(vtx->lock_tx);
 
 	/* add random timestamp offset */
 	rtp_ts = vtx->ts_offset + (ts & 0xffffffff);
 
 	err = vidqent_alloc(&qent, strm, marker, pt, rtp_ts,
-			    hdr, hdr_len, pld, pld_len);
+			    extmap_rid, rid, hdr, hdr_len, pld, pld_len);
 	if (err)
 		return err;
 
 	mtx_lock(vtx->lock_tx);
-	list_append(&vtx->sendq, &qent->le, qent);
+	list_append(&l->sendq, &qent->le, qent);
 	mtx_unlock(vtx->lock_tx);
 
 	cnd_signal(&vtx->wait);
@@ -367,9 +469,40 @@ static int packet_handler(bool marker, uint64_t ts,
 }
 
 
+/* scale a layer from the next higher layer, the size is halved */
+static int layer_scale(struct vtx_layer *l, const struct vidframe *src)
+{
+	struct vidsz sz;
+	int err;
+
+	sz.w = (src->size.w / 2) & ~1u;
+	sz.h = (src->size.h / 2) & ~1u;
+
+	if (!sz.w || !sz.h)
+		return EINVAL;
+
+	if (!l->frame || l->frame->fmt != src->fmt ||
+	    !vidsz_cmp(&l->frame->size, &sz)) {
+
+		l->frame = mem_deref(l->frame);
+
+		err = vidframe_alloc(&l->frame, src->fmt, &sz);
+		if (err)
+			return err;
+	}
+
+	vidconv(l->frame, src, NULL);
+
+	return 0;
+}
+
+
 /**
  * Encode video and send via RTP stream
  *
+ * The frame is converted and filtered once, each simulcast layer is
+ * scaled from the next higher layer and encoded by its own encoder.
+ *
  * @note This function has REAL-TIME properties
  *
  * @param vtx        Video transmit object
@@ -380,17 +513,22 @@ static void encode_rtp_send(struct vtx *vtx, struct vidframe *frame,
 			    struct vidpacket *packet, uint64_t timestamp)
 {
 	struct le *le;
+	unsigned ready = 0;
 	int err = 0;
-	bool sendq_empty;
 
-	if (!vtx->enc)
+	if (!vtx->layerv[0].enc)
+		return;
+
+	/* payload is forwarded by the media relay or SFU */
+	if (stream_is_relayed(vtx->video->strm) || re_atomic_acq(&vtx->fwd))
 		return;
 
 	if (packet) {
 		mtx_lock(vtx->lock_enc);
 
+		/* pre-encoded sources only feed the full layer */
 		if (vtx->vc && vtx->vc->packetizeh) {
-			err = vtx->vc->packetizeh(vtx->enc, packet);
+			err = vtx->vc->packetizeh(vtx->layerv[0].enc, packet);
 			if (err)
 				goto out;
 
@@ -403,16 +541,25 @@ static void encode_rtp_send(struct vtx *vtx, struct vidframe *frame,
 		goto out;
 	}
 
+	/* skip layers that have not sent the previous frame yet */
 	mtx_lock(vtx->lock_tx);
-	sendq_empty = (vtx->sendq.head == NULL);
+	for (unsigned i=0; i<vtx->layerc; i++) {
 
-	if (!sendq_empty) {
-		++vtx->skipc;
-		mtx_unlock(vtx->lock_tx);
-		return;
+		struct vtx_layer *l = &vtx->layerv[i];
+
+		if (!re_atomic_rlx(&l->active))
+			continue;
+
+		if (l->sendq.head)
+			++l->skipc;
+		else
+			ready |= 1u << i;
 	}
 	mtx_unlock(vtx->lock_tx);
 
+	if (!ready)
+		return;
+
 	mtx_lock(vtx->lock_enc);
 
 	/* Convert image */
@@ -448,10 +595,30 @@ static void encode_rtp_send(struct vtx *vtx, struct vidframe *frame,
 	if (frame)
 		vtx->fmt = frame->fmt;
 
-	/* Encode the whole picture frame */
-	err = vtx->vc->ench(vtx->enc, vtx->picup, frame, timestamp);
-	if (err)
-		goto out;
+	/* Encode the whole picture frame, once per layer */
+	for (unsigned i=0; i<vtx->layerc && (ready >> i); i++) {
+
+		struct vtx_layer *l = &vtx->layerv[i];
+
+		if (i) {
+			err = layer_scale(l, frame);
+			if (err)
+				goto out;
+
+			frame = l->frame;
+		}
+
+		if (!(ready & (1u << i)) || !l->enc)
+			continue;
+
+		vtx->enc_layer = l;
+		err = vtx->vc->ench(l->enc, vtx->picup, frame, timestamp);
+		vtx->enc_layer = NULL;
+		if (err)
+			goto out;
+
+		++l->frames;
+	}
 
 	vtx->picup = false;
 
@@ -509,12 +676,31 @@ static void vidsrc_error_handler(int err, void *arg)
 }
 
 
+/* the layer with the earliest send time among layers with packets */
+static struct vtx_layer *next_layer(struct vtx *vtx)
+{
+	struct vtx_layer *next = NULL;
+
+	for (unsigned i=0; i<vtx->layerc; i++) {
+
+		struct vtx_layer *l = &vtx->layerv[i];
+
+		if (!l->sendq.head)
+			continue;
+
+		if (!next || l->target_jfs < next->target_jfs)
+			next = l;
+	}
+
+	return next;
+}
+
+
 static int vtx_thread(void *arg)
 {
 	struct vtx *vtx = arg;
+	struct stream *strm = vtx->video->strm;
 	uint64_t jfs;
-	uint64_t start_jfs  = tmr_jiffies_usec();
-	uint64_t target_jfs = tmr_jiffies_usec();
 	uint32_t bitrate;
 
 	if (vtx->video->cfg.send_bitrate)
@@ -522,62 +708,91 @@ static int vtx_thread(void *arg)
 	else
 		bitrate = vtx->video->cfg.bitrate;
 
-	const uint64_t max_delay = PKT_SIZE * 8 * 1000000LL / bitrate + 1;
-	const uint64_t max_burst =
-		vtx->video->cfg.burst_bits * 1000000LL / bitrate;
+	/* every layer is paced at its share of the send bitrate */
+	for (unsigned i=0; i<vtx->layerc; i++) {
+
+		struct vtx_layer *l = &vtx->layerv[i];
 
+		l->rate       = layer_bitrate(bitrate, i, vtx->layerc);
+		l->start_jfs  = tmr_jiffies_usec();
+		l->target_jfs = l->start_jfs;
+		l->sent       = 0;
+	}
+
+	struct vtx_layer *l;
 	struct vidqent *qent = NULL;
 	struct mbuf *mbd;
-	size_t sent = 0;
 
 	while (re_atomic_rlx(&vtx->run)) {
 		mtx_lock(vtx->lock_tx);
-		if (!vtx->sendq.head) {
+		l = next_layer(vtx);
+		if (!l) {
+			mtx_unlock(vtx->lock_tx);
+			stream_send_flush(strm);
+			mtx_lock(vtx->lock_tx);
+			if (next_layer(vtx)) {
+				mtx_unlock(vtx->lock_tx);
+				continue;
+			}
 			cnd_wait(&vtx->wait, vtx->lock_tx);
 			qent = NULL;
 			mtx_unlock(vtx->lock_tx);
 			continue;
 		}
-		qent = vtx->sendq.head->data;
+		qent = l->sendq.head->data;
 		mtx_unlock(vtx->lock_tx);
 
+		const uint64_t max_delay =
+			PKT_SIZE * 8 * 1000000LL / l->rate + 1;
+		const uint64_t max_burst =
+			vtx->video->cfg.burst_bits * 1000000LL / l->rate;
+
 		jfs = tmr_jiffies_usec();
 
-		if (jfs < target_jfs) {
-			uint64_t delay = target_jfs - jfs;
+		if (jfs < l->target_jfs) {
+			uint64_t delay = l->target_jfs - jfs;
 			if (delay > max_delay) {
-				delay	  = max_delay;
-				start_jfs = jfs + delay;
-				sent	  = 0;
+				delay	     = max_delay;
+				l->start_jfs = jfs + delay;
+				l->sent	     = 0;
 			}
+			stream_send_flush(strm);
 			sys_usleep((unsigned int)delay);
 		}
 		else {
-			if (jfs - max_burst > target_jfs) {
-				start_jfs = jfs - max_burst;
-				sent	  = 0;
+			if (jfs - max_burst > l->target_jfs) {
+				l->start_jfs = jfs - max_burst;
+				l->sent	     = 0;
 			}
 		}
 
-		sent += mbuf_get_left(qent->mb) * 8;
-		target_jfs = start_jfs + sent * 1000000 / bitrate;
+		l->sent += mbuf_get_left(qent->mb) * 8;
+		l->target_jfs = l->start_jfs + l->sent * 1000000 / l->rate;
 
-		mbd = mbuf_dup(qent->mb);
+		mbd = mempool_mbuf_dup(qent->mb);
 
-		stream_send(vtx->video->strm, qent->ext, qent->marker,
-			    qent->pt, qent->ts, qent->mb);
+		if (l->idx) {
+			qent->seq = l->seq++;
+			stream_send_ssrc(strm, l->ssrc, qent->seq, qent->ext,
+					 qent->marker, qent->pt, qent->ts,
+					 qent->mb);
+		}
+		else {
+			stream_send(strm, qent->ext, qent->marker,
+				    qent->pt, qent->ts, qent->mb);
+			qent->seq = rtp_sess_seq(stream_rtp_sock(strm));
+		}
 
 		mem_deref(qent->mb);
 
 		qent->jfs_nack = jfs + NACK_QUEUE_TIME * 1000;
-		qent->seq = rtp_sess_seq(stream_rtp_sock(vtx->video->strm));
 		qent->mb  = mbd;
 
 		mtx_lock(vtx->lock_tx);
-		list_move(&qent->le, &vtx->sendqnb);
+		list_move(&qent->le, &l->sendqnb);
 
 		/* Delayed NACK queue cleanup */
-		struct le *le = vtx->sendqnb.head;
+		struct le *le = l->sendqnb.head;
 		while (le) {
 			qent = le->data;
 
@@ -616,6 +831,24 @@ static int vtx_alloc(struct vtx *vtx, struct video *video)
 	/* The initial value of the timestamp SHOULD be random */
 	vtx->ts_offset = rand_u16();
 
+	vtx->layerc = min(max(video->cfg.simulcast, 1u),
+			  (unsigned)SIMCAST_MAX);
+
+	for (unsigned i=0; i<vtx->layerc; i++) {
+
+		struct vtx_layer *l = &vtx->layerv[i];
+
+		l->idx = i;
+		str_ncpy(l->rid, simcast_ridv[i], sizeof(l->rid));
+		l->neg = (i == 0);
+		re_atomic_rlx_set(&l->active, l->neg);
+
+		if (i) {
+			l->ssrc = rand_u32();
+			l->seq  = rand_u16();
+		}
+	}
+
 	str_ncpy(vtx->device, video->cfg.src_dev, sizeof(vtx->device));
 
 	vtx->fmt = (enum vidfmt)-1;
@@ -811,7 +1044,7 @@ static int video_stream_decode(struct vrx *vrx, const struct rtp_header *hdr,
 
 	if (!list_isempty(&vrx->filtl)) {
 
-		err = vidframe_alloc(&frame_filt, frame->fmt, &frame->size);
+		err = mempool_vidframe(&frame_filt, frame->fmt, &frame->size);
 		if (err)
 			goto out;
 
@@ -883,13 +1116,12 @@ static int stream_pt_handler(uint8_t pt, struct mbuf *mb, void *arg)
 
 /* Handle incoming stream data from the network */
 static void stream_recv_handler(const struct rtp_header *hdr,
-				struct rtpext *extv, size_t extc,
+				const struct rtpext_tbl *ext,
 				struct mbuf *mb, unsigned lostc, bool *ignore,
 				void *arg)
 {
 	struct video *v = arg;
-	(void)extv;
-	(void)extc;
+	(void)ext;
 	(void)ignore;
 
 	MAGIC_CHECK(v);
@@ -902,8 +1134,22 @@ static void stream_recv_handler(const struct rtp_header *hdr,
 }
 
 
+/* the layer sent with the given SSRC, the full layer by default */
+static struct vtx_layer *layer_find(struct vtx *vtx, uint32_t ssrc)
+{
+	for (unsigned i=1; i<vtx->layerc; i++) {
+
+		if (vtx->layerv[i].ssrc == ssrc)
+			return &vtx->layerv[i];
+	}
+
+	return &vtx->layerv[0];
+}
+
+
 static void rtcp_nack_handler(struct vtx *vtx, struct rtcp_msg *msg)
 {
+	struct vtx_layer *l;
 	uint16_t nack_pid;
 	uint16_t nack_blp;
 	uint16_t pids[NACK_BLPSZ + 1];
@@ -913,6 +1159,8 @@ static void rtcp_nack_handler(struct vtx *vtx, struct rtcp_msg *msg)
 	    !msg->r.fb.fci.gnackv)
 		return;
 
+	l = layer_find(vtx, msg->r.fb.ssrc_media);
+
 	nack_pid = msg->r.fb.fci.gnackv->pid;
 	nack_blp = msg->r.fb.fci.gnackv->blp;
 	pids[0]	 = nack_pid;
@@ -926,7 +1174,7 @@ static void rtcp_nack_handler(struct vtx *vtx, struct rtcp_msg *msg)
 	}
 
 	mtx_lock(vtx->lock_tx);
-	LIST_FOREACH(&vtx->sendqnb, le) {
+	LIST_FOREACH(&l->sendqnb, le) {
 		struct vidqent *qent = le->data;
 
 		if (qent->seq == nack_pid)
@@ -941,8 +1189,16 @@ static void rtcp_nack_handler(struct vtx *vtx, struct rtcp_msg *msg)
 			continue;
 
 		debug("NACK resend rtp seq: %u\n", pids[i]);
-		stream_resend(vtx->video->strm, qent->seq, qent->ext,
-			      qent->marker, qent->pt, qent->ts, qent->mb);
+		if (l->idx) {
+			stream_send_ssrc(vtx->video->strm, l->ssrc, qent->seq,
+					 qent->ext, qent->marker, qent->pt,
+					 qent->ts, qent->mb);
+		}
+		else {
+			stream_resend(vtx->video->strm, qent->seq, qent->ext,
+				      qent->marker, qent->pt, qent->ts,
+				      qent->mb);
+		}
 
 		/* sent only once */
 		mem_deref(qent);
@@ -952,6 +1208,23 @@ static void rtcp_nack_handler(struct vtx *vtx, struct rtcp_msg *msg)
 }
 
 
+/*
+ * The encoder output of a relayed stream is discarded, so a picture
+ * update request goes to the source of the relayed RTP instead
+ */
+static bool relay_picup(struct video *v, bool pli)
+{
+	struct stream *peer = stream_relay_peer(v->strm);
+
+	if (!peer)
+		return false;
+
+	send_fir(peer, pli);
+
+	return true;
+}
+
+
 static void rtcp_handler(struct stream *strm, struct rtcp_msg *msg, void *arg)
 {
 	struct video *v = arg;
@@ -963,6 +1236,14 @@ static void rtcp_handler(struct stream *strm, struct rtcp_msg *msg, void *arg)
 	switch (msg->hdr.pt) {
 
 	case RTCP_FIR:
+		if (v->sfu) {
+			sfu_picup(v->sfu);
+			break;
+		}
+
+		if (relay_picup(v, false))
+			break;
+
 		mtx_lock(vtx->lock_enc);
 		vtx->picup = true;
 		mtx_unlock(vtx->lock_enc);
@@ -971,6 +1252,15 @@ static void rtcp_handler(struct stream *strm, struct rtcp_msg *msg, void *arg)
 	case RTCP_PSFB:
 		if (msg->hdr.count == RTCP_PSFB_PLI) {
 			debug("video: recv Picture Loss Indication (PLI)\n");
+
+			if (v->sfu) {
+				sfu_picup(v->sfu);
+				break;
+			}
+
+			if (relay_picup(v, true))
+				break;
+
 			mtx_lock(vtx->lock_enc);
 			vtx->picup = true;
 			mtx_unlock(vtx->lock_enc);
@@ -1043,6 +1333,247 @@ static int vrx_print_pipeline(struct re_printf *pf, const struct vrx *vrx)
 }
 
 
+static int print_rids(struct re_printf *pf, const struct vtx *vtx)
+{
+	int err = 0;
+
+	for (unsigned i=0; i<vtx->layerc; i++) {
+		err |= re_hprintf(pf, "%s%s", i ? ";" : "",
+				  vtx->layerv[i].rid);
+	}
+
+	return err;
+}
+
+
+static int print_ssrcs(struct re_printf *pf, const struct video *v)
+{
+	int err;
+
+	err = re_hprintf(pf, "%u", rtp_sess_ssrc(stream_rtp_sock(v->strm)));
+
+	for (unsigned i=1; i<v->vtx.layerc; i++)
+		err |= re_hprintf(pf, " %u", v->vtx.layerv[i].ssrc);
+
+	return err;
+}
+
+
+/* RFC 8851, RFC 8852, RFC 8853 and RFC 5576 */
+static int simulcast_lattr_add(struct video *v)
+{
+	struct sdp_media *m = stream_sdpmedia(v->strm);
+	struct vtx *vtx = &v->vtx;
+	uint8_t id;
+	int err = 0;
+
+	mtx_lock(vtx->lock_tx);
+	if (!vtx->extmap_rid)
+		vtx->extmap_rid = stream_generate_extmap_id(v->strm);
+	id = vtx->extmap_rid;
+	mtx_unlock(vtx->lock_tx);
+
+	if (id) {
+		err |= sdp_media_set_lattr(m, true, "extmap", "%u %s",
+					   id, uri_rid);
+	}
+
+	for (unsigned i=0; i<vtx->layerc; i++) {
+		err |= sdp_media_set_lattr(m, false, "rid", "%s send",
+					   vtx->layerv[i].rid);
+	}
+
+	err |= sdp_media_set_lattr(m, true, "simulcast", "send %H",
+				   print_rids, vtx);
+
+	for (unsigned i=1; i<vtx->layerc; i++) {
+		err |= sdp_media_set_lattr(m, false, "ssrc", "%u cname:%s",
+					   vtx->layerv[i].ssrc,
+					   stream_cname(v->strm));
+	}
+
+	err |= sdp_media_set_lattr(m, true, "ssrc-group", "SIM %H",
+				   print_ssrcs, v);
+
+	v->simcast_lattr = true;
+
+	return err;
+}
+
+
+/* update the active layers, a resumed layer starts with a keyframe */
+static void simulcast_apply(struct vtx *vtx)
+{
+	bool picup = false;
+
+	for (unsigned i=0; i<vtx->layerc; i++) {
+
+		struct vtx_layer *l = &vtx->layerv[i];
+		bool active = l->neg && !l->paused;
+
+		if (active == re_atomic_rlx(&l->active))
+			continue;
+
+		info("video: simulcast layer %s %s\n", l->rid,
+		     active ? "active" : "paused");
+
+		re_atomic_rlx_set(&l->active, active);
+		picup |= active;
+	}
+
+	if (picup) {
+		mtx_lock(vtx->lock_enc);
+		vtx->picup = true;
+		mtx_unlock(vtx->lock_enc);
+	}
+}
+
+
+static struct vtx_layer *layer_find_rid(struct vtx *vtx,
+					const struct pl *rid)
+{
+	for (unsigned i=0; i<vtx->layerc; i++) {
+
+		if (0 == pl_strcmp(rid, vtx->layerv[i].rid))
+			return &vtx->layerv[i];
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Select the layer for one ';' separated entry of the peer's list, the
+ * first alternative that we send. Alternatives are separated by commas
+ * and paused ones start with a tilde.
+ */
+static struct vtx_layer *layer_select(struct video *v, struct pl *alts,
+				      unsigned n)
+{
+	struct vtx *vtx = &v->vtx;
+
+	while (alts->l) {
+
+		struct vtx_layer *l;
+		struct pl rid, sep;
+		bool paused;
+
+		if (re_regex(alts->p, alts->l, "[^,]+[,]*", &rid, &sep))
+			break;
+
+		pl_advance(alts, sep.p + sep.l - alts->p);
+
+		paused = rid.p[0] == '~';
+		if (paused)
+			pl_advance(&rid, 1);
+
+		/* answering, the offerer chose the identifiers */
+		if (!v->simcast_lattr) {
+
+			if (n >= vtx->layerc)
+				return NULL;
+
+			mtx_lock(vtx->lock_tx);
+			pl_strcpy(&rid, vtx->layerv[n].rid,
+				  sizeof(vtx->layerv[n].rid));
+			mtx_unlock(vtx->lock_tx);
+		}
+
+		l = layer_find_rid(vtx, &rid);
+		if (l) {
+			l->neg    = true;
+			l->paused = paused;
+			return l;
+		}
+
+		if (!v->simcast_lattr)
+			return NULL;
+	}
+
+	return NULL;
+}
+
+
+/* the peer's RID extension ID, in its offer or answer */
+static bool extmap_rid_handler(const char *name, const char *value,
+			       void *arg)
+{
+	struct vtx *vtx = arg;
+	struct sdp_extmap extmap;
+	(void)name;
+
+	if (sdp_extmap_decode(&extmap, value))
+		return false;
+
+	if (pl_strcasecmp(&extmap.name, uri_rid))
+		return false;
+
+	if (extmap.id < RTPEXT_ID_MIN || extmap.id > RTPEXT_ID_MAX) {
+		warning("video: extmap id out of range (%u)\n", extmap.id);
+		return false;
+	}
+
+	mtx_lock(vtx->lock_tx);
+	vtx->extmap_rid = extmap.id;
+	mtx_unlock(vtx->lock_tx);
+
+	return true;
+}
+
+
+/*
+ * The peer lists the layers it receives, in the answer to our offer or
+ * in its own offer, e.g. "recv f;~h;q". Each ';' separated entry is one
+ * layer. Without the attribute, only the full layer is sent.
+ */
+static void simulcast_decode(struct video *v)
+{
+	struct sdp_media *m = stream_sdpmedia(v->strm);
+	struct vtx *vtx = &v->vtx;
+	const char *attr;
+	struct pl pl;
+	unsigned n = 0;
+
+	if (vtx->layerc < 2)
+		return;
+
+	attr = sdp_media_rattr(m, "simulcast");
+	if (!attr || re_regex(attr, str_len(attr), "recv[ ]+[^ ]+",
+			      NULL, &pl))
+		pl_set_str(&pl, "");
+
+	for (unsigned i=1; i<vtx->layerc; i++)
+		vtx->layerv[i].neg = false;
+
+	while (pl.l) {
+
+		struct pl alts, sep;
+
+		if (re_regex(pl.p, pl.l, "[^;]+[;]*", &alts, &sep))
+			break;
+
+		pl_advance(&pl, sep.p + sep.l - pl.p);
+
+		(void)layer_select(v, &alts, n);
+
+		++n;
+	}
+
+	if (n)
+		(void)sdp_media_rattr_apply(m, "extmap",
+					    extmap_rid_handler, vtx);
+
+	if (n && !v->simcast_lattr) {
+
+		int err = simulcast_lattr_add(v);
+		if (err)
+			warning("video: simulcast attributes: %m\n", err);
+	}
+
+	simulcast_apply(vtx);
+}
+
+
 /**
  * Allocate a video stream
  *
@@ -1135,6 +1666,9 @@ int video_alloc(struct video **vp, struct list *streaml,
 					   "content", "%s", content);
 	}
 
+	if (offerer && v->vtx.layerc > 1)
+		err |= simulcast_lattr_add(v);
+
 	if (err)
 		goto out;
 
@@ -1310,6 +1844,9 @@ int video_update(struct video *v, const char *peer)
 	if (err)
 		warning("video: video stream error: %m\n", err);
 
+	/* payload types may have changed */
+	sfu_member_update(v->sfu);
+
 	return err;
 }
 
@@ -1456,10 +1993,7 @@ static void video_stop_source(struct video *v)
 		thrd_join(v->vtx.thrd, NULL);
 	}
 
-	mtx_lock(v->vtx.lock_tx);
-	list_flush(&v->vtx.sendq);
-	list_flush(&v->vtx.sendqnb);
-	mtx_unlock(v->vtx.lock_tx);
+	vtx_flush(&v->vtx);
 }
 
 
@@ -1573,12 +2107,21 @@ int video_encoder_set(struct video *v, struct vidcodec *vc,
 		info("Set video encoder: %s %s (%u bit/s, %.2f fps)\n",
 		     vc->name, vc->variant, prm.bitrate, prm.fps);
 
-		vtx->enc = mem_deref(vtx->enc);
-		err = vc->encupdh(&vtx->enc, vc, &prm, params,
-				  packet_handler, v);
-		if (err) {
-			warning("video: encoder alloc: %m\n", err);
-			goto out;
+		for (unsigned i=0; i<vtx->layerc; i++) {
+
+			struct vtx_layer *l = &vtx->layerv[i];
+
+			l->bitrate  = layer_bitrate(v->cfg.bitrate, i,
+						    vtx->layerc);
+			prm.bitrate = l->bitrate;
+
+			l->enc = mem_deref(l->enc);
+			err = vc->encupdh(&l->enc, vc, &prm, params,
+					  packet_handler, v);
+			if (err) {
+				warning("video: encoder alloc: %m\n", err);
+				goto out;
+			}
 		}
 
 		vtx->vc = vc;
@@ -1689,6 +2232,40 @@ void video_sdp_attr_decode(struct video *v)
 	if (sdp_media_rattr_apply(stream_sdpmedia(v->strm), "rtcp-fb",
 				  nack_handler, 0))
 		v->nack_pli = true;
+
+	/* RFC 8853 */
+	simulcast_decode(v);
+}
+
+
+/**
+ * Pause or resume sending a simulcast layer, e.g. when no receiver
+ * of the layer is left
+ *
+ * @param v     Video object
+ * @param rid   RTP stream identifier of the layer
+ * @param pause True to pause, false to resume
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int video_simulcast_pause(struct video *v, const char *rid, bool pause)
+{
+	struct vtx_layer *l;
+	struct pl pl;
+
+	if (!v || !str_isset(rid))
+		return EINVAL;
+
+	pl_set_str(&pl, rid);
+
+	l = layer_find_rid(&v->vtx, &pl);
+	if (!l)
+		return ENOENT;
+
+	l->paused = pause;
+	simulcast_apply(&v->vtx);
+
+	return 0;
 }
 
 
@@ -1710,8 +2287,18 @@ static int vtx_debug(struct re_printf *pf, const struct vtx *vtx)
 	mtx_unlock(vtx->lock_enc);
 
 	mtx_lock(vtx->lock_tx);
-	err |= re_hprintf(pf, "     skipc=%u sendq=%u\n",
-			  vtx->skipc, list_count(&vtx->sendq));
+	for (unsigned i=0; i<vtx->layerc; i++) {
+
+		const struct vtx_layer *l = &vtx->layerv[i];
+
+		err |= re_hprintf(pf, "     layer %s: %s %u bit/s"
+				  " frames=%llu skipc=%u sendq=%u\n",
+				  l->rid,
+				  re_atomic_rlx(&l->active) ? "active" :
+				  l->neg ? "paused" : "off",
+				  l->bitrate, l->frames, l->skipc,
+				  list_count(&l->sendq));
+	}
 
 	if (vtx->ts_base) {
 		err |= re_hprintf(pf, "     time = %.3f sec\n",
@@ -1922,3 +2509,81 @@ void video_req_keyframe(struct video *vid)
 	vid->vtx.picup = true;
 	mtx_unlock(vid->vtx.lock_enc);
 }
+
+
+/**
+ * Queue a forwarded RTP payload for sending, the packet is paced by the
+ * transmit thread and kept for NACK like encoded packets
+ *
+ * @param v      Video object
+ * @param marker Marker bit
+ * @param pt     Payload type
+ * @param ts     RTP timestamp
+ * @param mb     RTP payload
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int video_forward(struct video *v, bool marker, uint8_t pt, uint32_t ts,
+		  struct mbuf *mb)
+{
+	struct vtx *vtx;
+	struct vidqent *qent;
+	int err;
+
+	if (!v || !mb)
+		return EINVAL;
+
+	vtx = &v->vtx;
+
+	if (!re_atomic_rlx(&vtx->run))
+		return ENOTCONN;
+
+	err = vidqent_alloc(&qent, v->strm, marker, pt, ts, 0, NULL,
+			    NULL, 0, mbuf_buf(mb), mbuf_get_left(mb));
+	if (err)
+		return err;
+
+	mtx_lock(vtx->lock_tx);
+	list_append(&vtx->layerv[0].sendq, &qent->le, qent);
+	mtx_unlock(vtx->lock_tx);
+
+	cnd_signal(&vtx->wait);
+
+	return 0;
+}
+
+
+/**
+ * Request a new picture from the peer, at most once per FIR/PLI interval
+ *
+ * @param v Video object
+ */
+void video_request_picup(struct video *v)
+{
+	if (!v)
+		return;
+
+	request_picture_update(&v->vrx);
+}
+
+
+/**
+ * Set the SFU membership of a video stream. While set, the local encoder
+ * output is discarded and picture update requests from the peer are
+ * passed to the SFU.
+ *
+ * @param v Video object
+ * @param m SFU member, NULL to leave the SFU
+ */
+void video_set_sfu(struct video *v, struct sfu_member *m)
+{
+	if (!v)
+		return;
+
+	v->sfu = m;
+	re_atomic_rls_set(&v->vtx.fwd, m != NULL);
+
+	/* the local encoder takes over again */
+	if (!m)
+		video_req_keyframe(v);
+}
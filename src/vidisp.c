@@ -61,6 +61,8 @@ const struct vidisp *vidisp_find(const struct list *vidispl, const char *name)
 {
 	struct le *le;
 
+	module_lazy_load("vidisp");
+
 	for (le = list_head(vidispl); le; le = le->next) {
 		struct vidisp *vd = le->data;
 
@@ -68,6 +68,8 @@ const struct vidsrc *vidsrc_find(const struct list *vidsrcl, const char *name)
 {
 	struct le *le;
 
+	module_lazy_load("vidsrc");
+
 	for (le=list_head(vidsrcl); le; le=le->next) {
 
 		struct vidsrc *vs = le->data;
@@ -0,0 +1,471 @@
+/**
+ * @file wavmap.c  Memory-mapped WAV files, shared by all players
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The data chunk of a WAV file is mapped read-only into memory and
+ * samples are converted to native-endian S16 on demand, one window at a
+ * time. Opening a file only parses the RIFF header, so playback starts in
+ * constant time regardless of the file length.
+ *
+ * Open mappings are kept in a list keyed by path and file identity
+ * (device, inode, size and modification time), and concurrent players of
+ * the same file share one reference-counted mapping. A file that was
+ * replaced or rewritten is mapped again, players of the old mapping keep
+ * it until they are done. A file that is played should be replaced by
+ * renaming a new file over it, not truncated in place.
+ *
+ * Mappings must be opened and released from the main thread, reading
+ * samples is safe from any thread.
+ */
+
+
+enum {
+	WAVE_FMT_PCM        = 0x0001,
+	WAVE_FMT_ALAW       = 0x0006,
+	WAVE_FMT_ULAW       = 0x0007,
+	WAVE_FMT_EXTENSIBLE = 0xfffe,
+	RIFF_HDR_SIZE       = 12,
+	CHUNK_HDR_SIZE      = 8,
+	FMT_MIN_SIZE        = 16,
+	FMT_EXT_SIZE        = 26,
+};
+
+
+/** File identity, to detect a replaced or rewritten file */
+struct fileid {
+	uint64_t dev;
+	uint64_t ino;
+	int64_t size;
+	int64_t mtime;
+};
+
+
+/** Memory-mapped WAV file */
+struct wavmap {
+	struct le le;
+	char *path;
+	struct fileid id;        /**< Identity of the mapped file        */
+	uint8_t *map;            /**< Mapped or loaded file              */
+	size_t mapsz;            /**< Size of mapping in bytes           */
+	bool mapped;             /**< True if mmap'ed, false if loaded   */
+	const uint8_t *data;     /**< Start of data chunk                */
+	size_t sampc;            /**< Samples in data chunk (all ch)     */
+	enum aufmt fmt;          /**< File sample format                 */
+	uint32_t srate;
+	uint8_t ch;
+};
+
+
+static struct list wavmapl;
+
+
+static void destructor(void *arg)
+{
+	struct wavmap *wm = arg;
+
+	list_unlink(&wm->le);
+
+#ifdef HAVE_MMAP
+	if (wm->mapped)
+		(void)munmap(wm->map, wm->mapsz);
+	else
+#endif
+		mem_deref(wm->map);
+
+	mem_deref(wm->path);
+}
+
+
+static inline uint16_t get_u16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | p[1] << 8);
+}
+
+
+static inline uint32_t get_u32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+		(uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+
+static int decode_fmt(struct wavmap *wm, const uint8_t *p, size_t len)
+{
+	uint16_t tag, bits;
+
+	if (len < FMT_MIN_SIZE)
+		return EBADMSG;
+
+	tag       = get_u16(p);
+	wm->ch    = (uint8_t)get_u16(p + 2);
+	wm->srate = get_u32(p + 4);
+	bits      = get_u16(p + 14);
+
+	/* the sub-format GUID starts with the format tag */
+	if (tag == WAVE_FMT_EXTENSIBLE) {
+		if (len < FMT_EXT_SIZE)
+			return EBADMSG;
+
+		tag = get_u16(p + 24);
+	}
+
+	switch (tag) {
+
+	case WAVE_FMT_PCM:
+		if (bits != 16)
+			return ENOTSUP;
+		wm->fmt = AUFMT_S16LE;
+		break;
+
+	case WAVE_FMT_ALAW:
+		wm->fmt = AUFMT_PCMA;
+		break;
+
+	case WAVE_FMT_ULAW:
+		wm->fmt = AUFMT_PCMU;
+		break;
+
+	default:
+		return ENOTSUP;
+	}
+
+	if (!wm->ch || !wm->srate)
+		return EBADMSG;
+
+	return 0;
+}
+
+
+static int decode_riff(struct wavmap *wm)
+{
+	const uint8_t *p   = wm->map;
+	const uint8_t *end = wm->map + wm->mapsz;
+	bool fmt = false;
+	int err;
+
+	if (wm->mapsz < RIFF_HDR_SIZE ||
+	    memcmp(p, "RIFF", 4) || memcmp(p + 8, "WAVE", 4))
+		return EBADMSG;
+
+	p += RIFF_HDR_SIZE;
+
+	while ((size_t)(end - p) >= CHUNK_HDR_SIZE) {
+
+		size_t len  = get_u32(p + 4);
+		size_t left = end - p - CHUNK_HDR_SIZE;
+
+		if (!memcmp(p, "fmt ", 4)) {
+			if (len > left)
+				return EBADMSG;
+
+			err = decode_fmt(wm, p + CHUNK_HDR_SIZE, len);
+			if (err)
+				return err;
+
+			fmt = true;
+		}
+		else if (!memcmp(p, "data", 4)) {
+			if (!fmt)
+				return EBADMSG;
+
+			/* files still being written may have a bogus size */
+			if (len > left)
+				len = left;
+
+			wm->data  = p + CHUNK_HDR_SIZE;
+			wm->sampc = len / aufmt_sample_size(wm->fmt);
+
+			return 0;
+		}
+
+		if (len > left)
+			break;
+
+		p += CHUNK_HDR_SIZE + len + (len & 1);
+	}
+
+	return EBADMSG;
+}
+
+
+static void fileid_set(struct fileid *id, const struct stat *st)
+{
+	id->dev   = (uint64_t)st->st_dev;
+	id->ino   = (uint64_t)st->st_ino;
+	id->size  = (int64_t)st->st_size;
+	id->mtime = (int64_t)st->st_mtime;
+}
+
+
+#ifdef HAVE_MMAP
+static int map_file(struct wavmap *wm)
+{
+	struct stat st;
+	void *p;
+	int fd, err = 0;
+
+	fd = open(wm->path, O_RDONLY);
+	if (fd < 0)
+		return errno;
+
+	if (fstat(fd, &st) < 0) {
+		err = errno;
+		goto out;
+	}
+
+	if (st.st_size <= 0) {
+		err = EBADMSG;
+		goto out;
+	}
+
+	p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		err = errno;
+		goto out;
+	}
+
+	wm->map    = p;
+	wm->mapsz  = (size_t)st.st_size;
+	wm->mapped = true;
+	fileid_set(&wm->id, &st);
+
+	/* playback reads the mapping front to back */
+	(void)madvise(p, wm->mapsz, MADV_SEQUENTIAL);
+
+ out:
+	(void)close(fd);
+
+	return err;
+}
+#else
+static int map_file(struct wavmap *wm)
+{
+	struct stat st;
+	FILE *f;
+	long sz;
+	int err = 0;
+
+	if (stat(wm->path, &st) < 0)
+		return errno;
+
+	fileid_set(&wm->id, &st);
+
+	f = fopen(wm->path, "rb");
+	if (!f)
+		return errno;
+
+	if (fseek(f, 0, SEEK_END) || (sz = ftell(f)) <= 0 ||
+	    fseek(f, 0, SEEK_SET)) {
+		err = EBADMSG;
+		goto out;
+	}
+
+	wm->map = mem_alloc((size_t)sz, NULL);
+	if (!wm->map) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	wm->mapsz = (size_t)sz;
+
+	if (fread(wm->map, 1, wm->mapsz, f) != wm->mapsz)
+		err = EIO;
+
+ out:
+	(void)fclose(f);
+
+	return err;
+}
+#endif
+
+
+static bool path_cmp_handler(struct le *le, void *arg)
+{
+	const struct wavmap *wm = le->data;
+
+	return 0 == str_cmp(wm->path, arg);
+}
+
+
+static bool fileid_cmp(const struct fileid *a, const struct fileid *b)
+{
+	return a->dev == b->dev && a->ino == b->ino &&
+		a->size == b->size && a->mtime == b->mtime;
+}
+
+
+/**
+ * Open a WAV file for streaming playback
+ *
+ * If the file is already open and unchanged, the existing mapping is
+ * referenced.
+ * Supported sample formats are 16-bit PCM, A-law and u-law.
+ *
+ * @param wmp  Pointer to allocated WAV mapping
+ * @param path Path to WAV file
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int wavmap_open(struct wavmap **wmp, const char *path)
+{
+	struct wavmap *wm;
+	struct fileid id;
+	struct stat st;
+	struct le *le;
+	int err;
+
+	if (!wmp || !str_isset(path))
+		return EINVAL;
+
+	if (stat(path, &st) < 0)
+		return errno;
+
+	fileid_set(&id, &st);
+
+	le = list_apply(&wavmapl, true, path_cmp_handler, (void *)path);
+	if (le) {
+		wm = le->data;
+
+		if (fileid_cmp(&wm->id, &id)) {
+			*wmp = mem_ref(wm);
+			return 0;
+		}
+
+		/* the file changed, current players keep the old mapping */
+		list_unlink(&wm->le);
+	}
+
+	wm = mem_zalloc(sizeof(*wm), destructor);
+	if (!wm)
+		return ENOMEM;
+
+	err = str_dup(&wm->path, path);
+	if (err)
+		goto out;
+
+	err = map_file(wm);
+	if (err)
+		goto out;
+
+	err = decode_riff(wm);
+	if (err)
+		goto out;
+
+	list_append(&wavmapl, &wm->le, wm);
+
+ out:
+	if (err)
+		mem_deref(wm);
+	else
+		*wmp = wm;
+
+	return err;
+}
+
+
+/**
+ * Read and convert a window of samples to native-endian S16
+ *
+ * @param wm    WAV mapping
+ * @param pos   Position of first sample, counted over all channels
+ * @param sampv Buffer for converted samples
+ * @param sampc Maximum number of samples to read
+ *
+ * @return Number of samples read, 0 at end of file
+ */
+size_t wavmap_read(const struct wavmap *wm, size_t pos,
+		   int16_t *sampv, size_t sampc)
+{
+	const uint8_t *p;
+	size_t i;
+
+	if (!wm || !sampv || pos >= wm->sampc)
+		return 0;
+
+	if (sampc > wm->sampc - pos)
+		sampc = wm->sampc - pos;
+
+	p = wm->data + pos * aufmt_sample_size(wm->fmt);
+
+	switch (wm->fmt) {
+
+	case AUFMT_S16LE:
+		for (i=0; i<sampc; i++, p+=2)
+			sampv[i] = (int16_t)get_u16(p);
+		break;
+
+	case AUFMT_PCMA:
+		for (i=0; i<sampc; i++)
+			sampv[i] = g711_alaw2pcm(p[i]);
+		break;
+
+	case AUFMT_PCMU:
+		for (i=0; i<sampc; i++)
+			sampv[i] = g711_ulaw2pcm(p[i]);
+		break;
+
+	default:
+		return 0;
+	}
+
+	return sampc;
+}
+
+
+/**
+ * Get the number of samples in a WAV mapping, counted over all channels
+ *
+ * @param wm WAV mapping
+ *
+ * @return Number of samples
+ */
+size_t wavmap_sampc(const struct wavmap *wm)
+{
+	return wm ? wm->sampc : 0;
+}
+
+
+uint32_t wavmap_srate(const struct wavmap *wm)
+{
+	return wm ? wm->srate : 0;
+}
+
+
+uint8_t wavmap_channels(const struct wavmap *wm)
+{
+	return wm ? wm->ch : 0;
+}
+
+
+/**
+ * Get the duration of a WAV mapping
+ *
+ * @param wm WAV mapping
+ *
+ * @return Duration in [ms]
+ */
+uint64_t wavmap_duration(const struct wavmap *wm)
+{
+	if (!wm || !wm->srate || !wm->ch)
+		return 0;
+
+	return (uint64_t)wm->sampc * 1000 / (wm->srate * wm->ch);
+}
@@ -0,0 +1,126 @@
+/**
+ * @file test/auresamp.c  Baresip selftest -- resampler throughput
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "test.h"
+
+
+enum {
+	PTIME      = 20,
+	NUM_FRAMES = 500,
+};
+
+
+static const struct aufilt *aufilt_find_name(const char *name)
+{
+	struct le *le;
+
+	for (le = list_head(baresip_aufiltl()); le; le = le->next) {
+
+		const struct aufilt *af = le->data;
+
+		if (0 == str_casecmp(af->name, name))
+			return af;
+	}
+
+	return NULL;
+}
+
+
+static int perf_resample(const struct aufilt *af, uint8_t ch,
+			 uint32_t irate, uint32_t orate)
+{
+	struct aufilt_dec_st *st = NULL;
+	struct aufilt_prm prm;
+	struct auframe frame;
+	const size_t sampc = irate * ch * PTIME / 1000;
+	float *sampv;
+	uint64_t t0, t;
+	int err;
+
+	sampv = mem_zalloc(sampc * sizeof(float), NULL);
+	if (!sampv)
+		return ENOMEM;
+
+	/* a different triangle wave on each channel */
+	for (size_t i=0; i<sampc; i++) {
+		int v = (int)((i / ch * 7 + i % ch * 13) % 200) - 100;
+
+		sampv[i] = (float)v / 200.0f;
+	}
+
+	prm.srate = orate;
+	prm.ch    = ch;
+	prm.fmt   = AUFMT_FLOAT;
+
+	err = af->decupdh(&st, NULL, af, &prm, NULL);
+	TEST_ERR(err);
+
+	t0 = tmr_jiffies_usec();
+	for (unsigned i=0; i<NUM_FRAMES; i++) {
+
+		auframe_init(&frame, AUFMT_FLOAT, sampv, sampc, irate, ch);
+
+		err = af->dech(st, &frame);
+		TEST_ERR(err);
+	}
+	t = tmr_jiffies_usec() - t0;
+
+	ASSERT_EQ(orate, frame.srate);
+	ASSERT_EQ(ch, frame.ch);
+	ASSERT_EQ(orate * ch * PTIME / 1000, frame.sampc);
+
+	info("test: auresamp: %uch %u -> %u Hz: %llu us/frame,"
+	     " %llu us/ch\n", ch, irate, orate,
+	     t / NUM_FRAMES, t / NUM_FRAMES / ch);
+
+ out:
+	mem_deref(st);
+	mem_deref(sampv);
+
+	return err;
+}
+
+
+/*
+ * Single-threaded auresamp throughput on 20 ms float frames, stereo and
+ * with more channels (planar path).
+ * Not part of the default run; use "selftest -v test_auresamp_perf".
+ */
+int test_auresamp_perf(void)
+{
+	static const struct {
+		uint8_t ch;
+		uint32_t irate;
+		uint32_t orate;
+	} casev[] = {
+		{2, 48000, 16000},
+		{8, 48000, 16000},
+		{8, 16000, 48000},
+	};
+	const struct aufilt *af;
+	int err;
+
+	err = module_load(".", "auresamp");
+	TEST_ERR(err);
+
+	af = aufilt_find_name("auresamp");
+	ASSERT_TRUE(af != NULL);
+
+	for (size_t i=0; i<RE_ARRAY_SIZE(casev); i++) {
+
+		err = perf_resample(af, casev[i].ch,
+				    casev[i].irate, casev[i].orate);
+		TEST_ERR(err);
+	}
+
+ out:
+	module_unload("auresamp");
+
+	return err;
+}
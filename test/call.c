@@ -83,8 +83,11 @@ struct agent {
 	unsigned n_resume_cnt;
 	unsigned n_vidframe;
 	unsigned n_auframe;
+	unsigned n_auframe_allch;   /* frames with signal on all channels */
 	unsigned n_audebug;
 	double aulvl;
+	uint32_t ausrate;           /* last played audio frame            */
+	uint8_t auch;
 
 	struct tmr tmr_ack;
 	bool gotack;
@@ -906,6 +909,99 @@ int test_call_answer(void)
 }
 
 
+/*
+ * The setup timeline of a call without and with reliable provisional
+ * responses. The UAS records the PRACK when it arrives. The UAC records
+ * it when the PRACK is answered with an SDP body, otherwise not at all.
+ */
+int test_call_setup_timeline(void)
+{
+	struct fixture fix, *f = &fix;
+	struct cancel_rule *cr;
+	struct call *call;
+	int64_t t;
+	int err = 0;
+
+	fixture_init(f);
+
+	f->behaviour = BEHAVIOUR_ANSWER;
+
+	err = ua_connect(f->a.ua, 0, NULL, f->buri, VIDMODE_OFF);
+	TEST_ERR(err);
+
+	err = re_main_timeout(5000);
+	TEST_ERR(err);
+	TEST_ERR(fix.err);
+
+	call = ua_call(f->a.ua);
+	ASSERT_EQ(0, (int)call_setup_time(call, CALL_SETUP_START));
+	ASSERT_TRUE(call_setup_time(call, CALL_SETUP_INVITE) >= 0);
+	ASSERT_TRUE(call_setup_time(call, CALL_SETUP_TRYING) >=
+		    call_setup_time(call, CALL_SETUP_INVITE));
+	ASSERT_TRUE(call_setup_time(call, CALL_SETUP_SDP) >= 0);
+	ASSERT_TRUE(call_setup_time(call, CALL_SETUP_ANSWERED) >= 0);
+	ASSERT_TRUE(call_setup_time(call, CALL_SETUP_ESTABLISHED) >=
+		    call_setup_time(call, CALL_SETUP_ANSWERED));
+	ASSERT_EQ(-1, (int)call_setup_time(call, CALL_SETUP_PRACK));
+
+	call = ua_call(f->b.ua);
+	ASSERT_EQ(-1, (int)call_setup_time(call, CALL_SETUP_INVITE));
+	ASSERT_TRUE(call_setup_time(call, CALL_SETUP_PROGRESS) >= 0);
+	ASSERT_TRUE(call_setup_time(call, CALL_SETUP_ANSWERED) >= 0);
+	ASSERT_TRUE(call_setup_time(call, CALL_SETUP_ESTABLISHED) >= 0);
+	ASSERT_EQ(-1, (int)call_setup_time(call, CALL_SETUP_PRACK));
+
+	fixture_close(f);
+
+	/* reliable 183 with SDP, B answers once the PRACK has arrived */
+	fixture_init_prm(f, ";100rel=yes;answermode=early");
+
+	f->behaviour = BEHAVIOUR_NOTHING;
+	f->estab_action = ACTION_NOTHING;
+
+	cancel_rule_new(UA_EVENT_CALL_PROGRESS, f->a.ua, 0, 1, 0);
+
+	err = ua_connect(f->a.ua, 0, NULL, f->buri, VIDMODE_OFF);
+	TEST_ERR(err);
+
+	err = re_main_timeout(5000);
+	TEST_ERR(err);
+	TEST_ERR(fix.err);
+	cancel_rule_pop();
+
+	/* the reliable 183 alone does not mark the PRACK at the UAC */
+	call = ua_call(f->a.ua);
+	ASSERT_TRUE(call_setup_time(call, CALL_SETUP_PROGRESS) >= 0);
+	ASSERT_EQ(-1, (int)call_setup_time(call, CALL_SETUP_PRACK));
+
+	cancel_rule_new(UA_EVENT_CALL_ESTABLISHED, f->a.ua, 0, 1, 1);
+	cancel_rule_and(UA_EVENT_CALL_ESTABLISHED, f->b.ua, 1, 0, 1);
+
+	call_start_answtmr(ua_call(f->b.ua), 0);
+
+	err = re_main_timeout(5000);
+	TEST_ERR(err);
+	TEST_ERR(fix.err);
+
+	call = ua_call(f->b.ua);
+	t = call_setup_time(call, CALL_SETUP_PRACK);
+	ASSERT_TRUE(t >= call_setup_time(call, CALL_SETUP_PROGRESS));
+	ASSERT_TRUE(t <= call_setup_time(call, CALL_SETUP_ANSWERED));
+
+	call = ua_call(f->a.ua);
+	t = call_setup_time(call, CALL_SETUP_PRACK);
+	ASSERT_TRUE(t == -1 ||
+		    t >= call_setup_time(call, CALL_SETUP_PROGRESS));
+	ASSERT_TRUE(call_setup_time(call, CALL_SETUP_ANSWERED) >=
+		    call_setup_time(call, CALL_SETUP_PROGRESS));
+
+ out:
+	fixture_close(f);
+
+	return err;
+}
+
+
 int test_call_reject(void)
 {
 	struct fixture fix, *f = &fix;
@@ -1077,88 +1173,643 @@ int test_call_multiple(void)
 	unsigned i;
 	int err = 0;
 
-	fixture_init(f);
+	fixture_init(f);
+
+	f->behaviour = BEHAVIOUR_ANSWER;
+	f->exp_estab = 4;
+	/* 4 incoming + 4 outgoing calls */
+	conf_config()->call.max_calls = 8;
+
+	/*
+	 * Step 1 -- make 4 calls from A to B
+	 */
+	for (i=0; i<4; i++) {
+		err = ua_connect(f->a.ua, 0, NULL, f->buri, VIDMODE_OFF);
+		TEST_ERR(err);
+	}
+
+	err = re_main_timeout(5000);
+	TEST_ERR(err);
+	TEST_ERR(fix.err);
+
+	ASSERT_EQ(0, fix.a.n_incoming);
+	ASSERT_EQ(4, fix.a.n_established);
+	ASSERT_EQ(0, fix.a.n_closed);
+
+	ASSERT_EQ(4, fix.b.n_incoming);
+	ASSERT_EQ(4, fix.b.n_established);
+	ASSERT_EQ(0, fix.b.n_closed);
+
+	ASSERT_EQ(4, list_count(ua_calls(f->a.ua)));
+	ASSERT_EQ(4, list_count(ua_calls(f->b.ua)));
+	ASSERT_TRUE(linenum_are_sequential(f->a.ua));
+	ASSERT_TRUE(linenum_are_sequential(f->b.ua));
+
+
+	/*
+	 * Step 2 -- hangup calls with even line-number
+	 */
+
+	f->exp_closed = 2;
+
+	le = list_head(ua_calls(f->a.ua));
+	while (le) {
+		struct call *call = le->data;
+		le = le->next;
+
+		if (!(call_linenum(call) % 2)) {
+			ua_hangup(f->a.ua, call, 0, 0);
+		}
+	}
+
+	err = re_main_timeout(5000);
+	TEST_ERR(err);
+	TEST_ERR(fix.err);
+
+	ASSERT_EQ(2, list_count(ua_calls(f->a.ua)));
+	ASSERT_EQ(2, list_count(ua_calls(f->b.ua)));
+	ASSERT_TRUE(linenum_are_sequential(f->a.ua));
+	ASSERT_TRUE(linenum_are_sequential(f->b.ua));
+
+
+	/*
+	 * Step 3 -- make 2 calls from A to B
+	 */
+
+	f->a.n_established = 0;
+	f->b.n_established = 0;
+	f->exp_estab = 2;
+	for (i=0; i<2; i++) {
+		err = ua_connect(f->a.ua, 0, NULL, f->buri, VIDMODE_OFF);
+		TEST_ERR(err);
+	}
+
+	err = re_main_timeout(5000);
+	TEST_ERR(err);
+	TEST_ERR(fix.err);
+
+	ASSERT_EQ(4, list_count(ua_calls(f->a.ua)));
+	ASSERT_EQ(4, list_count(ua_calls(f->b.ua)));
+
+ out:
+	fixture_close(f);
+	/* set back to default */
+	conf_config()->call.max_calls = 4;
+
+	return err;
+}
+
+
+enum { BCAST_CALLS = 3, BCAST_PKTS = 10 };
+
+/* waits until each call received BCAST_PKTS more audio packets */
+struct bcast_check {
+	struct tmr tmr;
+	const struct list *calls;
+	uint32_t rxv[BCAST_CALLS];
+	bool done;
+};
+
+
+static uint32_t call_rx_packets(const struct call *call)
+{
+	return stream_metric_get_rx_n_packets(audio_strm(call_audio(call)));
+}
+
+
+static uint32_t call_tx_packets(const struct call *call)
+{
+	return stream_metric_get_tx_n_packets(audio_strm(call_audio(call)));
+}
+
+
+static void bcast_check_handler(void *arg)
+{
+	struct bcast_check *chk = arg;
+	struct le *le;
+	unsigned i = 0;
+
+	LIST_FOREACH(chk->calls, le) {
+
+		if (i < BCAST_CALLS &&
+		    call_rx_packets(le->data) < chk->rxv[i] + BCAST_PKTS) {
+			tmr_start(&chk->tmr, 10, bcast_check_handler, chk);
+			return;
+		}
+
+		++i;
+	}
+
+	chk->done = true;
+	re_cancel();
+}
+
+
+int test_call_bcast(void)
+{
+	struct fixture fix, *f = &fix;
+	struct bcast *bc = NULL;
+	struct bcast_check chk;
+	uint32_t txv[BCAST_CALLS];
+	struct le *le;
+	unsigned i;
+	int err = 0;
+
+	memset(&chk, 0, sizeof(chk));
+	tmr_init(&chk.tmr);
+
+	fixture_init(f);
+
+	err = module_load(".", "ausine");
+	TEST_ERR(err);
+
+	f->behaviour = BEHAVIOUR_ANSWER;
+	f->exp_estab = BCAST_CALLS;
+	/* 3 incoming + 3 outgoing calls */
+	conf_config()->call.max_calls = 6;
+
+	for (i=0; i<BCAST_CALLS; i++) {
+		err = ua_connect(f->a.ua, 0, NULL, f->buri, VIDMODE_OFF);
+		TEST_ERR(err);
+	}
+
+	err = re_main_timeout(5000);
+	TEST_ERR(err);
+	TEST_ERR(fix.err);
+
+	ASSERT_EQ(3, fix.a.n_established);
+	ASSERT_EQ(3, fix.b.n_established);
+
+	err = bcast_alloc(&bc);
+	TEST_ERR(err);
+
+	/* same codec on all calls, one encoder for the group */
+	LIST_FOREACH(ua_calls(f->a.ua), le) {
+		err = bcast_add(bc, le->data);
+		TEST_ERR(err);
+	}
+
+	ASSERT_EQ(1, bcast_encoders(bc));
+
+	err = bcast_add(bc, list_head(ua_calls(f->a.ua))->data);
+	ASSERT_EQ(EALREADY, err);
+
+	/* the followers send the payload of the leader, B gets audio */
+	i = 0;
+	LIST_FOREACH(ua_calls(f->a.ua), le) {
+		ASSERT_TRUE(i < BCAST_CALLS);
+		txv[i++] = call_tx_packets(le->data);
+	}
+
+	i = 0;
+	LIST_FOREACH(ua_calls(f->b.ua), le) {
+		ASSERT_TRUE(i < BCAST_CALLS);
+		chk.rxv[i++] = call_rx_packets(le->data);
+	}
+
+	chk.calls = ua_calls(f->b.ua);
+	tmr_start(&chk.tmr, 10, bcast_check_handler, &chk);
+
+	while (!chk.done) {
+		err = re_main_timeout(5000);
+		TEST_ERR(err);
+		TEST_ERR(fix.err);
+	}
+
+	i = 0;
+	LIST_FOREACH(ua_calls(f->a.ua), le) {
+		ASSERT_TRUE(call_tx_packets(le->data) > txv[i]);
+		++i;
+	}
+
+	/* the leader leaves, the next call takes over */
+	bcast_remove(bc, list_head(ua_calls(f->a.ua))->data);
+	ASSERT_EQ(1, bcast_encoders(bc));
+
+	bc = mem_deref(bc);
+
+	ASSERT_EQ(BCAST_CALLS, list_count(ua_calls(f->a.ua)));
+	ASSERT_EQ(0, fix.a.n_closed);
+	err = 0;
+
+ out:
+	tmr_cancel(&chk.tmr);
+	mem_deref(bc);
+	fixture_close(f);
+	module_unload("ausine");
+	/* set back to default */
+	conf_config()->call.max_calls = 4;
+
+	return err;
+}
+
+
+/*
+ * B relays the audio of its two calls to each other. The encoders of B
+ * are idle, so all audio that A receives was sent by A on the other call.
+ */
+int test_call_relay(void)
+{
+	struct fixture fix, *f = &fix;
+	struct bcast_check chk;
+	struct stream *sa, *sb;
+	struct le *le;
+	unsigned i;
+	int err = 0;
+
+	memset(&chk, 0, sizeof(chk));
+	tmr_init(&chk.tmr);
+
+	fixture_init(f);
+
+	err = module_load(".", "ausine");
+	TEST_ERR(err);
+
+	f->behaviour = BEHAVIOUR_ANSWER;
+	f->exp_estab = 2;
+
+	for (i=0; i<2; i++) {
+		err = ua_connect(f->a.ua, 0, NULL, f->buri, VIDMODE_OFF);
+		TEST_ERR(err);
+	}
+
+	err = re_main_timeout(5000);
+	TEST_ERR(err);
+	TEST_ERR(fix.err);
+
+	ASSERT_EQ(2, fix.a.n_established);
+	ASSERT_EQ(2, fix.b.n_established);
+
+	le = list_head(ua_calls(f->b.ua));
+	sa = audio_strm(call_audio(le->data));
+	sb = audio_strm(call_audio(le->next->data));
+
+	err = stream_relay_start(sa, sb);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(stream_is_relayed(sa));
+	ASSERT_TRUE(stream_is_relayed(sb));
+	ASSERT_TRUE(stream_relay_peer(sa) == sb);
+	ASSERT_TRUE(stream_relay_peer(sb) == sa);
+
+	ASSERT_EQ(EALREADY, stream_relay_start(sa, sa));
+	ASSERT_EQ(EINVAL, stream_relay_start(sa, NULL));
+
+	i = 0;
+	LIST_FOREACH(ua_calls(f->a.ua), le)
+		chk.rxv[i++] = call_rx_packets(le->data);
+
+	chk.calls = ua_calls(f->a.ua);
+	tmr_start(&chk.tmr, 10, bcast_check_handler, &chk);
+
+	while (!chk.done) {
+		err = re_main_timeout(5000);
+		TEST_ERR(err);
+		TEST_ERR(fix.err);
+	}
+
+	/* either end stops the relay for both */
+	stream_relay_stop(sb);
+
+	ASSERT_TRUE(!stream_is_relayed(sa));
+	ASSERT_TRUE(!stream_is_relayed(sb));
+	ASSERT_TRUE(stream_relay_peer(sa) == NULL);
+
+	ASSERT_EQ(0, fix.a.n_closed);
+	err = 0;
+
+ out:
+	tmr_cancel(&chk.tmr);
+	fixture_close(f);
+	module_unload("ausine");
+
+	return err;
+}
+
+
+/* waits until the mock encoder of A got a picture update request */
+struct picup_check {
+	struct tmr tmr;
+	unsigned n_update;
+	bool done;
+};
+
+
+static void picup_check_handler(void *arg)
+{
+	struct picup_check *chk = arg;
+
+	if (mock_vidcodec_n_update() <= chk->n_update) {
+		tmr_start(&chk->tmr, 10, picup_check_handler, chk);
+		return;
+	}
+
+	chk->done = true;
+	re_cancel();
+}
+
+
+/*
+ * B echoes the video of A. A picture update request from A must reach
+ * the encoder of A, as the encoder of B is idle.
+ */
+int test_call_relay_video(void)
+{
+	struct fixture fix, *f = &fix;
+	struct vidisp *vidisp = NULL;
+	struct cancel_rule *cr;
+	struct picup_check chk;
+	struct stream *strm;
+	int err = 0;
+
+	memset(&chk, 0, sizeof(chk));
+	tmr_init(&chk.tmr);
+
+	conf_config()->video.fps = 100;
+	conf_config()->video.enc_fmt = VID_FMT_YUV420P;
+
+	fixture_init(f);
+	cancel_rule_new(UA_EVENT_CUSTOM, f->b.ua, 1, 0, 1);
+	cr->prm = "vidframe";
+	cr->n_vidframe = 3;
+	cancel_rule_and(UA_EVENT_CUSTOM, f->a.ua, 0, 0, 1);
+	cr->prm = "vidframe";
+	cr->n_vidframe = 3;
+
+	mock_vidcodec_register();
+
+	err = mock_vidisp_register(&vidisp, mock_vidisp_handler, f);
+	TEST_ERR(err);
+
+	err = module_load(".", "fakevideo");
+	TEST_ERR(err);
+
+	f->behaviour = BEHAVIOUR_ANSWER;
+	f->estab_action = ACTION_NOTHING;
+
+	err = ua_connect(f->a.ua, 0, NULL, f->buri, VIDMODE_ON);
+	TEST_ERR(err);
+
+	err = re_main_timeout(10000);
+	TEST_ERR(err);
+	TEST_ERR(fix.err);
+
+	ASSERT_TRUE(call_has_video(ua_call(f->a.ua)));
+	ASSERT_TRUE(call_has_video(ua_call(f->b.ua)));
+
+	strm = video_strm(call_video(ua_call(f->b.ua)));
+
+	err = stream_relay_start(strm, strm);
+	TEST_ERR(err);
+	ASSERT_TRUE(stream_relay_peer(strm) == strm);
+
+	chk.n_update = mock_vidcodec_n_update();
+	video_request_picup(call_video(ua_call(f->a.ua)));
+
+	tmr_start(&chk.tmr, 10, picup_check_handler, &chk);
+
+	while (!chk.done) {
+		err = re_main_timeout(5000);
+		TEST_ERR(err);
+		TEST_ERR(fix.err);
+	}
+
+	stream_relay_stop(strm);
+
+ out:
+	tmr_cancel(&chk.tmr);
+	fixture_close(f);
+	mem_deref(vidisp);
+	module_unload("fakevideo");
+	mock_vidcodec_unregister();
+
+	return err;
+}
+
+
+/* Timestamps continue from the last one sent when the source changes */
+int test_call_relay_map(void)
+{
+	struct relay_map map;
+	struct rtp_header hdr;
+	uint32_t ts;
+	int err = 0;
+
+	memset(&map, 0, sizeof(map));
+	memset(&hdr, 0, sizeof(hdr));
+	relay_map_reset(&map);
+	map.srate = 90000;
+
+	hdr.ssrc = 1;
+	hdr.ts   = 1000;
+	ASSERT_TRUE(!relay_map_ts(&map, &hdr, 33, &ts));
+	ASSERT_EQ(1000, ts);
+	map.ts_last = ts;
+
+	hdr.ts = 4000;
+	ASSERT_TRUE(!relay_map_ts(&map, &hdr, 33, &ts));
+	ASSERT_EQ(4000, ts);
+	map.ts_last = ts;
+
+	/* new source, 33 ms after the last packet */
+	hdr.ssrc = 2;
+	hdr.ts   = 0xfffff000;
+	ASSERT_TRUE(relay_map_ts(&map, &hdr, 33, &ts));
+	ASSERT_EQ(4000 + 2970, ts);
+	map.ts_last = ts;
+
+	hdr.ts += 3000;
+	ASSERT_TRUE(!relay_map_ts(&map, &hdr, 33, &ts));
+	ASSERT_EQ(4000 + 2970 + 3000, ts);
+	map.ts_last = ts;
+
+	/* same SSRC, but the viewer switched sources */
+	map.rebase = true;
+	hdr.ts = 500;
+	ASSERT_TRUE(relay_map_ts(&map, &hdr, 33, &ts));
+	ASSERT_EQ(4000 + 2970 + 3000 + 2970, ts);
+
+ out:
+	return err;
+}
+
+
+/* RTP headers received by A on the first call */
+struct sfu_capture {
+	struct tmr tmr;
+	uint32_t ssrc;
+	uint16_t seq;
+	uint32_t ts;
+	unsigned n;
+	unsigned n_ssrc;          /**< SSRC changes              */
+	unsigned n_gap;           /**< Sequence number gaps      */
+	bool done;
+};
+
+
+static void sfu_capture_handler(struct stream *strm,
+				const struct rtp_header *hdr,
+				struct mbuf *mb, void *arg)
+{
+	struct sfu_capture *cap = arg;
+	(void)strm;
+	(void)mb;
+
+	if (cap->n) {
+		if (hdr->ssrc != cap->ssrc)
+			++cap->n_ssrc;
+		if (hdr->seq != (uint16_t)(cap->seq + 1))
+			++cap->n_gap;
+	}
+
+	cap->ssrc = hdr->ssrc;
+	cap->seq  = hdr->seq;
+	cap->ts   = hdr->ts;
+	++cap->n;
+}
+
+
+static void sfu_check_handler(void *arg)
+{
+	struct sfu_capture *cap = arg;
+
+	if (cap->n < 20) {
+		tmr_start(&cap->tmr, 10, sfu_check_handler, cap);
+		return;
+	}
+
+	cap->done = true;
+	re_cancel();
+}
+
+
+/*
+ * B joins its two video calls from A in an SFU. Each call views the
+ * other one, so A receives the video it sends on the other call, with
+ * the SSRC and sequence numbers of B.
+ */
+int test_call_sfu(void)
+{
+	struct fixture fix, *f = &fix;
+	struct vidisp *vidisp = NULL;
+	struct sfu_capture cap;
+	struct picup_check chk;
+	struct sfu *sfu = NULL;
+	struct stream *a1, *a2, *b1;
+	struct call *bc1, *bc2;
+	char *str = NULL;
+	struct le *le;
+	unsigned i;
+	int err = 0;
+
+	memset(&cap, 0, sizeof(cap));
+	memset(&chk, 0, sizeof(chk));
+	tmr_init(&cap.tmr);
+	tmr_init(&chk.tmr);
+
+	conf_config()->video.fps = 100;
+	conf_config()->video.enc_fmt = VID_FMT_YUV420P;
+
+	fixture_init(f);
+
+	mock_vidcodec_register();
+
+	err = mock_vidisp_register(&vidisp, mock_vidisp_handler, f);
+	TEST_ERR(err);
+
+	err = module_load(".", "fakevideo");
+	TEST_ERR(err);
 
 	f->behaviour = BEHAVIOUR_ANSWER;
-	f->exp_estab = 4;
-	/* 4 incoming + 4 outgoing calls */
-	conf_config()->call.max_calls = 8;
+	f->exp_estab = 2;
 
-	/*
-	 * Step 1 -- make 4 calls from A to B
-	 */
-	for (i=0; i<4; i++) {
-		err = ua_connect(f->a.ua, 0, NULL, f->buri, VIDMODE_OFF);
+	for (i=0; i<2; i++) {
+		err = ua_connect(f->a.ua, 0, NULL, f->buri, VIDMODE_ON);
 		TEST_ERR(err);
 	}
 
-	err = re_main_timeout(5000);
+	err = re_main_timeout(10000);
 	TEST_ERR(err);
 	TEST_ERR(fix.err);
 
-	ASSERT_EQ(0, fix.a.n_incoming);
-	ASSERT_EQ(4, fix.a.n_established);
-	ASSERT_EQ(0, fix.a.n_closed);
+	ASSERT_EQ(2, fix.a.n_established);
+	ASSERT_EQ(2, fix.b.n_established);
 
-	ASSERT_EQ(4, fix.b.n_incoming);
-	ASSERT_EQ(4, fix.b.n_established);
-	ASSERT_EQ(0, fix.b.n_closed);
+	le  = list_head(ua_calls(f->a.ua));
+	a1  = video_strm(call_video(le->data));
+	a2  = video_strm(call_video(le->next->data));
+	le  = list_head(ua_calls(f->b.ua));
+	bc1 = le->data;
+	bc2 = le->next->data;
+	b1  = video_strm(call_video(bc1));
+	ASSERT_TRUE(a1 && a2 && b1);
+
+	/* the first call of B must be the one of a1 */
+	if (str_cmp(call_id(bc1),
+		    call_id(list_head(ua_calls(f->a.ua))->data))) {
+		struct call *tmp = bc1;
+
+		bc1 = bc2;
+		bc2 = tmp;
+		b1  = video_strm(call_video(bc1));
+	}
 
-	ASSERT_EQ(4, list_count(ua_calls(f->a.ua)));
-	ASSERT_EQ(4, list_count(ua_calls(f->b.ua)));
-	ASSERT_TRUE(linenum_are_sequential(f->a.ua));
-	ASSERT_TRUE(linenum_are_sequential(f->b.ua));
+	err = sfu_alloc(&sfu);
+	TEST_ERR(err);
 
+	err  = sfu_add(sfu, bc1);
+	err |= sfu_add(sfu, bc2);
+	TEST_ERR(err);
 
-	/*
-	 * Step 2 -- hangup calls with even line-number
-	 */
+	ASSERT_EQ(EALREADY, sfu_add(sfu, bc1));
 
-	f->exp_closed = 2;
+	err = stream_set_forward(a1, sfu_capture_handler, &cap);
+	TEST_ERR(err);
 
-	le = list_head(ua_calls(f->a.ua));
-	while (le) {
-		struct call *call = le->data;
-		le = le->next;
+	tmr_start(&cap.tmr, 10, sfu_check_handler, &cap);
 
-		if (!(call_linenum(call) % 2)) {
-			ua_hangup(f->a.ua, call, 0, 0);
-		}
+	while (!cap.done) {
+		err = re_main_timeout(5000);
+		TEST_ERR(err);
+		TEST_ERR(fix.err);
 	}
 
-	err = re_main_timeout(5000);
-	TEST_ERR(err);
-	TEST_ERR(fix.err);
+	(void)stream_set_forward(a1, NULL, NULL);
 
-	ASSERT_EQ(2, list_count(ua_calls(f->a.ua)));
-	ASSERT_EQ(2, list_count(ua_calls(f->b.ua)));
-	ASSERT_TRUE(linenum_are_sequential(f->a.ua));
-	ASSERT_TRUE(linenum_are_sequential(f->b.ua));
+	/* video of a2, sent with the SSRC and sequence numbers of B */
+	ASSERT_EQ(rtp_sess_ssrc(stream_rtp_sock(b1)), cap.ssrc);
+	ASSERT_TRUE(cap.ssrc != rtp_sess_ssrc(stream_rtp_sock(a2)));
+	ASSERT_EQ(0, cap.n_ssrc);
+	ASSERT_EQ(0, cap.n_gap);
 
+	/* the second call leaves, its encoder takes over again */
+	chk.n_update = mock_vidcodec_n_update();
+	sfu_remove(sfu, bc2);
+	sfu_remove(sfu, bc2);
 
-	/*
-	 * Step 3 -- make 2 calls from A to B
-	 */
+	err = re_sdprintf(&str, "%H", sfu_debug, sfu);
+	TEST_ERR(err);
+	ASSERT_TRUE(NULL != strstr(str, "SFU (1 members)"));
 
-	f->a.n_established = 0;
-	f->b.n_established = 0;
-	f->exp_estab = 2;
-	for (i=0; i<2; i++) {
-		err = ua_connect(f->a.ua, 0, NULL, f->buri, VIDMODE_OFF);
+	tmr_start(&chk.tmr, 10, picup_check_handler, &chk);
+
+	while (!chk.done) {
+		err = re_main_timeout(5000);
 		TEST_ERR(err);
+		TEST_ERR(fix.err);
 	}
 
-	err = re_main_timeout(5000);
-	TEST_ERR(err);
-	TEST_ERR(fix.err);
-
-	ASSERT_EQ(4, list_count(ua_calls(f->a.ua)));
-	ASSERT_EQ(4, list_count(ua_calls(f->b.ua)));
+	ASSERT_EQ(0, fix.a.n_closed);
 
  out:
+	tmr_cancel(&cap.tmr);
+	tmr_cancel(&chk.tmr);
+	mem_deref(str);
+	mem_deref(sfu);
 	fixture_close(f);
-	/* set back to default */
-	conf_config()->call.max_calls = 4;
+	mem_deref(vidisp);
+	module_unload("fakevideo");
+	mock_vidcodec_unregister();
 
 	return err;
 }
@@ -1343,6 +1994,185 @@ int test_call_video(void)
 }
 
 
+int test_call_video_simulcast(void)
+{
+	struct fixture fix, *f = &fix;
+	struct vidisp *vidisp = NULL;
+	struct sdp_media *vm;
+	struct cancel_rule *cr;
+	const char *attr;
+	int err = 0;
+
+	conf_config()->video.fps = 100;
+	conf_config()->video.enc_fmt = VID_FMT_YUV420P;
+	conf_config()->video.simulcast = 3;
+
+	fixture_init(f);
+	cancel_rule_new(UA_EVENT_CUSTOM, f->b.ua, 1, 0, 1);
+	cr->prm = "vidframe";
+	cr->n_vidframe = 3;
+	cancel_rule_and(UA_EVENT_CUSTOM, f->a.ua, 0, 0, 1);
+	cr->prm = "vidframe";
+	cr->n_vidframe = 3;
+
+	mock_vidcodec_register();
+
+	err = mock_vidisp_register(&vidisp, mock_vidisp_handler, f);
+	TEST_ERR(err);
+
+	err = module_load(".", "fakevideo");
+	TEST_ERR(err);
+
+	f->behaviour = BEHAVIOUR_ANSWER;
+	f->estab_action = ACTION_NOTHING;
+
+	err = ua_connect(f->a.ua, 0, NULL, f->buri, VIDMODE_ON);
+	TEST_ERR(err);
+
+	err = re_main_timeout(10000);
+	TEST_ERR(err);
+	TEST_ERR(fix.err);
+
+	ASSERT_EQ(1, fix.a.n_established);
+	ASSERT_EQ(1, fix.b.n_established);
+
+	/* A offers three layers */
+	vm = stream_sdpmedia(video_strm(call_video(ua_call(f->b.ua))));
+	ASSERT_STREQ("send f;h;q", sdp_media_rattr(vm, "simulcast"));
+	attr = sdp_media_rattr(vm, "ssrc-group");
+	ASSERT_EQ(0, re_regex(attr, str_len(attr), "SIM [0-9]+ [0-9]+ [0-9]+",
+			      NULL, NULL, NULL));
+
+	/* B does not receive simulcast, only the full layer is sent */
+	vm = stream_sdpmedia(video_strm(call_video(ua_call(f->a.ua))));
+	ASSERT_TRUE(NULL == sdp_media_rattr(vm, "simulcast"));
+
+	ASSERT_EQ(ENOENT, video_simulcast_pause(call_video(ua_call(f->a.ua)),
+						"x", true));
+	ASSERT_EQ(0, video_simulcast_pause(call_video(ua_call(f->a.ua)),
+					   "h", true));
+
+ out:
+	conf_config()->video.simulcast = 1;
+	fixture_close(f);
+	mem_deref(vidisp);
+	module_unload("fakevideo");
+	mock_vidcodec_unregister();
+
+	return err;
+}
+
+
+/* B asks for all layers, A sends each with its own SSRC */
+int test_call_video_simulcast_send(void)
+{
+	struct fixture fix, *f = &fix;
+	struct vidisp *vidisp = NULL;
+	struct sdp_media *vm;
+	struct cancel_rule *cr, *cr_vida, *cr_vidb;
+	struct rtp_sock *rtp;
+	struct pl ssrcv[3];
+	const char *attr;
+	int err = 0;
+
+	conf_config()->video.fps = 100;
+	conf_config()->video.enc_fmt = VID_FMT_YUV420P;
+	conf_config()->video.simulcast = 3;
+
+	fixture_init(f);
+	cr_vidb = cancel_rule_new(UA_EVENT_CUSTOM, f->b.ua, 1, 0, 1);
+	cr_vidb->prm = "vidframe";
+	cr_vidb->n_vidframe = 3;
+	cr_vida = cancel_rule_and(UA_EVENT_CUSTOM, f->a.ua, 0, 0, 1);
+	cr_vida->prm = "vidframe";
+	cr_vida->n_vidframe = 3;
+
+	mock_vidcodec_register();
+
+	err = mock_vidisp_register(&vidisp, mock_vidisp_handler, f);
+	TEST_ERR(err);
+
+	err = module_load(".", "fakevideo");
+	TEST_ERR(err);
+
+	f->behaviour = BEHAVIOUR_ANSWER;
+	f->estab_action = ACTION_NOTHING;
+
+	err = ua_connect(f->a.ua, 0, NULL, f->buri, VIDMODE_ON);
+	TEST_ERR(err);
+
+	err = re_main_timeout(10000);
+	TEST_ERR(err);
+	TEST_ERR(fix.err);
+
+	ASSERT_EQ(1, fix.a.n_established);
+	ASSERT_EQ(1, fix.b.n_established);
+
+	/* B re-offers and receives all three layers */
+	cancel_rule_new(UA_EVENT_CALL_REMOTE_SDP, f->a.ua, 0, 0, 1);
+	cr->prm = "offer";
+	cancel_rule_and(UA_EVENT_CALL_REMOTE_SDP, f->b.ua, 1, 0, 1);
+	cr->prm = "answer";
+
+	cr_vida->ev = UA_EVENT_MAX;
+	cr_vidb->ev = UA_EVENT_MAX;
+
+	vm = stream_sdpmedia(video_strm(call_video(ua_call(f->b.ua))));
+	err = sdp_media_set_lattr(vm, true, "simulcast", "recv f;h;q");
+	TEST_ERR(err);
+
+	err = call_modify(ua_call(f->b.ua));
+	TEST_ERR(err);
+
+	err = re_main_timeout(10000);
+	TEST_ERR(err);
+	TEST_ERR(fix.err);
+	err = agent_wait_for_ack(&f->b, -1, -1, 1);
+	TEST_ERR(err);
+	cancel_rule_pop();
+
+	/* wait for frames sent with all layers active */
+	f->a.n_vidframe = 0;
+	f->b.n_vidframe = 0;
+	cr_vida->ev = UA_EVENT_CUSTOM;
+	cr_vidb->ev = UA_EVENT_CUSTOM;
+	cr_vidb->n_vidframe = 10;
+
+	err = re_main_timeout(10000);
+	TEST_ERR(err);
+	TEST_ERR(fix.err);
+
+	attr = sdp_media_rattr(vm, "ssrc-group");
+	err = re_regex(attr, str_len(attr), "SIM [0-9]+ [0-9]+ [0-9]+",
+		       &ssrcv[0], &ssrcv[1], &ssrcv[2]);
+	TEST_ERR(err);
+
+	rtp = stream_rtp_sock(video_strm(call_video(ua_call(f->b.ua))));
+
+	for (size_t i=0; i<RE_ARRAY_SIZE(ssrcv); i++) {
+
+		struct rtcp_stats stats;
+
+		err = rtcp_stats(rtp, pl_u32(&ssrcv[i]), &stats);
+		TEST_ERR(err);
+
+		ASSERT_TRUE(stats.rx.sent > 0);
+	}
+
+ out:
+	if (err)
+		failure_debug(f, false);
+
+	conf_config()->video.simulcast = 1;
+	fixture_close(f);
+	mem_deref(vidisp);
+	module_unload("fakevideo");
+	mock_vidcodec_unregister();
+
+	return err;
+}
+
+
 int test_call_change_videodir(void)
 {
 	struct fixture fix, *f = &fix;
@@ -1559,13 +2389,39 @@ int test_call_100rel_video(void)
 }
 
 
+/* true if every channel of the frame carries a signal */
+static bool auframe_allch(const struct auframe *af)
+{
+	uint32_t mask = 0;
+
+	if (!af->ch || af->ch > 32)
+		return false;
+
+	for (size_t i=0; i<af->sampc; i++) {
+
+		bool nz;
+
+		if (af->fmt == AUFMT_S16LE)
+			nz = ((const int16_t *)af->sampv)[i] != 0;
+		else if (af->fmt == AUFMT_FLOAT)
+			nz = ((const float *)af->sampv)[i] != 0.0f;
+		else
+			return false;
+
+		if (nz)
+			mask |= 1u << (i % af->ch);
+	}
+
+	return mask == (uint32_t)((1ull << af->ch) - 1);
+}
+
+
 static void auframe_handler(struct auframe *af, const char *dev, void *arg)
 {
 	struct fixture *fix = arg;
 	struct agent *ag = NULL;
 	struct ua *ua;
 	int err = 0;
-	(void)af;
 
 	ASSERT_EQ(MAGIC, fix->magic);
 
@@ -1591,6 +2447,11 @@ static void auframe_handler(struct auframe *af, const char *dev, void *arg)
 	++ag->n_auframe;
 	(void)audio_level_get(call_audio(ua_call(ua)), &ag->aulvl);
 
+	ag->ausrate = af->srate;
+	ag->auch    = af->ch;
+	if (auframe_allch(af))
+		++ag->n_auframe_allch;
+
 	ua_event(ua, UA_EVENT_CUSTOM, ua_call(ua), "auframe %u",
 		 ag->n_auframe);
 
@@ -1803,7 +2664,7 @@ int test_call_progress(void)
 
 
 static int test_media_base(enum audio_mode txmode,
-			   enum aufmt sndfmt, enum aufmt acfmt)
+			   enum aufmt sndfmt, enum aufmt acfmt, uint8_t ch)
 {
 	struct fixture fix, *f = &fix;
 	struct cancel_rule *cr;
@@ -1820,8 +2681,8 @@ static int test_media_base(enum audio_mode txmode,
 	conf_config()->audio.srate_src = 16000;
 	conf_config()->audio.txmode = txmode;
 	conf_config()->audio.src_fmt = sndfmt;
-	conf_config()->audio.channels_play = 1;
-	conf_config()->audio.channels_src = 1;
+	conf_config()->audio.channels_play = ch;
+	conf_config()->audio.channels_src = ch;
 	conf_config()->audio.play_fmt = sndfmt;
 	conf_config()->audio.enc_fmt = acfmt;
 	conf_config()->audio.dec_fmt = acfmt;
@@ -1862,6 +2723,11 @@ static int test_media_base(enum audio_mode txmode,
 	ASSERT_EQ(1, fix.b.n_established);
 	ASSERT_EQ(0, fix.b.n_closed);
 
+	/* the player gets the configured format back from the codec */
+	ASSERT_EQ(16000, fix.b.ausrate);
+	ASSERT_EQ(ch, fix.b.auch);
+	ASSERT_TRUE(fix.b.n_auframe_allch > 0);
+
  out:
 	if (err)
 		failure_debug(f, false);
@@ -1899,28 +2765,62 @@ int test_call_format_float(void)
 
 	mock_aucodec_register();
 
-	err = test_media_base(AUDIO_MODE_POLL, AUFMT_S16LE, AUFMT_S16LE);
+	err = test_media_base(AUDIO_MODE_POLL, AUFMT_S16LE, AUFMT_S16LE, 1);
+	TEST_ERR(err);
+
+	err = test_media_base(AUDIO_MODE_POLL, AUFMT_S16LE, AUFMT_FLOAT, 1);
+	TEST_ERR(err);
+
+	err = test_media_base(AUDIO_MODE_POLL, AUFMT_FLOAT, AUFMT_S16LE, 1);
+	TEST_ERR(err);
+
+	err = test_media_base(AUDIO_MODE_POLL, AUFMT_FLOAT, AUFMT_FLOAT, 1);
+	TEST_ERR(err);
+
+	err = test_media_base(AUDIO_MODE_THREAD, AUFMT_S16LE, AUFMT_S16LE, 1);
+	TEST_ERR(err);
+
+	err = test_media_base(AUDIO_MODE_THREAD, AUFMT_S16LE, AUFMT_FLOAT, 1);
+	TEST_ERR(err);
+
+	err = test_media_base(AUDIO_MODE_THREAD, AUFMT_FLOAT, AUFMT_S16LE, 1);
 	TEST_ERR(err);
 
-	err = test_media_base(AUDIO_MODE_POLL, AUFMT_S16LE, AUFMT_FLOAT);
+	err = test_media_base(AUDIO_MODE_THREAD, AUFMT_FLOAT, AUFMT_FLOAT, 1);
 	TEST_ERR(err);
 
-	err = test_media_base(AUDIO_MODE_POLL, AUFMT_FLOAT, AUFMT_S16LE);
+ out:
+	mock_aucodec_unregister();
+	module_unload("auresamp");
+	module_unload("auconv");
+
+	return err;
+}
+
+
+/* four channels at 48 kHz in the codec, resampled one plane at a time */
+int test_call_format_multich(void)
+{
+	int err;
+
+	err = module_load(".", "auconv");
 	TEST_ERR(err);
 
-	err = test_media_base(AUDIO_MODE_POLL, AUFMT_FLOAT, AUFMT_FLOAT);
+	err = module_load(".", "auresamp");
 	TEST_ERR(err);
 
-	err = test_media_base(AUDIO_MODE_THREAD, AUFMT_S16LE, AUFMT_S16LE);
+	mock_aucodec_register_ch(4);
+
+	err = test_media_base(AUDIO_MODE_POLL, AUFMT_S16LE, AUFMT_S16LE, 4);
 	TEST_ERR(err);
 
-	err = test_media_base(AUDIO_MODE_THREAD, AUFMT_S16LE, AUFMT_FLOAT);
+	err = test_media_base(AUDIO_MODE_POLL, AUFMT_S16LE, AUFMT_FLOAT, 4);
 	TEST_ERR(err);
 
-	err = test_media_base(AUDIO_MODE_THREAD, AUFMT_FLOAT, AUFMT_S16LE);
+	err = test_media_base(AUDIO_MODE_POLL, AUFMT_FLOAT, AUFMT_S16LE, 4);
 	TEST_ERR(err);
 
-	err = test_media_base(AUDIO_MODE_THREAD, AUFMT_FLOAT, AUFMT_FLOAT);
+	err = test_media_base(AUDIO_MODE_POLL, AUFMT_FLOAT, AUFMT_FLOAT, 4);
 	TEST_ERR(err);
 
  out:
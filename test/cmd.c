@@ -158,3 +158,73 @@ int test_cmd_long(void)
 	mem_deref(commands);
 	return err;
 }
+
+
+static int args_handler(struct re_printf *pf, void *arg)
+{
+	struct cmd_arg *carg = arg;
+	struct test *test = carg->data;
+	int err = 0;
+	(void)pf;
+
+	ASSERT_EQ('/', carg->key);
+	ASSERT_STREQ("a b", carg->prm);
+	ASSERT_TRUE(carg->od != NULL);
+	ASSERT_STREQ("b", odict_string(carg->od, "a"));
+
+	++test->cmd_called;
+
+ out:
+	return err;
+}
+
+
+static const struct cmd argscmdv[] = {
+	{ "ArgsTest", 0, 0, "Test Command", args_handler},
+};
+
+
+int test_cmd_args(void)
+{
+	struct commands *commands = NULL;
+	struct odict *od = NULL;
+	struct test test;
+	const struct cmd *cmd;
+	int err;
+
+	memset(&test, 0, sizeof(test));
+
+	err = cmd_init(&commands);
+	TEST_ERR(err);
+
+	err = cmd_register(commands, argscmdv, RE_ARRAY_SIZE(argscmdv));
+	TEST_ERR(err);
+
+	/* Long command lookup is case-insensitive */
+	cmd = cmd_find_long(commands, "argstest");
+	ASSERT_TRUE(cmd == &argscmdv[0]);
+	cmd = cmd_find_long(commands, "ARGSTEST");
+	ASSERT_TRUE(cmd == &argscmdv[0]);
+	ASSERT_TRUE(NULL == cmd_find_long(commands, "argstes"));
+
+	err = odict_alloc(&od, 4);
+	TEST_ERR(err);
+	err = odict_entry_add(od, "a", ODICT_STRING, "b");
+	TEST_ERR(err);
+
+	err = cmd_process_args(commands, cmd, "a b", od, &pf_null, &test);
+	TEST_ERR(err);
+	ASSERT_EQ(1, test.cmd_called);
+
+	err = cmd_process_long(commands, "nosuchcmd", 9, &pf_null, &test);
+	ASSERT_EQ(ENOTSUP, err);
+	err = 0;
+
+	cmd_unregister(commands, argscmdv);
+	ASSERT_TRUE(NULL == cmd_find_long(commands, "argstest"));
+
+ out:
+	mem_deref(od);
+	mem_deref(commands);
+	return err;
+}
@@ -0,0 +1,256 @@
+/**
+ * @file test/ctrl_tcp.c  Baresip selftest -- TCP control interface
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+/* Pipelined requests, sent in a single TCP segment */
+static const struct {
+	const char *req;
+	const char *token;      /* expected response token, or none */
+	bool ok;
+	const char *data;       /* expected response data, or any   */
+	const char *item;       /* batch: token of the first item   */
+} reqv[] = {
+	{"{\"command\":\"unsubscribe\",\"params\":\"all\",\"token\":\"1\"}",
+	 "1", true, "", NULL},
+	{"{\"command\":\"subscribe\",\"params\":\"call,register\","
+	 "\"token\":\"2\"}",
+	 "2", true, "register call", NULL},
+	{"{\"command\":\"no_such_command\",\"token\":\"3\"}",
+	 "3", false, NULL, NULL},
+	{"{\"command\":\"batch\",\"params\":[{\"command\":\"unsubscribe\","
+	 "\"params\":\"call\",\"token\":\"4a\"}],\"token\":\"4\"}",
+	 "4", true, NULL, "4a"},
+	{"{\"command\":\"subscribe\",\"params\":\"mwi\"}",
+	 NULL, true, "register mwi", NULL},
+};
+
+
+struct fixture {
+	struct tcp_conn *tc;
+	struct mbuf *mb;
+	unsigned n;             /* responses received */
+	int err;
+};
+
+
+static void fixture_abort(struct fixture *f, int err)
+{
+	f->err = err;
+	re_cancel();
+}
+
+
+static int response_check(struct fixture *f, const char *p, size_t len)
+{
+	const struct odict_entry *e;
+	const char *tok, *data;
+	struct odict *od = NULL;
+	bool ok = false;
+	int err;
+
+	err = json_decode_odict(&od, 8, p, len, 8);
+	TEST_ERR(err);
+
+	/* skip events */
+	if (!odict_lookup(od, "response"))
+		goto out;
+
+	ASSERT_TRUE(f->n < RE_ARRAY_SIZE(reqv));
+
+	tok = odict_string(od, "token");
+	if (reqv[f->n].token) {
+		ASSERT_STREQ(reqv[f->n].token, tok);
+	}
+	else {
+		ASSERT_TRUE(tok == NULL);
+	}
+
+	ASSERT_TRUE(odict_get_boolean(od, &ok, "ok"));
+	ASSERT_EQ(reqv[f->n].ok, ok);
+
+	data = odict_string(od, "data");
+	if (reqv[f->n].data) {
+		ASSERT_STREQ(reqv[f->n].data, data);
+	}
+
+	if (reqv[f->n].item) {
+		const struct odict_entry *ie;
+
+		e = odict_get_type(od, ODICT_ARRAY, "data");
+		ASSERT_TRUE(e != NULL);
+
+		ie = list_ledata(list_head(&odict_entry_array(e)->lst));
+		ASSERT_TRUE(ie != NULL);
+		ASSERT_EQ(ODICT_OBJECT, odict_entry_type(ie));
+		ASSERT_STREQ(reqv[f->n].item,
+			     odict_string(odict_entry_object(ie), "token"));
+	}
+
+	++f->n;
+
+ out:
+	mem_deref(od);
+
+	return err;
+}
+
+
+static void tcp_estab_handler(void *arg)
+{
+	struct fixture *f = arg;
+	struct mbuf *mb;
+	int err = 0;
+
+	mb = mbuf_alloc(1024);
+	if (!mb) {
+		fixture_abort(f, ENOMEM);
+		return;
+	}
+
+	for (size_t i=0; i<RE_ARRAY_SIZE(reqv); i++) {
+		err |= mbuf_printf(mb, "%zu:%s,", str_len(reqv[i].req),
+				   reqv[i].req);
+	}
+
+	mb->pos = 0;
+
+	if (!err)
+		err = tcp_send(f->tc, mb);
+
+	mem_deref(mb);
+
+	if (err)
+		fixture_abort(f, err);
+}
+
+
+static void tcp_recv_handler(struct mbuf *mb, void *arg)
+{
+	struct fixture *f = arg;
+	struct pl len;
+	int err;
+
+	f->mb->pos = f->mb->end;
+	err = mbuf_write_mem(f->mb, mbuf_buf(mb), mbuf_get_left(mb));
+	if (err)
+		goto out;
+
+	f->mb->pos = 0;
+
+	/* netstring framing "<len>:<payload>," */
+	while (!re_regex((char *)mbuf_buf(f->mb), mbuf_get_left(f->mb),
+			 "[0-9]+:", &len)) {
+
+		size_t hdr = len.p - (char *)mbuf_buf(f->mb) + len.l + 1;
+		size_t n = pl_u32(&len);
+
+		if (mbuf_get_left(f->mb) < hdr + n + 1)
+			break;
+
+		if (len.p != (char *)mbuf_buf(f->mb) ||
+		    mbuf_buf(f->mb)[hdr + n] != ',') {
+			err = EPROTO;
+			goto out;
+		}
+
+		err = response_check(f, (char *)mbuf_buf(f->mb) + hdr, n);
+		if (err)
+			goto out;
+
+		mbuf_advance(f->mb, hdr + n + 1);
+	}
+
+	/* keep a partial frame for the next segment */
+	memmove(f->mb->buf, mbuf_buf(f->mb), mbuf_get_left(f->mb));
+	f->mb->end = mbuf_get_left(f->mb);
+	f->mb->pos = 0;
+
+	if (f->n == RE_ARRAY_SIZE(reqv))
+		re_cancel();
+
+ out:
+	if (err)
+		fixture_abort(f, err);
+}
+
+
+static void tcp_close_handler(int err, void *arg)
+{
+	struct fixture *f = arg;
+
+	fixture_abort(f, err ? err : ECONNRESET);
+}
+
+
+/*
+ * Requests pipelined on one connection are answered in request order,
+ * each response carries the token of its request, or none if the
+ * request had none.
+ */
+int test_ctrl_tcp(void)
+{
+	struct config cfg = *conf_config();
+	struct fixture f;
+	struct tcp_sock *ts = NULL;
+	struct sa laddr;
+	char *modconfig = NULL;
+	int err;
+
+	memset(&f, 0, sizeof(f));
+
+	/* find a free port */
+	err  = sa_set_str(&laddr, "127.0.0.1", 0);
+	err |= tcp_listen(&ts, &laddr, NULL, NULL);
+	TEST_ERR(err);
+
+	err = tcp_sock_local_get(ts, &laddr);
+	ts = mem_deref(ts);
+	TEST_ERR(err);
+
+	err = re_sdprintf(&modconfig, "ctrl_tcp_listen %J\n", &laddr);
+	TEST_ERR(err);
+
+	err = conf_configure_buf((uint8_t *)modconfig, str_len(modconfig));
+	TEST_ERR(err);
+
+	err = module_load(".", "ctrl_tcp");
+	TEST_ERR(err);
+
+	f.mb = mbuf_alloc(1024);
+	if (!f.mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = tcp_connect(&f.tc, &laddr, tcp_estab_handler, tcp_recv_handler,
+			  tcp_close_handler, &f);
+	TEST_ERR(err);
+
+	err = re_main_timeout(5000);
+	TEST_ERR(err);
+
+	err = f.err;
+	TEST_ERR(err);
+
+	ASSERT_EQ((unsigned)RE_ARRAY_SIZE(reqv), f.n);
+
+ out:
+	mem_deref(f.tc);
+	mem_deref(f.mb);
+	module_unload("ctrl_tcp");
+
+	(void)conf_configure_buf((uint8_t *)test_modconfig,
+				 str_len(test_modconfig));
+	*conf_config() = cfg;
+
+	mem_deref(modconfig);
+
+	return err;
+}
@@ -0,0 +1,109 @@
+/**
+ * @file test/dtls.c  Baresip selftest -- DTLS-SRTP
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <stdio.h>
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+static int read_file(struct mbuf **mbp, const char *file)
+{
+	struct mbuf *mb;
+	FILE *f;
+	int err = 0;
+
+	f = fopen(file, "rb");
+	if (!f)
+		return errno;
+
+	mb = mbuf_alloc(2048);
+	if (!mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	while (!feof(f) && !err) {
+		size_t n;
+
+		err = mbuf_resize(mb, mb->end + 1024);
+		if (err)
+			break;
+
+		n = fread(mb->buf + mb->end, 1, mb->size - mb->end, f);
+		if (ferror(f))
+			err = EIO;
+
+		mb->end += n;
+	}
+
+ out:
+	(void)fclose(f);
+
+	if (err)
+		mem_deref(mb);
+	else
+		*mbp = mb;
+
+	return err;
+}
+
+
+int test_dtls_cert_cache(void)
+{
+	static const char *modconfig =
+		"dtls_srtp_cert_cache   yes\n"
+		"dtls_srtp_cert_rotate  30\n";
+	struct config cfg = *conf_config();
+	struct mbuf *mb1 = NULL, *mb2 = NULL;
+	char dir[256] = "", file[512] = "";
+	int err;
+
+	err = test_tmpdir(dir, sizeof(dir));
+	TEST_ERR(err);
+
+	if (re_snprintf(file, sizeof(file), "%s/dtls_srtp.pem", dir) < 0) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = conf_configure_buf((uint8_t *)modconfig, str_len(modconfig));
+	TEST_ERR(err);
+
+	conf_path_set(dir);
+
+	/* the first load generates and saves a certificate */
+	err = module_load(".", "dtls_srtp");
+	TEST_ERR(err);
+	module_unload("dtls_srtp");
+
+	err = read_file(&mb1, file);
+	TEST_ERR(err);
+
+	/* a fresh certificate is loaded again, not replaced */
+	err = module_load(".", "dtls_srtp");
+	TEST_ERR(err);
+	module_unload("dtls_srtp");
+
+	err = read_file(&mb2, file);
+	TEST_ERR(err);
+
+	TEST_MEMCMP(mb1->buf, mb1->end, mb2->buf, mb2->end);
+
+ out:
+	conf_path_set(NULL);
+	(void)conf_configure_buf((uint8_t *)test_modconfig,
+				 str_len(test_modconfig));
+	*conf_config() = cfg;
+
+	(void)remove(file);
+	(void)remove(dir);
+
+	mem_deref(mb2);
+	mem_deref(mb1);
+
+	return err;
+}
@@ -0,0 +1,857 @@
+/**
+ * @file test/loadgen.c  SIP and RTP load generator for Baresip core
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#ifdef HAVE_GETOPT
+#include <getopt.h>
+#endif
+#ifndef WIN32
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "test.h"
+#include "sip/sipsrv.h"
+
+
+/*
+ * The load generator starts the mock SIP server and a number of user
+ * agents on loopback. All agents register with the mock server, then
+ * calls are placed between pairs of agents at a fixed rate, held for a
+ * fixed duration with real audio (and optionally video) media, and
+ * hung up by the caller.
+ *
+ * The mock server is a registrar only, so INVITEs are sent directly to
+ * the local SIP address of the callee.
+ *
+ * When all calls are finished, a JSON report is written to stdout. The
+ * exit code is non-zero if any call failed.
+ */
+
+
+enum {
+	ASYNC_WORKERS = 4,
+	PACE_INTERVAL = 10,
+	SAMPLE_INTERVAL = 1000,
+	DRAIN_INTERVAL = 100,
+	DRAIN_TIMEOUT = 5000,
+};
+
+
+struct lcall {
+	struct le le;
+	struct call *call;
+	struct tmr tmr;
+};
+
+struct latency {
+	uint32_t *v;
+	uint32_t n;
+};
+
+static struct loadgen {
+	struct sip_server *srv;
+	struct ua **uav;
+	uint32_t uac;
+	uint32_t n_calls;
+	uint32_t cps;
+	uint32_t hold;
+	bool video;
+
+	struct list calll;
+	struct tmr tmr_pace;
+	struct tmr tmr_sample;
+	struct tmr tmr_drain;
+	uint64_t ts_reg;
+	uint64_t ts_start;
+	uint64_t ts_last_estab;
+	uint64_t ts_end;
+	uint64_t ts_drain;
+
+	uint32_t n_registered;
+	uint32_t n_placed;
+	uint32_t n_estab;
+	uint32_t n_failed;
+	uint32_t n_finished;
+	uint32_t n_active;
+	uint32_t peak_active;
+
+	struct latency setup;
+	struct latency media;
+
+	uint64_t rx_packets;
+	uint64_t rx_lost;
+	uint64_t jit_sum;
+	uint32_t jit_max;
+	uint32_t n_rtcp;
+
+	uint64_t rss_base;
+	uint64_t rss_peak;
+	uint32_t threads_peak;
+	uint64_t cpu_base;
+
+	int err;
+} lg;
+
+
+static uint64_t cpu_usage(void)
+{
+#ifndef WIN32
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru))
+		return 0;
+
+	return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+		ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+#else
+	return 0;
+#endif
+}
+
+
+/* resident set size in bytes */
+static uint64_t rss_usage(void)
+{
+	uint64_t rss = 0;
+#ifdef LINUX
+	unsigned long size, resident;
+	FILE *f;
+
+	f = fopen("/proc/self/statm", "r");
+	if (!f)
+		return 0;
+
+	if (fscanf(f, "%lu %lu", &size, &resident) == 2)
+		rss = (uint64_t)resident * sysconf(_SC_PAGESIZE);
+
+	(void)fclose(f);
+#endif
+	return rss;
+}
+
+
+static uint32_t thread_count(void)
+{
+	uint32_t n = 0;
+#ifdef LINUX
+	char line[256];
+	FILE *f;
+
+	f = fopen("/proc/self/status", "r");
+	if (!f)
+		return 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (1 == sscanf(line, "Threads: %u", &n))
+			break;
+	}
+
+	(void)fclose(f);
+#endif
+	return n;
+}
+
+
+static void sample(void)
+{
+	lg.rss_peak     = max(lg.rss_peak, rss_usage());
+	lg.threads_peak = max(lg.threads_peak, thread_count());
+}
+
+
+static void sample_handler(void *arg)
+{
+	(void)arg;
+
+	tmr_start(&lg.tmr_sample, SAMPLE_INTERVAL, sample_handler, NULL);
+
+	sample();
+}
+
+
+static void latency_add(struct latency *lat, int64_t t)
+{
+	if (t < 0 || lat->n >= lg.n_calls)
+		return;
+
+	lat->v[lat->n++] = (uint32_t)t;
+}
+
+
+static int u32_cmp(const void *a, const void *b)
+{
+	const uint32_t x = *(const uint32_t *)a;
+	const uint32_t y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+
+static int latency_encode(struct odict *od, const char *key,
+			  struct latency *lat)
+{
+	static const unsigned pctv[] = {50, 90, 95, 99};
+	struct odict *o;
+	uint64_t sum = 0;
+	char name[8];
+	int err;
+
+	err = odict_alloc(&o, 8);
+	if (err)
+		return err;
+
+	qsort(lat->v, lat->n, sizeof(*lat->v), u32_cmp);
+
+	for (uint32_t i=0; i<lat->n; i++)
+		sum += lat->v[i];
+
+	err  = odict_entry_add(o, "n", ODICT_INT, (int64_t)lat->n);
+	err |= odict_entry_add(o, "avg", ODICT_INT,
+			       (int64_t)(lat->n ? sum / lat->n : 0));
+
+	for (unsigned i=0; i<RE_ARRAY_SIZE(pctv); i++) {
+
+		uint32_t v = 0;
+
+		if (lat->n)
+			v = lat->v[(lat->n - 1) * pctv[i] / 100];
+
+		re_snprintf(name, sizeof(name), "p%u", pctv[i]);
+		err |= odict_entry_add(o, name, ODICT_INT, (int64_t)v);
+	}
+
+	err |= odict_entry_add(o, "max", ODICT_INT,
+			       (int64_t)(lat->n ? lat->v[lat->n - 1] : 0));
+	if (err)
+		goto out;
+
+	err = odict_entry_add(od, key, ODICT_OBJECT, o);
+
+ out:
+	mem_deref(o);
+
+	return err;
+}
+
+
+static void stream_sample(const struct stream *strm)
+{
+	const struct rtcp_stats *rs;
+
+	if (!strm)
+		return;
+
+	lg.rx_packets += stream_metric_get_rx_n_packets(strm);
+
+	rs = stream_rtcp_stats(strm);
+	if (!rs || !rs->rx.sent)
+		return;
+
+	if (rs->rx.lost > 0)
+		lg.rx_lost += rs->rx.lost;
+
+	lg.jit_sum += rs->rx.jit;
+	lg.jit_max  = max(lg.jit_max, rs->rx.jit);
+	++lg.n_rtcp;
+}
+
+
+static int report(void)
+{
+	struct odict *od = NULL, *o = NULL;
+	double dur, cps = 0.0;
+	uint64_t cpu = cpu_usage() - lg.cpu_base;
+	uint32_t peak = max(lg.peak_active, 1);
+	int err;
+
+	sample();
+
+	dur = (double)(lg.ts_end - lg.ts_start) / 1000.0;
+
+	if (lg.n_estab > 1 && lg.ts_last_estab > lg.ts_start)
+		cps = lg.n_estab * 1000.0 / (lg.ts_last_estab - lg.ts_start);
+
+	err  = odict_alloc(&od, 32);
+	err |= odict_alloc(&o, 8);
+	if (err)
+		goto out;
+
+	err  = odict_entry_add(o, "uas", ODICT_INT, (int64_t)lg.uac);
+	err |= odict_entry_add(o, "calls", ODICT_INT, (int64_t)lg.n_calls);
+	err |= odict_entry_add(o, "cps", ODICT_INT, (int64_t)lg.cps);
+	err |= odict_entry_add(o, "hold", ODICT_INT, (int64_t)lg.hold);
+	err |= odict_entry_add(o, "video", ODICT_BOOL, lg.video);
+	err |= odict_entry_add(od, "config", ODICT_OBJECT, o);
+	o = mem_deref(o);
+
+	err |= odict_entry_add(od, "version", ODICT_STRING, BARESIP_VERSION);
+	err |= odict_entry_add(od, "register_ms", ODICT_INT,
+			       (int64_t)(lg.ts_start - lg.ts_reg));
+	err |= odict_entry_add(od, "duration", ODICT_DOUBLE, dur);
+	err |= odict_entry_add(od, "placed", ODICT_INT,
+			       (int64_t)lg.n_placed);
+	err |= odict_entry_add(od, "established", ODICT_INT,
+			       (int64_t)lg.n_estab);
+	err |= odict_entry_add(od, "failed", ODICT_INT,
+			       (int64_t)lg.n_failed);
+	err |= odict_entry_add(od, "cps", ODICT_DOUBLE, cps);
+	err |= odict_entry_add(od, "peak_calls", ODICT_INT,
+			       (int64_t)lg.peak_active);
+	if (err)
+		goto out;
+
+	err  = latency_encode(od, "setup_ms", &lg.setup);
+	err |= latency_encode(od, "media_ms", &lg.media);
+	if (err)
+		goto out;
+
+	err  = odict_alloc(&o, 8);
+	if (err)
+		goto out;
+
+	err  = odict_entry_add(o, "packets", ODICT_INT,
+			       (int64_t)lg.rx_packets);
+	err |= odict_entry_add(o, "lost", ODICT_INT, (int64_t)lg.rx_lost);
+	err |= odict_entry_add(o, "loss", ODICT_DOUBLE,
+			       lg.rx_packets ?
+			       (double)lg.rx_lost /
+			       (lg.rx_packets + lg.rx_lost) : 0.0);
+	err |= odict_entry_add(o, "reports", ODICT_INT, (int64_t)lg.n_rtcp);
+	err |= odict_entry_add(o, "jitter_avg_us", ODICT_INT,
+			       (int64_t)(lg.n_rtcp ?
+					 lg.jit_sum / lg.n_rtcp : 0));
+	err |= odict_entry_add(o, "jitter_max_us", ODICT_INT,
+			       (int64_t)lg.jit_max);
+	err |= odict_entry_add(od, "rtp", ODICT_OBJECT, o);
+	o = mem_deref(o);
+	if (err)
+		goto out;
+
+	err  = odict_alloc(&o, 8);
+	if (err)
+		goto out;
+
+	err  = odict_entry_add(o, "cpu_ms", ODICT_INT, (int64_t)(cpu / 1000));
+	err |= odict_entry_add(o, "cpu_us_per_call", ODICT_INT,
+			       (int64_t)(lg.n_placed ? cpu / lg.n_placed : 0));
+	err |= odict_entry_add(o, "rss_base", ODICT_INT,
+			       (int64_t)lg.rss_base);
+	err |= odict_entry_add(o, "rss_peak", ODICT_INT,
+			       (int64_t)lg.rss_peak);
+	err |= odict_entry_add(o, "rss_per_call", ODICT_INT,
+			       (int64_t)(lg.rss_peak > lg.rss_base ?
+					 (lg.rss_peak - lg.rss_base) / peak :
+					 0));
+	err |= odict_entry_add(o, "threads_peak", ODICT_INT,
+			       (int64_t)lg.threads_peak);
+	err |= odict_entry_add(od, "process", ODICT_OBJECT, o);
+	if (err)
+		goto out;
+
+	err = re_printf("%H\n", json_encode_odict, od);
+
+ out:
+	mem_deref(o);
+	mem_deref(od);
+
+	return err;
+}
+
+
+static void drain_handler(void *arg)
+{
+	(void)arg;
+
+	if (uag_call_count() &&
+	    tmr_jiffies() < lg.ts_drain + DRAIN_TIMEOUT) {
+		tmr_start(&lg.tmr_drain, DRAIN_INTERVAL, drain_handler, NULL);
+		return;
+	}
+
+	re_cancel();
+}
+
+
+static void finish(void)
+{
+	lg.ts_end = lg.ts_drain = tmr_jiffies();
+	tmr_start(&lg.tmr_drain, 0, drain_handler, NULL);
+}
+
+
+static void lcall_destructor(void *arg)
+{
+	struct lcall *lc = arg;
+
+	tmr_cancel(&lc->tmr);
+	list_unlink(&lc->le);
+}
+
+
+static void hold_handler(void *arg)
+{
+	struct lcall *lc = arg;
+
+	ua_hangup(call_get_ua(lc->call), lc->call, 0, NULL);
+}
+
+
+static struct lcall *lcall_find(const struct call *call)
+{
+	for (struct le *le = lg.calll.head; le; le = le->next) {
+
+		struct lcall *lc = le->data;
+
+		if (lc->call == call)
+			return lc;
+	}
+
+	return NULL;
+}
+
+
+static void call_closed(struct call *call)
+{
+	struct lcall *lc;
+
+	stream_sample(audio_strm(call_audio(call)));
+	stream_sample(video_strm(call_video(call)));
+
+	if (!call_is_outgoing(call))
+		return;
+
+	lc = lcall_find(call);
+	if (lc) {
+		latency_add(&lg.media,
+			    call_setup_time(call, CALL_SETUP_RTP));
+		mem_deref(lc);
+	}
+	else {
+		++lg.n_failed;
+	}
+
+	--lg.n_active;
+	++lg.n_finished;
+
+	if (lg.n_finished >= lg.n_calls)
+		finish();
+}
+
+
+static void call_established(struct call *call)
+{
+	struct lcall *lc;
+
+	if (!call_is_outgoing(call))
+		return;
+
+	lc = mem_zalloc(sizeof(*lc), lcall_destructor);
+	if (!lc) {
+		ua_hangup(call_get_ua(call), call, 0, NULL);
+		return;
+	}
+
+	lc->call = call;
+	list_append(&lg.calll, &lc->le, lc);
+
+	++lg.n_estab;
+	lg.ts_last_estab = tmr_jiffies();
+	latency_add(&lg.setup, call_setup_time(call, CALL_SETUP_ESTABLISHED));
+
+	tmr_start(&lc->tmr, lg.hold, hold_handler, lc);
+}
+
+
+static int place_call(void)
+{
+	uint32_t pairs = lg.uac / 2;
+	uint32_t i = lg.n_placed % pairs;
+	struct sa laddr;
+	char uri[256];
+	int err;
+
+	err = sip_transp_laddr(uag_sip(), &laddr, SIP_TRANSP_UDP, NULL);
+	if (err)
+		return err;
+
+	re_snprintf(uri, sizeof(uri), "sip:u%u@%J", 2*i + 1, &laddr);
+
+	++lg.n_placed;
+
+	err = ua_connect(lg.uav[2*i], NULL, NULL, uri,
+			 lg.video ? VIDMODE_ON : VIDMODE_OFF);
+	if (err) {
+		warning("loadgen: call to %s failed (%m)\n", uri, err);
+		++lg.n_failed;
+		++lg.n_finished;
+		return err;
+	}
+
+	++lg.n_active;
+	lg.peak_active = max(lg.peak_active, lg.n_active);
+
+	return 0;
+}
+
+
+static void pace_handler(void *arg)
+{
+	uint64_t due;
+	(void)arg;
+
+	due = (tmr_jiffies() - lg.ts_start) * lg.cps / 1000 + 1;
+
+	while (lg.n_placed < min(due, lg.n_calls))
+		(void)place_call();
+
+	if (lg.n_placed < lg.n_calls)
+		tmr_start(&lg.tmr_pace, PACE_INTERVAL, pace_handler, NULL);
+	else if (lg.n_finished >= lg.n_calls)
+		finish();
+}
+
+
+static void start_calls(void)
+{
+	info("loadgen: %u agents registered in %llu ms\n",
+	     lg.uac, tmr_jiffies() - lg.ts_reg);
+
+	sample();
+	lg.rss_base = rss_usage();
+	lg.cpu_base = cpu_usage();
+	lg.ts_start = tmr_jiffies();
+
+	tmr_start(&lg.tmr_sample, SAMPLE_INTERVAL, sample_handler, NULL);
+	tmr_start(&lg.tmr_pace, 0, pace_handler, NULL);
+}
+
+
+static void event_handler(struct ua *ua, enum ua_event ev,
+			  struct call *call, const char *prm, void *arg)
+{
+	int err;
+	(void)arg;
+
+	switch (ev) {
+
+	case UA_EVENT_REGISTER_OK:
+		if (++lg.n_registered == lg.uac)
+			start_calls();
+		break;
+
+	case UA_EVENT_REGISTER_FAIL:
+		warning("loadgen: %s: register failed (%s)\n",
+			account_aor(ua_account(ua)), prm);
+		lg.err = EPROTO;
+		re_cancel();
+		break;
+
+	case UA_EVENT_CALL_INCOMING:
+		err = ua_answer(ua, call, VIDMODE_ON);
+		if (err)
+			warning("loadgen: answer failed (%m)\n", err);
+		break;
+
+	case UA_EVENT_CALL_ESTABLISHED:
+		call_established(call);
+		break;
+
+	case UA_EVENT_CALL_CLOSED:
+		call_closed(call);
+		break;
+
+	default:
+		break;
+	}
+}
+
+
+static void sip_server_exit_handler(void *arg)
+{
+	(void)arg;
+	re_cancel();
+}
+
+
+static int agents_alloc(void)
+{
+	char srv[256];
+	struct sa laddr;
+	int err;
+
+	err = sip_server_alloc(&lg.srv, sip_server_exit_handler, NULL);
+	if (err) {
+		warning("loadgen: could not start sip server (%m)\n", err);
+		return err;
+	}
+
+	err = sip_transp_laddr(lg.srv->sip, &laddr, SIP_TRANSP_UDP, NULL);
+	if (err)
+		return err;
+
+	re_snprintf(srv, sizeof(srv), "%J", &laddr);
+
+	lg.uav = mem_zalloc(lg.uac * sizeof(*lg.uav), NULL);
+	if (!lg.uav)
+		return ENOMEM;
+
+	for (uint32_t i=0; i<lg.uac; i++) {
+
+		char aor[256];
+
+		re_snprintf(aor, sizeof(aor),
+			    "<sip:u%u@%s>;regint=600"
+			    ";audio_player=mock-auplay,u%u", i, srv, i);
+
+		err = ua_alloc(&lg.uav[i], aor);
+		if (err)
+			return err;
+
+		err = ua_register(lg.uav[i]);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+
+static void agents_close(void)
+{
+	for (uint32_t i=0; lg.uav && i<lg.uac; i++)
+		mem_deref(lg.uav[i]);
+
+	lg.uav = mem_deref(lg.uav);
+	lg.srv = mem_deref(lg.srv);
+}
+
+
+static int run(void)
+{
+	struct auplay *auplay = NULL;
+	struct vidisp *vidisp = NULL;
+	uint32_t timeout;
+	int err;
+
+	lg.setup.v = mem_zalloc(lg.n_calls * sizeof(uint32_t), NULL);
+	lg.media.v = mem_zalloc(lg.n_calls * sizeof(uint32_t), NULL);
+	if (!lg.setup.v || !lg.media.v) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = ua_init("loadgen", true, false, false);
+	if (err)
+		goto out;
+
+	err  = module_load(".", "g711");
+	err |= module_load(".", "ausine");
+	if (err)
+		goto out;
+
+	err = mock_auplay_register(&auplay, baresip_auplayl(), NULL, NULL);
+	if (err)
+		goto out;
+
+	if (lg.video) {
+		mock_vidcodec_register();
+
+		err = mock_vidisp_register(&vidisp, NULL, NULL);
+		if (err)
+			goto out;
+
+		err = module_load(".", "fakevideo");
+		if (err)
+			goto out;
+	}
+
+	err = uag_event_register(event_handler, NULL);
+	if (err)
+		goto out;
+
+	lg.ts_reg = tmr_jiffies();
+
+	err = agents_alloc();
+	if (err)
+		goto out;
+
+	timeout = lg.n_calls * 1000 / lg.cps + lg.hold + 30000;
+
+	err = re_main_timeout(timeout);
+	if (err) {
+		warning("loadgen: timeout after %u ms (%u/%u calls done)\n",
+			timeout, lg.n_finished, lg.n_calls);
+		lg.ts_end = tmr_jiffies();
+	}
+
+	if (lg.err)
+		err = lg.err;
+
+	if (lg.ts_start)
+		err |= report();
+
+	if (!err && lg.n_failed)
+		err = EPROTO;
+
+ out:
+	tmr_cancel(&lg.tmr_pace);
+	tmr_cancel(&lg.tmr_sample);
+	tmr_cancel(&lg.tmr_drain);
+	list_flush(&lg.calll);
+
+	uag_event_unregister(event_handler);
+	agents_close();
+	ua_stop_all(true);
+
+	if (lg.video) {
+		module_unload("fakevideo");
+		mem_deref(vidisp);
+		mock_vidcodec_unregister();
+	}
+
+	mem_deref(auplay);
+	module_unload("ausine");
+	module_unload("g711");
+
+	ua_close();
+
+	mem_deref(lg.setup.v);
+	mem_deref(lg.media.v);
+
+	return err;
+}
+
+
+static void usage(void)
+{
+	(void)re_fprintf(stderr,
+			 "Usage: loadgen [options]\n"
+			 "options:\n"
+			 "\t-u <n>       Number of user agents (default 10)\n"
+			 "\t-n <n>       Number of calls (default 100)\n"
+			 "\t-r <cps>     Calls per second (default 10)\n"
+			 "\t-d <ms>      Call hold duration (default 5000)\n"
+			 "\t-V           Enable video\n"
+			 "\t-v           Verbose output (INFO level)\n"
+			 );
+}
+
+
+static const char *modconfig =
+	"ausrc_format    s16\n"
+	"call_max_calls  0\n";
+
+
+int main(int argc, char *argv[])
+{
+	struct config *config;
+	struct sa sa;
+	int err;
+
+	lg.uac     = 10;
+	lg.n_calls = 100;
+	lg.cps     = 10;
+	lg.hold    = 5000;
+
+	err = libre_init();
+	if (err)
+		return err;
+
+	log_enable_info(false);
+	re_thread_async_init(ASYNC_WORKERS);
+
+#ifdef HAVE_GETOPT
+	for (;;) {
+		const int c = getopt(argc, argv, "hu:n:r:d:Vv");
+		if (0 > c)
+			break;
+
+		switch (c) {
+
+		case '?':
+		case 'h':
+			usage();
+			return -2;
+
+		case 'u':
+			lg.uac = (uint32_t)atoi(optarg);
+			break;
+
+		case 'n':
+			lg.n_calls = (uint32_t)atoi(optarg);
+			break;
+
+		case 'r':
+			lg.cps = (uint32_t)atoi(optarg);
+			break;
+
+		case 'd':
+			lg.hold = (uint32_t)atoi(optarg);
+			break;
+
+		case 'V':
+			lg.video = true;
+			break;
+
+		case 'v':
+			log_enable_info(true);
+			break;
+
+		default:
+			break;
+		}
+	}
+#else
+	(void)argc;
+	(void)argv;
+#endif
+
+	if (lg.uac < 2 || !lg.n_calls || !lg.cps) {
+		usage();
+		return -2;
+	}
+
+	err = conf_configure_buf((uint8_t *)modconfig, str_len(modconfig));
+	if (err) {
+		warning("loadgen: configure failed: %m\n", err);
+		goto out;
+	}
+
+	config = conf_config();
+	if (!config) {
+		err = ENOENT;
+		goto out;
+	}
+
+	/* note: run SIP and RTP traffic on localhost */
+	err = baresip_init(config);
+	err |= sa_set_str(&sa, "127.0.0.1", 0);
+	err |= net_add_address(baresip_network(), &sa);
+	if (err)
+		goto out;
+
+	str_ncpy(config->sip.local, "0.0.0.0:0", sizeof(config->sip.local));
+	config->sip.verify_server = false;
+
+	err = run();
+
+ out:
+	if (err)
+		warning("loadgen: failed (%m)\n", err);
+
+	conf_close();
+	baresip_close();
+
+	re_thread_async_close();
+
+	libre_close();
+
+	return err ? 1 : 0;
+}
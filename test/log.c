@@ -0,0 +1,239 @@
+/**
+ * @file test/log.c  Baresip selftest -- asynchronous and rate-limited log
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "../src/core.h"
+#include "test.h"
+
+
+enum {
+	NUM_THREADS = 4,
+	NUM_MSGS    = 100,      /* per thread, all fit in the ring */
+	NUM_FLOOD   = 1000,     /* more than the ring holds        */
+	RING_SIZE   = 512,      /* see src/log.c                   */
+	RL_BURST    = 10,       /* see src/log.c                   */
+	NUM_RL      = 100,
+};
+
+
+static struct {
+	mtx_t *mtx;
+	cnd_t cnd;
+	bool block;             /* the handler blocks on "block"   */
+	bool blocked;
+	unsigned n;             /* "log-test" messages             */
+	unsigned next[NUM_THREADS];
+	bool order_err;
+	unsigned dropped;
+	unsigned n_rl;          /* "log-rl" messages               */
+	unsigned suppressed;
+} tl;
+
+
+static void log_handler(uint32_t level, const char *msg)
+{
+	struct pl id, seq, num;
+	unsigned i;
+	(void)level;
+
+	if (!re_regex(msg, str_len(msg), "log-test [0-9]+ [0-9]+",
+		      &id, &seq)) {
+
+		i = pl_u32(&id);
+		if (i >= NUM_THREADS || pl_u32(&seq) < tl.next[i])
+			tl.order_err = true;
+		else
+			tl.next[i] = pl_u32(&seq) + 1;
+
+		++tl.n;
+	}
+	else if (!re_regex(msg, str_len(msg), "log: dropped [0-9]+ messages",
+			   &num)) {
+		tl.dropped += pl_u32(&num);
+	}
+	else if (!re_regex(msg, str_len(msg), "(suppressed [0-9]+ similar",
+			   &num)) {
+		tl.suppressed += pl_u32(&num);
+	}
+	else if (!re_regex(msg, str_len(msg), "log-rl", NULL)) {
+		++tl.n_rl;
+	}
+	else if (!re_regex(msg, str_len(msg), "log-block", NULL)) {
+
+		mtx_lock(tl.mtx);
+		tl.blocked = true;
+		cnd_signal(&tl.cnd);
+		while (tl.block)
+			cnd_wait(&tl.cnd, tl.mtx);
+		mtx_unlock(tl.mtx);
+	}
+}
+
+
+static struct log lh = {
+	.h = log_handler,
+};
+
+
+static int log_thread(void *arg)
+{
+	unsigned id = (unsigned)(uintptr_t)arg;
+
+	for (unsigned i = 0; i < NUM_MSGS; i++)
+		warning("log-test %u %u\n", id, i);
+
+	return 0;
+}
+
+
+static int log_setup(void)
+{
+	int err;
+
+	memset(&tl, 0, sizeof(tl));
+
+	err = mutex_alloc(&tl.mtx);
+	if (err)
+		return err;
+
+	if (cnd_init(&tl.cnd) != thrd_success) {
+		tl.mtx = mem_deref(tl.mtx);
+		return ENOMEM;
+	}
+
+	log_enable_stdout(false);
+	log_register_handler(&lh);
+
+	return 0;
+}
+
+
+static void log_teardown(void)
+{
+	(void)log_enable_async(false);
+
+	log_unregister_handler(&lh);
+	log_enable_stdout(true);
+
+	if (!tl.mtx)
+		return;
+
+	cnd_destroy(&tl.cnd);
+	tl.mtx = mem_deref(tl.mtx);
+}
+
+
+/*
+ * Messages from several producer threads are all written once async
+ * logging is disabled again, each thread's messages in order. When the
+ * ring is full, messages are dropped and the drop count is reported.
+ */
+int test_log_async(void)
+{
+	thrd_t thrv[NUM_THREADS];
+	unsigned i, n = 0;
+	int err;
+
+	err = log_setup();
+	TEST_ERR(err);
+
+	err = log_enable_async(true);
+	TEST_ERR(err);
+
+	for (i = 0; i < NUM_THREADS; i++) {
+		err = thread_create_name(&thrv[i], "log-test", log_thread,
+					 (void *)(uintptr_t)i);
+		if (err)
+			break;
+		++n;
+	}
+
+	for (i = 0; i < n; i++)
+		thrd_join(thrv[i], NULL);
+
+	TEST_ERR(err);
+
+	/* all pending messages are written */
+	err = log_enable_async(false);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(!tl.order_err);
+	ASSERT_EQ(NUM_THREADS * NUM_MSGS, tl.n);
+	ASSERT_EQ(0, tl.dropped);
+
+	/* overflow, the consumer blocks in the handler */
+	memset(tl.next, 0, sizeof(tl.next));
+	tl.n = 0;
+	tl.block = true;
+
+	err = log_enable_async(true);
+	TEST_ERR(err);
+
+	warning("log-block\n");
+
+	mtx_lock(tl.mtx);
+	while (!tl.blocked)
+		cnd_wait(&tl.cnd, tl.mtx);
+	mtx_unlock(tl.mtx);
+
+	for (i = 0; i < NUM_FLOOD; i++)
+		warning("log-test 0 %u\n", i);
+
+	mtx_lock(tl.mtx);
+	tl.block = false;
+	cnd_broadcast(&tl.cnd);
+	mtx_unlock(tl.mtx);
+
+	err = log_enable_async(false);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(!tl.order_err);
+	ASSERT_EQ(NUM_FLOOD, tl.n + tl.dropped);
+	ASSERT_TRUE(tl.dropped >= NUM_FLOOD - RING_SIZE);
+
+ out:
+	if (tl.mtx) {
+		mtx_lock(tl.mtx);
+		tl.block = false;
+		cnd_broadcast(&tl.cnd);
+		mtx_unlock(tl.mtx);
+	}
+
+	log_teardown();
+
+	return err;
+}
+
+
+/*
+ * A call site passes a burst of messages, the rest within the interval
+ * is suppressed. Every message is either written or counted as
+ * suppressed.
+ */
+int test_log_ratelimit(void)
+{
+	struct log_ratelimit rl;
+	int err;
+
+	memset(&rl, 0, sizeof(rl));
+
+	err = log_setup();
+	TEST_ERR(err);
+
+	for (unsigned i = 0; i < NUM_RL; i++)
+		loglv_ratelimit(&rl, LEVEL_WARN, "log-rl %u\n", i);
+
+	ASSERT_TRUE(tl.n_rl >= RL_BURST);
+	ASSERT_TRUE(tl.n_rl < NUM_RL);
+	ASSERT_EQ(NUM_RL, tl.n_rl + tl.suppressed +
+		  re_atomic_rlx(&rl.suppressed));
+
+ out:
+	log_teardown();
+
+	return err;
+}
@@ -28,15 +28,21 @@ static const struct test tests[] = {
 	TEST(test_call_answer_hangup_a),
 	TEST(test_call_answer_hangup_b),
 	TEST(test_call_aulevel),
+	TEST(test_call_bcast),
 	TEST(test_call_custom_headers),
 	TEST(test_call_dtmf),
 	TEST(test_call_format_float),
+	TEST(test_call_format_multich),
 	TEST(test_call_max),
 	TEST(test_call_mediaenc),
 	TEST(test_call_medianat),
 	TEST(test_call_multiple),
 	TEST(test_call_progress),
 	TEST(test_call_reject),
+	TEST(test_call_relay),
+	TEST(test_call_relay_video),
+	TEST(test_call_relay_map),
+	TEST(test_call_sfu),
 	TEST(test_call_rtcp),
 	TEST(test_call_rtp_timeout),
 	TEST(test_call_tcp),
@@ -45,6 +51,8 @@ static const struct test tests[] = {
 	TEST(test_call_transfer_fail),
 	TEST(test_call_attended_transfer),
 	TEST(test_call_video),
+	TEST(test_call_video_simulcast),
+	TEST(test_call_video_simulcast_send),
 	TEST(test_call_change_videodir),
 	TEST(test_call_webrtc),
 	TEST(test_call_bundle),
@@ -53,16 +61,33 @@ static const struct test tests[] = {
 	TEST(test_call_100rel_video),
 	TEST(test_call_hold_resume),
 	TEST(test_call_srtp_tx_rekey),
+	TEST(test_call_setup_timeline),
 	TEST(test_cmd),
 	TEST(test_cmd_long),
+	TEST(test_cmd_args),
 	TEST(test_contact),
+	TEST(test_ctrl_tcp),
+	TEST(test_dtls_cert_cache),
 	TEST(test_event),
 	TEST(test_jbuf),
 	TEST(test_jbuf_adaptive),
 	TEST(test_jbuf_adaptive_video),
+	TEST(test_log_async),
+	TEST(test_log_ratelimit),
+	TEST(test_mclock),
+	TEST(test_mcu),
+	TEST(test_mempool),
 	TEST(test_message),
 	TEST(test_network),
 	TEST(test_play),
+	TEST(test_play_wav),
+	TEST(test_playout),
+	TEST(test_presence_jitter),
+	TEST(test_presence_pace),
+	TEST(test_presence_rls),
+	TEST(test_rtpext),
+	TEST(test_rtpport),
+	TEST(test_srtp_prefer_aead),
 	TEST(test_stunuri),
 	TEST(test_ua_alloc),
 	TEST(test_ua_options),
@@ -78,6 +103,14 @@ static const struct test tests[] = {
 };
 
 
+/* performance tests, only run when given by name */
+static const struct test tests_perf[] = {
+	TEST(test_auresamp_perf),
+	TEST(test_mcu_perf),
+	TEST(test_srtp_perf),
+};
+
+
 static int run_one_test(const struct test *test)
 {
 	struct config *config = conf_config();
@@ -196,6 +229,12 @@ static void test_listcases(void)
 				(i+(n+1)/2) < n ? tests[i+(n+1)/2].name : "");
 	}
 
+	(void)re_printf("\n%zu performance test cases:\n",
+			RE_ARRAY_SIZE(tests_perf));
+
+	for (i=0; i<RE_ARRAY_SIZE(tests_perf); i++)
+		(void)re_printf("    %s\n", tests_perf[i].name);
+
 	(void)re_printf("\n");
 }
 
@@ -210,6 +249,12 @@ static const struct test *find_test(const char *name)
 			return &tests[i];
 	}
 
+	for (i=0; i<RE_ARRAY_SIZE(tests_perf); i++) {
+
+		if (0 == str_casecmp(name, tests_perf[i].name))
+			return &tests_perf[i];
+	}
+
 	return NULL;
 }
 
@@ -236,7 +281,7 @@ static void usage(void)
 }
 
 
-static const char *modconfig =
+const char *test_modconfig =
 	"ausrc_format    s16\n";
 
 
@@ -306,7 +351,8 @@ int main(int argc, char *argv[])
 	re_printf("running baresip selftest version %s with %zu tests\n",
 		  BARESIP_VERSION, ntests);
 
-	err = conf_configure_buf((uint8_t *)modconfig, str_len(modconfig));
+	err = conf_configure_buf((uint8_t *)test_modconfig,
+				 str_len(test_modconfig));
 	if (err) {
 		warning("main: configure failed: %m\n", err);
 		goto out;
@@ -0,0 +1,138 @@
+/**
+ * @file test/mclock.c  Media clock Testcode
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+enum {
+	WAIT_MS = 5000,             /**< Upper limit for waiting [ms] */
+	TICKS   = 10,
+};
+
+
+struct clk {
+	struct mclock * RE_ATOMIC mc;
+	RE_ATOMIC unsigned n;
+	uint64_t ts;
+	uint32_t ptime;
+	bool ts_ok;
+};
+
+
+/* take the clock, only one of the handler and the test gets it */
+static struct mclock *clk_take(struct clk *clk)
+{
+	struct mclock *mc = re_atomic_acq(&clk->mc);
+
+	while (mc && !re_atomic_compare_exchange_weak(&clk->mc, &mc, NULL,
+					re_memory_order_acq_rel,
+					re_memory_order_acquire))
+		;
+
+	return mc;
+}
+
+
+static int clk_start(struct clk *clk, int flags, mclock_h *h)
+{
+	struct mclock *mc;
+	int err;
+
+	err = mclock_start(&mc, clk->ptime, flags, h, clk);
+	if (err)
+		return err;
+
+	re_atomic_rls_set(&clk->mc, mc);
+
+	return 0;
+}
+
+
+static void tick_handler(uint64_t ts, void *arg)
+{
+	struct clk *clk = arg;
+
+	/* nominal timestamps advance by exactly one packet-time */
+	if (clk->ts && ts != clk->ts + clk->ptime * 1000)
+		clk->ts_ok = false;
+
+	clk->ts = ts;
+	re_atomic_rlx_add(&clk->n, 1);
+}
+
+
+static void self_stop_handler(uint64_t ts, void *arg)
+{
+	struct clk *clk = arg;
+	struct mclock *mc = clk_take(clk);
+	(void)ts;
+
+	/* not stored yet, or already stopped */
+	if (!mc)
+		return;
+
+	re_atomic_rlx_add(&clk->n, 1);
+	mem_deref(mc);
+}
+
+
+/*
+ * The checks do not depend on the scheduling of the test: the number
+ * of callbacks is compared with the time that has actually passed, and
+ * waits are bounded by WAIT_MS.
+ */
+int test_mclock(void)
+{
+	struct clk clkv[3] = {
+		{NULL, 0, 0, 5,  true},
+		{NULL, 0, 0, 10, true},
+		{NULL, 0, 0, 5,  true},
+	};
+	uint64_t t0, t;
+	unsigned n;
+	size_t i;
+	int err;
+
+	t0 = tmr_jiffies();
+
+	err  = clk_start(&clkv[0], 0, tick_handler);
+	err |= clk_start(&clkv[1], MCLOCK_DEDICATED, tick_handler);
+	err |= clk_start(&clkv[2], 0, self_stop_handler);
+	TEST_ERR(err);
+
+	while (tmr_jiffies() - t0 < WAIT_MS &&
+	       (re_atomic_rlx(&clkv[0].n) < TICKS ||
+		re_atomic_rlx(&clkv[1].n) < TICKS ||
+		re_atomic_rlx(&clkv[2].n) < 1))
+		sys_msleep(5);
+
+	for (i=0; i<2; i++) {
+		mem_deref(clk_take(&clkv[i]));
+
+		/* late callbacks are caught up, but never run ahead */
+		t = tmr_jiffies() - t0;
+		n = re_atomic_rlx(&clkv[i].n);
+		ASSERT_TRUE(n >= TICKS);
+		ASSERT_TRUE(n <= t / clkv[i].ptime + 1);
+		ASSERT_TRUE(clkv[i].ts_ok);
+	}
+
+	/* no callbacks after the clock is dereferenced */
+	n = re_atomic_rlx(&clkv[0].n);
+	sys_msleep(20);
+	ASSERT_EQ((int)n, (int)re_atomic_rlx(&clkv[0].n));
+
+	/* a clock may stop itself from its handler */
+	ASSERT_EQ(1, (int)re_atomic_rlx(&clkv[2].n));
+	ASSERT_TRUE(re_atomic_acq(&clkv[2].mc) == NULL);
+
+ out:
+	for (i=0; i<RE_ARRAY_SIZE(clkv); i++)
+		mem_deref(clk_take(&clkv[i]));
+
+	return err;
+}
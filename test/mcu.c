@@ -0,0 +1,71 @@
+/**
+ * @file test/mcu.c  Baresip selftest -- video compositor
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+static int print_handler(const char *p, size_t size, void *arg)
+{
+	(void)arg;
+
+	info("%b", p, size);
+
+	return 0;
+}
+
+
+static struct re_printf pf_info = {print_handler, NULL};
+
+
+static int mcu_command(const char *cmd)
+{
+	int err;
+
+	err = module_load(".", "mcu");
+	if (err)
+		return err;
+
+	err = cmd_process_long(baresip_commands(), cmd, str_len(cmd),
+			       &pf_info, NULL);
+
+	module_unload("mcu");
+
+	return err;
+}
+
+
+/*
+ * The SSE2 or NEON scaling kernels give the same result as the C
+ * kernels, for all row widths.
+ */
+int test_mcu(void)
+{
+	int err;
+
+	err = mcu_command("mcu_selftest");
+	TEST_ERR(err);
+
+ out:
+	return err;
+}
+
+
+/*
+ * Canvas frame rate with all tiles changed, for 720p and 1080p canvases
+ * with 4, 9 and 16 tiles.
+ * Not part of the default run; use "selftest -v test_mcu_perf".
+ */
+int test_mcu_perf(void)
+{
+	int err;
+
+	err = mcu_command("mcu_bench");
+	TEST_ERR(err);
+
+ out:
+	return err;
+}
@@ -0,0 +1,119 @@
+/**
+ * @file test/mempool.c  Memory pool Testcode
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "test.h"
+
+
+enum {
+	POOL_OBJS = 1024,
+};
+
+
+static int pool_thread(void *arg)
+{
+	struct mbuf **mbp = arg;
+
+	*mbp = mempool_mbuf(1000);
+	if (*mbp)
+		(void)mbuf_write_str(*mbp, "thread");
+
+	return 0;
+}
+
+
+static int release_thread(void *arg)
+{
+	mem_deref(arg);
+
+	return 0;
+}
+
+
+int test_mempool(void)
+{
+	static const struct vidsz sz = {64, 48};
+	struct mbuf *mb = NULL, *mb2 = NULL, *mbt = NULL;
+	struct vidframe *vf = NULL;
+	void *pv[POOL_OBJS] = {NULL};
+	void *p;
+	bool found = false;
+	thrd_t thr;
+	size_t i;
+	int err = 0;
+
+	/* a released object is handed out again, objects in use are not */
+	p = mempool_alloc(100);
+	ASSERT_TRUE(p != NULL);
+	mem_deref(p);
+
+	for (i = 0; i < RE_ARRAY_SIZE(pv); i++) {
+
+		pv[i] = mempool_alloc(120);
+		ASSERT_TRUE(pv[i] != NULL);
+		ASSERT_TRUE(i == 0 || pv[i] != pv[i-1]);
+
+		if (pv[i] == p) {
+			found = true;
+			break;
+		}
+	}
+
+	ASSERT_TRUE(found);
+
+	/* an object released by another thread is on the free list */
+	p = mempool_alloc(3000);
+	ASSERT_TRUE(p != NULL);
+	memset(p, 0xa5, 3000);
+
+	err = thread_create_name(&thr, "mempool", release_thread, p);
+	TEST_ERR(err);
+	thrd_join(thr, NULL);
+
+	ASSERT_TRUE(p == mempool_alloc(4000));
+	mem_deref(p);
+
+	mb = mempool_mbuf(300);
+	ASSERT_TRUE(mb != NULL);
+	ASSERT_TRUE(mb->size >= 300);
+	ASSERT_EQ(0, (int)mb->end);
+
+	err = mbuf_write_str(mb, "hello world");
+	TEST_ERR(err);
+	mb->pos = 6;
+
+	mb2 = mempool_mbuf_dup(mb);
+	ASSERT_TRUE(mb2 != NULL);
+	ASSERT_TRUE(mb2 != mb);
+	ASSERT_EQ(6, (int)mb2->pos);
+	TEST_MEMCMP(mb->buf, mb->end, mb2->buf, mb2->end);
+
+	err = mempool_vidframe(&vf, VID_FMT_YUV420P, &sz);
+	TEST_ERR(err);
+	ASSERT_TRUE(vidframe_isvalid(vf));
+	ASSERT_TRUE(vidsz_cmp(&sz, &vf->size));
+
+	/* objects stay valid after the thread and its pool are gone */
+	err = thread_create_name(&thr, "mempool", pool_thread, &mbt);
+	TEST_ERR(err);
+	thrd_join(thr, NULL);
+
+	ASSERT_TRUE(mbt != NULL);
+	TEST_MEMCMP("thread", 6, mbt->buf, mbt->end);
+
+ out:
+	for (i = 0; i < RE_ARRAY_SIZE(pv); i++)
+		mem_deref(pv[i]);
+
+	mem_deref(mbt);
+	mem_deref(vf);
+	mem_deref(mb2);
+	mem_deref(mb);
+
+	return err;
+}
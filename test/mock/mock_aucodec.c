@@ -83,6 +83,15 @@ static struct aucodec aucmock = {
 
 void mock_aucodec_register(void)
 {
+	mock_aucodec_register_ch(2);
+}
+
+
+void mock_aucodec_register_ch(uint8_t ch)
+{
+	aucmock.ch  = ch;
+	aucmock.pch = ch;
+
 	aucodec_register(baresip_aucodecl(), &aucmock);
 }
 
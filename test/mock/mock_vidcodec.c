@@ -5,6 +5,7 @@
  */
 
 #include <string.h>
+#include <re_atomic.h>
 #include <re.h>
 #include <rem.h>
 #include <baresip.h>
@@ -31,6 +32,9 @@ struct viddec_state {
 };
 
 
+static RE_ATOMIC unsigned n_update;
+
+
 static int hdr_decode(struct hdr *hdr, struct mbuf *mb)
 {
 	if (mbuf_get_left(mb) < HDR_SIZE)
@@ -89,11 +93,13 @@ static int mock_encode(struct videnc_state *ves, bool update,
 	uint8_t payload[2] = {0,0};
 	uint64_t rtp_ts;
 	int err;
-	(void)update;
 
 	if (!ves || !frame)
 		return EINVAL;
 
+	if (update)
+		re_atomic_rlx_add(&n_update, 1);
+
 	hdr = mbuf_alloc(16);
 
 	err  = mbuf_write_u32(hdr, htonl(frame->fmt));
@@ -194,6 +200,13 @@ static struct vidcodec vc_dummy = {
 };
 
 
+/* Number of frames encoded with a picture update request */
+unsigned mock_vidcodec_n_update(void)
+{
+	return re_atomic_rlx(&n_update);
+}
+
+
 void mock_vidcodec_register(void)
 {
 	vidcodec_register(baresip_vidcodecl(), &vc_dummy);
@@ -3,6 +3,7 @@
  *
  * Copyright (C) 2010 Alfred E. Heggestad
  */
+#include <stdio.h>
 #include <string.h>
 #include <re.h>
 #include <rem.h>
@@ -103,3 +104,147 @@ int test_play(void)
 	mem_deref(auplay);
 	return err;
 }
+
+
+static int write_wav(const char *path, unsigned sampc)
+{
+	struct aufile_prm prm;
+	struct aufile *af = NULL;
+	struct mbuf *mb;
+	unsigned i;
+	int err = 0;
+
+	mb = mbuf_alloc(sampc * 2);
+	if (!mb)
+		return ENOMEM;
+
+	/* WAV files are always Little-Endian */
+	for (i=0; i<sampc; i++)
+		err |= mbuf_write_u16(mb, sys_htols(i));
+	if (err)
+		goto out;
+
+	prm.srate    = 8000;
+	prm.channels = 1;
+	prm.fmt      = AUFMT_S16LE;
+
+	err = aufile_open(&af, &prm, path, AUFILE_WRITE);
+	if (err)
+		goto out;
+
+	err = aufile_write(af, mb->buf, mb->end);
+
+ out:
+	mem_deref(af);
+	mem_deref(mb);
+	return err;
+}
+
+
+int test_play_wav(void)
+{
+	struct auplay *auplay = NULL;
+	struct player *player = NULL;
+	struct play *play = NULL;
+	struct wavmap *wm1 = NULL, *wm2 = NULL, *wm3 = NULL;
+	struct mbuf *mb_tone = NULL;
+	struct test test = {0};
+	char dir[256] = "", path[512] = "", path2[512] = "";
+	int16_t sampv[4];
+	size_t n;
+	int err;
+
+	err = test_tmpdir(dir, sizeof(dir));
+	TEST_ERR(err);
+
+	if (re_snprintf(path, sizeof(path), "%s/play.wav", dir) < 0 ||
+	    re_snprintf(path2, sizeof(path2), "%s/play2.wav", dir) < 0) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = write_wav(path, NUM_SAMPLES);
+	TEST_ERR(err);
+
+	/* concurrent users of the same file share one mapping */
+	err = wavmap_open(&wm1, path);
+	TEST_ERR(err);
+	err = wavmap_open(&wm2, path);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(wm1 == wm2);
+	ASSERT_EQ(8000, (int)wavmap_srate(wm1));
+	ASSERT_EQ(1, (int)wavmap_channels(wm1));
+	ASSERT_EQ(NUM_SAMPLES, (int)wavmap_sampc(wm1));
+	ASSERT_EQ(40, (int)wavmap_duration(wm1));
+
+	/* random access to a window, short read at the end */
+	n = wavmap_read(wm1, 100, sampv, 2);
+	ASSERT_EQ(2, (int)n);
+	ASSERT_EQ(100, sampv[0]);
+	ASSERT_EQ(101, sampv[1]);
+
+	n = wavmap_read(wm1, NUM_SAMPLES - 1, sampv, 4);
+	ASSERT_EQ(1, (int)n);
+	ASSERT_EQ(NUM_SAMPLES - 1, sampv[0]);
+
+	n = wavmap_read(wm1, NUM_SAMPLES, sampv, 4);
+	ASSERT_EQ(0, (int)n);
+
+	/* a replaced file is mapped again, the old mapping stays valid */
+	err = write_wav(path2, NUM_SAMPLES / 2);
+	TEST_ERR(err);
+	ASSERT_EQ(0, rename(path2, path));
+
+	err = wavmap_open(&wm3, path);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(wm3 != wm1);
+	ASSERT_EQ(NUM_SAMPLES / 2, (int)wavmap_sampc(wm3));
+	ASSERT_EQ(NUM_SAMPLES, (int)wavmap_sampc(wm1));
+
+	n = wavmap_read(wm1, NUM_SAMPLES - 1, sampv, 4);
+	ASSERT_EQ(1, (int)n);
+	ASSERT_EQ(NUM_SAMPLES - 1, sampv[0]);
+
+	wm3 = mem_deref(wm3);
+	wm2 = mem_deref(wm2);
+	wm1 = mem_deref(wm1);
+
+	err = write_wav(path, NUM_SAMPLES);
+	TEST_ERR(err);
+
+	/* stream the file through the player */
+	err = mock_auplay_register(&auplay, baresip_auplayl(),
+				   auframe_handler, &test);
+	TEST_ERR(err);
+
+	err = play_init(&player);
+	TEST_ERR(err);
+
+	err = play_file(&play, player, path, 0, NULL, NULL);
+	TEST_ERR(err);
+
+	err = re_main_timeout(10000);
+	TEST_ERR(err);
+
+	mb_tone = generate_tone();
+	ASSERT_TRUE(mb_tone != NULL);
+
+	TEST_MEMCMP(mb_tone->buf, NUM_SAMPLES*2,
+		    test.mb_samp->buf, test.mb_samp->end);
+
+ out:
+	mem_deref(test.mb_samp);
+	mem_deref(mb_tone);
+	mem_deref(play);
+	mem_deref(player);
+	mem_deref(auplay);
+	mem_deref(wm3);
+	mem_deref(wm2);
+	mem_deref(wm1);
+	(void)remove(path2);
+	(void)remove(path);
+	(void)remove(dir);
+	return err;
+}
@@ -0,0 +1,146 @@
+/**
+ * @file test/playout.c  Playout delay controller Testcode
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "../src/core.h"
+#include "test.h"
+
+
+enum {
+	PTIME  = 20,
+	CRATE  = 8000,
+	NPKT   = 600,
+	FRAMEC = 160,
+	PERIOD = 40,
+};
+
+
+static void frame_fill(int16_t *sampv)
+{
+	/* triangle wave with a period of 5 ms */
+	for (size_t i = 0; i < FRAMEC; i++) {
+
+		size_t k = i % PERIOD;
+
+		sampv[i] = (int16_t)((k < PERIOD / 2 ? k : PERIOD - k) * 1000);
+	}
+}
+
+
+/* stretch frames with a buffer level until one is changed */
+static int stretch(struct austretch *st, struct auframe *af,
+		   int16_t *sampv, size_t maxc, uint32_t level)
+{
+	for (int i = 0; i < 10; i++) {
+
+		int err;
+
+		frame_fill(sampv);
+		af->sampc = FRAMEC;
+
+		err = austretch_process(st, af, maxc, level, 40);
+		if (err)
+			return err;
+
+		if (af->sampc != FRAMEC)
+			break;
+	}
+
+	return 0;
+}
+
+
+static int test_austretch(void)
+{
+	int16_t sampv[FRAMEC * 2];
+	struct austretch *st = NULL;
+	struct auframe af;
+	int err;
+
+	auframe_init(&af, AUFMT_S16LE, sampv, FRAMEC, 8000, 1);
+
+	/* too full, shortened by one period, continuous at the end */
+	err = austretch_alloc(&st);
+	TEST_ERR(err);
+
+	err = stretch(st, &af, sampv, RE_ARRAY_SIZE(sampv), 200);
+	TEST_ERR(err);
+	ASSERT_EQ(FRAMEC - PERIOD, (int)af.sampc);
+	ASSERT_EQ(0, sampv[0]);
+	ASSERT_EQ(1000, sampv[af.sampc - 1]);
+	st = mem_deref(st);
+
+	/* too empty, but no space in the sample buffer */
+	err = austretch_alloc(&st);
+	TEST_ERR(err);
+
+	err = stretch(st, &af, sampv, 0, 0);
+	TEST_ERR(err);
+	ASSERT_EQ(FRAMEC, (int)af.sampc);
+
+	/* too empty, lengthened by one period */
+	err = stretch(st, &af, sampv, RE_ARRAY_SIZE(sampv), 0);
+	TEST_ERR(err);
+	ASSERT_EQ(FRAMEC + PERIOD, (int)af.sampc);
+	ASSERT_EQ(0, sampv[0]);
+	ASSERT_EQ(1000, sampv[af.sampc - 1]);
+
+ out:
+	mem_deref(st);
+
+	return err;
+}
+
+
+int test_playout(void)
+{
+	static const struct range bounds = {20, 160};
+	struct playout *po = NULL;
+	struct rtp_header hdr;
+	int err;
+
+	err = playout_alloc(&po, PTIME, &bounds, 1.0);
+	TEST_ERR(err);
+
+	ASSERT_EQ(20, (int)playout_target(po));
+	playout_set_crate(po, CRATE);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.ssrc = 0x1234;
+
+	/* every tenth packet is 40 ms late, one packet is reordered */
+	for (uint32_t i = 0; i < NPKT; i++) {
+
+		uint64_t now = (uint64_t)i * PTIME * 1000;
+
+		if (i % 10 == 0)
+			now += 40000;
+
+		hdr.seq = (uint16_t)(i == NPKT - 20 ? i - 3 : i);
+		hdr.ts  = i * CRATE * PTIME / 1000;
+
+		if (playout_arrival(po, &hdr, now))
+			playout_update(po, 0);
+	}
+
+	ASSERT_EQ(40 + PTIME, (int)playout_target(po));
+	ASSERT_EQ(2, (int)playout_reorder(po));
+	ASSERT_EQ(40 + PTIME - 2 * PTIME, (int)playout_aubuf_target(po));
+
+	/* the RTCP jitter is a floor */
+	playout_update(po, 50000);
+	ASSERT_EQ(100 + PTIME, (int)playout_target(po));
+
+	err = test_austretch();
+	TEST_ERR(err);
+
+ out:
+	mem_deref(po);
+
+	return err;
+}
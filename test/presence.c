@@ -0,0 +1,300 @@
+/**
+ * @file test/presence.c  Baresip selftest -- presence subscriber
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+#include "sip/sipsrv.h"
+#include "../modules/presence/presence.h"
+
+
+enum {
+	NUM_PARTS    = 4,
+	NUM_CONTACTS = 10,
+	SUB_RATE     = 20,    /* 2 SUBSCRIBEs per pacing tick */
+	PACE_TICK    = 100,   /* see modules/presence         */
+};
+
+
+struct parts {
+	unsigned n;
+	struct pl entv[NUM_PARTS];
+	struct pl pidfv[NUM_PARTS];
+};
+
+
+static void part_handler(const struct pl *entity, const struct pl *pidf,
+			 void *arg)
+{
+	struct parts *parts = arg;
+
+	if (parts->n >= NUM_PARTS)
+		return;
+
+	parts->entv[parts->n]  = *entity;
+	parts->pidfv[parts->n] = *pidf;
+	++parts->n;
+}
+
+
+static int rls_decode_str(struct parts *parts, const char *params,
+			  const char *body)
+{
+	static const char trailer[] = "\r\n--b1--\r\n";
+	struct mbuf *mb;
+	struct pl prm;
+	int err;
+
+	memset(parts, 0, sizeof(*parts));
+
+	mb = mbuf_alloc(1024);
+	if (!mb)
+		return ENOMEM;
+
+	/* data after the body end must not be parsed */
+	err  = mbuf_write_str(mb, body);
+	err |= mbuf_write_str(mb, trailer);
+	if (err)
+		goto out;
+
+	mb->end -= str_len(trailer);
+	mb->pos  = 0;
+
+	pl_set_str(&prm, params);
+
+	err = rls_decode(&prm, mb, part_handler, parts);
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
+
+
+#define PIDF(entity, basic)						\
+	"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\r\n"		\
+	"<presence xmlns=\"urn:ietf:params:xml:ns:pidf\"\r\n"		\
+	"    entity=\"" entity "\">\r\n"				\
+	"  <tuple id=\"t1\"><status><basic>" basic "</basic>"		\
+	"</status></tuple>\r\n"						\
+	"</presence>"
+
+
+/*
+ * The multipart/related body of a resource list NOTIFY is split at the
+ * boundary delimiter lines, the PIDF parts are passed on and the RLMI
+ * part is skipped. Parsing stays within the body.
+ */
+int test_presence_rls(void)
+{
+	static const char body[] =
+		"preamble, --b 1 is not a delimiter\r\n"
+		"--b 1\r\n"
+		"Content-Transfer-Encoding: binary\r\n"
+		"Content-ID: <nXYxAE@pres.vancouver.example.com>\r\n"
+		"Content-Type: application/rlmi+xml;charset=\"UTF-8\"\r\n"
+		"\r\n"
+		"<list xmlns=\"urn:ietf:params:xml:ns:rlmi\""
+		" uri=\"sip:list@example.com\"/>\r\n"
+		"--b 1\r\n"
+		"Content-Type: application/pidf+xml;charset=\"UTF-8\"\r\n"
+		"\r\n"
+		PIDF("sip:alice@example.com", "open") "\r\n"
+		"--b 1\t\r\n"
+		"Content-Type: application/pidf+xml;charset=\"UTF-8\"\r\n"
+		"\r\n"
+		PIDF("pres:bob@example.com", "closed") "\r\n"
+		"--b 1--\r\n"
+		"epilogue\r\n";
+	static const char body_open[] =
+		"--b1\r\n"
+		"Content-Type: application/pidf+xml\r\n"
+		"\r\n"
+		PIDF("sip:alice@example.com", "open") "\r\n"
+		"--b1\r\n"
+		"Content-Type: application/pidf+xml\r\n"
+		"\r\n"
+		PIDF("sip:bob@example.com", "open");
+	struct parts parts;
+	struct pl pl;
+	int err;
+
+	/* quoted boundary, with a space */
+	err = rls_decode_str(&parts,
+			     ";type=\"application/rlmi+xml\""
+			     ";boundary=\"b 1\"", body);
+	TEST_ERR(err);
+
+	ASSERT_EQ(2, parts.n);
+	ASSERT_TRUE(0 == pl_strcmp(&parts.entv[0],
+				   "sip:alice@example.com"));
+	ASSERT_TRUE(0 == pl_strcmp(&parts.entv[1], "pres:bob@example.com"));
+
+	ASSERT_EQ(0, re_regex(parts.pidfv[0].p, parts.pidfv[0].l,
+			      "<basic>[^<]+</basic>", &pl));
+	ASSERT_TRUE(0 == pl_strcmp(&pl, "open"));
+	ASSERT_EQ(0, re_regex(parts.pidfv[1].p, parts.pidfv[1].l,
+			      "<basic>[^<]+</basic>", &pl));
+	ASSERT_TRUE(0 == pl_strcmp(&pl, "closed"));
+
+	/* the part ends before the line ending of the delimiter */
+	ASSERT_EQ('>', parts.pidfv[1].p[parts.pidfv[1].l - 1]);
+
+	/* token boundary, the close delimiter is missing */
+	err = rls_decode_str(&parts, ";boundary=b1", body_open);
+	ASSERT_EQ(EBADMSG, err);
+	ASSERT_EQ(1, parts.n);
+	ASSERT_TRUE(0 == pl_strcmp(&parts.entv[0],
+				   "sip:alice@example.com"));
+
+	/* no boundary */
+	err = rls_decode_str(&parts, ";type=\"application/rlmi+xml\"",
+			     body);
+	ASSERT_TRUE(err != 0);
+	ASSERT_EQ(0, parts.n);
+
+	err = 0;
+
+ out:
+	return err;
+}
+
+
+/*
+ * Refresh and retry intervals are spread by +/- 10 percent.
+ */
+int test_presence_jitter(void)
+{
+	uint64_t lo = ~0ULL, hi = 0;
+	int err = 0;
+
+	ASSERT_TRUE(subscriber_jitter(0) == 0);
+
+	for (unsigned i=0; i<1000; i++) {
+
+		uint64_t ms = subscriber_jitter(1000);
+
+		ASSERT_TRUE(ms >= 900 && ms <= 1100);
+
+		lo = min(lo, ms);
+		hi = max(hi, ms);
+	}
+
+	/* the values are spread */
+	ASSERT_TRUE(hi - lo >= 100);
+
+ out:
+	return err;
+}
+
+
+static struct {
+	struct sip_server *srv;
+	struct tmr tmr;
+} pace;
+
+
+static void poll_handler(void *arg)
+{
+	(void)arg;
+
+	if (pace.srv->n_subscribe_req >= NUM_CONTACTS) {
+		re_cancel();
+		return;
+	}
+
+	tmr_start(&pace.tmr, 10, poll_handler, NULL);
+}
+
+
+/*
+ * New SUBSCRIBEs are paced, with presence_sub_rate 20 the ten contacts
+ * are subscribed two at a time over five pacing ticks.
+ */
+int test_presence_pace(void)
+{
+	struct config cfg = *conf_config();
+	struct contact *contactv[NUM_CONTACTS] = {NULL};
+	struct ua *ua = NULL;
+	struct sa laddr;
+	char *modconfig = NULL;
+	uint64_t span;
+	bool loaded = false;
+	int err;
+
+	memset(&pace, 0, sizeof(pace));
+	tmr_init(&pace.tmr);
+
+	err = ua_init("test", true, false, false);
+	TEST_ERR(err);
+
+	err = sip_server_alloc(&pace.srv, NULL, NULL);
+	TEST_ERR(err);
+
+	err = sip_transp_laddr(pace.srv->sip, &laddr, SIP_TRANSP_UDP, NULL);
+	TEST_ERR(err);
+
+	err = ua_alloc(&ua, "Foo <sip:user@127.0.0.1>;regint=0");
+	TEST_ERR(err);
+
+	for (unsigned i=0; i<NUM_CONTACTS; i++) {
+		char addr[128];
+		struct pl pl;
+
+		re_snprintf(addr, sizeof(addr),
+			    "<sip:c%u@%J>;presence=p2p", i, &laddr);
+		pl_set_str(&pl, addr);
+
+		err = contact_add(baresip_contacts(), &contactv[i], &pl);
+		TEST_ERR(err);
+	}
+
+	err = re_sdprintf(&modconfig, "presence_sub_rate %u\n", SUB_RATE);
+	TEST_ERR(err);
+
+	err = conf_configure_buf((uint8_t *)modconfig, str_len(modconfig));
+	TEST_ERR(err);
+
+	err = module_load(".", "presence");
+	TEST_ERR(err);
+
+	loaded = true;
+
+	tmr_start(&pace.tmr, 10, poll_handler, NULL);
+
+	err = re_main_timeout(5000);
+	TEST_ERR(err);
+
+	ASSERT_EQ(NUM_CONTACTS, pace.srv->n_subscribe_req);
+
+	span = pace.srv->subscribe_last - pace.srv->subscribe_first;
+
+	ASSERT_TRUE(span >= (NUM_CONTACTS / 2 - 2) * PACE_TICK);
+	ASSERT_TRUE(span < 10 * PACE_TICK);
+
+ out:
+	tmr_cancel(&pace.tmr);
+
+	if (loaded)
+		module_unload("presence");
+
+	for (unsigned i=0; i<NUM_CONTACTS; i++)
+		mem_deref(contactv[i]);
+
+	mem_deref(ua);
+	pace.srv = mem_deref(pace.srv);
+
+	ua_stop_all(true);
+	ua_close();
+
+	(void)conf_configure_buf((uint8_t *)test_modconfig,
+				 str_len(test_modconfig));
+	*conf_config() = cfg;
+
+	mem_deref(modconfig);
+
+	return err;
+}
@@ -0,0 +1,78 @@
+/**
+ * @file test/rtpext.c  RTP Header Extension table Testcode
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "../src/core.h"
+#include "test.h"
+
+
+int test_rtpext(void)
+{
+	/* one-byte header: id=1 len=1, padding, id=3 len=2, id=5 len=1 */
+	static const uint8_t ext1[] = {
+		0x10, 0xaa,
+		0x00,
+		0x31, 0x01, 0x02,
+		0x50, 0x55,
+		0x00, 0x00, 0x00, 0x00
+	};
+	/* two-byte header: id=2 len=0, padding, id=14 len=3 */
+	static const uint8_t ext2[] = {
+		0x02, 0x00,
+		0x00,
+		0x0e, 0x03, 0x0a, 0x0b, 0x0c
+	};
+	static const uint8_t trunc[] = {0x13, 0x01};
+	struct rtpext_tbl tbl;
+	const uint8_t *p;
+	size_t len = 0;
+	int err;
+
+	/* ID 5 is not wanted */
+	err = rtpext_tbl_decode(&tbl, RTPEXT_TYPE_MAGIC, ext1, sizeof(ext1),
+				1u<<1 | 1u<<3);
+	TEST_ERR(err);
+
+	p = rtpext_tbl_find(&tbl, 1, &len);
+	ASSERT_TRUE(p != NULL);
+	ASSERT_EQ(1, (int)len);
+	ASSERT_EQ(0xaa, p[0]);
+
+	p = rtpext_tbl_find(&tbl, 3, &len);
+	ASSERT_TRUE(p != NULL);
+	ASSERT_EQ(2, (int)len);
+	ASSERT_EQ(0x02, p[1]);
+
+	ASSERT_TRUE(NULL == rtpext_tbl_find(&tbl, 5, NULL));
+	ASSERT_TRUE(NULL == rtpext_tbl_find(&tbl, 2, NULL));
+
+	err = rtpext_tbl_decode(&tbl, 0x1000, ext2, sizeof(ext2), 0xffff);
+	TEST_ERR(err);
+
+	p = rtpext_tbl_find(&tbl, 2, &len);
+	ASSERT_TRUE(p != NULL);
+	ASSERT_EQ(0, (int)len);
+
+	p = rtpext_tbl_find(&tbl, 14, &len);
+	ASSERT_TRUE(p != NULL);
+	ASSERT_EQ(3, (int)len);
+	ASSERT_EQ(0x0c, p[2]);
+
+	/* errors */
+	err = rtpext_tbl_decode(&tbl, RTPEXT_TYPE_MAGIC, trunc, sizeof(trunc),
+				0xffff);
+	ASSERT_EQ(EBADMSG, err);
+
+	err = rtpext_tbl_decode(&tbl, 0x1234, ext1, sizeof(ext1), 0xffff);
+	ASSERT_EQ(ENOTSUP, err);
+	ASSERT_EQ(0, (int)tbl.present);
+
+	err = 0;
+
+ out:
+	return err;
+}
@@ -0,0 +1,111 @@
+/**
+ * @file test/rtpport.c  RTP port allocator Testcode
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "../src/core.h"
+#include "test.h"
+
+
+/* an even port from the ephemeral range, with room for four pairs */
+static int ephemeral_base(uint16_t *portp)
+{
+	struct udp_sock *us = NULL;
+	struct sa sa;
+	uint16_t port;
+	int err;
+
+	sa_set_str(&sa, "127.0.0.1", 0);
+
+	err = udp_listen(&us, &sa, NULL, NULL);
+	if (err)
+		return err;
+
+	err = udp_local_get(us, &sa);
+	mem_deref(us);
+	if (err)
+		return err;
+
+	port = sa_port(&sa) & ~1u;
+	if (port > 65535 - 8)
+		port -= 8;
+
+	*portp = port;
+
+	return 0;
+}
+
+
+int test_rtpport(void)
+{
+	struct config_avt cfg;
+	struct rtpports *mgr = NULL;
+	struct rtpport *rpv[4] = {NULL};
+	struct rtpport *rp = NULL;
+	uint16_t base, port, port0;
+	size_t i, j;
+	int err;
+
+	err = ephemeral_base(&base);
+	TEST_ERR(err);
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.rtp_ports.min = base;
+	cfg.rtp_ports.max = base + 7;
+
+	err = rtpports_alloc(&mgr, &cfg);
+	TEST_ERR(err);
+
+	for (i=0; i<RE_ARRAY_SIZE(rpv); i++) {
+
+		err = rtpport_alloc(&rpv[i], mgr, &cfg.rtp_ports, AF_INET,
+				    NULL, NULL, NULL);
+		TEST_ERR(err);
+
+		port = sa_port(rtp_local(rtpport_sock(rpv[i])));
+		ASSERT_TRUE(port >= base && port <= base + 6);
+		ASSERT_EQ(0, port & 1);
+
+		for (j=0; j<i; j++) {
+			ASSERT_TRUE(port !=
+				    sa_port(rtp_local(rtpport_sock(rpv[j]))));
+		}
+	}
+
+	/* range exhausted */
+	err = rtpport_alloc(&rp, mgr, &cfg.rtp_ports, AF_INET,
+			    NULL, NULL, NULL);
+	ASSERT_EQ(EADDRINUSE, err);
+
+	/* the only free pair is reused, even within quarantine */
+	port0 = sa_port(rtp_local(rtpport_sock(rpv[0])));
+	rpv[0] = mem_deref(rpv[0]);
+
+	err = rtpport_alloc(&rpv[0], mgr, &cfg.rtp_ports, AF_INET,
+			    NULL, NULL, NULL);
+	TEST_ERR(err);
+	ASSERT_EQ(port0, sa_port(rtp_local(rtpport_sock(rpv[0]))));
+
+	/* no lower limit, privileged ports are not used */
+	cfg.rtp_ports.min = 0;
+	cfg.rtp_ports.max = 65535;
+
+	err = rtpport_alloc(&rp, mgr, &cfg.rtp_ports, AF_INET,
+			    NULL, NULL, NULL);
+	TEST_ERR(err);
+
+	port = sa_port(rtp_local(rtpport_sock(rp)));
+	ASSERT_TRUE(port >= 1024);
+	ASSERT_EQ(0, port & 1);
+
+ out:
+	mem_deref(rp);
+	for (i=0; i<RE_ARRAY_SIZE(rpv); i++)
+		mem_deref(rpv[i]);
+	mem_deref(mgr);
+
+	return err;
+}
@@ -202,6 +202,14 @@ static bool sip_msg_handler(const struct sip_msg *msg, void *arg)
 
 		sip_reply(srv->sip, msg, 503, "Server Error");
 	}
+	else if (0 == pl_strcmp(&msg->met, "SUBSCRIBE")) {
+		srv->subscribe_last = tmr_jiffies();
+		if (!srv->n_subscribe_req++)
+			srv->subscribe_first = srv->subscribe_last;
+
+		/* no subscriptions, the requests are only counted */
+		sip_reply(srv->sip, msg, 403, "Forbidden");
+	}
 	else {
 		DEBUG_NOTICE("method not handled (%r)\n", &msg->met);
 		return false;
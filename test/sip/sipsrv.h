@@ -20,6 +20,9 @@ struct sip_server {
 	unsigned instance;
 
 	unsigned n_register_req;
+	unsigned n_subscribe_req;
+	uint64_t subscribe_first;   /**< Time of first SUBSCRIBE [ms] */
+	uint64_t subscribe_last;    /**< Time of last SUBSCRIBE [ms]  */
 	enum sip_transp tp_last;
 
 	uint64_t secret;
@@ -0,0 +1,421 @@
+/**
+ * @file test/srtp.c  Baresip selftest -- SRTP
+ *
+ * Copyright (C) 2010 Alfred E. Heggestad
+ */
+
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+enum {
+	NUM_PACKETS  = 1000,
+	PAYLOAD_SIZE = 160,
+	MAX_OVERHEAD = 16,
+	MAX_CRYPTO   = 2,
+};
+
+
+struct crypto_lines {
+	struct {
+		uint32_t tag;
+		char suite[32];
+		char key[64];
+	} v[MAX_CRYPTO];
+	unsigned n;
+};
+
+
+static bool crypto_handler(const char *name, const char *value, void *arg)
+{
+	struct crypto_lines *cl = arg;
+	struct pl tag, suite, key;
+	(void)name;
+
+	if (cl->n >= MAX_CRYPTO)
+		return true;
+
+	if (re_regex(value, str_len(value), "[0-9]+ [^ ]+ inline:[^| ]+",
+		     &tag, &suite, &key))
+		return false;
+
+	cl->v[cl->n].tag = pl_u32(&tag);
+	(void)pl_strcpy(&suite, cl->v[cl->n].suite,
+			sizeof(cl->v[cl->n].suite));
+	(void)pl_strcpy(&key, cl->v[cl->n].key, sizeof(cl->v[cl->n].key));
+	++cl->n;
+
+	return false;
+}
+
+
+/* decode a remote SDP with one audio line and the given crypto lines */
+static int sdp_remote(struct sdp_session *sess, bool offer,
+		      const char *crypto)
+{
+	struct mbuf *mb;
+	int err;
+
+	mb = mbuf_alloc(512);
+	if (!mb)
+		return ENOMEM;
+
+	err = mbuf_printf(mb,
+			  "v=0\r\n"
+			  "o=- 1 1 IN IP4 127.0.0.1\r\n"
+			  "s=-\r\n"
+			  "c=IN IP4 127.0.0.1\r\n"
+			  "t=0 0\r\n"
+			  "m=audio 5004 RTP/SAVP 0\r\n"
+			  "%s", crypto);
+	if (err)
+		goto out;
+
+	mb->pos = 0;
+
+	err = sdp_decode(sess, mb, offer);
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
+
+
+/* a random key, base64 encoded */
+static int crypto_key(char *key, size_t sz, size_t len)
+{
+	uint8_t buf[32+12];
+	size_t olen = sz - 1;
+	int err;
+
+	if (len > sizeof(buf))
+		return EINVAL;
+
+	rand_bytes(buf, len);
+
+	err = base64_encode(buf, len, key, &olen);
+	if (err)
+		return err;
+
+	key[olen] = '\0';
+
+	return 0;
+}
+
+
+static int srtp_media_alloc(struct menc_media **mmp, struct menc_sess *ms,
+			    struct sdp_media *m)
+{
+	const struct menc *menc = menc_find(baresip_mencl(), "srtp-mand");
+
+	if (!menc)
+		return ENOENT;
+
+	return menc->mediah(mmp, ms, NULL, NULL, NULL, NULL, NULL, m, NULL);
+}
+
+
+static int sess_alloc(struct sdp_session **sessp, struct sdp_media **mp,
+		      struct menc_sess **msp, bool offerer)
+{
+	const struct menc *menc = menc_find(baresip_mencl(), "srtp-mand");
+	struct sa laddr;
+	int err;
+
+	if (!menc)
+		return ENOENT;
+
+	err  = sa_set_str(&laddr, "127.0.0.1", 5002);
+	err |= sdp_session_alloc(sessp, &laddr);
+	if (err)
+		return err;
+
+	err  = sdp_media_add(mp, *sessp, "audio", 5002, "RTP/SAVP");
+	err |= sdp_format_add(NULL, *mp, false, "0", "PCMU", 8000, 1,
+			      NULL, NULL, NULL, false, NULL);
+	if (err)
+		return err;
+
+	return menc->sessh(msp, *sessp, offerer, NULL, NULL, NULL);
+}
+
+
+static int check_offer(void)
+{
+	struct sdp_session *sess = NULL;
+	struct sdp_media *m = NULL;
+	struct menc_sess *ms = NULL;
+	struct menc_media *mm = NULL;
+	struct crypto_lines offer = {0}, answer = {0};
+	char key[64], attr[128];
+	int err;
+
+	err = sess_alloc(&sess, &m, &ms, true);
+	TEST_ERR(err);
+
+	err = srtp_media_alloc(&mm, ms, m);
+	TEST_ERR(err);
+
+	/* AEAD first, the preferred suite as fallback with its own key */
+	(void)sdp_media_lattr_apply(m, "crypto", crypto_handler, &offer);
+	ASSERT_EQ(2, offer.n);
+	ASSERT_EQ(1, offer.v[0].tag);
+	ASSERT_STREQ("AEAD_AES_128_GCM", offer.v[0].suite);
+	ASSERT_EQ(2, offer.v[1].tag);
+	ASSERT_STREQ("AES_CM_128_HMAC_SHA1_80", offer.v[1].suite);
+	ASSERT_TRUE(0 != str_cmp(offer.v[0].key, offer.v[1].key));
+
+	/* the answer selects the fallback line */
+	err = crypto_key(key, sizeof(key), 16+14);
+	TEST_ERR(err);
+
+	if (re_snprintf(attr, sizeof(attr),
+			"a=crypto:2 AES_CM_128_HMAC_SHA1_80 inline:%s\r\n",
+			key) < 0) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = sdp_remote(sess, false, attr);
+	TEST_ERR(err);
+
+	err = srtp_media_alloc(&mm, ms, m);
+	TEST_ERR(err);
+
+	/* we now send with the key of the fallback line */
+	(void)sdp_media_lattr_apply(m, "crypto", crypto_handler, &answer);
+	ASSERT_EQ(1, answer.n);
+	ASSERT_EQ(2, answer.v[0].tag);
+	ASSERT_STREQ("AES_CM_128_HMAC_SHA1_80", answer.v[0].suite);
+	ASSERT_STREQ(offer.v[1].key, answer.v[0].key);
+
+ out:
+	mem_deref(mm);
+	mem_deref(ms);
+	mem_deref(sess);
+
+	return err;
+}
+
+
+static int check_answer(void)
+{
+	struct sdp_session *sess = NULL;
+	struct sdp_media *m = NULL;
+	struct menc_sess *ms = NULL;
+	struct menc_media *mm = NULL;
+	struct crypto_lines answer = {0};
+	char key1[64], key2[64], attr[256];
+	int err;
+
+	err = sess_alloc(&sess, &m, &ms, false);
+	TEST_ERR(err);
+
+	err  = crypto_key(key1, sizeof(key1), 16+14);
+	err |= crypto_key(key2, sizeof(key2), 16+12);
+	TEST_ERR(err);
+
+	/* the offer lists AEAD last */
+	if (re_snprintf(attr, sizeof(attr),
+			"a=crypto:1 AES_CM_128_HMAC_SHA1_80 inline:%s\r\n"
+			"a=crypto:2 AEAD_AES_128_GCM inline:%s\r\n",
+			key1, key2) < 0) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = sdp_remote(sess, true, attr);
+	TEST_ERR(err);
+
+	err = srtp_media_alloc(&mm, ms, m);
+	TEST_ERR(err);
+
+	/* the answer selects the AEAD line */
+	(void)sdp_media_lattr_apply(m, "crypto", crypto_handler, &answer);
+	ASSERT_EQ(1, answer.n);
+	ASSERT_EQ(2, answer.v[0].tag);
+	ASSERT_STREQ("AEAD_AES_128_GCM", answer.v[0].suite);
+
+ out:
+	mem_deref(mm);
+	mem_deref(ms);
+	mem_deref(sess);
+
+	return err;
+}
+
+
+/* true if the SRTP stack supports the suite */
+static bool suite_supported(enum srtp_suite suite, size_t keylen)
+{
+	struct srtp *srtp = NULL;
+	uint8_t key[32+12] = {0};
+	int err;
+
+	err = srtp_alloc(&srtp, suite, key, keylen, 0);
+	mem_deref(srtp);
+
+	return err == 0;
+}
+
+
+/*
+ * With "srtp_prefer_aead", the offer has an AEAD_AES_128_GCM line first
+ * and the preferred suite as fallback with its own key. If the answer
+ * selects the fallback, that key is used for sending. An answer selects
+ * the best AEAD line of the offer.
+ */
+int test_srtp_prefer_aead(void)
+{
+	static const char modconfig[] =
+		"ausrc_format    s16\n"
+		"srtp_prefer_aead yes\n";
+	struct config cfg = *conf_config();
+	int err;
+
+	if (!suite_supported(SRTP_AES_128_GCM, 16+12)) {
+		info("test: srtp: %s not supported -- skipped\n",
+		     srtp_suite_name(SRTP_AES_128_GCM));
+		return 0;
+	}
+
+	err = conf_configure_buf((uint8_t *)modconfig, str_len(modconfig));
+	TEST_ERR(err);
+
+	err = module_load(".", "srtp");
+	TEST_ERR(err);
+
+	err = check_offer();
+	TEST_ERR(err);
+
+	err = check_answer();
+	TEST_ERR(err);
+
+ out:
+	module_unload("srtp");
+
+	(void)conf_configure_buf((uint8_t *)test_modconfig,
+				 str_len(test_modconfig));
+	*conf_config() = cfg;
+
+	return err;
+}
+
+
+static int write_rtp(struct mbuf *mb, uint16_t seq)
+{
+	int err = 0;
+
+	mbuf_rewind(mb);
+
+	err |= mbuf_write_u8(mb, 0x80);
+	err |= mbuf_write_u8(mb, 0x00);
+	err |= mbuf_write_u16(mb, htons(seq));
+	err |= mbuf_write_u32(mb, htonl(seq * PAYLOAD_SIZE));
+	err |= mbuf_write_u32(mb, htonl(0x01020304));
+	err |= mbuf_fill(mb, 0xa5, PAYLOAD_SIZE);
+
+	mb->pos = 0;
+
+	return err;
+}
+
+
+static int perf_suite(enum srtp_suite suite, size_t keylen)
+{
+	struct srtp *tx = NULL, *rx = NULL;
+	struct mbuf *mbv[NUM_PACKETS] = {NULL};
+	uint8_t key[32+12];
+	uint64_t t0, t_enc, t_dec;
+	size_t i;
+	int err;
+
+	rand_bytes(key, sizeof(key));
+
+	err  = srtp_alloc(&tx, suite, key, keylen, 0);
+	err |= srtp_alloc(&rx, suite, key, keylen, 0);
+	if (err == ENOSYS || err == ENOTSUP) {
+		info("test: srtp: %s not supported -- skipped\n",
+		     srtp_suite_name(suite));
+		err = 0;
+		goto out;
+	}
+	TEST_ERR(err);
+
+	for (i=0; i<NUM_PACKETS; i++) {
+		mbv[i] = mbuf_alloc(12 + PAYLOAD_SIZE + MAX_OVERHEAD);
+		if (!mbv[i]) {
+			err = ENOMEM;
+			goto out;
+		}
+
+		err = write_rtp(mbv[i], (uint16_t)i);
+		TEST_ERR(err);
+	}
+
+	t0 = tmr_jiffies_usec();
+	for (i=0; i<NUM_PACKETS; i++) {
+		err = srtp_encrypt(tx, mbv[i]);
+		TEST_ERR(err);
+	}
+	t_enc = tmr_jiffies_usec() - t0;
+
+	for (i=0; i<NUM_PACKETS; i++)
+		mbv[i]->pos = 0;
+
+	t0 = tmr_jiffies_usec();
+	for (i=0; i<NUM_PACKETS; i++) {
+		err = srtp_decrypt(rx, mbv[i]);
+		TEST_ERR(err);
+	}
+	t_dec = tmr_jiffies_usec() - t0;
+
+	ASSERT_EQ(12 + PAYLOAD_SIZE, (int)mbuf_get_left(mbv[0]));
+
+	info("test: srtp: %s: protect %llu pkt/s, unprotect %llu pkt/s\n",
+	     srtp_suite_name(suite),
+	     NUM_PACKETS * 1000000ULL / (t_enc ? t_enc : 1),
+	     NUM_PACKETS * 1000000ULL / (t_dec ? t_dec : 1));
+
+ out:
+	for (i=0; i<NUM_PACKETS; i++)
+		mem_deref(mbv[i]);
+
+	mem_deref(tx);
+	mem_deref(rx);
+
+	return err;
+}
+
+
+/*
+ * Single-threaded SRTP throughput for the suites supported by the
+ * srtp module (see cryptosuite_issupported()).
+ * Not part of the default run; use "selftest -v test_srtp_perf".
+ */
+int test_srtp_perf(void)
+{
+	static const struct {
+		enum srtp_suite suite;
+		size_t keylen;
+	} suitev[] = {
+		{SRTP_AES_CM_128_HMAC_SHA1_32, 16+14},
+		{SRTP_AES_CM_128_HMAC_SHA1_80, 16+14},
+		{SRTP_AES_128_GCM,             16+12},
+		{SRTP_AES_256_GCM,             32+12},
+	};
+	size_t i;
+	int err = 0;
+
+	for (i=0; i<RE_ARRAY_SIZE(suitev); i++) {
+
+		err = perf_suite(suitev[i].suite, suitev[i].keylen);
+		TEST_ERR(err);
+	}
+
+ out:
+	return err;
+}
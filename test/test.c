@@ -4,6 +4,7 @@
  * Copyright (C) 2010 Alfred E. Heggestad
  */
 #include <math.h>
+#include <stdlib.h>
 #include <re.h>
 #include <baresip.h>
 #include "test.h"
@@ -43,6 +44,32 @@ int re_main_timeout(uint32_t timeout_ms)
 }
 
 
+/**
+ * Create a unique directory for the temporary files of a test
+ *
+ * @param dir Buffer for the directory path
+ * @param sz  Size of buffer
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int test_tmpdir(char *dir, size_t sz)
+{
+#ifdef WIN32
+	const char *tmp = getenv("TEMP");
+#else
+	const char *tmp = getenv("TMPDIR");
+#endif
+
+	if (!str_isset(tmp))
+		tmp = "/tmp";
+
+	if (re_snprintf(dir, sz, "%s/baresip-test-%08x", tmp, rand_u32()) < 0)
+		return ENOMEM;
+
+	return fs_mkdir(dir, 0700);
+}
+
+
 bool test_cmp_double(double a, double b, double precision)
 {
 	return fabs(a - b) < precision;
@@ -113,12 +113,16 @@
 /* helpers */
 
 int re_main_timeout(uint32_t timeout_ms);
+int test_tmpdir(char *dir, size_t sz);
 bool test_cmp_double(double a, double b, double precision);
 void test_hexdump_dual(FILE *f,
 		       const void *ep, size_t elen,
 		       const void *ap, size_t alen);
 
 
+extern const char *test_modconfig;
+
+
 #ifdef USE_TLS
 extern const char test_certificate[];
 #endif
@@ -154,6 +158,7 @@ struct auplay;
 typedef void (mock_sample_h)(struct auframe *af, const char *dev, void *arg);
 
 void mock_aucodec_register(void);
+void mock_aucodec_register_ch(uint8_t ch);
 void mock_aucodec_unregister(void);
 int mock_auplay_register(struct auplay **auplayp, struct list *auplayl,
 			 mock_sample_h *sampleh, void *arg);
@@ -172,6 +177,7 @@ void mock_mnat_unregister(void);
  */
 
 void mock_vidcodec_register(void);
+unsigned mock_vidcodec_n_update(void);
 void mock_vidcodec_unregister(void);
 
 
@@ -193,20 +199,27 @@ int mock_vidisp_register(struct vidisp **vidispp,
 
 int test_account(void);
 int test_account_uri_complete(void);
+int test_auresamp_perf(void);
 int test_aulevel(void);
 int test_call_answer(void);
 int test_call_answer_hangup_a(void);
 int test_call_answer_hangup_b(void);
 int test_call_aulevel(void);
+int test_call_bcast(void);
 int test_call_custom_headers(void);
 int test_call_dtmf(void);
 int test_call_format_float(void);
+int test_call_format_multich(void);
 int test_call_max(void);
 int test_call_mediaenc(void);
 int test_call_medianat(void);
 int test_call_multiple(void);
 int test_call_progress(void);
 int test_call_reject(void);
+int test_call_relay(void);
+int test_call_relay_video(void);
+int test_call_relay_map(void);
+int test_call_sfu(void);
 int test_call_rtcp(void);
 int test_call_rtp_timeout(void);
 int test_call_tcp(void);
@@ -215,6 +228,8 @@ int test_call_transfer(void);
 int test_call_transfer_fail(void);
 int test_call_attended_transfer(void);
 int test_call_video(void);
+int test_call_video_simulcast(void);
+int test_call_video_simulcast_send(void);
 int test_call_change_videodir(void);
 int test_call_webrtc(void);
 int test_call_bundle(void);
@@ -223,16 +238,35 @@ int test_call_100rel_audio(void);
 int test_call_100rel_video(void);
 int test_call_hold_resume(void);
 int test_call_srtp_tx_rekey(void);
+int test_call_setup_timeline(void);
 int test_cmd(void);
 int test_cmd_long(void);
+int test_cmd_args(void);
 int test_contact(void);
+int test_ctrl_tcp(void);
+int test_dtls_cert_cache(void);
 int test_event(void);
 int test_jbuf(void);
 int test_jbuf_adaptive(void);
 int test_jbuf_adaptive_video(void);
+int test_log_async(void);
+int test_log_ratelimit(void);
+int test_mclock(void);
+int test_mcu(void);
+int test_mcu_perf(void);
+int test_mempool(void);
 int test_message(void);
 int test_network(void);
 int test_play(void);
+int test_play_wav(void);
+int test_playout(void);
+int test_presence_jitter(void);
+int test_presence_pace(void);
+int test_presence_rls(void);
+int test_rtpext(void);
+int test_rtpport(void);
+int test_srtp_perf(void);
+int test_srtp_prefer_aead(void);
 int test_stunuri(void);
 int test_ua_alloc(void);
 int test_ua_options(void);